@@ -487,7 +487,8 @@
   signal
   waiting
   malloced-ptr
-  spinlock)
+  spinlock
+  stats)
 
 (define-storage-layout rwlock 0
   spin
@@ -498,6 +499,7 @@
   reader-signal
   writer-signal
   malloced-ptr
+  stats
   )
 
 ;;; For the eabi port: mark this stack frame as Lisp's (since EABI
@@ -646,6 +648,32 @@
   lisp-sigexit
   jvm-init
   lisp-lstat
+  image-ready
+  configure-save-application
+  lisp-fork
+  lisp-immutable-ranges
+  add-immutable-range
+  lisp-profiler-start
+  lisp-profiler-stop
+  lisp-profiler-buffers
+  lisp-jitdump-start
+  lisp-jitdump-stop
+  lisp-allocation-profiler-start
+  lisp-allocation-profiler-stop
+  lisp-allocation-profiler-buffers
+  lisp-heap-census-control
+  lisp-heap-census
+  lisp-heap-census-wrappers
+  lisp-lock-wait-begin
+  lisp-lock-acquired
+  lisp-lock-profiling-control
+  lisp-lock-stats
+  lisp-lock-stats-values
+  lisp-lock-stats-reset
+  lisp-trace-start
+  lisp-trace-stop
+  lisp-trace-event
+  lisp-trace-buffers
 )
 
 (defmacro nrs-offset (name)
@@ -3270,6 +3270,46 @@
    (def-x86-opcode pandn ((:anymem :insert-memory) (:regxmm :insert-modrm-reg))
      #x0fdf #o000 #x0 #x66)
 
+   ;; packssdw
+   (def-x86-opcode packssdw ((:regxmm :insert-xmm-rm) (:regxmm :insert-xmm-reg))
+     #x0f6b #o300 #x0 #x66)
+   (def-x86-opcode packssdw ((:anymem :insert-memory) (:regxmm :insert-xmm-reg))
+     #x0f6b #o000 #x0 #x66)
+
+   ;; packuswb
+   (def-x86-opcode packuswb ((:regxmm :insert-xmm-rm) (:regxmm :insert-xmm-reg))
+     #x0f67 #o300 #x0 #x66)
+   (def-x86-opcode packuswb ((:anymem :insert-memory) (:regxmm :insert-xmm-reg))
+     #x0f67 #o000 #x0 #x66)
+
+   ;; punpcklbw
+   (def-x86-opcode punpcklbw ((:regxmm :insert-xmm-rm) (:regxmm :insert-xmm-reg))
+     #x0f60 #o300 #x0 #x66)
+   (def-x86-opcode punpcklbw ((:anymem :insert-memory) (:regxmm :insert-xmm-reg))
+     #x0f60 #o000 #x0 #x66)
+
+   ;; punpckhbw
+   (def-x86-opcode punpckhbw ((:regxmm :insert-xmm-rm) (:regxmm :insert-xmm-reg))
+     #x0f68 #o300 #x0 #x66)
+   (def-x86-opcode punpckhbw ((:anymem :insert-memory) (:regxmm :insert-xmm-reg))
+     #x0f68 #o000 #x0 #x66)
+
+   ;; punpcklwd
+   (def-x86-opcode punpcklwd ((:regxmm :insert-xmm-rm) (:regxmm :insert-xmm-reg))
+     #x0f61 #o300 #x0 #x66)
+   (def-x86-opcode punpcklwd ((:anymem :insert-memory) (:regxmm :insert-xmm-reg))
+     #x0f61 #o000 #x0 #x66)
+
+   ;; punpckhwd
+   (def-x86-opcode punpckhwd ((:regxmm :insert-xmm-rm) (:regxmm :insert-xmm-reg))
+     #x0f69 #o300 #x0 #x66)
+   (def-x86-opcode punpckhwd ((:anymem :insert-memory) (:regxmm :insert-xmm-reg))
+     #x0f69 #o000 #x0 #x66)
+
+   ;; pmovmskb
+   (def-x86-opcode pmovmskb ((:regxmm :insert-xmm-rm) (:reg32 :insert-modrm-reg))
+     #x0fd7 #o300 #x0 #x66)
+
    ;; pcmpeqb
    (def-x86-opcode pcmpeqb ((:regxmm :insert-modrm-rm) (:regxmm :insert-modrm-reg))
      #x0f74 #o300 #x0 #x66)
@@ -366,6 +366,9 @@
 (defconstant gc-trap-function-configure-egc 64)
 (defconstant gc-trap-function-freeze 129)
 (defconstant gc-trap-function-thaw 130)
+(defconstant gc-trap-function-fork-freeze 144)
+(defconstant gc-trap-function-purify-object 160)
+(defconstant gc-trap-function-heap-dump 176)
 
 (defconstant watch-trap-function-watch 0)
 (defconstant watch-trap-function-unwatch 1)
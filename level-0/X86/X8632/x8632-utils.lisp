@@ -376,6 +376,32 @@ of sense to be turning the EGC on and off from multiple threads ..."
   (movl ($ nil) (% arg_z))
   (single-value-return))
 
+(defx8632lapfunction %fork-freeze ()
+  (check-nargs 0)
+  (movl ($ arch::gc-trap-function-fork-freeze) (% imm0))
+  (uuo-gc-trap)
+  (jmp-subprim .SPmakeu32))
+
+(defx8632lapfunction %purify-object-graph ((object arg_z))
+  (check-nargs 1)
+  (movl ($ arch::gc-trap-function-purify-object) (% imm0))
+  (uuo-gc-trap)
+  (movl (% esp) (% temp0))
+  (push (% arg_z))
+  (box-fixnum imm0 arg_y)
+  (push (% arg_y))
+  (set-nargs 2)
+  (jmp-subprim .SPvalues))
+
+(defx8632lapfunction %heap-dump ((fd arg_y) (nthreads arg_z))
+  (check-nargs 2)
+  (unbox-fixnum fd imm0)
+  (movd (% imm0) (% mm0))
+  (movl ($ arch::gc-trap-function-heap-dump) (% imm0))
+  (uuo-gc-trap)
+  (box-fixnum imm0 arg_z)
+  (single-value-return))
+
 (defx8632lapfunction lisp-heap-gc-threshold ()
   "Return the value of the kernel variable that specifies the amount
 of free space to leave in the heap after full GC."
@@ -376,6 +376,351 @@
     (movq (% dest) (% arg_z))
     (single-value-return 4)))
 
+;;; Return the index of the first linefeed octet in the (UNSIGNED-BYTE 8)
+;;; vector V between START and END, or NIL.  Compares 8 octets at a time.
+(defx86lapfunction %find-linefeed-octet ((v arg_x) (start arg_y) (end arg_z))
+  (let ((idx imm2)
+        (limit imm1)
+        (mask imm0))
+    (check-nargs 3)
+    (unbox-fixnum start idx)
+    (unbox-fixnum end limit)
+    (movq ($ #x0a0a0a0a0a0a0a0a) (% mask))
+    (movd (% mask) (% xmm1))
+    (jmp @test8)
+    @loop8
+    (movq (@ target::misc-data-offset (% v) (% idx)) (% xmm0))
+    (pcmpeqb (% xmm1) (% xmm0))
+    (movd (% xmm0) (% mask))
+    (testq (% mask) (% mask))
+    (jne @found8)
+    (addq ($ 8) (% idx))
+    @test8
+    (lea (@ 8 (% idx)) (% mask))
+    (cmpq (% limit) (% mask))
+    (jbe @loop8)
+    (jmp @test1)
+    @loop1
+    (cmpb ($ 10) (@ target::misc-data-offset (% v) (% idx)))
+    (je @found)
+    (addq ($ 1) (% idx))
+    @test1
+    (cmpq (% limit) (% idx))
+    (jb @loop1)
+    (movl ($ (target-nil-value)) (%l arg_z))
+    (single-value-return)
+    @found8
+    (bsfq (% mask) (% mask))
+    (shrq ($ 3) (% mask))
+    (addq (% mask) (% idx))
+    @found
+    (box-fixnum idx arg_z)
+    (single-value-return)))
+
+;;; The ASCII fast paths of the UTF-8, Latin-1, ASCII and UTF-16
+;;; encodings.  Each checks (and, when converting, widens or narrows)
+;;; 16 characters at a time with SSE2, then finishes a character at a
+;;; time; each stops at the first non-ASCII character.  A character is
+;;; ASCII if its code is less than #x80; PMOVMSKB of the octets, or of
+;;; the characters' codes packed into octets with saturation, is zero
+;;; if all of them are.
+
+;;; Return the index of the first octet in V between START and END
+;;; that's not ASCII, or END.
+(defx86lapfunction %skip-ascii-octets ((v arg_x) (start arg_y) (end arg_z))
+  (let ((idx imm2)
+        (limit imm1)
+        (mask imm0))
+    (check-nargs 3)
+    (unbox-fixnum start idx)
+    (unbox-fixnum end limit)
+    (jmp @test16)
+    @loop16
+    (movdqu (@ target::misc-data-offset (% v) (% idx)) (% xmm0))
+    (pmovmskb (% xmm0) (%l mask))
+    (testl (%l mask) (%l mask))
+    (jne @test1)
+    (addq ($ 16) (% idx))
+    @test16
+    (lea (@ 16 (% idx)) (% mask))
+    (cmpq (% limit) (% mask))
+    (jbe @loop16)
+    (jmp @test1)
+    @loop1
+    (movzbl (@ target::misc-data-offset (% v) (% idx)) (%l mask))
+    (cmpl ($ #x80) (%l mask))
+    (jae @done)
+    (addq ($ 1) (% idx))
+    @test1
+    (cmpq (% limit) (% idx))
+    (jb @loop1)
+    @done
+    (box-fixnum idx arg_z)
+    (single-value-return)))
+
+;;; Return the index of the first character in STRING between START and
+;;; END that's not ASCII, or END.
+(defx86lapfunction %skip-ascii-chars ((string arg_x) (start arg_y) (end arg_z))
+  (let ((idx imm2)
+        (limit imm1)
+        (mask imm0))
+    (check-nargs 3)
+    ;; Byte offsets of characters
+    (movq (% start) (% idx))
+    (sarq ($ (- target::fixnumshift 2)) (% idx))
+    (movq (% end) (% limit))
+    (sarq ($ (- target::fixnumshift 2)) (% limit))
+    (jmp @test16)
+    @loop16
+    (movdqu (@ target::misc-data-offset (% string) (% idx)) (% xmm0))
+    (movdqu (@ (+ target::misc-data-offset 16) (% string) (% idx)) (% xmm1))
+    (movdqu (@ (+ target::misc-data-offset 32) (% string) (% idx)) (% xmm2))
+    (movdqu (@ (+ target::misc-data-offset 48) (% string) (% idx)) (% xmm3))
+    (packssdw (% xmm1) (% xmm0))
+    (packssdw (% xmm3) (% xmm2))
+    (packuswb (% xmm2) (% xmm0))
+    (pmovmskb (% xmm0) (%l mask))
+    (testl (%l mask) (%l mask))
+    (jne @test1)
+    (addq ($ 64) (% idx))
+    @test16
+    (lea (@ 64 (% idx)) (% mask))
+    (cmpq (% limit) (% mask))
+    (jbe @loop16)
+    (jmp @test1)
+    @loop1
+    (cmpl ($ #x80) (@ target::misc-data-offset (% string) (% idx)))
+    (jae @done)
+    (addq ($ 4) (% idx))
+    @test1
+    (cmpq (% limit) (% idx))
+    (jb @loop1)
+    @done
+    (shlq ($ (- target::fixnumshift 2)) (% idx))
+    (movq (% idx) (% arg_z))
+    (single-value-return)))
+
+;;; Store the characters whose codes are the N octets in V starting at
+;;; START in STRING starting at DEST.  Returns the number stored.
+(defx86lapfunction %widen-ascii-octets ((v 16) (start 8) #||(ra 0)||# (string arg_x) (dest arg_y) (n arg_z))
+  (let ((src temp0)
+        (remaining temp1)
+        (srcidx imm2)
+        (destidx imm1)
+        (mask imm0))
+    (movq (@ v (% rsp)) (% src))
+    (movq (@ start (% rsp)) (% srcidx))
+    (sarq ($ target::fixnumshift) (% srcidx))
+    (movq (% dest) (% destidx))
+    (sarq ($ (- target::fixnumshift 2)) (% destidx))
+    (movq (% n) (% remaining))
+    (pxor (% xmm5) (% xmm5))
+    (jmp @test16)
+    @loop16
+    (movdqu (@ target::misc-data-offset (% src) (% srcidx)) (% xmm0))
+    (pmovmskb (% xmm0) (%l mask))
+    (testl (%l mask) (%l mask))
+    (jne @test1)
+    (movaps (% xmm0) (% xmm1))
+    (punpcklbw (% xmm5) (% xmm0))
+    (punpckhbw (% xmm5) (% xmm1))
+    (movaps (% xmm0) (% xmm2))
+    (movaps (% xmm1) (% xmm3))
+    (punpcklwd (% xmm5) (% xmm0))
+    (punpckhwd (% xmm5) (% xmm2))
+    (punpcklwd (% xmm5) (% xmm1))
+    (punpckhwd (% xmm5) (% xmm3))
+    (movdqu (% xmm0) (@ target::misc-data-offset (% string) (% destidx)))
+    (movdqu (% xmm2) (@ (+ target::misc-data-offset 16) (% string) (% destidx)))
+    (movdqu (% xmm1) (@ (+ target::misc-data-offset 32) (% string) (% destidx)))
+    (movdqu (% xmm3) (@ (+ target::misc-data-offset 48) (% string) (% destidx)))
+    (addq ($ 16) (% srcidx))
+    (addq ($ 64) (% destidx))
+    (subq ($ '16) (% remaining))
+    @test16
+    (cmpq ($ '16) (% remaining))
+    (jge @loop16)
+    (jmp @test1)
+    @loop1
+    (movzbl (@ target::misc-data-offset (% src) (% srcidx)) (%l mask))
+    (cmpl ($ #x80) (%l mask))
+    (jae @done)
+    (movl (%l mask) (@ target::misc-data-offset (% string) (% destidx)))
+    (addq ($ 1) (% srcidx))
+    (addq ($ 4) (% destidx))
+    (subq ($ '1) (% remaining))
+    @test1
+    (testq (% remaining) (% remaining))
+    (jg @loop1)
+    @done
+    (subq (% remaining) (% arg_z))
+    (single-value-return 4)))
+
+;;; Store the codes of the N characters in STRING starting at START in
+;;; V starting at DEST, one octet each.  Returns the number stored.
+(defx86lapfunction %narrow-ascii-string ((string 16) (start 8) #||(ra 0)||# (v arg_x) (dest arg_y) (n arg_z))
+  (let ((src temp0)
+        (remaining temp1)
+        (srcidx imm2)
+        (destidx imm1)
+        (mask imm0))
+    (movq (@ string (% rsp)) (% src))
+    (movq (@ start (% rsp)) (% srcidx))
+    (sarq ($ (- target::fixnumshift 2)) (% srcidx))
+    (movq (% dest) (% destidx))
+    (sarq ($ target::fixnumshift) (% destidx))
+    (movq (% n) (% remaining))
+    (jmp @test16)
+    @loop16
+    (movdqu (@ target::misc-data-offset (% src) (% srcidx)) (% xmm0))
+    (movdqu (@ (+ target::misc-data-offset 16) (% src) (% srcidx)) (% xmm1))
+    (movdqu (@ (+ target::misc-data-offset 32) (% src) (% srcidx)) (% xmm2))
+    (movdqu (@ (+ target::misc-data-offset 48) (% src) (% srcidx)) (% xmm3))
+    (packssdw (% xmm1) (% xmm0))
+    (packssdw (% xmm3) (% xmm2))
+    (packuswb (% xmm2) (% xmm0))
+    (pmovmskb (% xmm0) (%l mask))
+    (testl (%l mask) (%l mask))
+    (jne @test1)
+    (movdqu (% xmm0) (@ target::misc-data-offset (% v) (% destidx)))
+    (addq ($ 64) (% srcidx))
+    (addq ($ 16) (% destidx))
+    (subq ($ '16) (% remaining))
+    @test16
+    (cmpq ($ '16) (% remaining))
+    (jge @loop16)
+    (jmp @test1)
+    @loop1
+    (movl (@ target::misc-data-offset (% src) (% srcidx)) (%l mask))
+    (cmpl ($ #x80) (%l mask))
+    (jae @done)
+    (movb (%b mask) (@ target::misc-data-offset (% v) (% destidx)))
+    (addq ($ 4) (% srcidx))
+    (addq ($ 1) (% destidx))
+    (subq ($ '1) (% remaining))
+    @test1
+    (testq (% remaining) (% remaining))
+    (jg @loop1)
+    @done
+    (subq (% remaining) (% arg_z))
+    (single-value-return 4)))
+
+;;; Store the characters whose codes are the N native-endian 16-bit
+;;; code units in V starting at octet START in STRING starting at DEST.
+;;; Returns the number stored.
+(defx86lapfunction %widen-ascii-u16 ((v 16) (start 8) #||(ra 0)||# (string arg_x) (dest arg_y) (n arg_z))
+  (let ((src temp0)
+        (remaining temp1)
+        (srcidx imm2)
+        (destidx imm1)
+        (mask imm0))
+    (movq (@ v (% rsp)) (% src))
+    (movq (@ start (% rsp)) (% srcidx))
+    (sarq ($ target::fixnumshift) (% srcidx))
+    (movq (% dest) (% destidx))
+    (sarq ($ (- target::fixnumshift 2)) (% destidx))
+    (movq (% n) (% remaining))
+    (pxor (% xmm5) (% xmm5))
+    (jmp @test16)
+    @loop16
+    (movdqu (@ target::misc-data-offset (% src) (% srcidx)) (% xmm0))
+    (movdqu (@ (+ target::misc-data-offset 16) (% src) (% srcidx)) (% xmm1))
+    (movaps (% xmm0) (% xmm2))
+    (packuswb (% xmm1) (% xmm2))
+    (pmovmskb (% xmm2) (%l mask))
+    (testl (%l mask) (%l mask))
+    (jne @test1)
+    ;; Units with the high bit set are negative, and so are packed
+    ;; into 0; look for them separately.
+    (movaps (% xmm0) (% xmm2))
+    (por (% xmm1) (% xmm2))
+    (pmovmskb (% xmm2) (%l mask))
+    (testl (%l mask) (%l mask))
+    (jne @test1)
+    (movaps (% xmm0) (% xmm2))
+    (movaps (% xmm1) (% xmm3))
+    (punpcklwd (% xmm5) (% xmm0))
+    (punpckhwd (% xmm5) (% xmm2))
+    (punpcklwd (% xmm5) (% xmm1))
+    (punpckhwd (% xmm5) (% xmm3))
+    (movdqu (% xmm0) (@ target::misc-data-offset (% string) (% destidx)))
+    (movdqu (% xmm2) (@ (+ target::misc-data-offset 16) (% string) (% destidx)))
+    (movdqu (% xmm1) (@ (+ target::misc-data-offset 32) (% string) (% destidx)))
+    (movdqu (% xmm3) (@ (+ target::misc-data-offset 48) (% string) (% destidx)))
+    (addq ($ 32) (% srcidx))
+    (addq ($ 64) (% destidx))
+    (subq ($ '16) (% remaining))
+    @test16
+    (cmpq ($ '16) (% remaining))
+    (jge @loop16)
+    (jmp @test1)
+    @loop1
+    (movzwl (@ target::misc-data-offset (% src) (% srcidx)) (%l mask))
+    (cmpl ($ #x80) (%l mask))
+    (jae @done)
+    (movl (%l mask) (@ target::misc-data-offset (% string) (% destidx)))
+    (addq ($ 2) (% srcidx))
+    (addq ($ 4) (% destidx))
+    (subq ($ '1) (% remaining))
+    @test1
+    (testq (% remaining) (% remaining))
+    (jg @loop1)
+    @done
+    (subq (% remaining) (% arg_z))
+    (single-value-return 4)))
+
+;;; Store the codes of the N characters in STRING starting at START in
+;;; V as native-endian 16-bit code units, starting at octet DEST.
+;;; Returns the number stored.
+(defx86lapfunction %narrow-ascii-string-to-u16 ((string 16) (start 8) #||(ra 0)||# (v arg_x) (dest arg_y) (n arg_z))
+  (let ((src temp0)
+        (remaining temp1)
+        (srcidx imm2)
+        (destidx imm1)
+        (mask imm0))
+    (movq (@ string (% rsp)) (% src))
+    (movq (@ start (% rsp)) (% srcidx))
+    (sarq ($ (- target::fixnumshift 2)) (% srcidx))
+    (movq (% dest) (% destidx))
+    (sarq ($ target::fixnumshift) (% destidx))
+    (movq (% n) (% remaining))
+    (jmp @test16)
+    @loop16
+    (movdqu (@ target::misc-data-offset (% src) (% srcidx)) (% xmm0))
+    (movdqu (@ (+ target::misc-data-offset 16) (% src) (% srcidx)) (% xmm1))
+    (movdqu (@ (+ target::misc-data-offset 32) (% src) (% srcidx)) (% xmm2))
+    (movdqu (@ (+ target::misc-data-offset 48) (% src) (% srcidx)) (% xmm3))
+    (packssdw (% xmm1) (% xmm0))
+    (packssdw (% xmm3) (% xmm2))
+    (movaps (% xmm0) (% xmm4))
+    (packuswb (% xmm2) (% xmm4))
+    (pmovmskb (% xmm4) (%l mask))
+    (testl (%l mask) (%l mask))
+    (jne @test1)
+    (movdqu (% xmm0) (@ target::misc-data-offset (% v) (% destidx)))
+    (movdqu (% xmm2) (@ (+ target::misc-data-offset 16) (% v) (% destidx)))
+    (addq ($ 64) (% srcidx))
+    (addq ($ 32) (% destidx))
+    (subq ($ '16) (% remaining))
+    @test16
+    (cmpq ($ '16) (% remaining))
+    (jge @loop16)
+    (jmp @test1)
+    @loop1
+    (movl (@ target::misc-data-offset (% src) (% srcidx)) (%l mask))
+    (cmpl ($ #x80) (%l mask))
+    (jae @done)
+    (movw (%w mask) (@ target::misc-data-offset (% v) (% destidx)))
+    (addq ($ 4) (% srcidx))
+    (addq ($ 2) (% destidx))
+    (subq ($ '1) (% remaining))
+    @test1
+    (testq (% remaining) (% remaining))
+    (jg @loop1)
+    @done
+    (subq (% remaining) (% arg_z))
+    (single-value-return 4)))
+
 (defx86lapfunction %heap-bytes-allocated ()
   (movq (:rcontext x8664::tcr.save-allocptr) (% temp1))
   (movq (:rcontext x8664::tcr.last-allocptr) (% temp0))
@@ -411,6 +411,42 @@ of sense to be turning the EGC on and off from multiple threads ..."
   (movq ($ nil) (% arg_z))
   (single-value-return))
 
+;;; Do a full GC, then freeze everything that's live so that later
+;;; full GCs don't mark, move or scan it.  Returns the number of bytes
+;;; frozen, or 0 if that couldn't be done.
+(defx86lapfunction %fork-freeze ()
+  (check-nargs 0)
+  (movq ($ arch::gc-trap-function-fork-freeze) (% imm0))
+  (uuo-gc-trap)
+  (jmp-subprim .SPmakeu64))
+
+;;; Copy everything reachable from OBJECT that's in the dynamic heap
+;;; to an immutable part of the readonly area.  Returns two values:
+;;; OBJECT (or, on failure, the object that couldn't be copied) and
+;;; a fixnum status code.
+(defx86lapfunction %purify-object-graph ((object arg_z))
+  (check-nargs 1)
+  (movq ($ arch::gc-trap-function-purify-object) (% imm0))
+  (uuo-gc-trap)
+  (movq (% rsp) (% temp0))
+  (push (% arg_z))
+  (box-fixnum imm0 arg_y)
+  (push (% arg_y))
+  (set-nargs 2)
+  (jmp-subprim .SPvalues))
+
+;;; Do a full GC, then describe the heap to the file descriptor FD
+;;; using up to NTHREADS writer threads (0 means one per CPU.)
+;;; Returns 1 on success, 0 if the GC was inhibited, or a negated
+;;; errno value.
+(defx86lapfunction %heap-dump ((fd arg_y) (nthreads arg_z))
+  (check-nargs 2)
+  (unbox-fixnum fd imm1)
+  (movq ($ arch::gc-trap-function-heap-dump) (% imm0))
+  (uuo-gc-trap)
+  (box-fixnum imm0 arg_z)
+  (single-value-return))
+
 
 (defx86lapfunction lisp-heap-gc-threshold ()
   "Return the value of the kernel variable that specifies the amount
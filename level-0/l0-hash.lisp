@@ -79,6 +79,7 @@
    find-new                             ; nhash.find-new
    nil                                  ; nhash.read-only
    (or min-size 0)                      ; nhash.min-size
+   nil                                  ; nhash.stats
    ))
 
 (defun nhash.vector-size (vector)
@@ -430,7 +431,8 @@ before doing so.")
                              (finalizeable nil)
                              (address-based t)  ;; Ignored
                              (lock-free *lock-free-hash-table-default*)
-                             (shared *shared-hash-table-default*))
+                             (shared *shared-hash-table-default*)
+                             (statistics *hash-table-statistics-default*))
   "Create and return a new hash table. The keywords are as follows:
      :TEST -- Indicates what kind of test to use.
      :SIZE -- A hint as to how many elements will be put in this hash
@@ -442,7 +444,9 @@ before doing so.")
      :REHASH-THRESHOLD -- Indicates how dense the table can become before
        forcing a rehash. Can be any positive number <=1, with density
        approaching zero as the threshold approaches 0. Density 1 means an
-       average of one entry per bucket."
+       average of one entry per bucket.
+     :STATISTICS -- If true, keep the statistics that HASH-TABLE-STATISTICS
+       reports."
   (declare (ignore address-based)) ;; TODO: could reinterpret as "warn if becomes address-based"
   (unless (and test (or (functionp test) (symbolp test)))
     (report-bad-arg test '(and (not null) (or symbol function))))
@@ -504,8 +508,117 @@ before doing so.")
                     lock-free
                     size)))
         (setf (nhash.vector.hash (nhash.vector hash)) hash)
+        (when statistics
+          (enable-hash-table-statistics hash))
         hash))))
 
+;;; Per-table statistics.  A table's statistics are kept by replacing
+;;; its find functions with ones that call the originals and then count
+;;; the slots that the originals must have looked at, so tables without
+;;; statistics don't pay anything for them.  Lookups that hit the
+;;; table's one-entry cache aren't counted.
+
+(defparameter *hash-table-statistics-default* nil
+  "If true, new hash tables keep statistics unless MAKE-HASH-TABLE is
+told otherwise.")
+
+;;; A population (a weak list) of the tables that have kept statistics.
+(defvar *hash-tables-with-statistics* nil)
+
+(defun hash-tables-with-statistics ()
+  (or *hash-tables-with-statistics*
+      (progn
+        (conditional-store *hash-tables-with-statistics* nil (%cons-population nil))
+        *hash-tables-with-statistics*)))
+
+(defun enable-hash-table-statistics (hash &optional (enable t))
+  "Start (or, if ENABLE is false, stop) keeping statistics about the
+lookups in HASH.  Statistics that have been kept are retained when
+this is stopped."
+  (unless (typep hash 'hash-table)
+    (report-bad-arg hash 'hash-table))
+  (with-lock-context
+    (without-interrupts
+      (let* ((stats (nhash.stats hash)))
+        (if enable
+          (progn
+            (unless stats
+              (setq stats (make-array nhash.stats.size :initial-element 0))
+              (setf (nhash.stats.find stats) (nhash.find hash)
+                    (nhash.stats.find-new stats) (nhash.find-new hash)
+                    (nhash.stats hash) stats)
+              (atomic-push-uvector-cell (hash-tables-with-statistics)
+                                        population.data
+                                        hash))
+            (setf (nhash.find hash) #'%hash-find-with-statistics
+                  (nhash.find-new hash) #'%hash-find-for-put-with-statistics))
+          (when stats
+            (setf (nhash.find hash) (nhash.stats.find stats)
+                  (nhash.find-new hash) (nhash.stats.find-new stats)))))))
+  enable)
+
+;;; Return the number of slots a find function examined in looking for
+;;; KEY in VECTOR and returning VECTOR-INDEX, by following the same
+;;; probe sequence.
+(defun %hash-probe-count (hash key vector vector-index)
+  (declare (fixnum vector-index) (optimize (speed 3) (safety 0)))
+  (multiple-value-bind (hash-code index entries)
+      (compute-hash-code hash key nil vector)
+    (declare (fixnum hash-code index entries))
+    (let* ((target (if (eql vector-index -1) -1 (vector-index->index vector-index)))
+           (secondary-hash (%svref secondary-keys (logand 7 hash-code)))
+           (count 1))
+      (declare (fixnum target secondary-hash count))
+      (loop
+        (when (or (eql index target)
+                  (eq (%svref vector (index->vector-index index)) free-hash-marker)
+                  (>= count entries))
+          (return count))
+        (incf count)
+        (incf index secondary-hash)
+        (when (>= index entries)
+          (decf index entries))))))
+
+(defun %note-hash-probes (hash stats key vector vector-index)
+  (let* ((count (%hash-probe-count hash key vector vector-index)))
+    (declare (fixnum count))
+    (atomic-incf (nhash.stats.lookups stats))
+    (atomic-incf-decf (nhash.stats.probes stats) count)
+    (loop
+      (let* ((max (nhash.stats.max-probe stats)))
+        (when (or (<= count (the fixnum max))
+                  (store-gvector-conditional nhash.stats.max-probe stats max count))
+          (return))))))
+
+(defun %hash-find-with-statistics (hash key)
+  (let* ((stats (nhash.stats hash))
+         (vector (nhash.vector hash))
+         (vector-index (funcall (the function (nhash.stats.find stats)) hash key)))
+    (%note-hash-probes hash stats key vector vector-index)
+    vector-index))
+
+(defun %hash-find-for-put-with-statistics (hash key)
+  (let* ((stats (nhash.stats hash))
+         (vector (nhash.vector hash))
+         (vector-index (funcall (the function (nhash.stats.find-new stats)) hash key)))
+    (%note-hash-probes hash stats key vector vector-index)
+    vector-index))
+
+;;; Called before HASH's vector is rehashed.  GROWING is true if it's
+;;; about to be replaced by a bigger one.
+(defun %note-hash-rehash (hash vector growing)
+  (let* ((stats (nhash.stats hash)))
+    (when stats
+      (cond (growing (atomic-incf (nhash.stats.grows stats)))
+            ((%needs-rehashing-p vector)
+             (atomic-incf (nhash.stats.gc-rehashes stats)))
+            (t (atomic-incf (nhash.stats.in-place-rehashes stats)))))))
+
+(defun %note-lock-free-hash-retry (hash)
+  (let* ((stats (nhash.stats hash)))
+    (when stats
+      (atomic-incf (nhash.stats.lock-free-retries stats)))))
+
 (defun compute-hash-size (size rehash-size rehash-ratio)
   (let* ((new-size (max 30 (if (fixnump rehash-size)
                              (%i+ size rehash-size)
@@ -728,6 +841,7 @@ before doing so.")
          (inherited-flags (logand $nhash_weak_flags_mask (nhash.vector.flags old-vector)))
          (grow-threshold (nhash.grow-threshold hash))
          count new-vector vector-size)
+    (%note-hash-rehash hash old-vector (%i<= grow-threshold 0))
     ;; Prevent puthash from adding new entries.
     (setf (nhash.grow-threshold hash) 0)
     (setq count (lock-free-count-entries hash))
@@ -828,6 +942,7 @@ before doing so.")
                        (return-from lock-free-gethash (values value t)))))))))
     ;; We're here because the table needs rehashing or it was getting rehashed while we
     ;; were searching. Take care of it and try again.
+    (%note-lock-free-hash-retry hash)
     (lock-free-rehash hash)))
 
 (defun lock-free-remhash (key hash)
@@ -860,6 +975,7 @@ before doing so.")
                        (return-from lock-free-remhash t)))))))
       ;; We're here because the table needs rehashing or it was getting rehashed while we
       ;; were searching.  Take care of it and try again.
+      (%note-lock-free-hash-retry hash)
       (lock-free-rehash hash))))
 
 (defun replace-nhash-vector (hash size flags)
@@ -954,6 +1070,7 @@ before doing so.")
     ;; were searching, or no room for new entry, or somebody else claimed the key from
     ;; under us (that last case doesn't need to retry, but it's unlikely enough that
     ;; it's not worth checking for).  Take care of it and try again.
+    (%note-lock-free-hash-retry hash)
     (lock-free-rehash hash)))
 
 (defun lock-free-hash-table-count (hash)
@@ -1239,6 +1356,7 @@ before doing so.")
                 (setf (nhash.vector.flags old-vector) flags)
                 (setq weak-flags nil)
                 (return-from grow-hash-table (%rehash hash)))
+              (%note-hash-rehash hash old-vector t)
               (setq vector (%cons-nhash-vector total-size 0))
               (do* ((index 0 (1+ index))
                     (vector-index (index->vector-index 0) (+ vector-index 2)))
@@ -1540,6 +1658,7 @@ before doing so.")
 (defun %rehash (hash)
   (when (hash-lock-free-p hash)
     (error "How did we get here?"))
+  (%note-hash-rehash hash (nhash.vector hash) nil)
   (let* ((vector (nhash.vector hash))
          (flags (nhash.vector.flags vector))
          (vector-index (- $nhash.vector_overhead 2))
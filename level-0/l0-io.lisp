@@ -29,7 +29,11 @@
         (declare (type (mod #x110000) code))
         (incf noctets
               (if (< code #x80)
-                1
+                ;; Skip the whole run of ASCII characters.
+                (let* ((j (%skip-ascii-chars string i end)))
+                  (declare (fixnum j))
+                  (prog1 (- j i)
+                    (setq i (1- j))))
                 (if (< code #x800)
                   2
                   (if (< code #x10000)
@@ -69,6 +69,107 @@
       (incf source-idx)
       (incf dest-idx))))
     
+;;; These are written in LAP on x86-64.
+#-x8664-target
+(defun %find-linefeed-octet (v start end)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start end)
+           (type (simple-array (unsigned-byte 8) (*)) v))
+  (do* ((i start (1+ i)))
+       ((= i end))
+    (declare (fixnum i))
+    (when (eql (aref v i) 10)
+      (return i))))
+
+;; The ASCII fast paths of the UTF-8, Latin-1, ASCII and UTF-16
+;; encodings use SSE2 on x86-64.  Each stops at the first character
+;; whose code is not less than #x80.
+#-x8664-target
+(defun %skip-ascii-octets (v start end)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start end)
+           (type (simple-array (unsigned-byte 8) (*)) v))
+  (do* ((i start (1+ i)))
+       ((= i end) i)
+    (declare (fixnum i))
+    (when (>= (aref v i) #x80)
+      (return i))))
+
+#-x8664-target
+(defun %skip-ascii-chars (string start end)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start end)
+           (simple-string string))
+  (do* ((i start (1+ i)))
+       ((= i end) i)
+    (declare (fixnum i))
+    (when (>= (the fixnum (%scharcode string i)) #x80)
+      (return i))))
+
+#-x8664-target
+(defun %widen-ascii-octets (v start string dest n)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start dest n)
+           (type (simple-array (unsigned-byte 8) (*)) v)
+           (simple-string string))
+  (do* ((i 0 (1+ i)))
+       ((= i n) n)
+    (declare (fixnum i))
+    (let* ((code (aref v (the fixnum (+ start i)))))
+      (when (>= code #x80)
+        (return i))
+      (setf (%scharcode string (the fixnum (+ dest i))) code))))
+
+#-x8664-target
+(defun %narrow-ascii-string (string start v dest n)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start dest n)
+           (type (simple-array (unsigned-byte 8) (*)) v)
+           (simple-string string))
+  (do* ((i 0 (1+ i)))
+       ((= i n) n)
+    (declare (fixnum i))
+    (let* ((code (%scharcode string (the fixnum (+ start i)))))
+      (declare (fixnum code))
+      (when (>= code #x80)
+        (return i))
+      (setf (aref v (the fixnum (+ dest i))) code))))
+
+;; START and DEST are octet offsets; N counts native-endian 16-bit units.
+#-x8664-target
+(defun %widen-ascii-u16 (v start string dest n)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start dest n)
+           (type (simple-array (unsigned-byte 8) (*)) v)
+           (simple-string string))
+  (do* ((i 0 (1+ i))
+        (j start (+ j 2)))
+       ((= i n) n)
+    (declare (fixnum i j))
+    (let* ((hi #+big-endian-target (aref v j)
+               #+little-endian-target (aref v (the fixnum (1+ j))))
+           (lo #+big-endian-target (aref v (the fixnum (1+ j)))
+               #+little-endian-target (aref v j)))
+      (when (or (/= hi 0) (>= lo #x80))
+        (return i))
+      (setf (%scharcode string (the fixnum (+ dest i))) lo))))
+
+#-x8664-target
+(defun %narrow-ascii-string-to-u16 (string start v dest n)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start dest n)
+           (type (simple-array (unsigned-byte 8) (*)) v)
+           (simple-string string))
+  (do* ((i 0 (1+ i))
+        (j dest (+ j 2)))
+       ((= i n) n)
+    (declare (fixnum i j))
+    (let* ((code (%scharcode string (the fixnum (+ start i)))))
+      (declare (fixnum code))
+      (when (>= code #x80)
+        (return i))
+      (setf (aref v #+big-endian-target j #+little-endian-target (1+ j)) 0
+            (aref v #+big-endian-target (1+ j) #+little-endian-target j) code))))
         
 
 
@@ -568,6 +669,72 @@
 (eval-when (:compile-toplevel :execute)
   (declaim (inline note-lock-wait note-lock-held note-lock-released)))
 
+;;; Lock contention profiling.  When *LOCK-PROFILING* is true, every
+;;; acquisition of a lock or rwlock is counted in the kernel's
+;;; lock_stats for that lock, along with the time spent waiting for
+;;; it if it had to wait; see lisp-kernel/thread_manager.c.  A waiter
+;;; sometimes asks the holder to note its backtrace when it releases
+;;; the lock.  The user interface is in "ccl:library;lock-profiler".
+;;; When *EVENT-TRACING* is true, lock waits are timed and recorded
+;;; in the thread's trace buffer; see "ccl:library;event-trace".
+
+(eval-when (:compile-toplevel :execute)
+  (defconstant lock-stats-recursive 0)
+  (defconstant lock-stats-rwlock 1))
+
+(defparameter *lock-profiling* nil)
+(defparameter *event-tracing* nil)
+;;; A weak list of the locks that lisp has allocated lock_stats for.
+(defparameter *profiled-locks* nil)
+;;; A list (in its car) of (lock_stats address . functions) entries.
+(defparameter *lock-holder-backtraces* (list nil))
+(defparameter *lock-holder-backtrace-depth* 8)
+
+(defun %lock-wait-begin (ptr kind)
+  (ff-call (%kernel-import target::kernel-import-lisp-lock-wait-begin)
+           :address ptr
+           #+64-bit-target :unsigned-doubleword #+32-bit-target :unsigned-fullword kind
+           :unsigned-doubleword))
+
+(defun %note-lock-acquired (ptr lock kind wait-start)
+  (let* ((offset (if (eql kind lock-stats-rwlock)
+                   target::rwlock.stats
+                   target::lockptr.stats))
+         (had-stats (not (eql 0 (%get-natural ptr offset))))
+         (locks *profiled-locks*))
+    (ff-call (%kernel-import target::kernel-import-lisp-lock-acquired)
+             :address ptr
+             #+64-bit-target :unsigned-doubleword #+32-bit-target :unsigned-fullword kind
+             :unsigned-doubleword wait-start
+             :void)
+    (when (and locks
+               (not had-stats)
+               (not (eql 0 (%get-natural ptr offset))))
+      (atomic-push-uvector-cell locks population.data lock))))
+
+;;; Called by the holder of the lock whose kernel pointer is PTR just
+;;; before it releases it.
+(defun %note-lock-holder-backtrace (ptr stats-offset)
+  (with-macptrs ((stats (%get-ptr ptr stats-offset)))
+    (unless (or (%null-ptr-p stats)
+                (eql 0 (%get-natural stats 0)))
+      (setf (%get-natural stats 0) 0)
+      (let* ((functions ()))
+        ;; Skip MAP-CALL-FRAMES's frame and ours.
+        (map-call-frames (lambda (p context)
+                           (declare (ignore context))
+                           (push (cfp-lfun p) functions))
+                         :count *lock-holder-backtrace-depth*
+                         :start-frame-number 2
+                         :test 'function-frame-p)
+        (let* ((cell *lock-holder-backtraces*)
+               (new (list (cons (%ptr-to-int stats) (nreverse functions)))))
+          (loop
+            (let* ((old (car cell)))
+              (setf (cdr new) old)
+              (when (%rplaca-conditional cell old new)
+                (return)))))))))
+
 
 
 
@@ -584,23 +751,28 @@
     (if (istruct-typep flag 'lock-acquisition)
       (setf (lock-acquisition.status flag) nil)
       (if flag (report-bad-arg flag 'lock-acquisition)))
-    (loop
-      (without-interrupts
-       (when (eql p owner)
-         (incf (%get-natural ptr target::lockptr.count))
-         (when flag
-           (setf (lock-acquisition.status flag) t))
-         (return t))
-       (%get-spin-lock spin)
-       (when (eql 1 (incf (%get-natural ptr target::lockptr.avail)))
-         (setf (%get-ptr ptr target::lockptr.owner) p
-               (%get-natural ptr target::lockptr.count) 1)
-         (setf (%get-natural spin 0) 0)
-         (if flag
-           (setf (lock-acquisition.status flag) t))
-         (return t))
-       (setf (%get-natural spin 0) 0))
-      (%process-wait-on-semaphore-ptr signal 1 0 (recursive-lock-whostate lock)))))
+    (let* ((wait-start 0))
+      (loop
+        (without-interrupts
+         (when (eql p owner)
+           (incf (%get-natural ptr target::lockptr.count))
+           (when flag
+             (setf (lock-acquisition.status flag) t))
+           (return t))
+         (%get-spin-lock spin)
+         (when (eql 1 (incf (%get-natural ptr target::lockptr.avail)))
+           (setf (%get-ptr ptr target::lockptr.owner) p
+                 (%get-natural ptr target::lockptr.count) 1)
+           (setf (%get-natural spin 0) 0)
+           (when (or *lock-profiling* (not (eql wait-start 0)))
+             (%note-lock-acquired ptr lock lock-stats-recursive wait-start))
+           (if flag
+             (setf (lock-acquisition.status flag) t))
+           (return t))
+         (setf (%get-natural spin 0) 0))
+        (when (and (or *lock-profiling* *event-tracing*) (eql wait-start 0))
+          (setq wait-start (%lock-wait-begin ptr lock-stats-recursive)))
+        (%process-wait-on-semaphore-ptr signal 1 0 (recursive-lock-whostate lock))))))
 
 #+futex
 (defun %lock-recursive-lock-ptr (ptr lock flag)
@@ -613,7 +785,9 @@
     (without-interrupts
      (cond ((eql self (%get-object ptr target::lockptr.owner))
             (incf (%get-natural ptr target::lockptr.count)))
-           (t (%lock-futex ptr level lock #'recursive-lock-whostate)
+           (t (if (or *lock-profiling* *event-tracing*)
+                (%lock-futex-profiled ptr level lock)
+                (%lock-futex ptr level lock #'recursive-lock-whostate))
               (%set-object ptr target::lockptr.owner self)
               (setf (%get-natural ptr target::lockptr.count) 1)))
      (when flag
@@ -669,6 +843,14 @@
           (when (eql futex-avail (xchgl val p))
             (return t))))))
 
+#+futex
+(defun %lock-futex-profiled (ptr level lock)
+  (let* ((wait-start 0))
+    (unless (eql futex-avail (%ptr-store-conditional ptr futex-avail futex-locked))
+      (setq wait-start (%lock-wait-begin ptr lock-stats-recursive))
+      (%lock-futex ptr level lock #'recursive-lock-whostate))
+    (%note-lock-acquired ptr lock lock-stats-recursive wait-start)))
+
 #+futex
 (defun %unlock-futex (p)
   (unless (eql futex-avail (%atomic-decf-ptr p))
@@ -749,6 +931,8 @@
     (without-interrupts
      (when (eql 0 (decf (the fixnum
                           (%get-natural ptr target::lockptr.count))))
+       (when *lock-profiling*
+         (%note-lock-holder-backtrace ptr target::lockptr.stats))
        (%get-spin-lock spin)
        (setf (%get-ptr ptr target::lockptr.owner) (%null-ptr))
        (let* ((pending (+ (the fixnum
@@ -772,6 +956,8 @@
   (without-interrupts
    (when (eql 0 (decf (the fixnum
                         (%get-natural ptr target::lockptr.count))))
+     (when *lock-profiling*
+       (%note-lock-holder-backtrace ptr target::lockptr.stats))
      (setf (%get-natural ptr target::lockptr.owner) 0)
      (%unlock-futex ptr)))
   nil)
@@ -873,9 +1059,11 @@
            (if flag
              (setf (lock-acquisition.status flag) t))
            t)
-         (do* ()
+         (do* ((wait-start 0))
               ((eql 0 (%get-signed-natural ptr target::rwlock.state))
                ;; That wasn't so bad, was it ?  We have the spinlock now.
+               (when (or *lock-profiling* (not (eql wait-start 0)))
+                 (%note-lock-acquired ptr lock lock-stats-rwlock wait-start))
                (setf (%get-signed-natural ptr target::rwlock.state) 1
                      (%get-natural ptr target::rwlock.spin) 0)
                (%set-object ptr target::rwlock.writer tcr)
@@ -884,6 +1072,8 @@
                t)
            (incf (%get-natural ptr target::rwlock.blocked-writers))
            (setf (%get-natural ptr target::rwlock.spin) 0)
+           (when (and (or *lock-profiling* *event-tracing*) (eql wait-start 0))
+             (setq wait-start (%lock-wait-begin ptr lock-stats-rwlock)))
            (let* ((*interrupt-level* level))
                   (%process-wait-on-semaphore-ptr write-signal 1 0 (rwlock-write-whostate lock)))
            (%get-spin-lock ptr)))))))
@@ -905,9 +1095,11 @@
            (if flag
              (setf (lock-acquisition.status flag) t))
            t)
-         (do* ()
+         (do* ((wait-start 0))
               ((eql 0 (%get-signed-natural ptr target::rwlock.state))
                ;; That wasn't so bad, was it ?  We have the spinlock now.
+               (when (or *lock-profiling* (not (eql wait-start 0)))
+                 (%note-lock-acquired ptr lock lock-stats-rwlock wait-start))
                (setf (%get-signed-natural ptr target::rwlock.state) 1)
                (setf (%get-signed-long write-signal) -1)
                (%unlock-futex ptr)
@@ -918,6 +1110,8 @@
            (incf (%get-natural ptr target::rwlock.blocked-writers))
            (let* ((waitval -1))
              (%unlock-futex ptr)
+             (when (and (or *lock-profiling* *event-tracing*) (eql wait-start 0))
+               (setq wait-start (%lock-wait-begin ptr lock-stats-rwlock)))
              (with-process-whostate ((rwlock-write-whostate lock))
                (let* ((*interrupt-level* level))
                  (futex-wait write-signal waitval (rwlock-write-whostate lock)))))
@@ -946,9 +1140,12 @@
            (error 'deadlock :lock lock))
          (do* ((state
                 (%get-signed-natural ptr target::rwlock.state)
-                (%get-signed-natural ptr target::rwlock.state)))
+                (%get-signed-natural ptr target::rwlock.state))
+               (wait-start 0))
               ((<= state 0)
                ;; That wasn't so bad, was it ?  We have the spinlock now.
+               (when (or *lock-profiling* (not (eql wait-start 0)))
+                 (%note-lock-acquired ptr lock lock-stats-rwlock wait-start))
                (setf (%get-signed-natural ptr target::rwlock.state)
                      (the fixnum (1- state))
                      (%get-natural ptr target::rwlock.spin) 0)
@@ -958,6 +1155,8 @@
            (declare (fixnum state))
            (incf (%get-natural ptr target::rwlock.blocked-readers))
            (setf (%get-natural ptr target::rwlock.spin) 0)
+           (when (and (or *lock-profiling* *event-tracing*) (eql wait-start 0))
+             (setq wait-start (%lock-wait-begin ptr lock-stats-rwlock)))
            (let* ((*interrupt-level* level))
              (%process-wait-on-semaphore-ptr read-signal 1 0 (rwlock-read-whostate lock)))
            (%get-spin-lock ptr)))))))
@@ -979,9 +1178,12 @@
            (error 'deadlock :lock lock))
          (do* ((state
                 (%get-signed-natural ptr target::rwlock.state)
-                (%get-signed-natural ptr target::rwlock.state)))
+                (%get-signed-natural ptr target::rwlock.state))
+               (wait-start 0))
               ((<= state 0)
                ;; That wasn't so bad, was it ?  We have the spinlock now.
+               (when (or *lock-profiling* (not (eql wait-start 0)))
+                 (%note-lock-acquired ptr lock lock-stats-rwlock wait-start))
                (setf (%get-signed-natural ptr target::rwlock.state)
                      (the fixnum (1- state)))
                (setf (%get-signed-long reader-signal) -1) ; can happen multiple times, but that's harmless
@@ -993,6 +1195,8 @@
            (incf (%get-natural ptr target::rwlock.blocked-readers))
            (let* ((waitval -1))
              (%unlock-futex ptr)
+             (when (and (or *lock-profiling* *event-tracing*) (eql wait-start 0))
+               (setq wait-start (%lock-wait-begin ptr lock-stats-rwlock)))
              (let* ((*interrupt-level* level))
                (futex-wait reader-signal waitval (rwlock-read-whostate lock))))
            (%lock-futex ptr level lock nil)
@@ -1010,6 +1214,8 @@
   (with-macptrs ((reader-signal (%get-ptr ptr target::rwlock.reader-signal))
                  (writer-signal (%get-ptr ptr target::rwlock.writer-signal)))
     (without-interrupts
+     (when *lock-profiling*
+       (%note-lock-holder-backtrace ptr target::rwlock.stats))
      (%get-spin-lock ptr)
      (let* ((state (%get-signed-natural ptr target::rwlock.state))
             (tcr (%current-tcr)))
@@ -1066,6 +1272,8 @@
     (let* ((signal nil)
            (wakeup 0))
     (without-interrupts
+     (when *lock-profiling*
+       (%note-lock-holder-backtrace ptr target::rwlock.stats))
      (%lock-futex ptr -1 lock nil)
      (let* ((state (%get-signed-natural ptr target::rwlock.state))
             (tcr (%current-tcr)))
@@ -75,6 +75,26 @@
 
 (defloadvar *unprocessed-command-line-arguments* ())
 
+(defloadvar *image-ready-time* nil)
+
+(defun note-image-ready ()
+  "Tell the lisp kernel that the application has finished starting up.
+This happens automatically when the first listener prompt is printed;
+applications that don't run a listener can call it from their toplevel
+function.  If the kernel was started with --record-page-order, the order
+in which the heap image's pages were touched up to this point is stored
+in the image and used to prefetch those pages on subsequent startups.
+Returns the number of microseconds between kernel startup and the first
+call to this function."
+  (or *image-ready-time*
+      (%stack-block ((elapsed 8))
+        (let* ((err (ff-call (%kernel-import target::kernel-import-image-ready)
+                             :address elapsed
+                             :signed-fullword)))
+          (unless (eql err 0)
+            (warn "Couldn't record image page order: ~a" (%strerror err)))
+          (setq *image-ready-time* (%get-natural elapsed 0))))))
+
 ;;; Returns four values: error-flag, options-alist, non-option-arguments, unprocessed arguments
 (defmethod parse-application-arguments ((a application))
   (let* ((cla (slot-value a 'command-line-arguments))
@@ -19,7 +19,9 @@
 
 
 
-
+;;; If true, generic functions keep dispatch statistics as they're
+;;; created.  See ENABLE-GF-DISPATCH-STATISTICS.
+(defvar *gf-dispatch-statistics* nil)
 
 
 (defun %make-gf-instance (class &key
@@ -47,6 +49,8 @@
       (error "Cannot specify ~s without specifying ~s" :argument-precedence-order
 	     :lambda-list)))
   (let* ((gf (%allocate-gf-instance class)))
+    (when *gf-dispatch-statistics*
+      (%ensure-gf-dispatch-stats gf))
     (setf (sgf.name gf) name
           (sgf.method-combination gf) method-combination
           (sgf.methods gf) nil
@@ -169,7 +173,11 @@
 (defun make-n+1th-arg-combined-method (methods gf argnum)
   (let ((table (make-gf-dispatch-table)))
     (setf (%gf-dispatch-table-methods table) methods
-          (%gf-dispatch-table-argnum table) (%i+ 1 argnum))
+          (%gf-dispatch-table-argnum table) (%i+ 1 argnum)
+          (%gf-dispatch-table-stats table)
+          (%gf-dispatch-table-stats (if (generic-function-p gf)
+                                      (%gf-dispatch-table gf)
+                                      (%combined-method-methods gf))))
     (let ((self (%cons-combined-method gf table #'%%nth-arg-dcode))) ; <<
       (setf (%gf-dispatch-table-gf table) self)
       self)))
@@ -183,6 +191,9 @@
                  (report-bad-arg gf 'standard-generic-function))
   (let ((dt (%gf-dispatch-table gf)))
     (unless (< (%gf-dispatch-table-argnum dt) 0) ;reader-method optimization
+      (let* ((stats (%gf-dispatch-table-stats dt)))
+        (when stats
+          (atomic-incf (gf-dispatch-stats.clears stats))))
       (if (eq (%gf-dispatch-table-size dt) *min-gf-dispatch-table-size*)
         (clear-gf-dispatch-table dt)
         (let ((new (make-gf-dispatch-table)))
@@ -193,6 +204,7 @@
           (setf (%gf-dispatch-table-keyvect new)
                 (%gf-dispatch-table-keyvect dt))
           (setf (%gf-dispatch-table-argnum new) (%gf-dispatch-table-argnum dt))
+          (setf (%gf-dispatch-table-stats new) (%gf-dispatch-table-stats dt))
           (setf (%gf-dispatch-table gf) new))))))
 
 (defun %gf-dispatch-table-store-conditional (dt index new)
@@ -219,14 +231,18 @@
     (if (> new-size *max-gf-dispatch-table-size*)
       (progn 
         (setq new-dt (clear-gf-dispatch-table dt)
-                   *gf-dt-ovf-cnt* (%i+ *gf-dt-ovf-cnt* 1)))
+                   *gf-dt-ovf-cnt* (%i+ *gf-dt-ovf-cnt* 1))
+        (let* ((stats (%gf-dispatch-table-stats dt)))
+          (when stats
+            (atomic-incf (gf-dispatch-stats.overflows stats)))))
       (progn
         (setq new-dt (make-gf-dispatch-table new-size))
         (setf (%gf-dispatch-table-methods new-dt) (%gf-dispatch-table-methods dt)
               (%gf-dispatch-table-precedence-list new-dt) (%gf-dispatch-table-precedence-list dt)
               (%gf-dispatch-table-keyvect new-dt) (%gf-dispatch-table-keyvect dt)
               (%gf-dispatch-table-gf new-dt) gf-or-cm
-              (%gf-dispatch-table-argnum new-dt) (%gf-dispatch-table-argnum dt))
+              (%gf-dispatch-table-argnum new-dt) (%gf-dispatch-table-argnum dt)
+              (%gf-dispatch-table-stats new-dt) (%gf-dispatch-table-stats dt))
         (let ((i 0) index w cm)
           (dotimes (j (%ilsr 1 (%gf-dispatch-table-size dt)))
 	    (declare (fixnum j))
@@ -294,6 +310,9 @@
 
 
 (defun %find-1st-arg-combined-method (dt arg)
+  (let* ((stats (%gf-dispatch-table-stats dt)))
+    (when stats
+      (atomic-incf (gf-dispatch-stats.calls stats))))
   (let ((wrapper (instance-class-wrapper arg)))
     (when (eql 0 (%wrapper-hash-index wrapper))
       (update-obsolete-instance arg)
@@ -310,6 +329,9 @@
               (if (or (neq table-wrapper (%unbound-marker))
                       (eql 0 flag))
                 (without-interrupts     ; why?
+                 (let* ((stats (%gf-dispatch-table-stats dt)))
+                   (when stats
+                     (atomic-incf (gf-dispatch-stats.misses stats))))
                  (return (1st-arg-combined-method-trap (%gf-dispatch-table-gf dt) wrapper arg))) ; the only difference?
                 (setq flag 0 index -2)))
             (setq index (+ 2 index))))))))
@@ -340,7 +362,10 @@
               (if (or (neq table-wrapper (%unbound-marker))
                       (eql 0 flag))
                 (without-interrupts     ; why?
-                 (let ((gf (%gf-dispatch-table-gf dt)))
+                 (let ((gf (%gf-dispatch-table-gf dt))
+                       (stats (%gf-dispatch-table-stats dt)))
+                   (when stats
+                     (atomic-incf (gf-dispatch-stats.misses stats)))
                    (if (listp args)
                      (return (nth-arg-combined-method-trap-0 gf dt wrapper args))
                      (with-list-from-lexpr (args-list args)
@@ -686,9 +711,12 @@
           (let ((wrapper (%gf-dispatch-table-ref dt index)))
             (if wrapper
               (if (eql 0 (%wrapper-hash-index wrapper))
-                (setf contains-obsolete-wrappers-p t
-                      (%gf-dispatch-table-ref dt index) *obsolete-wrapper*
-                      (%gf-dispatch-table-ref dt (1+ index)) *gf-dispatch-bug*)
+                (let* ((stats (%gf-dispatch-table-stats dt)))
+                  (when (and stats (neq wrapper *obsolete-wrapper*))
+                    (atomic-incf (gf-dispatch-stats.invalidations stats)))
+                  (setf contains-obsolete-wrappers-p t
+                        (%gf-dispatch-table-ref dt index) *obsolete-wrapper*
+                        (%gf-dispatch-table-ref dt (1+ index)) *gf-dispatch-bug*))
                 (setq count (%i+ count 1)))))
           (setq index (%i+ index 2)))
         (when (> count max-count)
@@ -724,6 +752,93 @@
 (defparameter *max-gf-dispatch-table-size* (expt 2 16))
 (defvar *gf-dt-ovf-cnt* 0)              ; overflow count
 
+;;; Dispatch statistics.  A generic function's counters live in a
+;;; vector that its dispatch table points to (and that's carried over
+;;; when the table is grown or replaced), so a GF without statistics
+;;; pays a test of a dispatch-table slot on each call.
+
+(defun %ensure-gf-dispatch-stats (gf)
+  (let* ((dt (%gf-dispatch-table gf)))
+    (or (%gf-dispatch-table-stats dt)
+        (setf (%gf-dispatch-table-stats dt)
+              (make-array gf-dispatch-stats.size :initial-element 0)))))
+
+(defun enable-gf-dispatch-statistics (&optional (gfs :all) (enable t))
+  "Start (or, if ENABLE is false, stop) counting calls, cache misses,
+overflows and invalidations in the dispatch caches of the generic
+functions GFS (a generic function, a list of them, or :ALL, which also
+affects generic functions created later).  Stopping discards the
+counts."
+  (flet ((enable (gf)
+           (if enable
+             (%ensure-gf-dispatch-stats gf)
+             (setf (%gf-dispatch-table-stats (%gf-dispatch-table gf)) nil))))
+    (if (eq gfs :all)
+      (progn
+        (setq *gf-dispatch-statistics* enable)
+        (dolist (gf (population-data %all-gfs%))
+          (enable gf)))
+      (dolist (gf (if (listp gfs) gfs (list gfs)))
+        (enable (require-type gf 'standard-generic-function)))))
+  enable)
+
+(defun gf-dispatch-statistics (gf)
+  "Return a plist describing GF's dispatch cache, or NIL if it isn't
+keeping statistics.  :CALLS counts calls that looked in the cache, and
+:MISSES those that found no entry for their arguments' classes and had
+to compute the applicable methods.  :OVERFLOWS counts the times the
+cache was full at its maximum size and was cleared, :INVALIDATIONS the
+entries dropped because their class was redefined, and :CLEARS the
+times the whole cache was flushed."
+  (let* ((dt (%gf-dispatch-table gf))
+         (stats (%gf-dispatch-table-stats dt)))
+    (when stats
+      (let* ((size (%ilsr 1 (%gf-dispatch-table-size dt)))
+             (used 0))
+        (declare (fixnum size used))
+        (dotimes (i size)
+          (let* ((wrapper (%gf-dispatch-table-ref dt (%ilsl 1 i))))
+            (when (and wrapper (neq wrapper *obsolete-wrapper*))
+              (incf used))))
+        (list :calls (gf-dispatch-stats.calls stats)
+              :misses (gf-dispatch-stats.misses stats)
+              :table-size size
+              :table-entries used
+              :overflows (gf-dispatch-stats.overflows stats)
+              :invalidations (gf-dispatch-stats.invalidations stats)
+              :clears (gf-dispatch-stats.clears stats))))))
+
+(defun reset-gf-dispatch-statistics ()
+  "Zero the dispatch statistics of all generic functions."
+  (dolist (gf (population-data %all-gfs%))
+    (let* ((stats (%gf-dispatch-table-stats (%gf-dispatch-table gf))))
+      (when stats
+        (fill stats 0)))))
+
+(defun gf-dispatch-report (&key (stream t) (count 20) (key :misses))
+  "Describe the COUNT generic functions with the largest KEY (a property
+that GF-DISPATCH-STATISTICS returns)."
+  (when (eq stream t) (setq stream *standard-output*))
+  (let* ((entries ()))
+    (dolist (gf (population-data %all-gfs%))
+      (let* ((stats (gf-dispatch-statistics gf)))
+        (when (and stats (plusp (getf stats :calls)))
+          (push (cons gf stats) entries))))
+    (setq entries (sort entries #'> :key #'(lambda (entry) (getf (cdr entry) key))))
+    (format stream "~&~12@a ~10@a ~6@a ~11@a ~9@a ~8@a  Generic function~%"
+            "Calls" "Misses" "Miss%" "Entries" "Overflows" "Invalid")
+    (loop for (gf . stats) in entries
+          repeat count
+          do (destructuring-bind (&key calls misses table-size table-entries
+                                       overflows invalidations &allow-other-keys)
+                 stats
+               (format stream "~&~12d ~10d ~5,1f% ~11@a ~9d ~8d  ~s~%"
+                       calls misses (/ (* 100.0 misses) calls)
+                       (format nil "~d/~d" table-entries table-size)
+                       overflows invalidations
+                       (function-name gf))))
+    (values)))
+
 (defvar *no-applicable-method-hash* nil)
 
 
@@ -832,6 +947,11 @@
 
 ;;;  arg is dispatch-table and argnum is in the dispatch table
 (defun %%nth-arg-dcode (dt args)
+  ;; Combined methods that dispatch on later arguments use this too,
+  ;; but those lookups aren't calls.
+  (let* ((stats (%gf-dispatch-table-stats dt)))
+    (when (and stats (not (combined-method-p (%gf-dispatch-table-gf dt))))
+      (atomic-incf (gf-dispatch-stats.calls stats))))
   (if (listp args)
     (let* ((args-len (list-length args))
            (argnum (%gf-dispatch-table-argnum dt)))
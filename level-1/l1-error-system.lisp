@@ -185,6 +185,23 @@
     (when instruction
       (format s "~&Faulting instruction: ~s" instruction))))
 
+;;; A write to an object that PURIFY-OBJECT has made immutable.
+(define-condition write-to-immutable-object (storage-condition)
+  ((object :initform nil :initarg :object
+	   :reader write-to-immutable-object-object)
+   (offset :initarg :offset
+	   :reader write-to-immutable-object-offset)
+   (instruction :initarg :instruction
+		:reader write-to-immutable-object-instruction))
+  (:report (lambda (c s)
+             (with-slots (object offset instruction) c
+               (let* ((*print-length* 10)
+                      (*print-level* 3))
+                 (format s "Write to immutable object ~s at byte offset ~s"
+                         object offset))
+               (when instruction
+                 (format s "~&Faulting instruction: ~s" instruction))))))
+
 (define-condition allocation-disabled (storage-condition)
   ()
   (:report (lambda (c s) (declare (ignore c)) (format s "Attempt to heap-allocate a lisp object when heap allocation is disabled."))))
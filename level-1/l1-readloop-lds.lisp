@@ -448,7 +448,8 @@ commands but aren't")
         (fresh-line stream)
         (format stream *listener-prompt-format* *break-level*))
       (setq *last-break-level* *break-level*)))
-    (force-output stream))
+    (force-output stream)
+    (note-image-ready))
 
 
 ;;; Fairly crude default error-handlingbehavior, and a fairly crude mechanism
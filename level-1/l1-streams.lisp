@@ -458,7 +458,11 @@
   (encode-literal-char-code-limit 256)
   (input-timeout nil)			;in milliseconds
   (output-timeout nil)			;in milliseconds
-  (deadline nil))
+  (deadline nil)
+  (io-backend nil)                      ;does fd I/O, if not fd-read/fd-write
+  (write-vector-function nil)           ;writes outbuf and an ivector, if any
+  (read-vector-function nil)            ;reads into an ivector, if any
+  (full-flushes 0 :type fixnum))        ;consecutive flushes of a full outbuf
 
 
 ;;; Functions on ioblocks.  So far, we aren't saying anything
@@ -1434,6 +1438,7 @@
 (defun %ioblock-out-ivect (ioblock ivector start-octet num-octets)
   (unless (= 0 (the fixnum (ioblock-element-shift ioblock)))
     (error "Can't write vector to stream ~s" (ioblock-stream ioblock)))
+  (%ioblock-maybe-grow-outbuf ioblock)
   (let* ((written 0)
 	 (out (ioblock-outbuf ioblock)))
     (declare (fixnum written))
@@ -1961,22 +1966,48 @@
   (declare (fixnum start-char num-chars)
            (simple-base-string string)
            (optimize (speed 3) (safety 0)))
-  (do* ((i 0 (1+ i))
+  (do* ((end (+ start-char num-chars))
         (col (ioblock-charpos ioblock))
         (limit (ioblock-encode-literal-char-code-limit ioblock))
         (encode-function (ioblock-encode-output-function ioblock))
-        (start-char start-char (1+ start-char)))
-       ((= i num-chars) (setf (ioblock-charpos ioblock) col) num-chars)
-    (declare (fixnum i start-char limit))
+        (outbuf (ioblock-outbuf ioblock)))
+       ((= start-char end) (setf (ioblock-charpos ioblock) col) num-chars)
+    (declare (fixnum end col limit))
     (let* ((char (schar string start-char))
            (code (char-code char)))
       (declare (type (mod #x110000) code))
-      (if (eq char #\newline)
-        (setq col 0)
-        (incf col))
-      (if (< code limit)
-        (%ioblock-write-u8-element ioblock code)
-        (funcall encode-function char #'%ioblock-write-u8-element ioblock)))))
+      (if (< code #x80)
+        ;; Copy as much of this run of ASCII characters as fits in
+        ;; the output buffer.
+        (let* ((idx (io-buffer-idx outbuf))
+               (room (- (the fixnum (io-buffer-limit outbuf)) idx)))
+          (declare (fixnum idx room))
+          (when (zerop room)
+            (%ioblock-force-output ioblock nil)
+            (setq idx (io-buffer-idx outbuf)
+                  room (- (the fixnum (io-buffer-limit outbuf)) idx)))
+          (let* ((n (%narrow-ascii-string string start-char
+                                          (io-buffer-buffer outbuf) idx
+                                          (min room (- end start-char))))
+                 (newidx (+ idx n))
+                 (runend (+ start-char n)))
+            (declare (fixnum n newidx runend))
+            (setf (io-buffer-idx outbuf) newidx)
+            (when (> newidx (the fixnum (io-buffer-count outbuf)))
+              (setf (io-buffer-count outbuf) newidx))
+            (setf (ioblock-dirty ioblock) t)
+            (do* ((j (1- runend) (1- j)))
+                 ((< j start-char) (incf col n))
+              (declare (fixnum j))
+              (when (eq (schar string j) #\newline)
+                (return (setq col (- runend j 1)))))
+            (setq start-char runend)))
+        (progn
+          (incf col)
+          (if (< code limit)
+            (%ioblock-write-u8-element ioblock code)
+            (funcall encode-function char #'%ioblock-write-u8-element ioblock))
+          (incf start-char))))))
 
 
 (declaim (inline %ioblock-write-u16-encoded-char))
@@ -2406,6 +2437,121 @@
         (setf (schar str pos) ch
               pos (1+ pos))))))
 	 
+;;; Decode the UTF-8 encoded octets in V between START and END, returning
+;;; a string of exactly the right length, or NIL if they're not all
+;;; well-formed (so that the caller can report the problem the way that
+;;; it usually would.)
+(defun %utf-8-octets-to-string (v start end)
+  (declare (optimize (speed 3) (safety 0))
+           (fixnum start end)
+           (type (simple-array (unsigned-byte 8) (*)) v))
+  (let* ((nchars 0))
+    (declare (fixnum nchars))
+    (flet ((continuation-p (i)
+             (declare (fixnum i))
+             (and (< i end)
+                  (< (the fixnum (logxor (aref v i) #x80)) #x40))))
+      (declare (inline continuation-p))
+      ;; Make sure that everything's well-formed, and count characters.
+      (do* ((i start))
+           ((= i end))
+        (declare (fixnum i))
+        (let* ((1st-unit (aref v i)))
+          (declare (type (unsigned-byte 8) 1st-unit))
+          (cond ((< 1st-unit #x80) (incf i))
+                ((< 1st-unit #xc2) (return-from %utf-8-octets-to-string nil))
+                ((< 1st-unit #xe0)
+                 (unless (continuation-p (1+ i))
+                   (return-from %utf-8-octets-to-string nil))
+                 (incf i 2))
+                ((< 1st-unit #xf0)
+                 (unless (and (continuation-p (1+ i))
+                              (continuation-p (+ i 2))
+                              (or (>= 1st-unit #xe1)
+                                  (>= (aref v (1+ i)) #xa0))
+                              ;; No surrogates
+                              (or (/= 1st-unit #xed)
+                                  (< (aref v (1+ i)) #xa0)))
+                   (return-from %utf-8-octets-to-string nil))
+                 (incf i 3))
+                ((< 1st-unit #xf5)
+                 (unless (and (continuation-p (1+ i))
+                              (continuation-p (+ i 2))
+                              (continuation-p (+ i 3))
+                              (or (>= 1st-unit #xf1)
+                                  (>= (aref v (1+ i)) #x90))
+                              (or (< 1st-unit #xf4)
+                                  (< (aref v (1+ i)) #x90)))
+                   (return-from %utf-8-octets-to-string nil))
+                 (incf i 4))
+                (t (return-from %utf-8-octets-to-string nil))))
+        (incf nchars)))
+    (let* ((string (make-string nchars)))
+      (do* ((i start)
+            (j 0 (1+ j)))
+           ((= i end) string)
+        (declare (fixnum i j))
+        (let* ((1st-unit (aref v i)))
+          (declare (type (unsigned-byte 8) 1st-unit))
+          (setf (%scharcode string j)
+                (cond ((< 1st-unit #x80)
+                       (incf i)
+                       1st-unit)
+                      ((< 1st-unit #xe0)
+                       (prog1
+                           (logior (ash (logand 1st-unit #x1f) 6)
+                                   (logand (aref v (1+ i)) #x3f))
+                         (incf i 2)))
+                      ((< 1st-unit #xf0)
+                       (prog1
+                           (logior (ash (logand 1st-unit #xf) 12)
+                                   (ash (logand (aref v (1+ i)) #x3f) 6)
+                                   (logand (aref v (+ i 2)) #x3f))
+                         (incf i 3)))
+                      (t
+                       (prog1
+                           (logior (ash (logand 1st-unit 7) 18)
+                                   (ash (logand (aref v (1+ i)) #x3f) 12)
+                                   (ash (logand (aref v (+ i 2)) #x3f) 6)
+                                   (logand (aref v (+ i 3)) #x3f))
+                         (incf i 4))))))))))
+
+;;; READ-LINE for 8-bit encodings in which a linefeed octet always
+;;; encodes #\Newline and is never part of the encoding of another
+;;; character (UTF-8, ISO-8859-1 and US-ASCII), when there's no line
+;;; termination translation.  If the line ends in the input buffer,
+;;; find its end 8 octets at a time and decode the whole line at once;
+;;; otherwise (or if the line can't be decoded without complaint), do
+;;; it a character at a time.
+(defun %ioblock-u8-encoded-read-line (ioblock)
+  (declare (optimize (speed 3) (safety 0)))
+  (let* ((inbuf (ioblock-inbuf ioblock)))
+    (unless (ioblock-untyi-char ioblock)
+      (when (= (the fixnum (io-buffer-idx inbuf)) (the fixnum (io-buffer-count inbuf)))
+        (%ioblock-advance ioblock t))
+      (let* ((buf (io-buffer-buffer inbuf))
+             (idx (io-buffer-idx inbuf))
+             (count (io-buffer-count inbuf)))
+        (declare (fixnum idx count)
+                 (type (simple-array (unsigned-byte 8) (*)) buf))
+        (when (< idx count)
+          (let* ((end (%find-linefeed-octet buf idx count)))
+            (when end
+              (let* ((n (- (the fixnum end) idx))
+                     (string
+                      (if (or (eql (ioblock-decode-literal-code-unit-limit ioblock) 256)
+                              (= (the fixnum (%skip-ascii-octets buf idx end))
+                                 (the fixnum end)))
+                        (%copy-u8-to-string buf idx (make-string n) 0 n)
+                        (if (eq (character-encoding-name (ioblock-encoding ioblock)) :utf-8)
+                          (%utf-8-octets-to-string buf idx end)))))
+                (declare (fixnum n))
+                (when string
+                  (setf (io-buffer-idx inbuf) (the fixnum (1+ (the fixnum end))))
+                  (return-from %ioblock-u8-encoded-read-line
+                    (values string nil)))))))))
+    (%ioblock-encoded-read-line ioblock)))
+
 (defun %ioblock-unencoded-character-read-vector (ioblock vector start end)
   (do* ((i start)
         (in (ioblock-inbuf ioblock))
@@ -2443,6 +2589,40 @@
 	(return i))
       (setf (schar vector i) ch))))
 
+;;; For the same encodings as %IOBLOCK-U8-ENCODED-READ-LINE: copy runs
+;;; of ASCII octets straight out of the input buffer, and decode
+;;; anything else a character at a time.
+(defun %ioblock-u8-encoded-character-read-vector (ioblock vector start end)
+  (declare (fixnum start end)
+           (optimize (speed 3) (safety 0)))
+  (do* ((i start)
+        (in (ioblock-inbuf ioblock))
+        (rcf (ioblock-read-char-when-locked-function ioblock)))
+       ((= i end) end)
+    (declare (fixnum i))
+    (let* ((idx (io-buffer-idx in))
+           (count (io-buffer-count in))
+           (n 0))
+      (declare (fixnum idx count n))
+      (when (and (< idx count)
+                 (null (ioblock-untyi-char ioblock)))
+        (setq n (%widen-ascii-octets (io-buffer-buffer in) idx vector i
+                                     (min (- count idx) (- end i))))
+        (setf (io-buffer-idx in) (+ idx n))
+        (incf i n))
+      (when (and (zerop n) (< i end))
+        (let* ((ch (funcall rcf ioblock)))
+          (if (eq ch :eof)
+            (return i))
+          (setf (schar vector i) ch)
+          (incf i))))))
+
+
+;;; The function that reads from IOBLOCK's device straight into an
+;;; ivector, if there is one and it can be used now.
+(defun %ioblock-direct-read-function (ioblock)
+  (and (null (ioblock-io-backend ioblock))
+       (ioblock-read-vector-function ioblock)))
 
 (defun %ioblock-binary-read-vector (ioblock vector start end)
   (declare (fixnum start end))
@@ -2460,9 +2640,25 @@
 	    (return i)
 	    (setf (uvref vector i) b))))
       (do* ((i start)
-	    (need (- end start)))
+	    (need (- end start))
+            (direct (%ioblock-direct-read-function ioblock)))
 	   ((= i end) end)
 	(declare (fixnum i need))
+        ;; Once the buffer's drained, read big requests straight into
+        ;; VECTOR.
+        (when (and direct
+                   (>= need (the fixnum (io-buffer-limit in)))
+                   (= (the fixnum (io-buffer-idx in))
+                      (the fixnum (io-buffer-count in))))
+          (return
+            (+ i (ioblock-octets-to-elements
+                  ioblock
+                  (funcall direct
+                           (ioblock-stream ioblock)
+                           ioblock
+                           vector
+                           (ioblock-elements-to-octets ioblock i)
+                           (ioblock-elements-to-octets ioblock need))))))
 	(let* ((b (funcall rbf ioblock)))
 	  (if (eq b :eof)
 	    (return i))
@@ -2532,9 +2728,16 @@
 	(in (ioblock-inbuf ioblock))
 	(inbuf (io-buffer-buffer in))
 	(need nb)
-	(end (+ start nb)))
+	(end (+ start nb))
+        (direct (%ioblock-direct-read-function ioblock)))
        ((= i end) nb)
     (declare (fixnum i end need))
+    (when (and direct
+               (>= need (the fixnum (io-buffer-limit in)))
+               (= (the fixnum (io-buffer-idx in))
+                  (the fixnum (io-buffer-count in))))
+      (return (+ (- i start)
+                 (the fixnum (funcall direct (ioblock-stream ioblock) ioblock vector i need)))))
     (let* ((b (funcall rbf ioblock)))
       (if (eq b :eof)
 	(return (- i start)))
@@ -2752,10 +2955,16 @@
     (if (and encoding (not (eq encoding :inferred)))
       (let* ((unit-size (character-encoding-code-unit-size encoding)))
         (setf (ioblock-peek-char-function ioblock) '%encoded-ioblock-peek-char)
-        (setf (ioblock-read-line-function ioblock)
-              '%ioblock-encoded-read-line)
-        (setf (ioblock-character-read-vector-function ioblock)
-              '%ioblock-encoded-character-read-vector)        
+        (if (member (character-encoding-name encoding)
+                    '(:utf-8 :iso-8859-1 :us-ascii))
+          (setf (ioblock-read-line-function ioblock)
+                '%ioblock-u8-encoded-read-line
+                (ioblock-character-read-vector-function ioblock)
+                '%ioblock-u8-encoded-character-read-vector)
+          (setf (ioblock-read-line-function ioblock)
+                '%ioblock-encoded-read-line
+                (ioblock-character-read-vector-function ioblock)
+                '%ioblock-encoded-character-read-vector))
         (setf (ioblock-decode-input-function ioblock)
               (character-encoding-stream-decode-function encoding))
         (setf (ioblock-read-char-function ioblock)
@@ -3143,6 +3352,8 @@
                             eofp-function
                             force-output-function
                             close-function
+                            write-vector-function
+                            read-vector-function
                             element-shift
                             interactive
                             (sharing :private)
@@ -3256,6 +3467,10 @@
       (setf (ioblock-force-output-function ioblock) force-output-function))
     (when close-function
       (setf (ioblock-close-function ioblock) close-function))
+    (when write-vector-function
+      (setf (ioblock-write-vector-function ioblock) write-vector-function))
+    (when read-vector-function
+      (setf (ioblock-read-vector-function ioblock) read-vector-function))
     (when interactive
       (setf (ioblock-interactive ioblock) interactive))
     (setf (stream-ioblock stream) ioblock)
@@ -3466,6 +3681,16 @@
                                  :force-output-function (if out-p
                                                           (select-stream-force-output-function class direction))
                                  :close-function 'fd-stream-close
+                                 :write-vector-function
+                                 #-windows-target
+                                 (if (and out-p (eq (%unix-fd-kind fd) :socket))
+                                   'fd-stream-write-vector)
+                                 #+windows-target nil
+                                 :read-vector-function
+                                 #-windows-target
+                                 (if (and in-p (eq (%unix-fd-kind fd) :socket))
+                                   'fd-stream-read-vector)
+                                 #+windows-target nil
                                  :sharing sharing
                                  :character-p character-p
                                  :encoding encoding
@@ -5185,6 +5410,7 @@
 				string &optional (start 0 start-p) end)
 				
   (with-stream-ioblock-output (ioblock stream :speedy t)
+    (%ioblock-maybe-grow-outbuf ioblock)
     (if (and (typep string 'simple-string)
 	     (not start-p))
       (funcall (ioblock-write-simple-string-function ioblock)
@@ -5208,6 +5434,7 @@
 
   (let* ((ioblock (basic-stream-ioblock stream)))
     (with-ioblock-output-locked (ioblock) 
+      (%ioblock-maybe-grow-outbuf ioblock)
       (if (and (typep string 'simple-string)
                (not start-p))
         (values
@@ -5292,6 +5519,7 @@
 (defun %ioblock-binary-stream-write-vector (ioblock vector start end)
   (declare (fixnum start end))
   (declare (optimize (safety 3)))
+  (%ioblock-maybe-grow-outbuf ioblock)
   (let* ((out (ioblock-outbuf ioblock))
          (written 0)
          (total (- end start))
@@ -5312,36 +5540,51 @@
             (if (characterp byte)
               (funcall wcf ioblock byte)
               (funcall wbf ioblock byte)))))
-      (do* ((pos start (+ pos written))
-            (left total (- left written)))
-           ((= left 0))
-        (declare (fixnum pos left))
-        (setf (ioblock-dirty ioblock) t)
-        (let* ((index (io-buffer-idx out))
-               (count (io-buffer-count out))
-               (limit (io-buffer-limit out))
-               (buf (io-buffer-buffer out))
-               (avail (- limit index)))
-          (declare (fixnum index avail count limit))
-          (cond
-            ((= (setq written avail) 0)
-             (%ioblock-force-output ioblock nil))
-            (t
-             (if (> written left)
-               (setq written left))
-             (%copy-ivector-to-ivector
-              vector
-              (ioblock-elements-to-octets ioblock pos)
-              buf
-              (ioblock-elements-to-octets ioblock index)
-              (ioblock-elements-to-octets ioblock written))
-             (setf (ioblock-dirty ioblock) t)
-             (incf index written)
-             (if (> index count)
-               (setf (io-buffer-count out) index))
-             (setf (io-buffer-idx out) index)
-             (if (= index  limit)
-               (%ioblock-force-output ioblock nil)))))))))
+      (let* ((write-vector (ioblock-write-vector-function ioblock)))
+        ;; A vector that's at least as big as the buffer goes straight
+        ;; to the device, along with whatever's buffered, if the device
+        ;; can do that.
+        (if (and write-vector
+                 (>= total (the fixnum (io-buffer-limit out)))
+                 (= (the fixnum (io-buffer-idx out))
+                    (the fixnum (io-buffer-count out)))
+                 (null (ioblock-io-backend ioblock)))
+          (funcall write-vector
+                   (ioblock-stream ioblock)
+                   ioblock
+                   vector
+                   (ioblock-elements-to-octets ioblock start)
+                   (ioblock-elements-to-octets ioblock total))
+          (do* ((pos start (+ pos written))
+                (left total (- left written)))
+               ((= left 0))
+            (declare (fixnum pos left))
+            (setf (ioblock-dirty ioblock) t)
+            (let* ((index (io-buffer-idx out))
+                   (count (io-buffer-count out))
+                   (limit (io-buffer-limit out))
+                   (buf (io-buffer-buffer out))
+                   (avail (- limit index)))
+              (declare (fixnum index avail count limit))
+              (cond
+                ((= (setq written avail) 0)
+                 (%ioblock-force-output ioblock nil))
+                (t
+                 (if (> written left)
+                   (setq written left))
+                 (%copy-ivector-to-ivector
+                  vector
+                  (ioblock-elements-to-octets ioblock pos)
+                  buf
+                  (ioblock-elements-to-octets ioblock index)
+                  (ioblock-elements-to-octets ioblock written))
+                 (setf (ioblock-dirty ioblock) t)
+                 (incf index written)
+                 (if (> index count)
+                   (setf (io-buffer-count out) index))
+                 (setf (io-buffer-idx out) index)
+                 (if (= index  limit)
+                   (%ioblock-force-output ioblock nil)))))))))))
 
 (defmethod stream-write-vector ((stream buffered-binary-output-stream-mixin)
 				vector start end)
@@ -5438,7 +5681,7 @@
   #+windows-target t
   #-windows-target
   (if (logtest #$O_NONBLOCK (the fixnum (fd-get-flags fd)))
-    (process-input-wait fd)
+    (fd-stream-wait fd :input nil)
     (- #$ETIMEDOUT)))
     
 (defun process-input-wait (fd &optional timeout)
@@ -5473,7 +5716,7 @@
   #+windows-target t
   #-windows-target
   (if (logtest #$O_NONBLOCK (the fixnum (fd-get-flags fd)))
-    (process-output-wait fd)
+    (fd-stream-wait fd :output nil)
     (- #$ETIMEDOUT)))
 
 (defun process-output-wait (fd &optional timeout)
@@ -5581,6 +5824,36 @@
 
 
 
+;;; If non-NIL, a function of (FD DIRECTION TIMEOUT) that FD-streams
+;;; (and WITH-EAGAIN, on non-blocking fds) call to wait until FD is
+;;; ready for input or output, in place of
+;;; PROCESS-INPUT-WAIT or PROCESS-OUTPUT-WAIT (and returning the same
+;;; values).  When it's set, FD-STREAM-ADVANCE waits through it before
+;;; every blocking read, even if the stream has no input timeout, so
+;;; that an idle connection doesn't tie up a thread in read(2).  The
+;;; epoll reactor in library/reactor.lisp installs one.
+(defvar *fd-stream-wait-function* nil)
+
+;;; If non-NIL, a function of one argument that FD-STREAM-CLOSE calls
+;;; with the stream's fd just before closing it, so that whatever
+;;; *FD-STREAM-WAIT-FUNCTION* waits with can forget about the fd.
+(defvar *fd-stream-close-function* nil)
+
+(defun fd-stream-wait (fd direction timeout)
+  (let* ((f *fd-stream-wait-function*))
+    (if f
+      (funcall f fd direction timeout)
+      (if (eq direction :input)
+        (process-input-wait fd timeout)
+        (process-output-wait fd timeout)))))
+
+;;; An FD-stream's ioblock can have an IO-BACKEND, which does the
+;;; stream's reads and writes in place of FD-READ and FD-WRITE (and
+;;; returns the same values).  See library/io-uring.lisp.
+(defgeneric io-backend-read (backend ioblock fd bufptr octets))
+(defgeneric io-backend-write (backend ioblock fd bufptr octets))
+(defgeneric io-backend-close (backend ioblock))
+
 ;;; FD-streams, built on top of the ioblock mechanism.
 (defclass fd-stream (buffered-stream-mixin fundamental-stream) ())
 
@@ -5651,6 +5924,24 @@
 (defclass fd-binary-io-stream (fd-io-stream buffered-binary-io-stream-mixin)
     ())
 
+;;; Wait until FD has input, or until the stream's input timeout or
+;;; deadline passes, in which case signal an error.
+(defun fd-stream-wait-for-input (s ioblock fd)
+  (let* ((deadline (ioblock-deadline ioblock))
+         (timeout
+          (if deadline
+            (milliseconds-until-deadline deadline ioblock)
+            (ioblock-input-timeout ioblock))))
+    (multiple-value-bind (win timedout error)
+        (fd-stream-wait fd :input timeout)
+      (unless win
+        (if timedout
+          (error (if deadline
+                   'communication-deadline-expired
+                   'input-timeout)
+                 :stream s)
+          (stream-io-error s (- error) "read"))))))
+
 (defun fd-stream-advance (s ioblock read-p)
   (let* ((fd (ioblock-device ioblock))
          (buf (ioblock-inbuf ioblock))
@@ -5662,23 +5953,15 @@
           (ioblock-eof ioblock) nil)
       (when (or read-p (setq avail (fd-input-available-p fd 0)))
         (unless avail
-          (let* ((deadline (ioblock-deadline ioblock))
-                 (timeout
-                  (if deadline
-                    (milliseconds-until-deadline deadline ioblock)
-                    (ioblock-input-timeout ioblock))))
-            (when timeout
-              (multiple-value-bind (win timedout error)
-                  (process-input-wait fd timeout)
-                (unless win
-                  (if timedout
-                    (error (if deadline
-                             'communication-deadline-expired
-                             'input-timeout)
-                           :stream s)
-                    (stream-io-error s (- error) "read")))))))
-        (let* ((n (with-eagain fd :input
-		    (fd-read fd bufptr size))))
+          (when (or (ioblock-deadline ioblock)
+                    (ioblock-input-timeout ioblock)
+                    *fd-stream-wait-function*)
+            (fd-stream-wait-for-input s ioblock fd)))
+        (let* ((backend (ioblock-io-backend ioblock))
+               (n (with-eagain fd :input
+                    (if backend
+                      (io-backend-read backend ioblock fd bufptr size)
+                      (fd-read fd bufptr size)))))
           (declare (fixnum n))
           (if (< n 0)
             (stream-io-error s (- n) "read")
@@ -5701,10 +5984,73 @@
   (cancel-terminate-when-unreachable s)
   (when (ioblock-dirty ioblock)
     (stream-force-output s))
+  (let* ((backend (ioblock-io-backend ioblock)))
+    (when backend
+      (setf (ioblock-io-backend ioblock) nil)
+      (io-backend-close backend ioblock)))
   (let* ((fd (ioblock-device ioblock)))
     (when fd
       (setf (ioblock-device ioblock) nil)
-      (if (>= fd 0) (fd-close fd)))))
+      (when (>= fd 0)
+        (let* ((f *fd-stream-close-function*))
+          (when f (funcall f fd)))
+        (fd-close fd)))))
+
+;;; If the stream has an output timeout or deadline, wait until FD is
+;;; writable or signal an error.  Returns true if it waited.
+(defun fd-stream-wait-for-output (s ioblock fd)
+  (let* ((deadline (ioblock-deadline ioblock))
+         (timeout
+          (if deadline
+            (milliseconds-until-deadline deadline ioblock)
+            (ioblock-output-timeout ioblock))))
+    (when timeout
+      (multiple-value-bind (win timedout error)
+          (fd-stream-wait fd :output timeout)
+        (unless win
+          (if timedout
+            (error (if deadline
+                     'communication-deadline-expired
+                     'output-timeout)
+                   :stream s)
+            (stream-io-error s (- error) "write"))))
+      t)))
+
+(defparameter *max-output-buffer-octets* (ash 1 18)
+  "The size that an FD-stream's output buffer can grow to when the
+stream keeps filling it.")
+
+;;; A stream that keeps filling its output buffer gets a bigger one,
+;;; so that it makes fewer and larger writes.  COUNT is the number of
+;;; elements that were just written.  The buffer isn't replaced here:
+;;; element writers hold on to it across a force-output.
+(defun %ioblock-note-output-flush (ioblock count)
+  (declare (fixnum count))
+  (if (< count (the fixnum (io-buffer-limit (ioblock-outbuf ioblock))))
+    (setf (ioblock-full-flushes ioblock) 0)
+    (incf (ioblock-full-flushes ioblock))))
+
+;;; Called at the start of sequence writes, where nothing refers to the
+;;; output buffer yet: replace an empty buffer that's been filled four
+;;; times running with one that's twice as big.
+(defun %ioblock-maybe-grow-outbuf (ioblock)
+  (let* ((outbuf (ioblock-outbuf ioblock)))
+    (when (and (>= (the fixnum (ioblock-full-flushes ioblock)) 4)
+               (eql 0 (io-buffer-count outbuf))
+               (< (io-buffer-size outbuf) *max-output-buffer-octets*)
+               (null (ioblock-io-backend ioblock))
+               (not (eq outbuf (ioblock-inbuf ioblock))))
+      (setf (ioblock-full-flushes ioblock) 0)
+      (let* ((old (io-buffer-buffer outbuf))
+             (limit (* 2 (io-buffer-limit outbuf))))
+        (multiple-value-bind (buffer ptr size)
+            (make-heap-ivector limit (array-element-type old))
+          (setf (io-buffer-buffer outbuf) buffer
+                (io-buffer-bufptr outbuf) ptr
+                (io-buffer-size outbuf) size
+                (io-buffer-limit outbuf) limit
+                (io-buffer-idx outbuf) 0)
+          (%dispose-heap-ivector old))))))
 
 (defun fd-stream-force-output (s ioblock count finish-p)
   (when (or (ioblock-dirty ioblock) finish-p)
@@ -5724,24 +6070,14 @@
 	    (when finish-p
 	      (case (%unix-fd-kind fd)
 		(:file (fd-fsync fd))))
+            (%ioblock-note-output-flush ioblock count)
 	    octets-to-write)
-        (let* ((deadline (ioblock-deadline ioblock))
-               (timeout
-                (if deadline
-                  (milliseconds-until-deadline deadline ioblock)
-                  (ioblock-output-timeout ioblock))))
-          (when timeout
-            (multiple-value-bind (win timedout error)
-                (process-output-wait fd timeout)
-              (unless win
-                (if timedout
-                  (error (if deadline
-                           'communication-deadline-expired
-                           'output-timeout)
-                         :stream s)
-                  (stream-io-error s (- error) "write"))))))
-	(let* ((written (with-eagain fd :output
-			  (fd-write fd buf octets))))
+        (fd-stream-wait-for-output s ioblock fd)
+	(let* ((backend (ioblock-io-backend ioblock))
+               (written (with-eagain fd :output
+                          (if backend
+                            (io-backend-write backend ioblock fd buf octets)
+                            (fd-write fd buf octets)))))
 	  (declare (fixnum written))
 	  (if (< written 0)
 	    (stream-io-error s (- written) "write"))
@@ -5749,6 +6085,97 @@
 	  (unless (zerop octets)
 	    (%incf-ptr buf written)))))))
 
+
+;;; Send IOBLOCK's buffered output and then NUM-OCTETS octets of
+;;; IVECTOR, starting at START-OCTET, to its socket with sendmsg(2),
+;;; so that a large vector isn't copied through the buffer.  The GC
+;;; can't run while the kernel's reading IVECTOR, so the sends don't
+;;; block: when the socket's full, wait (with the GC enabled) and try
+;;; again.
+#-windows-target
+(defun fd-stream-write-vector (s ioblock ivector start-octet num-octets)
+  (declare (fixnum start-octet num-octets))
+  (let* ((fd (ioblock-device ioblock))
+         (outbuf (ioblock-outbuf ioblock))
+         (bufptr (io-buffer-bufptr outbuf))
+         (buffered (ioblock-elements-to-octets ioblock (io-buffer-count outbuf)))
+         (bufstart 0))
+    (declare (fixnum buffered bufstart))
+    (setf (ioblock-dirty ioblock) nil
+          (io-buffer-idx outbuf) 0
+          (io-buffer-count outbuf) 0)
+    (loop
+      (when (and (zerop buffered) (zerop num-octets))
+        (return))
+      (let* ((n (%stack-block ((iov (* 2 (record-length :iovec)))
+                               (msg (record-length :msghdr)))
+                  (#_memset msg 0 (record-length :msghdr))
+                  (let* ((niov 0))
+                    (declare (fixnum niov))
+                    (when (> buffered 0)
+                      (setf (pref iov :iovec.iov_base) (%inc-ptr bufptr bufstart)
+                            (pref iov :iovec.iov_len) buffered)
+                      (incf niov))
+                    (with-macptrs ((v (%inc-ptr iov (* niov (record-length :iovec)))))
+                      (when (> num-octets 0)
+                        (setf (pref v :iovec.iov_len) num-octets)
+                        (incf niov))
+                      (setf (pref msg :msghdr.msg_iov) iov
+                            (pref msg :msghdr.msg_iovlen) niov)
+                      ;; Don't cons while the GC's disabled.
+                      (with-pointer-to-ivector (p ivector)
+                        (%incf-ptr p start-octet)
+                        (setf (pref v :iovec.iov_base) p)
+                        (int-errno-call (#_sendmsg fd msg #$MSG_DONTWAIT))))))))
+        (declare (fixnum n))
+        (cond ((eql n (- #$EAGAIN))
+               (unless (fd-stream-wait-for-output s ioblock fd)
+                 (multiple-value-bind (win timedout error)
+                     (fd-stream-wait fd :output nil)
+                   (declare (ignore timedout))
+                   (unless win
+                     (stream-io-error s (- error) "write")))))
+              ((eql n (- #$EINTR)))
+              ((< n 0)
+               (stream-io-error s (- n) "write"))
+              (t
+               (let* ((k (min n buffered)))
+                 (declare (fixnum k))
+                 (decf buffered k)
+                 (incf bufstart k)
+                 (decf n k))
+               (incf start-octet n)
+               (decf num-octets n)))))))
+
+;;; Read NUM-OCTETS octets (fewer at EOF) from IOBLOCK's socket into
+;;; IVECTOR, starting at START-OCTET, without going through the input
+;;; buffer, which is empty.  As in FD-STREAM-WRITE-VECTOR, the reads
+;;; don't block while the GC's disabled.  Returns the number of octets
+;;; read.
+#-windows-target
+(defun fd-stream-read-vector (s ioblock ivector start-octet num-octets)
+  (declare (fixnum start-octet num-octets))
+  (let* ((fd (ioblock-device ioblock))
+         (total 0))
+    (declare (fixnum total))
+    (loop
+      (when (= total num-octets)
+        (return total))
+      (let* ((n (with-pointer-to-ivector (p ivector)
+                  (%incf-ptr p (+ start-octet total))
+                  (int-errno-call
+                   (#_recv fd p (- num-octets total) #$MSG_DONTWAIT)))))
+        (declare (fixnum n))
+        (cond ((eql n (- #$EAGAIN))
+               (fd-stream-wait-for-input s ioblock fd))
+              ((eql n (- #$EINTR)))
+              ((< n 0)
+               (stream-io-error s (- n) "read"))
+              ((= n 0)
+               (setf (ioblock-eof ioblock) t)
+               (return total))
+              (t (incf total n)))))))
+
 (defmethod stream-read-line ((s buffered-input-stream-mixin))
    (with-stream-ioblock-input (ioblock s :speedy t)
      (funcall (ioblock-read-line-function ioblock) ioblock)))
@@ -5876,7 +6303,8 @@
                       (external-format :default)
 		      (class 'file-stream)
                       (sharing :private)
-                      (basic t))
+                      (basic t)
+                      (mmap nil))
   "Return a stream which reads from or writes to FILENAME.
   Defined keywords:
    :DIRECTION - one of :INPUT, :OUTPUT, :IO, or :PROBE
@@ -5884,6 +6312,9 @@
    :IF-EXISTS - one of :ERROR, :NEW-VERSION, :RENAME, :RENAME-AND-DELETE,
                        :OVERWRITE, :APPEND, :SUPERSEDE or NIL
    :IF-DOES-NOT-EXIST - one of :ERROR, :CREATE or NIL
+   :MMAP - if true, an :INPUT stream of octets (or of characters in an
+           encoding with 8-bit code units) on a regular file reads from a
+           window of the file mapped into memory, not from read(2)
   See the manual for details."
   (loop
     (restart-case
@@ -5896,7 +6327,8 @@
 			  class
 			  external-format
                           sharing
-                          basic))
+                          basic
+                          mmap))
       (retry-open ()
                   :report (lambda (stream) (format stream "Retry opening ~s" filename))
                   nil))))
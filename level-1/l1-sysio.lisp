@@ -19,6 +19,8 @@
 (defstruct (file-ioblock (:include ioblock))
   (octet-pos 0 )                       ; current io position in octets
   (fileeof 0 )                          ; file length in elements
+  (mapping nil)                         ; base of mmapped region, if :mmap
+  (mapping-size 0)                      ; size of that region in octets
   )
 
 
@@ -520,6 +522,38 @@ is :UNIX.")
     (setf (file-ioblock-octet-pos file-ioblock) newpos)
     (fd-stream-advance stream file-ioblock read-p)))
 
+;;; Read NUM-OCTETS octets (fewer at EOF) from the file into IVECTOR,
+;;; starting at START-OCTET, without going through the (empty) input
+;;; buffer.  The GC's disabled during each read(2), so this is only
+;;; used on regular files, and the reads are done in pieces.  Returns
+;;; the number of octets read.
+(defun input-file-read-vector (stream file-ioblock ivector start-octet num-octets)
+  (declare (fixnum start-octet num-octets))
+  (let* ((fd (file-ioblock-device file-ioblock))
+         (inbuf (file-ioblock-inbuf file-ioblock))
+         (total 0))
+    (declare (fixnum total))
+    ;; Account for the buffer as the advance function would.
+    (incf (file-ioblock-octet-pos file-ioblock)
+          (ioblock-elements-to-octets file-ioblock (io-buffer-count inbuf)))
+    (setf (io-buffer-idx inbuf) 0
+          (io-buffer-count inbuf) 0)
+    (loop
+      (when (= total num-octets)
+        (return))
+      (let* ((n (with-pointer-to-ivector (p ivector)
+                  (%incf-ptr p (+ start-octet total))
+                  (fd-read fd p (min (- num-octets total) (ash 1 24))))))
+        (declare (fixnum n))
+        (cond ((< n 0)
+               (stream-io-error stream (- n) "read"))
+              ((= n 0)
+               (setf (file-ioblock-eof file-ioblock) t)
+               (return))
+              (t (incf total n)))))
+    (incf (file-ioblock-octet-pos file-ioblock) total)
+    total))
+
 ;;; If the buffer's dirty, we have to back up and rewrite it before
 ;;; reading in a new buffer.
 (defun io-file-ioblock-advance (stream file-ioblock read-p)
@@ -745,7 +779,9 @@ is :UNIX.")
                     (funcall (character-encoding-character-size-in-octets-function encoding) char)
                     1)))
     (declare (fixnum idx noctets))
-    (if (>= idx noctets)
+    ;; A mapped buffer's origin can be before the start of the file.
+    (if (and (>= idx noctets)
+             (>= (+ (file-ioblock-octet-pos ioblock) idx) noctets))
       (setf (io-buffer-idx inbuf) (the fixnum (- idx noctets)))
       (let* ((stream (ioblock-stream ioblock))
              (pos (stream-position stream))
@@ -765,7 +801,8 @@ is :UNIX.")
 			 class
 			 external-format
                          sharing
-                         basic)
+                         basic
+                         &optional mmap)
   (let* ((temp-name nil)
          (created nil)
          (dir (pathname-directory filename))
@@ -869,6 +906,13 @@ is :UNIX.")
                                  :direction direction
                                  :listen-function 'fd-stream-listen
                                  :close-function 'fd-stream-close
+                                 ;; A read from a FIFO or a device could
+                                 ;; block, and it'd block with the GC
+                                 ;; disabled.
+                                 :read-vector-function
+                                 (if (and (eq direction :input)
+                                          (eq (%unix-fd-kind fd) :file))
+                                   'input-file-read-vector)
                                  :eofp-function 'fd-stream-eofp
                                  :advance-function
                                  (if in-p (select-stream-advance-function class direction))
@@ -891,6 +935,8 @@ is :UNIX.")
                     (infer-character-encoding ioblock))
                   (when (and in-p (eq line-termination :inferred))
                     (infer-line-termination ioblock))
+                  (when (and mmap (eq direction :input))
+                    (file-ioblock-map-input ioblock))
                   (cond ((eq if-exists :append)
                          (file-position fstream :end))
                         ((and (memq direction '(:io :output))
@@ -901,6 +947,163 @@ is :UNIX.")
                     (note-open-file-stream fstream))
                   fstream)))))))))
 
+;;; Memory-mapped input.  An :INPUT stream opened with :MMAP T on a
+;;; regular file reads from a window of the file that's mapped into
+;;; memory instead of from a buffer that read(2) fills; advancing the
+;;; stream slides the window along the file.  The window is a lisp
+;;; vector set up the way MAP-FILE-TO-IVECTOR sets one up: the vector
+;;; header lives at the end of an anonymous page that precedes the
+;;; mapped octets, so the first TARGET::NODE-SIZE elements of the
+;;; vector are in that page.  Those hold a copy of the octets that
+;;; precede the window, so element 0 of the vector is always at
+;;; FILE-IOBLOCK-OCTET-POS and the usual buffer arithmetic (including
+;;; FILE-POSITION's) works unchanged.  The fd is kept positioned just
+;;; after the window, where it'd be had the window been read.
+
+(defparameter *mmap-stream-window-size* (ash 1 26)
+  "The most octets of a file that an input stream opened with :MMAP T
+maps at once.")
+
+;;; Map the window that contains the octet at POS and make the
+;;; stream's buffer describe it.  Returns the new buffer count, or NIL
+;;; if POS is at or past EOF.
+#-windows-target
+(defun %file-ioblock-map-window (file-ioblock pos)
+  (let* ((fd (file-ioblock-device file-ioblock))
+         (inbuf (file-ioblock-inbuf file-ioblock))
+         (addr (file-ioblock-mapping file-ioblock))
+         (page *host-page-size*)
+         (pad target::node-size)
+         (start (logandc2 pos (1- page)))
+         (len (max 0 (min (- (file-ioblock-mapping-size file-ioblock) page)
+                          (- (fd-size fd) start)))))
+    (setf (io-buffer-idx inbuf) 0
+          (io-buffer-count inbuf) 0
+          (ioblock-eof file-ioblock) nil)
+    (when (<= len (- pos start))
+      (setf (file-ioblock-octet-pos file-ioblock) pos
+            (ioblock-eof file-ioblock) t)
+      (file-ioblock-seek file-ioblock pos)
+      (return-from %file-ioblock-map-window nil))
+    (with-macptrs ((header (%inc-ptr addr (- page (* 2 target::node-size))))
+                   (prefix (%inc-ptr addr (- page pad)))
+                   (data (%inc-ptr addr page)))
+      (unless (eql data (#_mmap data
+                                len
+                                #$PROT_READ
+                                (logior #$MAP_PRIVATE #$MAP_FIXED)
+                                fd
+                                start))
+        (stream-io-error (file-ioblock-stream file-ioblock) (%get-errno) "mmap"))
+      (external-call "madvise"
+                     :address data
+                     #+64-bit-target :unsigned-doubleword
+                     #+32-bit-target :unsigned-fullword
+                     len
+                     :int 2             ; MADV_SEQUENTIAL
+                     :int)
+      (if (< start pad)
+        (#_memset prefix 0 pad)
+        (progn
+          (file-ioblock-seek file-ioblock (- start pad))
+          (fd-read fd prefix pad)))
+      (setf (%get-natural header 0)
+            (logior (logand (%get-natural header 0)
+                            (1- (ash 1 target::num-subtag-bits)))
+                    (ash (+ pad len) target::num-subtag-bits))))
+    (file-ioblock-seek file-ioblock (+ start len))
+    (setf (file-ioblock-octet-pos file-ioblock) (- start pad)
+          (io-buffer-idx inbuf) (+ pad (- pos start))
+          (io-buffer-count inbuf) (+ pad len))))
+
+#-windows-target
+(defun mapped-file-ioblock-advance (stream file-ioblock read-p)
+  (declare (ignore stream read-p))
+  (%file-ioblock-map-window file-ioblock
+                            (+ (file-ioblock-octet-pos file-ioblock)
+                               (io-buffer-count (file-ioblock-inbuf file-ioblock)))))
+
+#-windows-target
+(defun mapped-file-stream-close (s file-ioblock)
+  (let* ((addr (file-ioblock-mapping file-ioblock))
+         (inbuf (file-ioblock-inbuf file-ioblock)))
+    (when addr
+      (setf (file-ioblock-mapping file-ioblock) nil)
+      ;; Keep %%IOBLOCK-CLOSE from trying to free the window.
+      (when inbuf
+        (setf (io-buffer-buffer inbuf) nil
+              (io-buffer-bufptr inbuf) nil
+              (io-buffer-idx inbuf) 0
+              (io-buffer-count inbuf) 0))
+      (#_munmap addr (file-ioblock-mapping-size file-ioblock))))
+  (fd-stream-close s file-ioblock))
+
+;;; Replace FILE-IOBLOCK's input buffer with a mapped window, positioned
+;;; where the stream is.  Streams whose elements aren't octets, and
+;;; fds that aren't regular files, are left alone; so is everything if
+;;; the address space can't be reserved.  So are character streams
+;;; without an encoding or whose encodings have 16- or 32-bit code
+;;; units: their readers (%IOBLOCK-TYI and the code-unit readers)
+;;; expect new data at element 0 of the buffer after an advance, not
+;;; at the buffer's index.
+#-windows-target
+(defun file-ioblock-map-input (file-ioblock)
+  (let* ((fd (file-ioblock-device file-ioblock))
+         (inbuf (file-ioblock-inbuf file-ioblock))
+         (buffer (io-buffer-buffer inbuf))
+         (page *host-page-size*))
+    (when (and (null (file-ioblock-mapping file-ioblock))
+               (eql 0 (file-ioblock-element-shift file-ioblock))
+               (let* ((encoding (file-ioblock-encoding file-ioblock)))
+                 (if (eq (file-ioblock-element-type file-ioblock) 'character)
+                   (and encoding
+                        (eql 8 (character-encoding-code-unit-size encoding)))
+                   (null encoding)))
+               (eq (%unix-fd-kind fd) :file))
+      (let* ((pos (+ (file-ioblock-octet-pos file-ioblock)
+                     (io-buffer-idx inbuf)))
+             (window (logandc2 (+ (min *mmap-stream-window-size*
+                                       (max 1 (fd-size fd)))
+                                  (1- page))
+                               (1- page)))
+             (nbytes (+ page window))
+             (addr (#_mmap (%null-ptr)
+                           nbytes
+                           #$PROT_NONE
+                           (logior #$MAP_ANON #$MAP_PRIVATE)
+                           -1
+                           0)))
+        (unless (eql addr (%int-to-ptr (1- (ash 1 target::nbits-in-word)))) ; #$MAP_FAILED
+          (#_mmap addr
+                  page
+                  (logior #$PROT_READ #$PROT_WRITE)
+                  (logior #$MAP_ANON #$MAP_PRIVATE #$MAP_FIXED)
+                  -1
+                  0)
+          ;; The window has the same subtype as the buffer it replaces.
+          (setf (%get-natural addr (- page (* 2 target::node-size)))
+                (typecode buffer))
+          (with-macptrs ((v (%inc-ptr addr (+ (- page (* 2 target::node-size))
+                                              target::fulltag-misc))))
+            (setf (io-buffer-buffer inbuf)
+                  (rlet ((p :address v)) (%get-object p 0))))
+          (%dispose-heap-ivector buffer)
+          (setf (io-buffer-bufptr inbuf) (%inc-ptr addr (- page target::node-size))
+                (io-buffer-size inbuf) (+ target::node-size window)
+                (io-buffer-limit inbuf) (+ target::node-size window)
+                (file-ioblock-mapping file-ioblock) addr
+                (file-ioblock-mapping-size file-ioblock) nbytes
+                (ioblock-advance-function file-ioblock) 'mapped-file-ioblock-advance
+                (ioblock-read-vector-function file-ioblock) nil
+                (ioblock-close-function file-ioblock) 'mapped-file-stream-close)
+          (%file-ioblock-map-window file-ioblock pos)
+          t)))))
+
+#+windows-target
+(defun file-ioblock-map-input (file-ioblock)
+  (declare (ignore file-ioblock))
+  nil)
+
 
 
 
@@ -958,3 +1161,197 @@ is :UNIX.")
              (length (character-encoding-bom-encoding encoding))
              0)))))))
   
+
+
+;;; Copying between streams.  If both streams are backed by file
+;;; descriptors, the kernel can move the octets from one to the other
+;;; (with sendfile(2) from a regular file, or splice(2) when either end
+;;; is a pipe) without copying them through lisp buffers.
+
+(defparameter *stream-copy-buffer-size* (ash 1 16))
+
+(defun %stream-copy-ioblock (stream direction)
+  (let* ((ioblock (and (typep stream '(or fd-stream basic-stream))
+                       (stream-ioblock stream nil))))
+    (when (and ioblock
+               (typep (ioblock-device ioblock) 'fixnum)
+               (>= (the fixnum (ioblock-device ioblock)) 0))
+      (if (eq direction :input)
+        (let* ((inbuf (ioblock-inbuf ioblock)))
+          (when (and inbuf
+                     (not (eq inbuf (ioblock-outbuf ioblock)))
+                     (null (ioblock-untyi-char ioblock))
+                     (typep (io-buffer-buffer inbuf) '(simple-array (unsigned-byte 8) (*))))
+            ioblock))
+        (when (ioblock-outbuf ioblock)
+          ioblock)))))
+
+;;; Write N octets at PTR to FD.  Returns NIL or a negative errno.
+(defun %fd-write-all (fd ptr n)
+  (do* ((p (%inc-ptr ptr 0)))
+       ((<= n 0))
+    (let* ((written (with-eagain fd :output (fd-write fd p n))))
+      (declare (fixnum written))
+      (when (< written 0)
+        (return written))
+      (decf n written)
+      (%incf-ptr p written))))
+
+;;; Copy at most COUNT octets (or, if COUNT is NIL, everything up to
+;;; EOF) from IN-FD to OUT-FD with read(2) and write(2).  Returns the
+;;; number copied and, if something failed, a negative errno.
+(defun %fd-copy-through-buffer (in-fd out-fd count)
+  (let* ((total 0)
+         (error nil)
+         (size *stream-copy-buffer-size*))
+    (declare (fixnum size))
+    (%stack-block ((buf size))
+      (loop
+        (when (and count (>= total count))
+          (return))
+        (let* ((n (with-eagain in-fd :input
+                    (fd-read in-fd buf (if count (min size (- count total)) size)))))
+          (declare (fixnum n))
+          (when (<= n 0)
+            (when (< n 0)
+              (setq error n))
+            (return))
+          (let* ((write-error (%fd-write-all out-fd buf n)))
+            (when write-error
+              (setq error write-error)
+              (return)))
+          (incf total n))))
+    (values total error)))
+
+;;; Copy at most COUNT octets (or, if COUNT is NIL, everything up to
+;;; EOF) from IN-FD to OUT-FD in the kernel if possible, else through a
+;;; buffer.  Returns the number copied and, if something failed, a
+;;; negative errno.
+(defun %fd-copy (in-fd out-fd count)
+  (let* ((in-kind (%unix-fd-kind in-fd))
+         (out-kind (%unix-fd-kind out-fd))
+         (chunk (ash 1 30))
+         (total 0)
+         (method (cond #+linux-target
+                       ((eq in-kind :file) :sendfile)
+                       #+linux-target
+                       ((or (eq in-kind :pipe) (eq out-kind :pipe)) :splice)
+                       (t :copy))))
+    (flet ((want ()
+             (if count (min chunk (- count total)) chunk)))
+      (loop
+        (when (and count (>= total count))
+          (return total))
+        (let* ((n (ecase method
+                    #+linux-target
+                    (:sendfile
+                     (with-eagain out-fd :output
+                       (int-errno-call
+                        (external-call "sendfile"
+                                       :int out-fd :int in-fd
+                                       :address (%null-ptr)
+                                       #+64-bit-target :unsigned-doubleword
+                                       #+32-bit-target :unsigned-fullword
+                                       (want)
+                                       #+64-bit-target :signed-doubleword
+                                       #+32-bit-target :signed-fullword))))
+                    #+linux-target
+                    (:splice
+                     (with-eagain out-fd :output
+                       (int-errno-call
+                        (external-call "splice"
+                                       :int in-fd :address (%null-ptr)
+                                       :int out-fd :address (%null-ptr)
+                                       #+64-bit-target :unsigned-doubleword
+                                       #+32-bit-target :unsigned-fullword
+                                       (want)
+                                       :unsigned-fullword 5 ; SPLICE_F_MOVE|SPLICE_F_MORE
+                                       #+64-bit-target :signed-doubleword
+                                       #+32-bit-target :signed-fullword))))
+                    (:copy
+                     (multiple-value-bind (n error)
+                         (%fd-copy-through-buffer in-fd out-fd (and count (- count total)))
+                       (return-from %fd-copy (values (+ total n) error)))))))
+          (declare (fixnum n))
+          (cond ((> n 0) (incf total n))
+                ((zerop n) (return total))
+                ((and (zerop total)
+                      (or (eql n (- #$EINVAL)) (eql n (- #$ENOSYS))))
+                 ;; This kind of fd can't be used that way after all.
+                 (setq method :copy))
+                (t (return (values total n)))))))))
+
+(defun stream-copy (from to &key count)
+  "Copy octets (or, if either stream isn't backed by a file descriptor,
+elements) from FROM to TO, until EOF or until COUNT of them have been
+copied, and return the number copied.  Any output pending on TO is sent
+first.  When both streams are FD-streams, the octets don't pass through
+lisp: the kernel moves them with sendfile(2) or splice(2) where it can."
+  (when count
+    (setq count (require-type count 'unsigned-byte)))
+  (let* ((in (%stream-copy-ioblock from :input))
+         (out (%stream-copy-ioblock to :output)))
+    (if (not (and in out))
+      (let* ((buffer (make-array *stream-copy-buffer-size*
+                                 :element-type (stream-element-type from)))
+             (total 0))
+        (loop
+          (let* ((n (read-sequence buffer from
+                                   :end (if count
+                                          (min (length buffer) (- count total))
+                                          (length buffer)))))
+            (when (zerop n)
+              (return total))
+            (write-sequence buffer to :end n)
+            (incf total n))))
+      (progn
+        (force-output to)
+        (with-ioblock-input-locked (in)
+          (with-ioblock-output-locked (out)
+            (let* ((in-fd (ioblock-device in))
+                   (out-fd (ioblock-device out))
+                   (inbuf (ioblock-inbuf in))
+                   (idx (io-buffer-idx inbuf))
+                   (buffered (- (the fixnum (io-buffer-count inbuf)) idx))
+                   (total 0))
+              (declare (fixnum idx buffered))
+              ;; Send what's already been read into the buffer.
+              (when count
+                (setq buffered (min buffered count)))
+              (when (> buffered 0)
+                (let* ((error (%fd-write-all out-fd (%inc-ptr (io-buffer-bufptr inbuf) idx) buffered)))
+                  (when error
+                    (stream-io-error to (- error) "write")))
+                (setf (io-buffer-idx inbuf) (+ idx buffered))
+                (setq total buffered))
+              (multiple-value-bind (n error)
+                  (if (and count (>= total count))
+                    0
+                    (progn
+                      (when (file-ioblock-p in)
+                        ;; The fd's position is past the buffer.
+                        (setf (io-buffer-idx inbuf) 0
+                              (io-buffer-count inbuf) 0))
+                      (%fd-copy in-fd out-fd (and count (- count total)))))
+                (incf total n)
+                ;; Tell the streams where their fds are now.
+                (when (and (file-ioblock-p in)
+                           (zerop (the fixnum (io-buffer-count inbuf))))
+                  (setf (file-ioblock-octet-pos in) (fd-tell in-fd)))
+                (when (and (> n 0) (file-ioblock-p out))
+                  (let* ((pos (fd-tell out-fd)))
+                    (setf (file-ioblock-octet-pos out) pos)
+                    (when (> pos (file-ioblock-fileeof out))
+                      (setf (file-ioblock-fileeof out) pos))))
+                (when error
+                  (stream-io-error to (- error) "copy")))
+              total)))))))
+
+(defun send-file (stream pathname &key (start 0) end)
+  "Send the octets of the file named by PATHNAME, from START up to END (or
+its end), to STREAM; usually a socket.  Returns the number of octets
+sent."
+  (with-open-file (in pathname :element-type '(unsigned-byte 8))
+    (unless (eql start 0)
+      (file-position in start))
+    (stream-copy in stream :count (and end (max 0 (- end start))))))
@@ -358,21 +358,24 @@ characters used in most Western European languages."
        (let* ((char (schar string i))
               (code (char-code char)))
          (declare (type (mod #x110000) code))
-         (if (>= code 256)
-           (setq code (note-encoding-problem char vector :iso-8859-1 (char-code #\Sub))))
-         (progn
-           (setf (aref vector idx) code)
-           (incf idx))))))
+         (if (< code #x80)
+           (let* ((n (%narrow-ascii-string string i vector idx (- end i))))
+             (declare (fixnum n))
+             (incf idx n)
+             (incf i (1- n)))
+           (progn
+             (if (>= code 256)
+               (setq code (note-encoding-problem char vector :iso-8859-1 (char-code #\Sub))))
+             (setf (aref vector idx) code)
+             (incf idx)))))))
   :vector-decode-function
   (nfunction
    iso-8859-1-vector-decode
    (lambda (vector idx noctets string)
-     (declare (type (simple-array (unsigned-byte 8) (*)) vector))
-     (do* ((i 0 (1+ i))
-           (index idx (1+ index)))
-          ((>= i noctets) index)
-       (setf (schar string i) (code-char (the (unsigned-byte 8)
-                                             (aref vector index)))))))
+     (declare (type (simple-array (unsigned-byte 8) (*)) vector)
+              (fixnum idx noctets))
+     (%copy-u8-to-string vector idx string 0 noctets)
+     (+ idx noctets)))
   :memory-encode-function
   (nfunction
    iso-8859-1-memory-encode
@@ -441,10 +444,15 @@ codes map to their Unicode equivalents."
        (let* ((char (schar string i))
               (code (char-code char)))
          (declare (type (mod #x110000) code))
-         (if (>= code 128)
-           (setq code (note-encoding-problem char vector :us-ascii (char-code #\Sub))))
-         (setf (aref vector idx) code)
-         (incf idx)))))
+         (if (< code 128)
+           (let* ((n (%narrow-ascii-string string i vector idx (- end i))))
+             (declare (fixnum n))
+             (incf idx n)
+             (incf i (1- n)))
+           (progn
+             (setf (aref vector idx)
+                   (note-encoding-problem char vector :us-ascii (char-code #\Sub)))
+             (incf idx)))))))
   :vector-decode-function
   (nfunction
    ascii-vector-decode
@@ -455,9 +463,13 @@ codes map to their Unicode equivalents."
           ((>= i noctets) index)
        (let* ((code (aref vector index)))
          (declare (type (unsigned-byte 8) code))
-         (setf (schar string i) (if (< code 128)
-                                  (code-char code)
-                                  (note-vector-decoding-problem vector index :us-ascii)))))))
+         (if (< code 128)
+           (let* ((n (%widen-ascii-octets vector index string i (- noctets i))))
+             (declare (fixnum n))
+             (incf i (1- n))
+             (incf index (1- n)))
+           (setf (schar string i)
+                 (note-vector-decoding-problem vector index :us-ascii)))))))
   :memory-encode-function
   (nfunction
    ascii-memory-encode
@@ -1248,8 +1260,11 @@ bytes."
                 (code (char-code char)))
            (declare (type (mod #x110000) code))
            (cond ((< code #x80)
-                  (setf (aref vector idx) code)
-                  (incf idx))
+                  ;; Copy the whole run of ASCII characters.
+                  (let* ((n (%narrow-ascii-string string i vector idx (- end i))))
+                    (declare (fixnum n))
+                    (incf idx n)
+                    (incf i (1- n))))
                  ((< code #x800)
                   (setf (aref vector idx)
                         (logior #xc0 (the fixnum (ash code -6))))
@@ -1285,11 +1300,18 @@ bytes."
              (end (+ idx noctets))
              (index idx (1+ index)))
             ((= index end) index)
+           (declare (fixnum i end index))
            (let* ((1st-unit (aref vector index)))
              (declare (type (unsigned-byte 8) 1st-unit))
              (let* ((char 
                      (if (< 1st-unit #x80)
-                       (code-char 1st-unit)
+                       ;; Copy the whole run of ASCII octets; the last
+                       ;; of them is stored below.
+                       (let* ((n (%widen-ascii-octets vector index string i (- end index))))
+                         (declare (fixnum n))
+                         (incf i (1- n))
+                         (incf index (1- n))
+                         (code-char (aref vector index)))
                        (if (>= 1st-unit #xc2)
                            (let* ((2nd-unit (aref vector (incf index))))
                              (declare (type (unsigned-byte 8) 2nd-unit))
@@ -1354,7 +1376,13 @@ bytes."
              (values nchars i))
          (declare (fixnum i))
          (let* ((code (aref vector i))
-                (nexti (+ i (cond ((< code #xc2) 1)
+                (nexti (+ i (cond ((< code #x80)
+                                   (let* ((j (%skip-ascii-octets vector i end)))
+                                     (declare (fixnum j))
+                                     ;; All but the last of the run.
+                                     (incf nchars (- j i 1))
+                                     (- j i)))
+                                  ((< code #xc2) 1)
                                   ((< code #xe0) 2)
                                   ((< code #xf0) 3)
                                   ((< code #xf8) 4)
@@ -1526,7 +1554,12 @@ interpreted on input or prepended to output."
                 (highbits (- code #x10000)))
            (declare (type (mod #x110000) code)
                     (fixnum highbits))
-           (cond ((< highbits 0)
+           (cond ((< code #x80)
+                  (let* ((n (%narrow-ascii-string-to-u16 string i vector idx (- end i))))
+                    (declare (fixnum n))
+                    (incf idx (* 2 n))
+                    (incf i (1- n))))
+                 ((< highbits 0)
                   (setf (%native-u8-ref-u16 vector idx) code)
                   (incf idx 2))
                  (t
@@ -1551,16 +1584,23 @@ interpreted on input or prepended to output."
            (declare (type (unsigned-byte 16) 1st-unit))
            (incf index 2)
            (let* ((char
-                   (if (or (< 1st-unit #xd800)
-                           (>= 1st-unit #xe000))
-                     (code-char 1st-unit)
-                     (if (< 1st-unit #xdc00)
-                       (let* ((2nd-unit (%native-u8-ref-u16 vector index)))
-                         (declare (type (unsigned-byte 16) 2nd-unit))
-                         (incf index 2)
-                         (if (and (>= 2nd-unit #xdc00)
-                                  (< 2nd-unit #xe000))
-                           (utf-16-combine-surrogate-pairs 1st-unit 2nd-unit)))))))
+                   (if (< 1st-unit #x80)
+                     (let* ((n (%widen-ascii-u16 vector (- index 2) string i
+                                                 (ash (- end (- index 2)) -1))))
+                       (declare (fixnum n))
+                       (incf i (1- n))
+                       (incf index (* 2 (1- n)))
+                       (schar string i))
+                     (if (or (< 1st-unit #xd800)
+                             (>= 1st-unit #xe000))
+                       (code-char 1st-unit)
+                       (if (< 1st-unit #xdc00)
+                         (let* ((2nd-unit (%native-u8-ref-u16 vector index)))
+                           (declare (type (unsigned-byte 16) 2nd-unit))
+                           (incf index 2)
+                           (if (and (>= 2nd-unit #xdc00)
+                                    (< 2nd-unit #xe000))
+                             (utf-16-combine-surrogate-pairs 1st-unit 2nd-unit))))))))
              (setf (schar string i) (or char (note-vector-decoding-problem vector index #+big-endian-target :utf-16be #-big-endian-target :utf-16le))))))))
     :memory-encode-function
     (nfunction
@@ -1864,7 +1904,12 @@ in native byte-order with a leading byte-order mark."
                 (highbits (- code #x10000)))
            (declare (type (mod #x110000) code)
                     (fixnum highbits))
-           (cond ((< highbits 0)
+           (cond ((< code #x80)
+                  (let* ((n (%narrow-ascii-string-to-u16 string i vector idx (- end i))))
+                    (declare (fixnum n))
+                    (incf idx (* 2 n))
+                    (incf i (1- n))))
+                 ((< highbits 0)
                   (setf (%native-u8-ref-u16 vector idx) code)
                   (incf idx 2))
                  (t
@@ -1899,18 +1944,25 @@ in native byte-order with a leading byte-order mark."
            (declare (type (unsigned-byte 16) 1st-unit))
            (incf index 2)
            (let* ((char
-                   (if (or (< 1st-unit #xd800)
-                           (>= 1st-unit #xe000))
-                     (code-char 1st-unit)
-                     (if (< 1st-unit #xdc00)
-                       (let* ((2nd-unit (if swap
-                                          (%reversed-u8-ref-u16 vector index)
-                                          (%native-u8-ref-u16 vector index))))
-                         (declare (type (unsigned-byte 16) 2nd-unit))
-                         (incf index 2)
-                         (if (and (>= 2nd-unit #xdc00)
-                                  (< 2nd-unit #xe000))
-                           (utf-16-combine-surrogate-pairs 1st-unit 2nd-unit)))))))
+                   (if (and (< 1st-unit #x80) (not swap))
+                     (let* ((n (%widen-ascii-u16 vector (- index 2) string i
+                                                 (ash (- end (- index 2)) -1))))
+                       (declare (fixnum n))
+                       (incf i (1- n))
+                       (incf index (* 2 (1- n)))
+                       (schar string i))
+                     (if (or (< 1st-unit #xd800)
+                             (>= 1st-unit #xe000))
+                       (code-char 1st-unit)
+                       (if (< 1st-unit #xdc00)
+                         (let* ((2nd-unit (if swap
+                                            (%reversed-u8-ref-u16 vector index)
+                                            (%native-u8-ref-u16 vector index))))
+                           (declare (type (unsigned-byte 16) 2nd-unit))
+                           (incf index 2)
+                           (if (and (>= 2nd-unit #xdc00)
+                                    (< 2nd-unit #xe000))
+                             (utf-16-combine-surrogate-pairs 1st-unit 2nd-unit))))))))
              (setf (schar string i) (or char (note-vector-decoding-problem vector index :utf-16)))))))))
   :memory-encode-function
   (nfunction
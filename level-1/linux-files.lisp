@@ -930,6 +930,41 @@ given is that of a group to which the current user belongs."
   (int-errno-call (#_getpid))
   #+windows-target (#_GetCurrentProcessId))
 
+#-windows-target
+(defun fork-worker (&key (freeze t) function)
+  "Fork a child process that shares this lisp's heap copy-on-write.
+Return the child's process ID in the parent and 0 in the child.  If
+FREEZE is true, first do a full GC and freeze everything that's live,
+so that later full GCs (in the parent or in any child) neither move
+nor scan the frozen objects; the GC only touches a frozen page when
+something has been stored into an object on it since.  Only the
+calling thread exists in the child.  If FUNCTION is non-NIL, the child
+calls it with no arguments and then exits, with FUNCTION's value as
+its exit status if that's an integer and 0 otherwise."
+  (when freeze
+    #+x86-target (%fork-freeze)
+    #-x86-target (gc))
+  (let* ((pid (ff-call (%kernel-import target::kernel-import-lisp-fork)
+                       #+64-bit-target :signed-doubleword
+                       #+32-bit-target :signed-fullword)))
+    (cond ((< pid 0) (%errno-disp pid))
+          ((> pid 0) pid)
+          (t
+           ;; The other threads didn't survive the fork.
+           (dolist (p (all-processes))
+             (unless (eq p *current-process*)
+               (remove-from-all-processes p)))
+           (when function
+             (let* ((status 0))
+               (unwind-protect
+                    (let* ((result (funcall function)))
+                      (when (typep result '(signed-byte 32))
+                        (setq status result)))
+                 (ignore-errors (finish-output *standard-output*))
+                 (ignore-errors (finish-output *error-output*))
+                 (#__exit status))))
+           0))))
+
 
 (defun getuid ()
   "Return the (real) user ID of the current user."
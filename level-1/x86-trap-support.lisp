@@ -560,7 +560,26 @@
                                       (setq skip insn-length))
                                 (unwatch ()
                                          :report "Unwatch the object and retry the write."
-                                         (unwatch object))))))))
+                                         (unwatch object))))))
+	     ((= code 3)
+	      ;; Write to an object made immutable by PURIFY-OBJECT.
+	      ;; As above, the object is on the lisp stack under the xcf.
+	      (let* ((offset other)
+		     (object (%get-object xcf target::xcf.size)))
+		(multiple-value-bind (insn insn-length)
+		    (ignore-errors (x86-faulting-instruction xp))
+		  (restart-case (%error (make-condition
+					 'write-to-immutable-object
+					 :offset offset
+					 :object object
+					 :instruction insn)
+					nil frame-ptr)
+                                (skip ()
+                                      :test (lambda (c)
+                                              (declare (ignore c))
+                                              insn)
+                                      :report "Skip over this write instruction."
+                                      (setq skip insn-length))))))))
           ((= signal #+win32-target 10 #-win32-target #$SIGBUS)
            (if (= code -1)
              (%error (make-condition 'invalid-memory-operation)
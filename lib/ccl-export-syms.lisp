@@ -25,6 +25,8 @@
      @
      *elements-per-buffer*
      save-application
+     note-image-ready
+     *tree-shake-roots*
      def-load-pointers
      *save-exit-functions*
      *restore-lisp-functions*
@@ -272,6 +274,10 @@
      clear-specializer-direct-methods-caches
      *check-call-next-method-with-args*
      clear-gf-cache
+     enable-gf-dispatch-statistics
+     gf-dispatch-statistics
+     reset-gf-dispatch-statistics
+     gf-dispatch-report
      clear-all-gf-caches
      clear-clos-caches
 
@@ -470,6 +476,10 @@
      set-lisp-heap-gc-threshold
      gc-retain-pages
      gc-retaining-pages
+     fork-worker
+     purify-object
+     dump-heap
+     write-to-immutable-object
      gc-verbose
      gc-verbose-p
      weak-gc-method
@@ -489,6 +499,11 @@
      population-contents
 
      hash-table-weak-p
+     enable-hash-table-statistics
+     hash-table-statistics
+     reset-hash-table-statistics
+     hash-table-statistics-report
+     *hash-table-statistics-default*
 
      compiler-let
 
@@ -502,6 +517,8 @@
      SET-CURRENT-FILE-COMPILER-POLICY
      STANDARD-METHOD-COMBINATION
      STREAM-DEVICE
+     stream-copy
+     send-file
      STREAM-DIRECTION
      *current-process*
      PROCESS
@@ -742,6 +759,8 @@
      ;; Miscellany
      heap-utilization
      collect-heap-utilization
+     enable-heap-census
+     heap-census
      parse-unsigned-integer
      parse-signed-integer
      pui-stream
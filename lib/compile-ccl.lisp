@@ -921,3 +921,30 @@ the lisp and run REBUILD-CCL again.")
                 (quit (if failed-tests 1 0)))
               failed-tests)))))))
 
+
+(defun benchmark-ccl (&key (output "ccl:benchmark-results.lisp")
+                           baseline (iterations 5) only (threshold 0.1) exit)
+  "Run the benchmarks in ccl:library;benchmarks.lisp (those whose names
+or categories are in ONLY, if that's non-NIL) ITERATIONS times each,
+and write the statistics to OUTPUT.  If BASELINE names a file written
+by an earlier run, report the benchmarks whose median run time has
+grown by more than THRESHOLD; if EXIT is true, exit with status 1 if
+there are any such regressions."
+  (let* ((fasl (merge-pathnames *.fasl-pathname* (temp-pathname))))
+    (unwind-protect
+         (let* ((*compile-verbose* nil)
+                (*load-verbose* nil))
+           (compile-file "ccl:library;benchmarks.lisp" :output-file fasl)
+           (load fasl))
+      (when (probe-file fasl)
+        (delete-file fasl))))
+  (multiple-value-bind (results regressions)
+      (funcall 'run-benchmarks
+               :output output
+               :baseline baseline
+               :iterations iterations
+               :only only
+               :threshold threshold)
+    (when exit
+      (quit (if regressions 1 0)))
+    (values results regressions)))
@@ -74,16 +74,39 @@
 			 (mode #o644)
 			 prepend-kernel
 			 #+windows-target (application-type :console)
-                         native)
+                         native
+                         writer-threads
+                         write-chunk-size
+                         direct-io
+                         progress
+                         (fsync t)
+                         tree-shake
+                         tree-shake-roots
+                         tree-shake-packages
+                         tree-shake-report)
   (declare (ignore toplevel-function error-handler application-class
-                   clear-clos-caches init-file impurify))
+                   clear-clos-caches init-file tree-shake-roots
+                   tree-shake-packages tree-shake-report))
+  (check-type tree-shake (member nil t :aggressive))
   #+windows-target (check-type application-type (member :console :gui))
-  (unless (probe-file (make-pathname :defaults nil
-                                     :directory (pathname-directory (translate-logical-pathname filename))))
-    (error "Directory containing ~s does not exist." filename))
-  (let* ((kind (%unix-file-kind (defaulted-native-namestring filename))))
-    (when (and kind (not (eq kind :file )))
-      (error "~S is not a regular file." filename)))
+  ;; FILENAME can also be an open file descriptor (a pipe or socket,
+  ;; for instance), to which the image is written sequentially.
+  (if (typep filename 'fixnum)
+    (when (or prepend-kernel native)
+      (error "~S and ~S can't be used when writing to a file descriptor."
+             :prepend-kernel :native))
+    (progn
+      (unless (probe-file (make-pathname :defaults nil
+                                         :directory (pathname-directory (translate-logical-pathname filename))))
+        (error "Directory containing ~s does not exist." filename))
+      (let* ((kind (%unix-file-kind (defaulted-native-namestring filename))))
+        (when (and kind (not (eq kind :file )))
+          (error "~S is not a regular file." filename)))))
+  (%configure-save-application :writer-threads writer-threads
+                               :write-chunk-size write-chunk-size
+                               :direct-io direct-io
+                               :progress progress
+                               :fsync fsync)
   (let* ((watched (watch)))
     (when watched
       (cerror "Un-watch them." "There are watched objects.")
@@ -93,17 +116,20 @@
   (let* ((ip *initial-process*)
 	 (cp *current-process*))
     (when (process-verify-quit ip)
-      (let* ((fd (open-dumplisp-file filename
-                                     :mode mode
-                                     :prepend-kernel prepend-kernel
-                                     #+windows-target  #+windows-target 
-                                     :application-type application-type)))
+      (let* ((fd (if (typep filename 'fixnum)
+                   filename
+                   (open-dumplisp-file filename
+                                       :mode mode
+                                       :prepend-kernel prepend-kernel
+                                       #+windows-target  #+windows-target 
+                                       :application-type application-type))))
         (when native
           #+(or darwinx8632-target darwinx8664-target) (setq fd (- fd))
           #-(or darwinx8632-target darwinx8664-target)
           (progn
             (warn "native image support not available, ignoring ~s option." :native)))
-            
+        ;; Code that's shaken out of the readonly area can only be
+        ;; reclaimed if it's moved back to the dynamic heap first.
         (process-interrupt ip
                            #'(lambda ()
                                (process-exit-application
@@ -112,6 +138,8 @@
                                     (apply #'%save-application-internal
                                            fd
                                            :purify purify
+                                           :impurify (or impurify
+                                                         (not (null tree-shake)))
                                            rest))))))
       (unless (eq cp ip)
 	(process-kill cp)))))
@@ -127,8 +155,18 @@
                                       (clear-clos-caches t)
                                       prepend-kernel
                                       #+windows-target application-type
-                                      native)
-  (declare (ignore mode prepend-kernel #+windows-target application-type native))
+                                      native
+                                      writer-threads
+                                      write-chunk-size
+                                      direct-io
+                                      progress
+                                      fsync
+                                      tree-shake
+                                      tree-shake-roots
+                                      tree-shake-packages
+                                      tree-shake-report)
+  (declare (ignore mode prepend-kernel #+windows-target application-type native
+                   writer-threads write-chunk-size direct-io progress fsync))
   (when (and application-class (neq  (class-of *application*)
                                      (if (symbolp application-class)
                                        (find-class application-class)
@@ -161,6 +199,15 @@
     (make-application-error-handler *application* error-handler))
   
   (if clear-clos-caches (clear-clos-caches))
+  (when tree-shake
+    (%tree-shake :toplevel-function toplevel-function
+                 :mode tree-shake
+                 :roots tree-shake-roots
+                 :packages tree-shake-packages
+                 :report tree-shake-report))
+  ;; IMPURIFY moves immutable objects back into the dynamic heap.
+  (setq *immutable-readonly-ranges*
+        (unless impurify (%immutable-readonly-ranges)))
   (save-image #'(lambda () (%save-application fd
                                               (logior (if impurify 2 0)
                                                       (if purify 1 0))))
@@ -312,6 +359,32 @@
       image-fd)))
 
 
+(defconstant $save-application-direct-io 1)
+(defconstant $save-application-no-fsync 2)
+(defconstant $save-application-report-progress 4)
+
+;;; These options are used by the kernel when it writes the image.
+;;; WRITER-THREADS threads write chunks of WRITE-CHUNK-SIZE bytes in
+;;; parallel (unless the image is being written to a pipe or socket.)
+;;; PROGRESS is either T (report progress on the kernel's debug
+;;; output) or a pointer to a foreign function of two (natural)
+;;; arguments: the number of bytes written so far and the total.  It's
+;;; called on a kernel thread while the lisp is stopped, so it can't
+;;; be a lisp callback.
+(defun %configure-save-application (&key writer-threads write-chunk-size
+                                         direct-io progress (fsync t))
+  (ff-call (%kernel-import target::kernel-import-configure-save-application)
+           :signed-fullword (or writer-threads 0)
+           #+64-bit-target :unsigned-doubleword
+           #+32-bit-target :unsigned-fullword (or write-chunk-size 0)
+           :signed-fullword (logior (if direct-io $save-application-direct-io 0)
+                                    (if fsync 0 $save-application-no-fsync)
+                                    (if (eq progress t)
+                                      $save-application-report-progress
+                                      0))
+           :address (if (typep progress 'macptr) progress (%null-ptr))
+           :void))
+
 (defun %save-application (fd &optional (flags 1))
   (let* ((err (%%save-application flags fd)))
     (unless (eql err 0)
@@ -359,3 +432,280 @@
             (when name
               (set name descriptor))))))))
 
+
+;;; Tree shaking.
+;;;
+;;; Before an application is saved, SAVE-APPLICATION can remove
+;;; definitions that can't be reached from the application's toplevel
+;;; function and a few other roots.  Reachability is determined by a
+;;; simple marking traversal of the heap graph that doesn't descend
+;;; into packages (so a symbol is only reachable if some reachable
+;;; code or data references it directly.)  Unreachable symbols lose
+;;; their function definitions, global values, property lists and
+;;; documentation and are uninterned; packages that become empty are
+;;; deleted.  The GC that SAVE-APPLICATION does reclaims what they
+;;; referenced.
+;;;
+;;; This is conservative in some ways (CLOS metaobjects are reachable
+;;; from each other, so little CLOS code is ever removed) and not in
+;;; others: anything that's only referenced by name at runtime (via
+;;; INTERN, FIND-SYMBOL, READ or EVAL) has to be declared as a root.
+
+(defvar *tree-shake-roots* ()
+  "A list of symbols, packages and other objects that tree-shaking
+SAVE-APPLICATION should treat as reachable.  A package designator
+keeps all symbols present in that package.")
+
+;;; The values of these variables are hash tables that index
+;;; definitions by name.  They don't make anything reachable, and
+;;; entries for removed definitions are removed from them.
+(defparameter *tree-shake-index-variables* '(%source-files%))
+
+(defparameter *tree-shake-kept-packages* '("COMMON-LISP" "KEYWORD"))
+
+(defun %tree-shake-heap-object-p (thing)
+  (or (consp thing)
+      (symbolp thing)
+      (functionp thing)
+      (uvectorp thing)))
+
+(defun %tree-shake-object-size (thing size-function)
+  (if (consp thing)
+    target::cons.size
+    (let* ((v (cond ((functionp thing) (function-to-function-vector thing))
+                    ((symbolp thing) (symptr->symvector (%symbol->symptr thing)))
+                    (t thing))))
+      (logandc2 (+ (funcall size-function (typecode v) (uvsize v))
+                   #+64-bit-target (+ 8 15)
+                   #+32-bit-target (+ 4 7))
+                #+64-bit-target 15
+                #+32-bit-target 7))))
+
+;;; Mark everything reachable from ROOTS that isn't already in MARKED
+;;; or EXCLUDE and isn't one of the objects in SKIP.  Return the total
+;;; size of the newly-marked objects.  Packages are marked (along with
+;;; the packages they use) but their contents aren't traversed, and
+;;; they aren't counted in the total.  When WEAK-KEYS is true, a
+;;; weak-on-key hash table's values are only reachable if their keys
+;;; are; otherwise weak-on-key hash tables' contents aren't traversed.
+(defun %tree-shake-mark (roots marked skip size-function &key weak-keys exclude)
+  (let* ((stack ())
+         (weak-vectors ())
+         (total 0))
+    (declare (fixnum total))
+    (flet ((note (thing)
+             (when (and (%tree-shake-heap-object-p thing)
+                        (not (gethash thing marked))
+                        (not (and exclude (gethash thing exclude)))
+                        (not (memq thing skip)))
+               (setf (gethash thing marked) t)
+               (push thing stack))))
+      (declare (dynamic-extent #'note))
+      (dolist (root roots) (note root))
+      (loop
+        (loop
+          (when (null stack) (return))
+          (let* ((thing (pop stack)))
+            (unless (packagep thing)
+              (incf total (%tree-shake-object-size thing size-function)))
+            (cond ((packagep thing)
+                   ;; A reachable package is kept, and so are the
+                   ;; packages it uses; its symbols are only reachable
+                   ;; if something else reaches them.
+                   (dolist (p (package-use-list thing))
+                     (note p)))
+                  ((consp thing)
+                   (note (%car thing))
+                   (note (%cdr thing)))
+                  ((symbolp thing)
+                   (let* ((v (symptr->symvector (%symbol->symptr thing)))
+                          (pp (%svref v target::symbol.package-predicate-cell)))
+                     (note (%svref v target::symbol.pname-cell))
+                     (note (%svref v target::symbol.vcell-cell))
+                     (note (%svref v target::symbol.fcell-cell))
+                     (note (%svref v target::symbol.plist-cell))
+                     (when (consp pp) (note (cdr pp)))))
+                  ((functionp thing)
+                   (lfunloop for imm in thing do (note imm)))
+                  ((and (eql (typecode thing) target::subtag-hash-vector)
+                        (logbitp $nhash_weak_bit (nhash.vector.flags thing))
+                        (not (logbitp $nhash_weak_value_bit (nhash.vector.flags thing))))
+                   (when weak-keys
+                     (push thing weak-vectors)))
+                  ((gvectorp thing)
+                   (dotimes (i (uvsize thing))
+                     (note (%svref thing i)))))))
+        ;; Values in weak-on-key tables whose keys are now reachable
+        ;; are reachable.  Keep going until that doesn't find anything
+        ;; new.
+        (dolist (v weak-vectors)
+          (do* ((i $nhash.vector_overhead (+ i 2)))
+               ((>= i (uvsize v)))
+            (declare (fixnum i))
+            (let* ((key (%svref v i)))
+              (when (or (not (%tree-shake-heap-object-p key))
+                        (gethash key marked))
+                (note (%svref v (1+ i)))))))
+        (when (null stack) (return))))
+    total))
+
+(defun %tree-shake-roots (toplevel-function roots)
+  (let* ((all (list toplevel-function *application* %pascal-functions%
+                    *lisp-system-pointer-functions* *lisp-user-pointer-functions*
+                    *lisp-startup-functions* *restore-lisp-functions*
+                    *save-exit-functions*
+                    ;; Needed to finish shaking and saving the image.
+                    '%tree-shake 'save-image '%save-application)))
+    ;; Static symbols and anything else that the kernel knows about.
+    (%map-areas #'(lambda (thing)
+                    (when (eq (typecode thing) target::subtag-function)
+                      (setq thing (function-vector-to-function thing)))
+                    (when (eq (typecode thing) target::subtag-symbol)
+                      (setq thing (symvector->symptr thing)))
+                    (push thing all))
+                '(:static :managed-static))
+    (dolist (r (append roots *tree-shake-roots*) all)
+      (let* ((pkg (and (or (packagep r) (stringp r)) (find-package r))))
+        (if pkg
+          (do-symbols (s pkg) (push s all))
+          (push r all))))))
+
+;;; Should unreachable SYM be removed ?  Symbols in kept packages never
+;;; are (their function definitions might be, if MODE is :AGGRESSIVE);
+;;; unless MODE is :AGGRESSIVE, external symbols are kept unless their
+;;; home package is one of PACKAGES.
+(defun %tree-shake-symbol-disposition (sym mode packages kept)
+  (let* ((pkg (symbol-package sym)))
+    (cond ((null pkg) nil)
+          ((memq pkg kept)
+           (and (eq mode :aggressive)
+                (fboundp sym)
+                (not (special-operator-p sym))
+                (not (macro-function sym))
+                :definition))
+          ((memq pkg packages) :symbol)
+          ((eq mode :aggressive) :symbol)
+          ((eq (nth-value 1 (find-symbol (symbol-name sym) pkg)) :external) nil)
+          (t :symbol))))
+
+(defun %tree-shake-remove-symbol (sym disposition)
+  (let* ((removed ()))
+    (when (fboundp sym)
+      (push :function removed)
+      (fmakunbound sym))
+    (unless (eq disposition :definition)
+      (when (and (boundp sym) (not (constant-symbol-p sym)))
+        (push :value removed)
+        (%set-sym-value sym (%unbound-marker)))
+      (when (symbol-plist sym)
+        (push :plist removed)
+        (setf (symbol-plist sym) nil))
+      (dolist (p (list-all-packages))
+        (when (eq (find-symbol (symbol-name sym) p) sym)
+          (ignore-errors (unintern sym p))))
+      (push :symbol removed))
+    (when (gethash sym %documentation)
+      (push :documentation removed)
+      (remhash sym %documentation))
+    removed))
+
+(defun %tree-shake-package-empty-p (pkg)
+  (with-package-iterator (next pkg :internal :external)
+    (not (next))))
+
+(defun %tree-shake (&key toplevel-function (mode t) roots packages report)
+  (let* ((size-function (arch::target-array-data-size-function
+                         (backend-target-arch *host-backend*)))
+         (kept (mapcar #'find-package *tree-shake-kept-packages*))
+         (packages (remove nil (mapcar #'find-package packages)))
+         (skip (mapcan #'(lambda (var)
+                           (when (boundp var)
+                             (let* ((h (symbol-value var)))
+                               (when (hash-table-p h)
+                                 (list h (nhash.vector h))))))
+                       *tree-shake-index-variables*))
+         (marked (make-hash-table :test 'eq :shared nil :size 200000))
+         (claimed (make-hash-table :test 'eq :shared nil))
+         (used-before (progn (gc) (%usedbytes)))
+         (victims ())
+         (removed ())
+         (deleted-packages ()))
+    ;; The list of all packages doesn't make any of them reachable.
+    (do* ((l %all-packages% (cdr l)))
+         ((null l))
+      (setf (gethash l marked) t))
+    (%tree-shake-mark (%tree-shake-roots toplevel-function roots)
+                      marked skip size-function :weak-keys t)
+    (do-all-symbols (s)
+      (unless (or (gethash s marked) (gethash s claimed))
+        (let* ((disposition (%tree-shake-symbol-disposition s mode packages kept)))
+          (when disposition
+            (setf (gethash s claimed) t)
+            (push (cons s disposition) victims)))))
+    (clrhash claimed)
+    ;; Attribute the space that each victim retains to it.  Something
+    ;; that's shared by several victims is charged to the first one
+    ;; that's visited.
+    (dolist (v victims)
+      (let* ((sym (car v))
+             (package-name (package-name (symbol-package sym)))
+             (bytes (%tree-shake-mark (if (eq (cdr v) :definition)
+                                        (list (fboundp sym))
+                                        (list sym))
+                                      claimed skip size-function
+                                      :exclude marked)))
+        (push (list sym package-name bytes) removed)))
+    (dolist (r removed)
+      (nconc r (list (%tree-shake-remove-symbol (car r) (cdr (assoc (car r) victims))))))
+    (dolist (h skip)
+      (when (hash-table-p h)
+        (maphash #'(lambda (k v)
+                     (declare (ignore v))
+                     (when (and (%tree-shake-heap-object-p k)
+                                (not (gethash k marked)))
+                       (remhash k h)))
+                 h)))
+    (dolist (pkg (list-all-packages))
+      (unless (or (memq pkg kept)
+                  (gethash pkg marked)
+                  (not (%tree-shake-package-empty-p pkg)))
+        (let* ((name (package-name pkg)))
+          (when (ignore-errors (delete-package pkg))
+            (push name deleted-packages)))))
+    (when report
+      (clrhash marked)
+      (clrhash claimed)
+      (gc)
+      (%tree-shake-report report removed deleted-packages used-before (%usedbytes)))
+    (values (length removed) deleted-packages)))
+
+(defun %tree-shake-report (report removed deleted-packages used-before used-after)
+  (flet ((write-report (stream)
+           (let* ((by-package (make-hash-table :test 'equal)))
+             (dolist (r removed)
+               (incf (gethash (cadr r) by-package 0) (caddr r)))
+             (format stream "~&;;; Tree shaking removed ~d symbol~:p and ~d package~:p.~%"
+                     (length removed) (length deleted-packages))
+             (format stream ";;; Dynamic heap: ~d bytes before, ~d bytes after.~%"
+                     used-before used-after)
+             (when deleted-packages
+               (format stream ";;; Deleted packages:~{ ~a~}~%" deleted-packages))
+             (format stream "~&;;;~%;;; Bytes retained, by package:~%")
+             (dolist (p (sort (let* ((l ()))
+                                (maphash #'(lambda (k v) (push (cons k v) l)) by-package)
+                                l)
+                              #'> :key #'cdr))
+               (format stream "~12d  ~a~%" (cdr p) (car p)))
+             (format stream "~&;;;~%;;; Bytes retained, by symbol:~%")
+             (dolist (r (sort (copy-list removed) #'> :key #'caddr))
+               (destructuring-bind (sym package-name bytes what) r
+                 (format stream "~12d  ~a::~a~@[ ~(~{~a~^ ~}~)~]~%"
+                         bytes package-name (symbol-name sym) what))))))
+    (if (streamp report)
+      (write-report report)
+      (if (eq report t)
+        (write-report *terminal-io*)
+        (with-open-file (stream report :direction :output
+                                :if-exists :supersede
+                                :if-does-not-exist :create)
+          (write-report stream))))))
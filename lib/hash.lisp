@@ -209,6 +209,76 @@
 ;;; it's not clear that that'd be incredibly useful.
 
 
+;;;;;;;;;;;;;
+;;
+;; Statistics (see ENABLE-HASH-TABLE-STATISTICS)
+;;
+
+(defun hash-table-statistics (hash)
+  "Return a plist describing the lookups in HASH since statistics were
+first enabled for it, or NIL if they never were.  Probe lengths count
+the slots examined by a lookup; a table whose average probe length is
+well above 1 is crowded or has badly distributed hash codes.
+:GC-REHASHES counts the rehashes caused by the GC moving address-based
+keys, and :LOCK-FREE-RETRIES the operations on a lock-free table that
+had to start over because it was being rehashed."
+  (unless (hash-table-p hash)
+    (setq hash (require-type hash 'hash-table)))
+  (let* ((stats (nhash.stats hash)))
+    (when stats
+      (let* ((lookups (nhash.stats.lookups stats)))
+        (list :lookups lookups
+              :average-probe-length (if (zerop lookups)
+                                      0
+                                      (/ (float (nhash.stats.probes stats)) lookups))
+              :max-probe-length (nhash.stats.max-probe stats)
+              :gc-rehashes (nhash.stats.gc-rehashes stats)
+              :grows (nhash.stats.grows stats)
+              :in-place-rehashes (nhash.stats.in-place-rehashes stats)
+              :lock-free-retries (nhash.stats.lock-free-retries stats)
+              :count (hash-table-count hash)
+              :size (hash-table-size hash)
+              :enabled (eq (nhash.find hash) #'%hash-find-with-statistics))))))
+
+(defun reset-hash-table-statistics (hash)
+  "Zero the counts that HASH-TABLE-STATISTICS reports for HASH."
+  (unless (hash-table-p hash)
+    (setq hash (require-type hash 'hash-table)))
+  (let* ((stats (nhash.stats hash)))
+    (when stats
+      (dotimes (i nhash.stats.find)
+        (setf (svref stats i) 0))))
+  hash)
+
+(defun hash-table-statistics-report (&key (stream t) (count 10)
+                                          (key :average-probe-length)
+                                          (min-lookups 100))
+  "Describe the COUNT hash tables with statistics whose KEY (a property
+that HASH-TABLE-STATISTICS returns) is largest, among those that have
+had at least MIN-LOOKUPS lookups."
+  (when (eq stream t) (setq stream *standard-output*))
+  (let* ((entries ()))
+    (dolist (hash (population-data (hash-tables-with-statistics)))
+      (let* ((stats (hash-table-statistics hash)))
+        (when (>= (getf stats :lookups) min-lookups)
+          (push (cons hash stats) entries))))
+    (setq entries (sort entries #'> :key #'(lambda (entry) (getf (cdr entry) key))))
+    (format stream "~&~12@a ~8@a ~6@a ~8@a ~6@a ~8@a ~9@a  Table~%"
+            "Lookups" "Avg" "Max" "GC rehash" "Grows" "Retries" "Count")
+    (loop for (hash . stats) in entries
+          repeat count
+          do (destructuring-bind (&key lookups average-probe-length max-probe-length
+                                       gc-rehashes grows lock-free-retries count size
+                                       &allow-other-keys)
+                 stats
+               (format stream "~&~12d ~8,2f ~6d ~8d ~6d ~8d ~9@a  ~s~%"
+                       lookups average-probe-length max-probe-length
+                       gc-rehashes grows lock-free-retries
+                       (format nil "~d/~d" count size)
+                       hash)))
+    (values)))
+
+
 
 ;;;;;;;;;;;;;
 ;;
@@ -1218,6 +1218,78 @@ are running on, or NIL if we can't find any useful information."
                map)
       data)))
 
+;;; The heap census is taken by the GC, which counts live objects in the
+;;; dynamic heap while it has them marked, so it's much cheaper than
+;;; walking the heap.  It's only taken by full GCs.
+
+(defun enable-heap-census (&optional (enable t))
+  "Make each full GC take a census of the dynamic heap (or stop it from
+doing so, if ENABLE is false.)  Returns true if it was enabled."
+  (not (eql 0 (ff-call (%kernel-import target::kernel-import-lisp-heap-census-control)
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword (if enable 1 0)
+                       :signed-fullword))))
+
+(defun %heap-census-wrappers ()
+  (without-gcing
+    (let* ((n (ff-call (%kernel-import target::kernel-import-lisp-heap-census-wrappers)
+                       :address (%null-ptr)
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword 0
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword))
+           (result ()))
+      (unless (zerop n)
+        (%stack-block ((buf (* 3 n target::node-size)))
+          (ff-call (%kernel-import target::kernel-import-lisp-heap-census-wrappers)
+                   :address buf
+                   #+64-bit-target :unsigned-doubleword
+                   #+32-bit-target :unsigned-fullword n
+                   #+64-bit-target :unsigned-doubleword
+                   #+32-bit-target :unsigned-fullword)
+          (dotimes (i n)
+            (let* ((base (* 3 i target::node-size)))
+              (push (list (%get-object buf base)
+                          (%get-natural buf (+ base target::node-size))
+                          (%get-natural buf (+ base (* 2 target::node-size))))
+                    result)))))
+      result)))
+
+(defun heap-census (&key classes)
+  "Return the results of the census taken by the last full GC while the
+census was enabled (see ENABLE-HEAP-CENSUS), in the same form as
+COLLECT-HEAP-UTILIZATION's result: a list of (type-name count bytes
+bytes).  If CLASSES is true, standard instances are counted by class.
+The second value is the number of the GC that took the census, or
+NIL if none has been."
+  (%stack-block ((counts (* 256 target::node-size))
+                 (bytes (* 256 target::node-size)))
+    (let* ((gc-num (ff-call (%kernel-import target::kernel-import-lisp-heap-census)
+                            :address counts
+                            :address bytes
+                            #+64-bit-target :unsigned-doubleword
+                            #+32-bit-target :unsigned-fullword))
+           (data ()))
+      (unless (zerop gc-num)
+        (dotimes (i 256)
+          (let* ((count (%get-natural counts (* i target::node-size)))
+                 (size (%get-natural bytes (* i target::node-size))))
+            (unless (or (zerop count)
+                        (and classes (eql i target::subtag-instance)))
+              (push (list (if (eql i target::fulltag-cons)
+                            'cons
+                            (aref *heap-utilization-vector-type-names* i))
+                          count size size)
+                    data))))
+        (when classes
+          (dolist (entry (%heap-census-wrappers))
+            (destructuring-bind (wrapper count size) entry
+              (let* ((class (%wrapper-class wrapper))
+                     (name (or (and (typep class 'class) (%class-proper-name class))
+                               class)))
+                (push (list (prin1-to-string name) count size size) data))))))
+      (values data (unless (zerop gc-num) gc-num)))))
+
 (defun collect-heap-ivector-utilization-by-typecode ()
   (let* ((counts (make-array 256 :initial-element 0))
 	 (sizes (make-array 256 :initial-element 0))
@@ -1506,6 +1578,89 @@ are running on, or NIL if we can't find any useful information."
 			(return-from unwatch (%unwatch thing new)))))
                 area-watched)))
 
+;;; PURIFY-OBJECT copies an object graph into its own page-aligned
+;;; range of the readonly area; the kernel treats writes to those pages
+;;; as errors.  The kernel only knows about the ranges it creates, so
+;;; SAVE-APPLICATION records them (as offsets from the start of the
+;;; readonly area) here, and they're re-established at startup.
+(defvar *immutable-readonly-ranges* nil)
+
+(defun %immutable-readonly-ranges ()
+  (flet ((get-ranges (buf n)
+           (ff-call (%kernel-import target::kernel-import-lisp-immutable-ranges)
+                    :address buf
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword n
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword)))
+    (let* ((n (get-ranges (%null-ptr) 0)))
+      (unless (zerop n)
+        (%stack-block ((buf (* n 2 target::node-size)))
+          (get-ranges buf n)
+          (collect ((ranges))
+            (dotimes (i n (ranges))
+              (ranges (cons (%get-natural buf (* i 2 target::node-size))
+                            (%get-natural buf (* (1+ (* i 2)) target::node-size)))))))))))
+
+(def-ccl-pointers immutable-readonly-ranges ()
+  (dolist (range *immutable-readonly-ranges*)
+    (ff-call (%kernel-import target::kernel-import-add-immutable-range)
+             #+64-bit-target :unsigned-doubleword
+             #+32-bit-target :unsigned-fullword (car range)
+             #+64-bit-target :unsigned-doubleword
+             #+32-bit-target :unsigned-fullword (cdr range)
+             :signed-fullword)))
+
+(defun purify-object (object)
+  "Make OBJECT and everything reachable from it deeply immutable: copy
+them to a write-protected part of the readonly area, update all
+references to them, and return OBJECT.  The copies are never scanned
+or moved by the GC and are shared by processes that map the same
+image; an attempt to modify one signals a WRITE-TO-IMMUTABLE-OBJECT
+error.  Everything reachable from OBJECT must be a cons, simple vector,
+array header, number, character or string or other specialized vector,
+or a function that isn't a generic function or closure; symbols and
+other objects that aren't already outside of the dynamic heap cause an
+error and nothing is copied."
+  #+x86-target
+  (multiple-value-bind (result status) (%purify-object-graph object)
+    (case status
+      ((1 2) result)
+      (0 (error "Can't purify ~s while the GC is inhibited." object))
+      (3 (let* ((*print-length* 10)
+                (*print-level* 3))
+           (error "Can't make ~s immutable: it refers to ~s, which is mutable or might be reclaimed."
+                  object result)))
+      (t (error "Not enough room in the readonly area to purify ~s." object))))
+  #-x86-target
+  (progn
+    object
+    (error "~s isn't implemented on this platform." 'purify-object)))
+
+(defun dump-heap (pathname &key (threads 0) (if-exists :supersede))
+  "Do a full GC, then write a description of every object in the heap,
+of the references between them and of the roots that reference them
+to PATHNAME, with THREADS writer threads (0 means one per CPU.)  The
+format is described in the kernel's x86-gc.c; OPEN-HEAP-DUMP in the
+HEAP-DUMP module reads it.  Returns PATHNAME."
+  #+(and x86-target (not windows-target))
+  (let* ((filename (native-translated-namestring pathname)))
+    (when (and (eq if-exists :error) (probe-file pathname))
+      (error "~s already exists." pathname))
+    (let* ((fd (fd-open filename (logior #$O_WRONLY #$O_CREAT #$O_TRUNC) #o644)))
+      (unless (>= fd 0) (signal-file-error fd pathname))
+      (unwind-protect
+           (let* ((status (%heap-dump fd threads)))
+             (cond ((eql status 1) pathname)
+                   ((eql status 0)
+                    (error "Can't dump the heap while the GC is inhibited."))
+                   (t (signal-file-error status pathname))))
+        (fd-close fd))))
+  #-(and x86-target (not windows-target))
+  (progn
+    threads if-exists
+    (error "~s isn't implemented on this platform." 'dump-heap)))
+
 (defun %parse-unsigned-integer (vector start end)
   (declare ((simple-array (unsigned-byte 8) (*)) vector)
            (fixnum start end)
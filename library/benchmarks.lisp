@@ -0,0 +1,488 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; benchmarks.lisp
+; Workloads for BENCHMARK-CCL (in ccl:lib;compile-ccl), which catch
+; performance regressions in the GC, the allocator, hash tables, CLOS
+; dispatch, streams, the reader, the printer and the fasl loader.  Each
+; benchmark does a fixed amount of work, so its run times can be
+; compared across builds; RUN-BENCHMARKS runs each of them a number of
+; times, writes the statistics to a file that can be READ back, and
+; compares them to those in a baseline file written by an earlier run.
+
+(in-package :ccl)
+
+(defstruct (benchmark (:constructor make-benchmark (name category function
+                                                    setup teardown)))
+  name
+  category
+  function                              ; of the value of setup, if any
+  setup                                 ; function, or nil
+  teardown)                             ; function of the value of setup
+
+(defvar *benchmarks* ())
+
+(defmacro defbenchmark (name (&key category setup teardown) lambda-list
+                             &body body)
+  "Define a benchmark named by the keyword NAME, which runs BODY.  If
+SETUP is given, it's a form that's evaluated before the benchmark's
+runs and whose value is passed to BODY (as the only element of
+LAMBDA-LIST) and then to the function TEARDOWN."
+  `(progn
+     (setq *benchmarks*
+           (append (remove ,name *benchmarks* :key #'benchmark-name)
+                   (list (make-benchmark ,name ,category
+                                         (nfunction ,name (lambda ,lambda-list ,@body))
+                                         ,(if setup `(lambda () ,setup))
+                                         ,teardown))))
+     ,name))
+
+;;; Keep the compiler from deciding that the work isn't needed.
+(defvar *benchmark-sink* nil)
+
+
+;;; Allocation and GC.
+
+(defbenchmark :cons-allocation (:category :allocation) ()
+  (dotimes (i 20)
+    (let* ((list ()))
+      (dotimes (j 100000)
+        (push j list))
+      (setq *benchmark-sink* list))))
+
+(defbenchmark :ivector-allocation (:category :allocation) ()
+  (dotimes (i 20000)
+    (setq *benchmark-sink* (make-array 1000 :element-type '(unsigned-byte 8))))
+  (dotimes (i 20000)
+    (setq *benchmark-sink* (make-array 100 :element-type 'double-float))))
+
+;;; Lots of short-lived garbage, which the EGC should collect cheaply.
+(defbenchmark :egc-churn (:category :gc
+                          :setup (prog1 (egc-enabled-p) (egc t))
+                          :teardown #'egc)
+    (egc-was-enabled)
+  (declare (ignore egc-was-enabled))
+  (let* ((keep (make-array 64)))
+    (dotimes (i 2000000)
+      (setf (svref keep (logand i 63)) (list i i)))
+    (setq *benchmark-sink* keep)))
+
+;;; A full GC with a large, pointer-rich live heap.
+(defbenchmark :full-gc (:category :gc
+                        :setup (let* ((v (make-array 200000)))
+                                 (dotimes (i (length v) v)
+                                   (setf (svref v i)
+                                         (list i (make-string 8) (cons i i))))))
+    (live)
+  (setq *benchmark-sink* live)
+  (gc))
+
+
+;;; Hash tables.
+
+(defun %benchmark-hash-table (table keys)
+  (declare (simple-vector keys))
+  (dotimes (pass 4)
+    (dotimes (i (length keys))
+      (setf (gethash (svref keys i) table) i))
+    (dotimes (i (length keys))
+      (gethash (svref keys i) table))
+    (dotimes (i (length keys))
+      (when (logbitp 0 i)
+        (remhash (svref keys i) table))))
+  (setq *benchmark-sink* table))
+
+(defun %benchmark-hash-keys (n type)
+  (let* ((keys (make-array n)))
+    (dotimes (i n keys)
+      (setf (svref keys i)
+            (ecase type
+              (:symbol (make-symbol (format nil "K~d" i)))
+              (:number (if (oddp i) (* i 1.5d0) (* i 1000003)))
+              (:string (format nil "key-~d" i)))))))
+
+(defbenchmark :eq-hash-table (:category :hashing
+                              :setup (%benchmark-hash-keys 100000 :symbol))
+    (keys)
+  (%benchmark-hash-table (make-hash-table :test 'eq :lock-free nil :shared nil) keys))
+
+(defbenchmark :eql-hash-table (:category :hashing
+                               :setup (%benchmark-hash-keys 100000 :number))
+    (keys)
+  (%benchmark-hash-table (make-hash-table :test 'eql :lock-free nil :shared nil) keys))
+
+(defbenchmark :equal-hash-table (:category :hashing
+                                 :setup (%benchmark-hash-keys 100000 :string))
+    (keys)
+  (%benchmark-hash-table (make-hash-table :test 'equal :lock-free nil :shared nil) keys))
+
+(defbenchmark :weak-hash-table (:category :hashing
+                                :setup (%benchmark-hash-keys 100000 :symbol))
+    (keys)
+  (%benchmark-hash-table (make-hash-table :test 'eq :weak :key) keys))
+
+(defbenchmark :lock-free-hash-table (:category :hashing
+                                     :setup (%benchmark-hash-keys 100000 :symbol))
+    (keys)
+  (%benchmark-hash-table (make-hash-table :test 'eq :lock-free t :shared t) keys))
+
+(defbenchmark :locked-hash-table (:category :hashing
+                                  :setup (%benchmark-hash-keys 100000 :symbol))
+    (keys)
+  (%benchmark-hash-table (make-hash-table :test 'eq :lock-free nil :shared t) keys))
+
+
+;;; CLOS dispatch.
+
+(defclass benchmark-a () ((x :initform 1 :accessor benchmark-x)))
+(defclass benchmark-b (benchmark-a) ())
+(defclass benchmark-c (benchmark-a) ())
+(defclass benchmark-d (benchmark-b benchmark-c) ())
+(defclass benchmark-e () ((x :initform 2 :accessor benchmark-x)))
+
+(defgeneric benchmark-gf (x y))
+(defmethod benchmark-gf ((x benchmark-a) y) y)
+(defmethod benchmark-gf ((x benchmark-b) y) (1+ (call-next-method)))
+(defmethod benchmark-gf ((x benchmark-c) (y fixnum)) (1- (call-next-method)))
+(defmethod benchmark-gf ((x benchmark-e) y) (- y))
+(defmethod benchmark-gf :around ((x benchmark-d) y) (call-next-method))
+
+(defbenchmark :clos-monomorphic (:category :clos
+                                 :setup (make-instance 'benchmark-b))
+    (instance)
+  (let* ((sum 0))
+    (declare (fixnum sum))
+    (dotimes (i 2000000)
+      (setq sum (logand most-positive-fixnum
+                        (+ sum (benchmark-gf instance i) (benchmark-x instance)))))
+    (setq *benchmark-sink* sum)))
+
+(defbenchmark :clos-megamorphic (:category :clos
+                                 :setup (map 'vector #'make-instance
+                                             '(benchmark-a benchmark-b benchmark-c
+                                               benchmark-d benchmark-e)))
+    (instances)
+  (let* ((sum 0))
+    (declare (fixnum sum) (simple-vector instances))
+    (dotimes (i 2000000)
+      (let* ((instance (svref instances (mod i 5))))
+        (setq sum (logand most-positive-fixnum
+                          (+ sum (benchmark-gf instance i) (benchmark-x instance))))))
+    (setq *benchmark-sink* sum)))
+
+(defbenchmark :make-instance (:category :clos) ()
+  (dotimes (i 200000)
+    (setq *benchmark-sink* (make-instance 'benchmark-d))))
+
+
+;;; Streams.
+
+(defparameter *benchmark-line*
+  "The quick brown fox jumps over the lazy dog; 0123456789 ABCDEFGHIJ.")
+
+;;; The same, with some 2- and 3-octet characters in UTF-8.
+(defparameter *benchmark-utf-8-line*
+  (concatenate 'string *benchmark-line*
+               (map 'string #'code-char '(32 #xe9 #xe8 #xfc #x3bb #x6771 #x4eac #x2192))))
+
+(defun %benchmark-write-lines (stream n &optional (line *benchmark-line*))
+  (dotimes (i n)
+    (write-string line stream)
+    (terpri stream)))
+
+(defun %benchmark-read-lines (stream)
+  (let* ((n 0))
+    (loop
+      (unless (read-line stream nil nil)
+        (return n))
+      (incf n))))
+
+(defbenchmark :file-write-string (:category :streams
+                                  :setup (temp-pathname)
+                                  :teardown #'delete-file)
+    (path)
+  (with-open-file (out path :direction :output :if-exists :supersede)
+    (%benchmark-write-lines out 200000)))
+
+(defbenchmark :file-read-line (:category :streams
+                               :setup (let* ((path (temp-pathname)))
+                                        (with-open-file (out path :direction :output
+                                                                  :if-exists :supersede)
+                                          (%benchmark-write-lines out 200000))
+                                        path)
+                               :teardown #'delete-file)
+    (path)
+  (with-open-file (in path)
+    (setq *benchmark-sink* (%benchmark-read-lines in))))
+
+(defbenchmark :utf-8-file-read-line (:category :streams
+                                     :setup (let* ((path (temp-pathname)))
+                                              (with-open-file (out path :direction :output
+                                                                   :if-exists :supersede
+                                                                   :external-format :utf-8)
+                                                (%benchmark-write-lines out 200000))
+                                              path)
+                                     :teardown #'delete-file)
+    (path)
+  (with-open-file (in path :external-format :utf-8)
+    (setq *benchmark-sink* (%benchmark-read-lines in))))
+
+(defbenchmark :utf-8-multibyte-read-line (:category :streams
+                                          :setup (let* ((path (temp-pathname)))
+                                                   (with-open-file (out path :direction :output
+                                                                        :if-exists :supersede
+                                                                        :external-format :utf-8)
+                                                     (%benchmark-write-lines out 200000 *benchmark-utf-8-line*))
+                                                   path)
+                                          :teardown #'delete-file)
+    (path)
+  (with-open-file (in path :external-format :utf-8)
+    (setq *benchmark-sink* (%benchmark-read-lines in))))
+
+(defun read-line-rate (pathname &key (external-format :default))
+  "Read all of the lines in the file PATHNAME, and return the number of
+lines read per second and the number of lines."
+  (let* ((start (current-time-in-nanoseconds))
+         (n (with-open-file (in pathname :external-format external-format)
+              (%benchmark-read-lines in)))
+         (elapsed (/ (- (current-time-in-nanoseconds) start) 1d9)))
+    (values (if (zerop elapsed) 0 (round n elapsed)) n)))
+
+;;; Send lines from another thread over a loopback TCP connection.
+(defbenchmark :socket-lines (:category :streams
+                             :setup (make-socket :connect :passive
+                                                 :local-host "127.0.0.1"
+                                                 :local-port 0
+                                                 :reuse-address t)
+                             :teardown #'close)
+    (listener)
+  (let* ((port (local-port listener))
+         (done (make-semaphore)))
+    (process-run-function
+     "benchmark writer"
+     #'(lambda ()
+         (unwind-protect
+              (with-open-stream (s (make-socket :remote-host "127.0.0.1"
+                                                :remote-port port))
+                (%benchmark-write-lines s 200000))
+           (signal-semaphore done))))
+    (with-open-stream (s (accept-connection listener))
+      (setq *benchmark-sink* (%benchmark-read-lines s)))
+    (wait-on-semaphore done)))
+
+
+;;; The reader and printer.
+
+(defun %benchmark-form ()
+  (let* ((*random-state* (make-random-state nil)))
+    (loop for i below 2000
+          collect (list (intern (format nil "SYM-~d" (mod i 97)) :keyword)
+                        i
+                        (/ i 7)
+                        (* i 1.25d0)
+                        (format nil "string ~d" i)
+                        #(1 2 3)
+                        (cons 'quote (list i))))))
+
+(defbenchmark :reader (:category :reader
+                       :setup (with-standard-io-syntax
+                                (prin1-to-string (%benchmark-form))))
+    (text)
+  (with-standard-io-syntax
+    (dotimes (i 10)
+      (setq *benchmark-sink* (read-from-string text)))))
+
+(defbenchmark :printer (:category :printer
+                        :setup (%benchmark-form))
+    (form)
+  (with-standard-io-syntax
+    (dotimes (i 10)
+      (setq *benchmark-sink* (prin1-to-string form)))
+    (let* ((*print-pretty* t))
+      (setq *benchmark-sink* (prin1-to-string form)))))
+
+
+;;; Fasl loading.
+
+(defun %benchmark-make-fasl ()
+  (let* ((source (merge-pathnames (make-pathname :type "lisp") (temp-pathname))))
+    (with-open-file (out source :direction :output :if-exists :supersede)
+      (with-standard-io-syntax
+        (let* ((*package* (find-package "CL-USER")))
+          (dotimes (i 300)
+            (let* ((name (format nil "BENCHMARK-FASL-FN-~d" i)))
+              (print `(defun ,(intern name) (x y)
+                        (if (consp x)
+                          (list ,name (car x) y #(1 2.0 "three"))
+                          (+ x y ,i)))
+                     out)
+              (print `(defparameter ,(intern (format nil "*~a*" name))
+                        '(,i ,(* i 1.5d0) ,name (a b c)))
+                     out))))))
+    (prog1 (let* ((*compile-verbose* nil))
+             (compile-file source))
+      (delete-file source))))
+
+(defbenchmark :fasl-load (:category :fasl
+                          :setup (%benchmark-make-fasl)
+                          :teardown #'delete-file)
+    (fasl)
+  (let* ((*load-verbose* nil)
+         (*warn-if-redefine* nil))
+    (dotimes (i 5)
+      (load fasl))))
+
+
+;;; Running benchmarks and reporting the results.
+
+(defun %benchmark-statistics (samples)
+  (let* ((n (length samples))
+         (sorted (sort (copy-list samples) #'<))
+         (mean (/ (reduce #'+ samples) n))
+         (median (if (oddp n)
+                   (nth (floor n 2) sorted)
+                   (/ (+ (nth (1- (floor n 2)) sorted) (nth (floor n 2) sorted)) 2)))
+         (variance (if (> n 1)
+                     (/ (reduce #'+ samples :key #'(lambda (x) (expt (- x mean) 2)))
+                        (1- n))
+                     0d0)))
+    (list :mean mean
+          :median median
+          :min (first sorted)
+          :max (car (last sorted))
+          :stddev (sqrt variance)
+          :variance variance)))
+
+(defun %run-benchmark (benchmark iterations)
+  (let* ((setup (benchmark-setup benchmark))
+         (arg (if setup (funcall setup)))
+         (args (if setup (list arg)))
+         (fn (benchmark-function benchmark))
+         (samples ())
+         (gc-samples ())
+         (allocated ()))
+    (unwind-protect
+         (progn
+           ;; One untimed run, to warm caches and fill dispatch tables.
+           (apply fn args)
+           (gc)
+           (dotimes (i iterations)
+             (let* ((gc-start (gctime))
+                    (bytes-start (total-bytes-allocated))
+                    (start (current-time-in-nanoseconds)))
+               (apply fn args)
+               (push (/ (- (current-time-in-nanoseconds) start) 1d9) samples)
+               (push (/ (- (gctime) gc-start) (float internal-time-units-per-second 0d0))
+                     gc-samples)
+               (push (- (total-bytes-allocated) bytes-start) allocated))))
+      (setq *benchmark-sink* nil)
+      (when (and setup (benchmark-teardown benchmark))
+        (funcall (benchmark-teardown benchmark) arg)))
+    (setq samples (nreverse samples))
+    `(:name ,(benchmark-name benchmark)
+      :category ,(benchmark-category benchmark)
+      ,@(%benchmark-statistics samples)
+      :gc-mean ,(/ (reduce #'+ gc-samples) iterations)
+      :bytes-allocated ,(round (reduce #'+ allocated) iterations)
+      :samples ,samples)))
+
+;;; A benchmark is considered to have changed when its median has
+;;; moved by more than THRESHOLD (a fraction) and by more than twice
+;;; the larger of the two standard deviations.
+(defun %compare-benchmark (result base threshold)
+  (let* ((median (getf result :median))
+         (base-median (getf base :median))
+         (noise (* 2 (max (getf result :stddev) (getf base :stddev))))
+         (ratio (if (zerop base-median) 1d0 (/ median base-median))))
+    (list :name (getf result :name)
+          :ratio ratio
+          :status (cond ((<= (abs (- median base-median)) noise) :same)
+                        ((> ratio (+ 1 threshold)) :slower)
+                        ((< ratio (- 1 threshold)) :faster)
+                        (t :same)))))
+
+(defun %read-benchmark-results (pathname)
+  (with-open-file (in pathname)
+    (with-standard-io-syntax
+      (let* ((*read-eval* nil)
+             (data (read in)))
+        (unless (and (consp data) (eq (car data) :benchmark-results))
+          (error "~s doesn't contain benchmark results." pathname))
+        (cdr data)))))
+
+(defun run-benchmarks (&key (output "ccl:benchmark-results.lisp")
+                            baseline
+                            (iterations 5)
+                            only
+                            (threshold 0.1)
+                            (stream *standard-output*))
+  (let* ((benchmarks (if only
+                       (remove-if-not #'(lambda (b)
+                                          (or (member (benchmark-name b) only)
+                                              (member (benchmark-category b) only)))
+                                      *benchmarks*)
+                       *benchmarks*))
+         (base-results (if baseline
+                         (getf (%read-benchmark-results baseline) :results)))
+         (results ())
+         (comparisons ()))
+    (format stream "~&;~a benchmarks, ~d iterations each~%"
+            (lisp-implementation-version) iterations)
+    (format stream "~&~24a ~12@a ~12@a ~8@a ~10@a ~8@a~%"
+            "Benchmark" "Median (s)" "Stddev (s)" "GC (s)" "MB" "Ratio")
+    (dolist (b benchmarks)
+      (let* ((result (%run-benchmark b iterations))
+             (base (find (benchmark-name b) base-results
+                         :key #'(lambda (r) (getf r :name))))
+             (comparison (if base (%compare-benchmark result base threshold))))
+        (push result results)
+        (when comparison (push comparison comparisons))
+        (format stream "~&~24a ~12,4f ~12,4f ~8,3f ~10,1f ~@[~8,3f~]~@[ ~a~]~%"
+                (string-downcase (benchmark-name b))
+                (getf result :median)
+                (getf result :stddev)
+                (getf result :gc-mean)
+                (/ (getf result :bytes-allocated) (* 1024 1024.0))
+                (getf comparison :ratio)
+                (case (getf comparison :status)
+                  (:slower "SLOWER")
+                  (:faster "faster")))
+        (force-output stream)))
+    (setq results (nreverse results)
+          comparisons (nreverse comparisons))
+    (when output
+      (with-open-file (out output :direction :output :if-exists :supersede)
+        (with-standard-io-syntax
+          (let* ((*print-readably* nil))
+            (pprint `(:benchmark-results
+                      :lisp-implementation-version ,(lisp-implementation-version)
+                      :machine-instance ,(machine-instance)
+                      :machine-version ,(machine-version)
+                      :date ,(get-universal-time)
+                      :iterations ,iterations
+                      :results ,results
+                      ,@(when baseline
+                          `(:baseline ,(namestring (truename baseline))
+                            :threshold ,threshold
+                            :comparisons ,comparisons)))
+                    out)
+            (terpri out)))))
+    (let* ((slower (remove :slower comparisons
+                           :key #'(lambda (c) (getf c :status)) :test-not #'eq)))
+      (when slower
+        (format stream "~&;~d benchmark~:p slower than the baseline: ~{~(~a~)~^, ~}~%"
+                (length slower) (mapcar #'(lambda (c) (getf c :name)) slower)))
+      (values results (mapcar #'(lambda (c) (getf c :name)) slower)))))
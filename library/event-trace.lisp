@@ -0,0 +1,269 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; event-trace.lisp
+; A timeline of what each thread was doing.  While tracing is enabled,
+; each thread records timed events in its own ring buffer: GCs (in the
+; thread that does them) and the time other threads spend suspended
+; for them, exception handling, waits for locks, foreign function calls
+; (on x86-64) and spans of lisp code delimited by WITH-TRACE-SPAN.  When
+; a buffer fills up, its oldest events are overwritten, so tracing can
+; be left on.  WRITE-CHROME-TRACE writes the buffers' contents in the
+; Chrome Trace Event format, which chrome://tracing and Perfetto
+; (https://ui.perfetto.dev) display.
+
+(in-package :ccl)
+
+(export '(start-event-tracing
+          stop-event-tracing
+          with-event-tracing
+          with-trace-span
+          write-chrome-trace))
+
+;;; Layout of the kernel's trace_buffer and trace_record structs (see
+;;; threads.h), as byte offsets.
+(eval-when (:compile-toplevel :load-toplevel :execute)
+  (defconstant trace-buffer.tcr (* 1 target::node-size))
+  (defconstant trace-buffer.nrecords (* 2 target::node-size))
+  (defconstant trace-buffer.head (* 3 target::node-size))
+  (defconstant trace-buffer.records (* 4 target::node-size))
+  (defconstant trace-record.time 0)
+  (defconstant trace-record.duration 8)
+  (defconstant trace-record.event 16)
+  (defconstant trace-record.phase 24)
+  (defconstant trace-record.arg 32)
+  (defconstant trace-record-size 40))
+
+;;; TRACE_EVENT_xxx and TRACE_PHASE_xxx
+(eval-when (:compile-toplevel :load-toplevel :execute)
+  (defconstant trace-event-exception 4)
+  (defconstant trace-event-ffcall 6)
+  (defconstant trace-event-span 7)
+  (defconstant trace-phase-begin 0)
+  (defconstant trace-phase-end 1)
+  (defconstant trace-phase-complete 2))
+
+;;; Names and categories of the kernel's events, indexed by event.
+(defparameter *trace-event-names*
+  #(nil ("GC" . "gc") ("suspend threads" . "gc") ("suspended" . "gc")
+    ("exception" . "exception") ("lock wait" . "lock")
+    ("ff-call" . "ffcall") (nil . "lisp")))
+
+(defvar *trace-spans-lock* (make-lock "trace spans"))
+(defvar *trace-span-indices* (make-hash-table :test #'equal))
+(defvar *trace-span-names* (make-array 16 :adjustable t :fill-pointer 0))
+
+(defun start-event-tracing (&key (buffer-size 65536) (ffcalls t))
+  "Start recording events in each thread's trace buffer, which holds
+the last BUFFER-SIZE (rounded up to a power of 2) of them.  If FFCALLS
+is true, foreign function calls are traced where that's supported."
+  (let* ((err (ff-call (%kernel-import target::kernel-import-lisp-trace-start)
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword buffer-size
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword (if ffcalls 1 0)
+                       :signed-fullword)))
+    (unless (zerop err)
+      (error "Can't start event tracing: ~a" (%strerror err)))
+    (setq *event-tracing* t)))
+
+(defun stop-event-tracing ()
+  "Stop recording events.  The events recorded so far stay in the
+trace buffers until tracing is started again."
+  (setq *event-tracing* nil)
+  (ff-call (%kernel-import target::kernel-import-lisp-trace-stop)
+           :signed-fullword)
+  nil)
+
+(defmacro with-event-tracing ((&rest args) &body body)
+  "Run BODY with event tracing started (with ARGS); stop it afterwards."
+  `(unwind-protect
+        (progn
+          (start-event-tracing ,@args)
+          ,@body)
+     (stop-event-tracing)))
+
+(defun %trace-event (event phase arg)
+  (ff-call (%kernel-import target::kernel-import-lisp-trace-event)
+           #+64-bit-target :unsigned-doubleword
+           #+32-bit-target :unsigned-fullword event
+           #+64-bit-target :unsigned-doubleword
+           #+32-bit-target :unsigned-fullword phase
+           #+64-bit-target :unsigned-doubleword
+           #+32-bit-target :unsigned-fullword arg
+           :void))
+
+(defun %trace-span-index (name)
+  (with-lock-grabbed (*trace-spans-lock*)
+    (or (gethash name *trace-span-indices*)
+        (setf (gethash name *trace-span-indices*)
+              (vector-push-extend name *trace-span-names*)))))
+
+(defun call-with-trace-span (name fn)
+  (let* ((index (%trace-span-index name)))
+    (%trace-event trace-event-span trace-phase-begin index)
+    (unwind-protect
+         (funcall fn)
+      (%trace-event trace-event-span trace-phase-end index))))
+
+(defmacro with-trace-span ((name) &body body)
+  "Run BODY, recording it as a span named NAME (which is printed with
+PRINC) in the current thread's trace buffer if event tracing is
+enabled."
+  (let* ((fn (gensym)))
+    `(flet ((,fn () ,@body))
+       (declare (dynamic-extent #',fn))
+       (if *event-tracing*
+         (call-with-trace-span ,name #',fn)
+         (,fn)))))
+
+(defun %trace-buffers ()
+  (flet ((get-buffers (v n)
+           (ff-call (%kernel-import target::kernel-import-lisp-trace-buffers)
+                    :address v
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword n
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword)))
+    (let* ((n (get-buffers (%null-ptr) 0)))
+      (unless (zerop n)
+        (%stack-block ((v (* n target::node-size)))
+          (setq n (min n (get-buffers v n)))
+          (collect ((buffers))
+            (dotimes (i n (buffers))
+              (buffers (%get-ptr v (* i target::node-size))))))))))
+
+;;; Call FN on the time, duration, event, phase and arg of each record
+;;; in BUF, oldest first.
+(defun %map-trace-buffer (buf fn)
+  (let* ((nrecords (%get-natural buf trace-buffer.nrecords))
+         (head (%get-natural buf trace-buffer.head))
+         (records (%get-ptr buf trace-buffer.records)))
+    (do* ((i (max 0 (- head nrecords)) (1+ i)))
+         ((>= i head))
+      (let* ((base (* (logand i (1- nrecords)) trace-record-size)))
+        (flet ((field (offset) (%%get-unsigned-longlong records (+ base offset))))
+          (funcall fn
+                   (field trace-record.time)
+                   (field trace-record.duration)
+                   (field trace-record.event)
+                   (field trace-record.phase)
+                   (field trace-record.arg)))))))
+
+(defun %foreign-entry-name (address)
+  #-windows-target
+  (rlet ((info #>Dl_info))
+    (unless (eql 0 (#_dladdr (%int-to-ptr address) info))
+      (let* ((name (pref info #>Dl_info.dli_sname)))
+        (unless (%null-ptr-p name)
+          (%get-cstring name)))))
+  #+windows-target
+  (progn address nil))
+
+(defun %write-trace-json-string (string stream)
+  (write-char #\" stream)
+  (dotimes (i (length string))
+    (let* ((c (char string i)))
+      (cond ((or (char= c #\") (char= c #\\))
+             (write-char #\\ stream)
+             (write-char c stream))
+            ((< (char-code c) 32)
+             (format stream "\\u~4,'0x" (char-code c)))
+            (t (write-char c stream)))))
+  (write-char #\" stream))
+
+;;; Trace Event timestamps are in microseconds.
+(defun %write-trace-microseconds (ns stream)
+  (multiple-value-bind (us frac) (floor ns 1000)
+    (format stream "~d.~3,'0d" us frac)))
+
+(defun write-chrome-trace (pathname &key (if-exists :supersede))
+  "Write the events in all threads' trace buffers to PATHNAME in the
+Chrome Trace Event (JSON) format."
+  (let* ((pid (getpid))
+         (entry-names (make-hash-table))
+         (first t))
+    (with-open-file (stream pathname :direction :output :if-exists if-exists)
+      (flet ((begin-event (name category phase tid)
+               (if first
+                 (setq first nil)
+                 (format stream ",~%"))
+               (write-string "{\"name\":" stream)
+               (%write-trace-json-string name stream)
+               (when category
+                 (write-string ",\"cat\":" stream)
+                 (%write-trace-json-string category stream))
+               (format stream ",\"ph\":\"~a\",\"pid\":~d,\"tid\":~d" phase pid tid)))
+        (write-string "{\"traceEvents\":[" stream)
+        (let* ((tid 0))
+          (dolist (buf (%trace-buffers))
+            (let* ((process (tcr->process (%get-object buf trace-buffer.tcr)))
+                   (depth 0))
+              (incf tid)
+              (begin-event "thread_name" nil "M" tid)
+              (write-string ",\"args\":{\"name\":" stream)
+              (%write-trace-json-string (if process
+                                          (format nil "~a" (process-name process))
+                                          (format nil "thread ~d (exited)" tid))
+                                        stream)
+              (write-string "}}" stream)
+              (%map-trace-buffer
+               buf
+               #'(lambda (time duration event phase arg)
+                   (let* ((info (and (< event (length *trace-event-names*))
+                                     (svref *trace-event-names* event))))
+                     ;; Skip unknown events, and ends whose beginnings
+                     ;; have been overwritten.
+                     (when (and info
+                                (or (/= phase trace-phase-end)
+                                    (> depth 0)))
+                       (cond ((= phase trace-phase-begin) (incf depth))
+                             ((= phase trace-phase-end) (decf depth)))
+                       (begin-event (if (= event trace-event-span)
+                                      (let* ((names *trace-span-names*))
+                                        (if (< arg (length names))
+                                          (princ-to-string (aref names arg))
+                                          "span"))
+                                      (car info))
+                                    (cdr info)
+                                    (case phase
+                                      (#.trace-phase-begin "B")
+                                      (#.trace-phase-end "E")
+                                      (#.trace-phase-complete "X")
+                                      (t "i"))
+                                    tid)
+                       (write-string ",\"ts\":" stream)
+                       (%write-trace-microseconds time stream)
+                       (when (= phase trace-phase-complete)
+                         (write-string ",\"dur\":" stream)
+                         (%write-trace-microseconds duration stream))
+                       (when (= phase trace-phase-begin)
+                         (case event
+                           (#.trace-event-exception
+                            (format stream ",\"args\":{\"signal\":~d}" arg))
+                           (#.trace-event-ffcall
+                            (let* ((name (or (gethash arg entry-names)
+                                             (setf (gethash arg entry-names)
+                                                   (or (%foreign-entry-name arg)
+                                                       (format nil "#x~x" arg))))))
+                              (write-string ",\"args\":{\"entry\":" stream)
+                              (%write-trace-json-string name stream)
+                              (write-string "}" stream)))))
+                       (when (= phase trace-phase-complete)
+                         (format stream ",\"args\":{\"lock\":\"#x~x\"}" arg))
+                       (write-string "}" stream))))))))
+        (format stream "~%],\"displayTimeUnit\":\"ns\"}~%")))
+    pathname))
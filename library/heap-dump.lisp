@@ -0,0 +1,779 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; heap-dump.lisp
+; Find out what's keeping memory alive, from the heap dumps that
+; DUMP-HEAP writes (the format is described in the kernel's x86-gc.c.)
+; OPEN-HEAP-DUMP reads a dump into arrays indexed by object; everything
+; else works on those arrays, so (unlike the core file tools in
+; core-files.lisp, dominance.lisp and leaks.lisp, which read a core
+; one word at a time) it's practical for very large heaps.  There are
+; equivalents of CORE-HEAP-UTILIZATION and IDOM-HEAP-UTILIZATION, the
+; retained size of each object (the memory that would be freed if it
+; were), the referencers of an object and a path from a root to it,
+; and a comparison of two dumps by type.  A dump can only be read by a
+; lisp with the same architecture as the one that wrote it.
+
+(in-package :ccl)
+
+(export '(open-heap-dump
+          heap-dump-object-count
+          heap-dump-object-address
+          heap-dump-object-index
+          heap-dump-object-type
+          heap-dump-object-size
+          heap-dump-object-description
+          heap-dump-retained-size
+          heap-dump-immediate-dominator
+          heap-dump-utilization
+          heap-dump-idom-utilization
+          heap-dump-largest-retainers
+          heap-dump-objects-of-type
+          heap-dump-referencers
+          heap-dump-path-to-root
+          heap-dump-growth))
+
+(eval-when (:compile-toplevel :load-toplevel :execute)
+  (defconstant heap-dump-version 1)
+  (defconstant heap-dump-header-size 40)
+  (defconstant heap-dump-block-header-size 24)
+  (defconstant heap-dump-end-block-size (+ heap-dump-block-header-size 32))
+  (defconstant heap-dump-block-end 0)
+  (defconstant heap-dump-block-objects 1)
+  (defconstant heap-dump-block-roots 2)
+  (defconstant heap-dump-block-names 3)
+  ;; An index that doesn't denote an object (or that denotes the root
+  ;; of the dominator tree.)
+  (defconstant heap-dump-no-object #xffffffff))
+
+;;; Indexed by HEAP_DUMP_ROOT_xxx.
+(defparameter *heap-dump-root-kinds* #(nil :vstack :tstack :register :tlb :static))
+
+(defstruct (heap-dump (:constructor %make-heap-dump))
+  pathname
+  areas                                 ; list of (area-code low high)
+  (nthreads 0)
+  ;; Objects, sorted by address
+  (addresses nil :type (or null (simple-array (unsigned-byte 64) (*))))
+  (subtags nil :type (or null (simple-array (unsigned-byte 8) (*))))
+  (counts nil :type (or null (simple-array (unsigned-byte 64) (*))))
+  ;; The references from object i are elements (aref ref-starts i)
+  ;; below (aref ref-starts (1+ i)) of ref-slots and ref-targets.
+  (ref-starts nil :type (or null (simple-array (unsigned-byte 64) (*))))
+  (ref-slots nil :type (or null (simple-array (unsigned-byte 32) (*))))
+  (ref-targets nil :type (or null (simple-array (unsigned-byte 32) (*))))
+  ;; Roots: kind (as in *heap-dump-root-kinds*), thread, source, object
+  (root-kinds nil :type (or null (simple-array (unsigned-byte 8) (*))))
+  (root-threads nil :type (or null (simple-array (unsigned-byte 32) (*))))
+  (root-sources nil :type (or null (simple-array (unsigned-byte 64) (*))))
+  (root-targets nil :type (or null (simple-array (unsigned-byte 32) (*))))
+  (names (make-hash-table))             ; symbol index -> name
+  ;; Computed when needed
+  (idoms nil :type (or null (simple-array (unsigned-byte 32) (*))))
+  (retained nil :type (or null (simple-array (unsigned-byte 64) (*)))))
+
+(defmethod print-object ((dump heap-dump) stream)
+  (print-unreadable-object (dump stream :type t :identity t)
+    (format stream "~a (~d objects)"
+            (heap-dump-pathname dump) (heap-dump-object-count dump))))
+
+(defun heap-dump-object-count (dump)
+  (length (heap-dump-addresses dump)))
+
+(defun heap-dump-object-address (dump index)
+  "The address of the object with index INDEX in DUMP."
+  (aref (heap-dump-addresses dump) index))
+
+(defun heap-dump-object-index (dump address)
+  "The index of the object at ADDRESS (which may be tagged) in DUMP, or
+NIL."
+  (%heap-dump-index (heap-dump-addresses dump)
+                    (logandc2 address (1- target::dnode-size))))
+
+(defun %heap-dump-index (addresses address)
+  (declare (type (simple-array (unsigned-byte 64) (*)) addresses)
+           (optimize (speed 3) (safety 0)))
+  (let* ((low 0)
+         (high (length addresses)))
+    (declare (fixnum low high))
+    (loop
+      (when (>= low high) (return nil))
+      (let* ((mid (ash (+ low high) -1))
+             (a (aref addresses mid)))
+        (declare (fixnum mid))
+        (cond ((= a address) (return mid))
+              ((< a address) (setq low (1+ mid)))
+              (t (setq high mid)))))))
+
+;;; Reading dumps
+
+(declaim (inline %heap-dump-varint))
+
+(defun %heap-dump-varint (octets i)
+  (declare (type (simple-array (unsigned-byte 8) (*)) octets)
+           (fixnum i)
+           (optimize (speed 3) (safety 0)))
+  (let* ((value 0)
+         (shift 0))
+    (declare (fixnum shift)
+             #+64-bit-target (fixnum value))
+    (loop
+      (let* ((b (aref octets i)))
+        (incf i)
+        (setq value (logior value (ash (logand b #x7f) shift)))
+        (if (< b #x80)
+          (return (values value i))
+          (incf shift 7))))))
+
+(defun %heap-dump-word (octets i nbytes)
+  (let* ((value 0))
+    (dotimes (j nbytes value)
+      (setq value (logior value (ash (aref octets (+ i j)) (* 8 j)))))))
+
+(defun %read-heap-dump-octets (stream n &optional buffer)
+  (let* ((octets (if (and buffer (>= (length buffer) n))
+                   buffer
+                   (make-array n :element-type '(unsigned-byte 8)))))
+    (unless (eql (read-sequence octets stream :end n) n)
+      (error "Unexpected end of heap dump ~s." (pathname stream)))
+    octets))
+
+(defun %read-heap-dump-block-header (stream buffer)
+  (let* ((h (%read-heap-dump-octets stream heap-dump-block-header-size buffer)))
+    (values (%heap-dump-word h 0 4)
+            (%heap-dump-word h 4 4)
+            (%heap-dump-word h 8 8)
+            (%heap-dump-word h 16 8))))
+
+(defun %decode-heap-dump-roots (octets count roots)
+  (let* ((i 0))
+    (dotimes (j count)
+      (let* ((kind (aref octets i)))
+        (multiple-value-bind (thread next) (%heap-dump-varint octets (1+ i))
+          (multiple-value-bind (source next) (%heap-dump-varint octets next)
+            (multiple-value-bind (target next) (%heap-dump-varint octets next)
+              (vector-push-extend (list kind thread source (ash target target::dnode-shift))
+                                  roots)
+              (setq i next))))))))
+
+(defun %decode-heap-dump-names (octets count names)
+  (let* ((i 0))
+    (dotimes (j count)
+      (multiple-value-bind (address next) (%heap-dump-varint octets i)
+        (multiple-value-bind (nbytes next) (%heap-dump-varint octets next)
+          (setf (gethash (ash address target::dnode-shift) names)
+                (decode-string-from-octets octets :start next :end (+ next nbytes)
+                                                  :external-format :utf-8))
+          (setq i (+ next nbytes)))))))
+
+;;; Decode the records in an objects block, starting with object index
+;;; FIRST and reference index REF.  Reference targets are stored as
+;;; addresses for now.  Returns the next reference index.
+(defun %decode-heap-dump-objects (octets count base first ref addresses subtags counts
+                                  ref-starts ref-slots ref-addresses)
+  (declare (type (simple-array (unsigned-byte 8) (*)) octets)
+           (type (simple-array (unsigned-byte 64) (*)) addresses counts ref-starts ref-addresses)
+           (type (simple-array (unsigned-byte 8) (*)) subtags)
+           (type (simple-array (unsigned-byte 32) (*)) ref-slots)
+           (fixnum count first ref)
+           (optimize (speed 3) (safety 0)))
+  (let* ((i 0)
+         (dnode (ash base (- target::dnode-shift))))
+    (declare (fixnum i dnode))
+    (dotimes (j count ref)
+      (let* ((index (+ first j))
+             (delta 0)
+             (subtag 0)
+             (nrefs 0)
+             (slot 0))
+        (declare (fixnum index delta subtag nrefs slot))
+        (multiple-value-setq (delta i) (%heap-dump-varint octets i))
+        (incf dnode delta)
+        (setq subtag (aref octets i))
+        (incf i)
+        (setf (aref addresses index) (ash dnode target::dnode-shift)
+              (aref subtags index) subtag)
+        (if (eql subtag target::fulltag-cons)
+          (setf (aref counts index) 0)
+          (multiple-value-bind (n next) (%heap-dump-varint octets i)
+            (setf (aref counts index) n
+                  i next)))
+        (multiple-value-setq (nrefs i) (%heap-dump-varint octets i))
+        (setf (aref ref-starts index) ref)
+        (dotimes (k nrefs)
+          (let* ((slot-delta 0)
+                 (zigzag 0))
+            (declare (fixnum slot-delta zigzag))
+            (multiple-value-setq (slot-delta i) (%heap-dump-varint octets i))
+            (multiple-value-setq (zigzag i) (%heap-dump-varint octets i))
+            (incf slot slot-delta)
+            (setf (aref ref-slots ref) slot
+                  (aref ref-addresses ref)
+                  (ash (+ dnode (logxor (ash zigzag -1) (- (logand zigzag 1))))
+                       target::dnode-shift))
+            (incf ref)))))))
+
+(defun %resolve-heap-dump-refs (addresses ref-addresses ref-targets)
+  (declare (type (simple-array (unsigned-byte 64) (*)) addresses ref-addresses)
+           (type (simple-array (unsigned-byte 32) (*)) ref-targets)
+           (optimize (speed 3) (safety 0)))
+  (dotimes (i (length ref-addresses))
+    (setf (aref ref-targets i)
+          (or (%heap-dump-index addresses (aref ref-addresses i))
+              heap-dump-no-object))))
+
+(defun open-heap-dump (pathname)
+  "Read the heap dump that DUMP-HEAP wrote to PATHNAME."
+  (with-open-file (s pathname :element-type '(unsigned-byte 8))
+    (let* ((header (%read-heap-dump-octets s heap-dump-header-size))
+           (word-size (%heap-dump-word header 12 4))
+           (nthreads (%heap-dump-word header 24 8))
+           (nareas (%heap-dump-word header 32 8))
+           (buffer (make-array heap-dump-block-header-size :element-type '(unsigned-byte 8)))
+           (names (make-hash-table))
+           (roots (make-array 1024 :adjustable t :fill-pointer 0))
+           (object-blocks ())
+           (areas ())
+           (end-pos (- (file-length s) heap-dump-end-block-size)))
+      (unless (string= (map 'string #'code-char (subseq header 0 8)) "CCLHDUMP")
+        (error "~s isn't a heap dump." pathname))
+      (unless (eql (%heap-dump-word header 8 4) heap-dump-version)
+        (error "~s is a version ~d heap dump; this lisp reads version ~d."
+               pathname (%heap-dump-word header 8 4) heap-dump-version))
+      (unless (eql word-size target::node-size)
+        (error "~s was written by a lisp with ~d-byte words." pathname word-size))
+      (dotimes (i nareas)
+        (let* ((info (%read-heap-dump-octets s 24)))
+          (push (list (%heap-dump-word info 0 8) (%heap-dump-word info 8 8) (%heap-dump-word info 16 8))
+                areas)))
+      (let* ((start-pos (file-position s))
+             nobjects nrefs)
+        ;; The end block says how big to make everything.
+        (file-position s end-pos)
+        (multiple-value-bind (kind count) (%read-heap-dump-block-header s buffer)
+          (declare (ignore count))
+          (unless (eql kind heap-dump-block-end)
+            (error "The heap dump ~s is incomplete." pathname))
+          (let* ((totals (%read-heap-dump-octets s 32)))
+            (setq nobjects (%heap-dump-word totals 0 8)
+                  nrefs (%heap-dump-word totals 8 8))))
+        ;; Read the roots and names, and find the objects blocks.
+        (file-position s start-pos)
+        (loop while (< (file-position s) end-pos)
+              do (multiple-value-bind (kind count nbytes base)
+                     (%read-heap-dump-block-header s buffer)
+                   (cond ((eql kind heap-dump-block-objects)
+                          (push (list base count (file-position s) nbytes) object-blocks)
+                          (file-position s (+ (file-position s) nbytes)))
+                         ((eql kind heap-dump-block-roots)
+                          (%decode-heap-dump-roots (%read-heap-dump-octets s nbytes) count roots))
+                         ((eql kind heap-dump-block-names)
+                          (%decode-heap-dump-names (%read-heap-dump-octets s nbytes) count names))
+                         (t (file-position s (+ (file-position s) nbytes))))))
+        (setq object-blocks (sort object-blocks #'< :key #'car))
+        (let* ((addresses (make-array nobjects :element-type '(unsigned-byte 64)))
+               (subtags (make-array nobjects :element-type '(unsigned-byte 8)))
+               (counts (make-array nobjects :element-type '(unsigned-byte 64)))
+               (ref-starts (make-array (1+ nobjects) :element-type '(unsigned-byte 64)))
+               (ref-slots (make-array nrefs :element-type '(unsigned-byte 32)))
+               (ref-targets (make-array nrefs :element-type '(unsigned-byte 32)))
+               (nroots (length roots))
+               (root-kinds (make-array nroots :element-type '(unsigned-byte 8)))
+               (root-threads (make-array nroots :element-type '(unsigned-byte 32)))
+               (root-sources (make-array nroots :element-type '(unsigned-byte 64)))
+               (root-targets (make-array nroots :element-type '(unsigned-byte 32)))
+               (index-names (make-hash-table :size (hash-table-count names)))
+               (first 0)
+               (ref 0)
+               (octets nil))
+          (let* ((ref-addresses (make-array nrefs :element-type '(unsigned-byte 64))))
+            (loop for (base count pos nbytes) in object-blocks
+                  do (file-position s pos)
+                     (setq octets (%read-heap-dump-octets s nbytes octets))
+                     (setq ref (%decode-heap-dump-objects octets count base first ref
+                                                          addresses subtags counts
+                                                          ref-starts ref-slots ref-addresses))
+                     (incf first count))
+            (unless (and (eql first nobjects) (eql ref nrefs))
+              (error "The heap dump ~s is inconsistent." pathname))
+            (setf (aref ref-starts nobjects) nrefs)
+            (%resolve-heap-dump-refs addresses ref-addresses ref-targets))
+          (dotimes (i nroots)
+            (destructuring-bind (kind thread source target) (aref roots i)
+              (setf (aref root-kinds i) kind
+                    (aref root-threads i) thread
+                    (aref root-sources i) source
+                    (aref root-targets i) (or (%heap-dump-index addresses target)
+                                              heap-dump-no-object))))
+          (maphash (lambda (address name)
+                     (let* ((index (%heap-dump-index addresses address)))
+                       (when index
+                         (setf (gethash index index-names) name))))
+                   names)
+          (%make-heap-dump :pathname (pathname pathname)
+                           :areas (nreverse areas)
+                           :nthreads nthreads
+                           :addresses addresses
+                           :subtags subtags
+                           :counts counts
+                           :ref-starts ref-starts
+                           :ref-slots ref-slots
+                           :ref-targets ref-targets
+                           :root-kinds root-kinds
+                           :root-threads root-threads
+                           :root-sources root-sources
+                           :root-targets root-targets
+                           :names index-names))))))
+
+;;; Objects
+
+;;; The index of the object that the word with index SLOT of object I
+;;; refers to, or NIL.
+(defun %heap-dump-slot (dump i slot)
+  (when i
+    (let* ((slots (heap-dump-ref-slots dump))
+           (starts (heap-dump-ref-starts dump)))
+      (loop for k from (aref starts i) below (aref starts (1+ i))
+            do (let* ((s (aref slots k)))
+                 (when (>= s slot)
+                   (return (when (eql s slot)
+                             (let* ((target (aref (heap-dump-ref-targets dump) k)))
+                               (unless (eql target heap-dump-no-object)
+                                 target))))))))))
+
+(defun %heap-dump-name (dump i)
+  (and i (gethash i (heap-dump-names dump))))
+
+(eval-when (:compile-toplevel :execute)
+  (defconstant heap-dump-car-slot (ash (+ target::cons.car target::fulltag-cons) (- target::word-shift))))
+
+(defun heap-dump-object-type (dump i &optional cache)
+  "The type of the object with index I in DUMP: a symbol for built-in
+types, or the name of the class of a standard instance or of a
+structure, as a string (when the dump includes it.)"
+  (let* ((subtag (aref (heap-dump-subtags dump) i)))
+    (flet ((named (type name)
+             (or name type)))
+      (cond ((eql subtag target::fulltag-cons) 'cons)
+            ((eql subtag target::subtag-instance)
+             (let* ((wrapper (%heap-dump-slot dump i (1+ instance.class-wrapper))))
+               (flet ((class-name ()
+                        (let* ((class (%heap-dump-slot dump wrapper (1+ %wrapper-class)))
+                               (slots (%heap-dump-slot dump class (1+ instance.slots))))
+                          (named 'instance (%heap-dump-name dump (%heap-dump-slot dump slots (1+ %class.name)))))))
+                 (if (and cache wrapper)
+                   (or (gethash wrapper cache)
+                       (setf (gethash wrapper cache) (class-name)))
+                   (class-name)))))
+            ((eql subtag target::subtag-struct)
+             (let* ((cells (%heap-dump-slot dump i 1))
+                    (cell (%heap-dump-slot dump cells heap-dump-car-slot)))
+               (named 'structure (%heap-dump-name dump (%heap-dump-slot dump cell 2)))))
+            ((eql subtag target::subtag-istruct)
+             (let* ((cell (%heap-dump-slot dump i 1)))
+               (named 'internal-structure
+                      (%heap-dump-name dump (%heap-dump-slot dump cell heap-dump-car-slot)))))
+            (t (aref *heap-utilization-vector-type-names* subtag))))))
+
+(defun heap-dump-object-size (dump i)
+  "Returns the logical and physical sizes in bytes of the object with
+index I in DUMP."
+  (let* ((subtag (aref (heap-dump-subtags dump) i)))
+    (if (eql subtag target::fulltag-cons)
+      (values target::dnode-size target::dnode-size)
+      (let* ((logsize (funcall (arch::target-array-data-size-function
+                                (backend-target-arch *host-backend*))
+                               subtag (aref (heap-dump-counts dump) i))))
+        (values logsize
+                (logandc2 (+ logsize target::node-size (1- target::dnode-size))
+                          (1- target::dnode-size)))))))
+
+(defun heap-dump-object-description (dump i)
+  (let* ((type (heap-dump-object-type dump i))
+         (name (%heap-dump-name dump i)))
+    (format nil "#<~a~@[ ~a~] #x~x>" type name (heap-dump-object-address dump i))))
+
+;;; Dominators
+
+(defun %heap-dump-postorder (dump)
+  "Number the objects reachable from the roots in DFS postorder.
+Returns a vector of objects in postorder and a vector mapping objects
+to their postorder numbers (or heap-dump-no-object.)"
+  (let* ((n (heap-dump-object-count dump))
+         (starts (heap-dump-ref-starts dump))
+         (targets (heap-dump-ref-targets dump))
+         (roots (heap-dump-root-targets dump))
+         (order (make-array n :element-type '(unsigned-byte 32)))
+         (numbers (make-array n :element-type '(unsigned-byte 32)
+                                :initial-element heap-dump-no-object))
+         (stack (make-array n :element-type '(unsigned-byte 32)))
+         (edges (make-array n :element-type '(unsigned-byte 64)))
+         (sp 0)
+         (count 0))
+    (declare (type (simple-array (unsigned-byte 64) (*)) starts edges)
+             (type (simple-array (unsigned-byte 32) (*)) targets roots order numbers stack)
+             (fixnum n sp count)
+             (optimize (speed 3) (safety 0)))
+    ;; numbers is also the "seen" marker: a node that's on the stack
+    ;; has number n.
+    (dotimes (r (length roots))
+      (let* ((root (aref roots r)))
+        (when (and (not (eql root heap-dump-no-object))
+                   (eql (aref numbers root) heap-dump-no-object))
+          (setf (aref numbers root) n
+                (aref stack 0) root
+                (aref edges 0) (aref starts root)
+                sp 1)
+          (loop while (> sp 0)
+                do (let* ((node (aref stack (1- sp)))
+                          (edge (aref edges (1- sp))))
+                     (declare (fixnum node edge))
+                     (if (< edge (aref starts (1+ node)))
+                       (let* ((next (aref targets edge)))
+                         (setf (aref edges (1- sp)) (1+ edge))
+                         (when (and (not (eql next heap-dump-no-object))
+                                    (eql (aref numbers next) heap-dump-no-object))
+                           (setf (aref numbers next) n
+                                 (aref stack sp) next
+                                 (aref edges sp) (aref starts next))
+                           (incf sp)))
+                       (progn
+                         (setf (aref numbers node) count
+                               (aref order count) node)
+                         (incf count)
+                         (decf sp))))))))
+    (values (subseq order 0 count) numbers)))
+
+(defun %heap-dump-compute-idoms (dump)
+  ;; Cooper, Harvey and Kennedy's iterative algorithm, as in
+  ;; dominance.lisp, on postorder numbers.  The root of the dominator
+  ;; tree is a node (numbered count) whose successors are the roots.
+  (multiple-value-bind (order numbers) (%heap-dump-postorder dump)
+    (let* ((n (heap-dump-object-count dump))
+           (count (length order))
+           (starts (heap-dump-ref-starts dump))
+           (targets (heap-dump-ref-targets dump))
+           (roots (heap-dump-root-targets dump))
+           (npreds (make-array (+ count 2) :element-type '(unsigned-byte 64) :initial-element 0))
+           (preds nil)
+           (doms (make-array (1+ count) :element-type '(unsigned-byte 32)
+                                        :initial-element heap-dump-no-object))
+           (idoms (make-array n :element-type '(unsigned-byte 32)
+                                :initial-element heap-dump-no-object)))
+      (declare (type (simple-array (unsigned-byte 32) (*)) order numbers targets roots doms idoms)
+               (type (simple-array (unsigned-byte 64) (*)) starts npreds)
+               (fixnum n count)
+               (optimize (speed 3) (safety 0)))
+      ;; Predecessors by postorder number: those of p are elements
+      ;; (aref npreds p) below (aref npreds (1+ p)) of preds.
+      (flet ((map-edges (fn)
+               (declare (function fn))
+               (dotimes (r (length roots))
+                 (let* ((root (aref roots r)))
+                   (unless (eql root heap-dump-no-object)
+                     (funcall fn count (aref numbers root)))))
+               (dotimes (p count)
+                 (let* ((node (aref order p)))
+                   (loop for e from (aref starts node) below (aref starts (1+ node))
+                         do (let* ((next (aref targets e)))
+                              (unless (eql next heap-dump-no-object)
+                                (funcall fn p (aref numbers next)))))))))
+        (map-edges (lambda (from to)
+                     (declare (ignore from) (fixnum to))
+                     (incf (aref npreds (1+ to)))))
+        (loop for p from 1 to (1+ count)
+              do (incf (aref npreds p) (aref npreds (1- p))))
+        (setq preds (make-array (aref npreds (1+ count)) :element-type '(unsigned-byte 32)))
+        (let* ((fill (subseq npreds 0 (1+ count)))
+               (preds preds))
+          (declare (type (simple-array (unsigned-byte 64) (*)) fill)
+                   (type (simple-array (unsigned-byte 32) (*)) preds))
+          (map-edges (lambda (from to)
+                       (declare (fixnum from to))
+                       (setf (aref preds (aref fill to)) from)
+                       (incf (aref fill to))))))
+      (let* ((preds preds))
+        (declare (type (simple-array (unsigned-byte 32) (*)) preds))
+        (setf (aref doms count) count)
+        (loop
+          (let* ((changed nil))
+            (loop for p from (1- count) downto 0
+                  do (let* ((new heap-dump-no-object))
+                       (declare (fixnum new))
+                       (loop for k from (aref npreds p) below (aref npreds (1+ p))
+                             do (let* ((pred (aref preds k)))
+                                  (declare (fixnum pred))
+                                  (unless (eql (aref doms pred) heap-dump-no-object)
+                                    (if (eql new heap-dump-no-object)
+                                      (setq new pred)
+                                      (let* ((a pred) (b new))
+                                        (declare (fixnum a b))
+                                        (loop until (eql a b)
+                                              do (loop while (< a b) do (setq a (aref doms a)))
+                                                 (loop while (< b a) do (setq b (aref doms b))))
+                                        (setq new a))))))
+                       (unless (eql new (aref doms p))
+                         (setf (aref doms p) new
+                               changed t))))
+            (unless changed (return)))))
+      (dotimes (p count)
+        (let* ((d (aref doms p)))
+          (setf (aref idoms (aref order p))
+                (if (eql d count) heap-dump-no-object (aref order d)))))
+      (setf (heap-dump-idoms dump) idoms)
+      ;; Dominators come after the objects they dominate in postorder.
+      (let* ((retained (make-array n :element-type '(unsigned-byte 64))))
+        (dotimes (i n)
+          (setf (aref retained i) (nth-value 1 (heap-dump-object-size dump i))))
+        (dotimes (p count)
+          (let* ((node (aref order p))
+                 (idom (aref idoms node)))
+            (unless (eql idom heap-dump-no-object)
+              (incf (aref retained idom) (aref retained node)))))
+        (setf (heap-dump-retained dump) retained))
+      dump)))
+
+(defun %heap-dump-dominators (dump)
+  (unless (heap-dump-idoms dump)
+    (%heap-dump-compute-idoms dump))
+  dump)
+
+(defun heap-dump-immediate-dominator (dump i)
+  "The index of the immediate dominator of object I in DUMP: the
+object that every path from a root to I goes through last.  Returns
+NIL if I is only dominated by the roots, or isn't reachable from them."
+  (%heap-dump-dominators dump)
+  (let* ((idom (aref (heap-dump-idoms dump) i)))
+    (unless (eql idom heap-dump-no-object) idom)))
+
+(defun heap-dump-retained-size (dump i)
+  "The number of bytes that would become garbage if there were no
+references to object I in DUMP: its size and that of everything it
+dominates."
+  (%heap-dump-dominators dump)
+  (aref (heap-dump-retained dump) i))
+
+;;; Reports
+
+(defun %heap-dump-type-key (dump i classes cache)
+  (if classes
+    (heap-dump-object-type dump i cache)
+    (let* ((subtag (aref (heap-dump-subtags dump) i)))
+      (if (eql subtag target::fulltag-cons)
+        'cons
+        (aref *heap-utilization-vector-type-names* subtag)))))
+
+(defun heap-dump-utilization (dump &key (stream *standard-output*) unit (sort :size)
+                                   classes (threshold 0.00005))
+  "Like HEAP-UTILIZATION, for the objects in DUMP: the number, logical
+and physical size of the objects of each type.  If CLASSES is true,
+instances and structures are counted by class."
+  (let* ((table (make-hash-table :test 'equal))
+         (cache (make-hash-table)))
+    (dotimes (i (heap-dump-object-count dump))
+      (multiple-value-bind (logsize physsize) (heap-dump-object-size dump i)
+        (let* ((type (%heap-dump-type-key dump i classes cache))
+               (info (or (gethash type table) (setf (gethash type table) (list 0 0 0)))))
+          (incf (car info))
+          (incf (cadr info) logsize)
+          (incf (caddr info) physsize))))
+    (report-heap-utilization table
+                             :stream stream :unit unit :sort sort :threshold threshold)))
+
+(defun heap-dump-idom-utilization (dump &key (stream *standard-output*) unit (sort :size)
+                                        (threshold 0.01))
+  "Like IDOM-HEAP-UTILIZATION, for the objects in DUMP: the memory
+retained by the objects that dominate others, by type, where an
+object's retained memory doesn't include that of other dominators."
+  (%heap-dump-dominators dump)
+  (let* ((n (heap-dump-object-count dump))
+         (idoms (heap-dump-idoms dump))
+         (dominators (make-array n :element-type 'bit :initial-element 0))
+         (table (make-hash-table :test 'equal))
+         (cache (make-hash-table)))
+    (dotimes (i n)
+      (let* ((idom (aref idoms i)))
+        (unless (eql idom heap-dump-no-object)
+          (setf (sbit dominators idom) 1))))
+    (dotimes (i n)
+      (let* ((idom (aref idoms i))
+             (owner (if (or (eql (sbit dominators i) 1) (eql idom heap-dump-no-object))
+                      i
+                      idom))
+             (type (heap-dump-object-type dump owner cache))
+             (info (or (gethash type table) (setf (gethash type table) (list 0 0 0)))))
+        (multiple-value-bind (logsize physsize) (heap-dump-object-size dump i)
+          (when (eql owner i)
+            (incf (car info)))
+          (incf (cadr info) logsize)
+          (incf (caddr info) physsize))))
+    (report-heap-utilization table
+                             :stream stream :unit unit :sort sort :threshold threshold)))
+
+(defun heap-dump-largest-retainers (dump &key (count 20) (stream *standard-output*))
+  "Describe the COUNT objects in DUMP with the largest retained sizes
+that aren't dominated by another object, and return their indices."
+  (%heap-dump-dominators dump)
+  (let* ((retained (heap-dump-retained dump))
+         (idoms (heap-dump-idoms dump))
+         (total 0)
+         (top ()))
+    (dotimes (i (heap-dump-object-count dump))
+      (when (eql (aref idoms i) heap-dump-no-object)
+        (incf total (aref retained i))
+        (push i top)))
+    (setq top (sort top #'> :key (lambda (i) (aref retained i))))
+    (when (> (length top) count)
+      (setq top (subseq top 0 count)))
+    (when stream
+      (format stream "~&~14@a ~6@a  Object~%" "Retained" "%")
+      (dolist (i top)
+        (format stream "~&~14d ~5,1f%  ~a~%"
+                (aref retained i)
+                (if (zerop total) 0 (/ (* 100.0 (aref retained i)) total))
+                (heap-dump-object-description dump i))))
+    top))
+
+;;; Leaks
+
+(defun heap-dump-objects-of-type (dump type &key (count most-positive-fixnum))
+  "Return the indices of up to COUNT objects in DUMP whose type (as
+returned by HEAP-DUMP-OBJECT-TYPE) is TYPE; a class or structure name
+may be given as a symbol or a string."
+  (let* ((cache (make-hash-table))
+         (name (string type))
+         (result ()))
+    (dotimes (i (heap-dump-object-count dump))
+      (when (<= count 0) (return))
+      (let* ((this (heap-dump-object-type dump i cache)))
+        (when (if (stringp this)
+                (string= this name)
+                (eq this type))
+          (push i result)
+          (decf count))))
+    (nreverse result)))
+
+(defun heap-dump-referencers (dump i)
+  "Return a list of (index . slot) pairs for the objects in DUMP that
+refer to object I, and (as a second value) a list of (kind thread
+source) lists for the roots that do."
+  (let* ((starts (heap-dump-ref-starts dump))
+         (slots (heap-dump-ref-slots dump))
+         (targets (heap-dump-ref-targets dump))
+         (objects ())
+         (roots ()))
+    (dotimes (j (heap-dump-object-count dump))
+      (loop for k from (aref starts j) below (aref starts (1+ j))
+            do (when (eql (aref targets k) i)
+                 (push (cons j (aref slots k)) objects))))
+    (dotimes (r (length (heap-dump-root-targets dump)))
+      (when (eql (aref (heap-dump-root-targets dump) r) i)
+        (push (%heap-dump-root-description dump r) roots)))
+    (values (nreverse objects) (nreverse roots))))
+
+(defun %heap-dump-root-description (dump r)
+  (list (svref *heap-dump-root-kinds* (aref (heap-dump-root-kinds dump) r))
+        (aref (heap-dump-root-threads dump) r)
+        (aref (heap-dump-root-sources dump) r)))
+
+(defun heap-dump-path-to-root (dump i &key (stream *standard-output*))
+  "Find one of the shortest chains of references from a root to object
+I in DUMP.  Returns a list whose first element describes the root as
+(kind thread source) and whose other elements are (index . slot)
+pairs, where slot is the slot of the previous object that refers to
+this one (NIL for the object the root refers to.)  If STREAM is
+non-NIL, the chain is described there too."
+  (let* ((n (heap-dump-object-count dump))
+         (starts (heap-dump-ref-starts dump))
+         (slots (heap-dump-ref-slots dump))
+         (targets (heap-dump-ref-targets dump))
+         (root-targets (heap-dump-root-targets dump))
+         ;; parent of each object reached, or (logior root #x80000000)
+         ;; for the objects the roots refer to directly.
+         (parents (make-array n :element-type '(unsigned-byte 32)
+                                :initial-element heap-dump-no-object))
+         (parent-slots (make-array n :element-type '(unsigned-byte 32)))
+         (queue (make-array n :element-type '(unsigned-byte 32)))
+         (head 0)
+         (tail 0)
+         (path nil))
+    (dotimes (r (length root-targets))
+      (let* ((target (aref root-targets r)))
+        (when (and (not (eql target heap-dump-no-object))
+                   (eql (aref parents target) heap-dump-no-object))
+          (setf (aref parents target) (logior r #x80000000)
+                (aref queue tail) target)
+          (incf tail))))
+    (loop while (and (< head tail) (eql (aref parents i) heap-dump-no-object))
+          do (let* ((node (aref queue head)))
+               (incf head)
+               (loop for k from (aref starts node) below (aref starts (1+ node))
+                     do (let* ((next (aref targets k)))
+                          (when (and (not (eql next heap-dump-no-object))
+                                     (eql (aref parents next) heap-dump-no-object))
+                            (setf (aref parents next) node
+                                  (aref parent-slots next) (aref slots k)
+                                  (aref queue tail) next)
+                            (incf tail))))))
+    (unless (eql (aref parents i) heap-dump-no-object)
+      (loop with node = i
+            as parent = (aref parents node)
+            do (if (logbitp 31 parent)
+                 (progn
+                   (push (cons node nil) path)
+                   (push (%heap-dump-root-description dump (logand parent #x7fffffff)) path)
+                   (return))
+                 (progn
+                   (push (cons node (aref parent-slots node)) path)
+                   (setq node parent))))
+      (when stream
+        (destructuring-bind ((kind thread source) &rest links) path
+          (if (eq kind :static)
+            (format stream "~&static root~%")
+            (format stream "~&~(~a~) root in thread ~d (~a #x~x)~%" kind thread
+                    (if (member kind '(:vstack :tstack)) "at" "source") source))
+          (dolist (link links)
+            (format stream "~&~@[  slot ~d of the above refers to~%~]    ~a~%"
+                    (cdr link) (heap-dump-object-description dump (car link)))))))
+    path))
+
+(defun heap-dump-growth (old new &key (stream *standard-output*) (count 20) (classes t))
+  "Compare the number and total size of the objects of each type in the
+heap dumps OLD and NEW, describe the COUNT types whose total size grew
+most, and return a list of (type count-delta bytes-delta) lists for
+every type that grew."
+  (let* ((table (make-hash-table :test 'equal)))
+    (flet ((tally (dump sign)
+             (let* ((cache (make-hash-table)))
+               (dotimes (i (heap-dump-object-count dump))
+                 (let* ((type (%heap-dump-type-key dump i classes cache))
+                        (info (or (gethash type table) (setf (gethash type table) (list 0 0)))))
+                   (incf (car info) sign)
+                   (incf (cadr info) (* sign (nth-value 1 (heap-dump-object-size dump i)))))))))
+      (tally old -1)
+      (tally new 1))
+    (let* ((result ()))
+      (maphash (lambda (type info)
+                 (when (or (plusp (car info)) (plusp (cadr info)))
+                   (push (cons type info) result)))
+               table)
+      (setq result (sort result #'> :key #'caddr))
+      (when stream
+        (format stream "~&~12@a ~14@a  Type~%" "Count" "Bytes")
+        (loop for (type count-delta bytes-delta) in result
+              repeat count
+              do (format stream "~&~12@d ~14@d  ~a~%" count-delta bytes-delta type)))
+      result)))
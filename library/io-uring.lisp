@@ -0,0 +1,538 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; io-uring.lisp
+; An io_uring I/O backend for FD-streams on x86-64 Linux.  USE-IO-URING
+; makes a stream do its reads and writes by submitting requests to a
+; shared ring (IO-URING); the calling thread sleeps on a semaphore until
+; a reaper thread sees the request's completion.  The stream's buffers
+; are registered with the ring when the kernel allows it, so the kernel
+; doesn't have to map them for each request.
+;
+; Input-only file streams also read ahead: each read of a buffer is
+; submitted together with a read of the following buffer into a spare
+; one, and if the next read wants that data the buffers are swapped
+; rather than copied.  Those reads use explicit file offsets, and the
+; fd's file position is set to match when a buffer is handed over.
+;
+; If the kernel doesn't support io_uring (it's missing, too old, or
+; disabled by sysctl or seccomp), IO-URING returns NIL and USE-IO-URING
+; leaves the stream using read(2) and write(2).
+
+(in-package :ccl)
+
+(export '(io-uring
+          io-uring-available-p
+          use-io-uring))
+
+(eval-when (:compile-toplevel :load-toplevel :execute)
+  (defconstant nr-io-uring-setup 425)
+  (defconstant nr-io-uring-enter 426)
+  (defconstant nr-io-uring-register 427)
+
+  (defconstant ioring-off-sq-ring 0)
+  (defconstant ioring-off-cq-ring #x8000000)
+  (defconstant ioring-off-sqes #x10000000)
+
+  (defconstant ioring-enter-getevents 1)
+
+  (defconstant ioring-feat-rw-cur-pos (ash 1 3))
+  (defconstant ioring-feat-fast-poll (ash 1 5))
+
+  (defconstant ioring-op-read-fixed 4)
+  (defconstant ioring-op-write-fixed 5)
+  (defconstant ioring-op-async-cancel 14)
+  (defconstant ioring-op-read 22)
+  (defconstant ioring-op-write 23)
+
+  (defconstant ioring-register-buffers2 15)
+  (defconstant ioring-register-buffers-update 16)
+  (defconstant ioring-rsrc-register-sparse 1)
+
+  (defconstant map-populate #x8000)
+
+  ;; struct io_uring_params
+  (defconstant io-uring-params.sq-entries 0)
+  (defconstant io-uring-params.cq-entries 4)
+  (defconstant io-uring-params.features 20)
+  (defconstant io-uring-params.sq-off 40)
+  (defconstant io-uring-params.cq-off 80)
+  (defconstant io-uring-params-size 120)
+  ;; struct io_sqring_offsets, struct io_cqring_offsets
+  (defconstant io-ring-offsets.head 0)
+  (defconstant io-ring-offsets.tail 4)
+  (defconstant io-ring-offsets.ring-mask 8)
+  (defconstant io-sqring-offsets.array 24)
+  (defconstant io-cqring-offsets.cqes 20)
+  ;; struct io_uring_sqe
+  (defconstant io-uring-sqe.opcode 0)
+  (defconstant io-uring-sqe.fd 4)
+  (defconstant io-uring-sqe.off 8)
+  (defconstant io-uring-sqe.addr 16)
+  (defconstant io-uring-sqe.len 24)
+  (defconstant io-uring-sqe.user-data 32)
+  (defconstant io-uring-sqe.buf-index 40)
+  (defconstant io-uring-sqe-size 64)
+  ;; struct io_uring_cqe
+  (defconstant io-uring-cqe.user-data 0)
+  (defconstant io-uring-cqe.res 8)
+  (defconstant io-uring-cqe-size 16))
+
+(defparameter *io-uring-entries* 256)
+(defparameter *io-uring-fixed-buffer-slots* 256)
+
+(defstruct (io-uring (:constructor %make-io-uring))
+  (fd -1)
+  (mappings ())                         ; (address . length) of each mmap
+  sq-entries
+  sq-head
+  sq-tail
+  (sq-local-tail 0)                     ; ours, published on submit
+  sq-mask
+  sq-array
+  sqes
+  cq-head
+  cq-tail
+  cq-mask
+  cqes
+  (lock (make-lock))
+  (requests (make-hash-table :test 'eql)) ; user_data -> io-uring-request
+  (next-id 1)
+  (reaper nil)
+  ;; A vector of registered buffers' (address . length), or NIL if the
+  ;; kernel can't register buffers after the ring's been set up.
+  (fixed-buffers nil))
+
+(defmethod print-object ((ring io-uring) stream)
+  (print-unreadable-object (ring stream :type t :identity t)
+    (format stream "fd ~d, ~d entries~:[~;, fixed buffers~]"
+            (io-uring-fd ring)
+            (io-uring-sq-entries ring)
+            (io-uring-fixed-buffers ring))))
+
+(defstruct io-uring-request
+  ring
+  (id 0)                                ; its user_data
+  (semaphore (make-semaphore))
+  (result nil))                         ; set before SEMAPHORE is signaled
+
+(defun %io-uring-syscall (nr a b c d &optional (e 0) (f 0))
+  (int-errno-call
+   (external-call "syscall"
+                  :signed-doubleword nr
+                  :signed-doubleword a
+                  :signed-doubleword b
+                  :signed-doubleword c
+                  :signed-doubleword d
+                  :signed-doubleword e
+                  :signed-doubleword f
+                  :signed-doubleword)))
+
+(defun %io-uring-map (fd length offset)
+  (let* ((addr (#_mmap (%null-ptr)
+                       length
+                       (logior #$PROT_READ #$PROT_WRITE)
+                       (logior #$MAP_SHARED map-populate)
+                       fd
+                       offset)))
+    (unless (eql addr (%int-to-ptr (1- (ash 1 target::nbits-in-word)))) ; #$MAP_FAILED
+      addr)))
+
+(defun %io-uring-unmap (ring)
+  (dolist (m (io-uring-mappings ring))
+    (#_munmap (car m) (cdr m)))
+  (setf (io-uring-mappings ring) ()))
+
+;;; Try to set up a ring; return it, or NIL if the kernel won't.
+(defun %setup-io-uring (entries)
+  #-(and linux-target x8664-target)
+  (progn entries nil)
+  #+(and linux-target x8664-target)
+  (%stack-block ((params io-uring-params-size))
+    (#_memset params 0 io-uring-params-size)
+    (let* ((fd (%io-uring-syscall nr-io-uring-setup entries (%ptr-to-int params) 0 0)))
+      (when (>= fd 0)
+        (let* ((features (%get-unsigned-long params io-uring-params.features))
+               (ring (%make-io-uring :fd fd)))
+          (flet ((fail ()
+                   (%io-uring-unmap ring)
+                   (fd-close fd)
+                   (return-from %setup-io-uring nil))
+                 (sq-off (field)
+                   (%get-unsigned-long params (+ io-uring-params.sq-off field)))
+                 (cq-off (field)
+                   (%get-unsigned-long params (+ io-uring-params.cq-off field))))
+            ;; We want IORING_OP_READ and IORING_OP_WRITE, and reads
+            ;; and writes at the current file position.
+            (unless (logtest features ioring-feat-rw-cur-pos)
+              (fail))
+            (unless (logtest features ioring-feat-fast-poll)
+              (fail))
+            (let* ((sq-entries (%get-unsigned-long params io-uring-params.sq-entries))
+                   (cq-entries (%get-unsigned-long params io-uring-params.cq-entries))
+                   (sq-size (+ (sq-off io-sqring-offsets.array) (* sq-entries 4)))
+                   (cq-size (+ (cq-off io-cqring-offsets.cqes) (* cq-entries io-uring-cqe-size)))
+                   (sqes-size (* sq-entries io-uring-sqe-size))
+                   (sq (or (%io-uring-map fd sq-size ioring-off-sq-ring) (fail))))
+              (push (cons sq sq-size) (io-uring-mappings ring))
+              (let* ((cq (or (%io-uring-map fd cq-size ioring-off-cq-ring) (fail))))
+                (push (cons cq cq-size) (io-uring-mappings ring))
+                (let* ((sqes (or (%io-uring-map fd sqes-size ioring-off-sqes) (fail))))
+                  (push (cons sqes sqes-size) (io-uring-mappings ring))
+                  (setf (io-uring-sq-entries ring) sq-entries
+                        (io-uring-sq-head ring) (%inc-ptr sq (sq-off io-ring-offsets.head))
+                        (io-uring-sq-tail ring) (%inc-ptr sq (sq-off io-ring-offsets.tail))
+                        (io-uring-sq-mask ring) (%get-unsigned-long sq (sq-off io-ring-offsets.ring-mask))
+                        (io-uring-sq-array ring) (%inc-ptr sq (sq-off io-sqring-offsets.array))
+                        (io-uring-sqes ring) sqes
+                        (io-uring-cq-head ring) (%inc-ptr cq (cq-off io-ring-offsets.head))
+                        (io-uring-cq-tail ring) (%inc-ptr cq (cq-off io-ring-offsets.tail))
+                        (io-uring-cq-mask ring) (%get-unsigned-long cq (cq-off io-ring-offsets.ring-mask))
+                        (io-uring-cqes ring) (%inc-ptr cq (cq-off io-cqring-offsets.cqes))
+                        (io-uring-sq-local-tail ring) (%get-unsigned-long (io-uring-sq-tail ring) 0))
+                  (%io-uring-register-fixed-buffers ring)
+                  ring)))))))))
+
+;;; Register an empty table of buffers, into which streams' buffers can
+;;; be put later.  (That needs Linux 5.13; without it, requests use
+;;; unregistered buffers.)
+(defun %io-uring-register-fixed-buffers (ring)
+  (let* ((nslots *io-uring-fixed-buffer-slots*))
+    (%stack-block ((reg 32))
+      (#_memset reg 0 32)
+      (setf (%get-unsigned-long reg 0) nslots
+            (%get-unsigned-long reg 4) ioring-rsrc-register-sparse)
+      (when (>= (%io-uring-syscall nr-io-uring-register
+                                   (io-uring-fd ring)
+                                   ioring-register-buffers2
+                                   (%ptr-to-int reg)
+                                   32)
+                0)
+        (setf (io-uring-fixed-buffers ring) (make-array nslots :initial-element nil))))))
+
+;;; Put a buffer in a slot (or, if BUFPTR is NIL, empty the slot).
+(defun %io-uring-update-fixed-buffer (ring slot bufptr length)
+  (%stack-block ((iov 16)
+                 (update 32))
+    (setf (%%get-unsigned-longlong iov 0) (if bufptr (%ptr-to-int bufptr) 0)
+          (%%get-unsigned-longlong iov 8) (if bufptr length 0))
+    (#_memset update 0 32)
+    (setf (%get-unsigned-long update 0) slot
+          (%%get-unsigned-longlong update 8) (%ptr-to-int iov)
+          (%get-unsigned-long update 24) 1)
+    (%io-uring-syscall nr-io-uring-register
+                       (io-uring-fd ring)
+                       ioring-register-buffers-update
+                       (%ptr-to-int update)
+                       32)))
+
+;;; Return the slot the buffer was registered in, or NIL.
+(defun %io-uring-add-fixed-buffer (ring bufptr length)
+  (with-lock-grabbed ((io-uring-lock ring))
+    (let* ((slots (io-uring-fixed-buffers ring))
+           (slot (and slots (position nil slots))))
+      (when (and slot
+                 (>= (%io-uring-update-fixed-buffer ring slot bufptr length) 0))
+        (setf (svref slots slot) (cons (%ptr-to-int bufptr) length))
+        slot))))
+
+(defun %io-uring-remove-fixed-buffer (ring slot)
+  (with-lock-grabbed ((io-uring-lock ring))
+    (%io-uring-update-fixed-buffer ring slot nil 0)
+    (setf (svref (io-uring-fixed-buffers ring) slot) nil)))
+
+;;; Queue a request; called with the ring's lock held.  Returns NIL if
+;;; the submission queue is full.
+(defun %io-uring-prepare (ring opcode fd bufptr octets offset slot)
+  (let* ((tail (io-uring-sq-local-tail ring))
+         (head (%get-unsigned-long (io-uring-sq-head ring) 0)))
+    (when (< (logand (- tail head) #xffffffff) (io-uring-sq-entries ring))
+      (let* ((index (logand tail (io-uring-sq-mask ring)))
+             (sqe (%inc-ptr (io-uring-sqes ring) (* index io-uring-sqe-size)))
+             (id (io-uring-next-id ring))
+             (request (make-io-uring-request :ring ring :id id)))
+        (#_memset sqe 0 io-uring-sqe-size)
+        (setf (%get-unsigned-byte sqe io-uring-sqe.opcode)
+              (if slot
+                (if (eql opcode ioring-op-read) ioring-op-read-fixed ioring-op-write-fixed)
+                opcode)
+              (%get-signed-long sqe io-uring-sqe.fd) fd
+              (%%get-unsigned-longlong sqe io-uring-sqe.off) (logand offset #xffffffffffffffff)
+              (%%get-unsigned-longlong sqe io-uring-sqe.addr) (if bufptr (%ptr-to-int bufptr) 0)
+              (%get-unsigned-long sqe io-uring-sqe.len) octets
+              (%%get-unsigned-longlong sqe io-uring-sqe.user-data) id
+              (%get-unsigned-word sqe io-uring-sqe.buf-index) (or slot 0))
+        (setf (%get-unsigned-long (io-uring-sq-array ring) (* index 4)) index
+              (io-uring-sq-local-tail ring) (logand (1+ tail) #xffffffff)
+              (io-uring-next-id ring) (1+ id)
+              (gethash id (io-uring-requests ring)) request)
+        request))))
+
+;;; Publish the last N queued requests and have the kernel start them;
+;;; called with the ring's lock held.  If that fails, fail the ones it
+;;; didn't take.
+(defun %io-uring-submit (ring n)
+  (setf (%get-unsigned-long (io-uring-sq-tail ring) 0) (io-uring-sq-local-tail ring))
+  (do* ((left n))
+       ((zerop left))
+    (let* ((result (%io-uring-syscall nr-io-uring-enter (io-uring-fd ring) left 0 0)))
+      (cond ((> result 0) (decf left result))
+            ((eql result (- #$EINTR)))
+            (t
+             ;; Take the rest back.
+             (setf (io-uring-sq-local-tail ring)
+                   (logand (- (io-uring-sq-local-tail ring) left) #xffffffff))
+             (setf (%get-unsigned-long (io-uring-sq-tail ring) 0)
+                   (io-uring-sq-local-tail ring))
+             (let* ((requests (io-uring-requests ring)))
+               (dotimes (i left)
+                 (let* ((id (- (io-uring-next-id ring) 1 i))
+                        (request (gethash id requests)))
+                   (remhash id requests)
+                   (setf (io-uring-request-result request)
+                         (if (< result 0) result (- #$EAGAIN)))
+                   (signal-semaphore (io-uring-request-semaphore request)))))
+             (return))))))
+
+;;; Ask the kernel to cancel REQUEST.  The request still completes (with
+;;; -ECANCELED, if it was cancelled) and signals its semaphore.
+(defun %io-uring-cancel (request)
+  (let* ((ring (io-uring-request-ring request)))
+    (with-lock-grabbed ((io-uring-lock ring))
+      (when (%io-uring-prepare ring ioring-op-async-cancel -1 nil 0 0 nil)
+        (let* ((index (logand (- (io-uring-sq-local-tail ring) 1)
+                              (io-uring-sq-mask ring)))
+               (sqe (%inc-ptr (io-uring-sqes ring) (* index io-uring-sqe-size))))
+          (setf (%%get-unsigned-longlong sqe io-uring-sqe.addr)
+                (io-uring-request-id request))
+          (%io-uring-submit ring 1))))))
+
+;;; The I/O is done when the request's semaphore is signaled.  If the
+;;; wait is interrupted by a non-local exit, cancel the request and
+;;; wait for it to finish, since the kernel may still be using the
+;;; buffer.
+(defun %io-uring-wait (request)
+  (unwind-protect
+       (wait-on-semaphore (io-uring-request-semaphore request))
+    (unless (io-uring-request-result request)
+      (without-interrupts
+       (%io-uring-cancel request)
+       (wait-on-semaphore (io-uring-request-semaphore request)))))
+  (io-uring-request-result request))
+
+(defun %io-uring-reap (ring)
+  (let* ((fd (io-uring-fd ring))
+         (cq-head (io-uring-cq-head ring))
+         (cq-tail (io-uring-cq-tail ring))
+         (mask (io-uring-cq-mask ring))
+         (cqes (io-uring-cqes ring))
+         (requests (io-uring-requests ring)))
+    (loop
+      (let* ((result (%io-uring-syscall nr-io-uring-enter fd 0 1 ioring-enter-getevents)))
+        (when (and (< result 0) (not (eql result (- #$EINTR))))
+          (error "io_uring_enter failed: ~a" (%strerror (- result)))))
+      (with-lock-grabbed ((io-uring-lock ring))
+        (do* ((head (%get-unsigned-long cq-head 0) (logand (1+ head) #xffffffff)))
+             ((eql head (%get-unsigned-long cq-tail 0))
+              (setf (%get-unsigned-long cq-head 0) head))
+          (let* ((cqe (%inc-ptr cqes (* (logand head mask) io-uring-cqe-size)))
+                 (id (%%get-unsigned-longlong cqe io-uring-cqe.user-data))
+                 (request (gethash id requests)))
+            (when request
+              (remhash id requests)
+              (setf (io-uring-request-result request)
+                    (%get-signed-long cqe io-uring-cqe.res))
+              (signal-semaphore (io-uring-request-semaphore request)))))))))
+
+(defvar *io-uring* nil)
+(defvar *io-uring-lock* (make-lock))
+;;; :UNKNOWN until we've tried to set up a ring.
+(defvar *io-uring-available* :unknown)
+
+(defun io-uring ()
+  "Return the ring that USE-IO-URING streams share, setting it up if
+necessary, or NIL if io_uring isn't available."
+  (or *io-uring*
+      (with-lock-grabbed (*io-uring-lock*)
+        (or *io-uring*
+            (when *io-uring-available*
+              (let* ((ring (%setup-io-uring *io-uring-entries*)))
+                (setq *io-uring-available* (not (null ring)))
+                (when ring
+                  (setf (io-uring-reaper ring)
+                        (process-run-function "io_uring reaper" #'%io-uring-reap ring))
+                  (setq *io-uring* ring))))))))
+
+(defun io-uring-available-p ()
+  "Return true if the kernel supports io_uring well enough for
+USE-IO-URING."
+  (not (null (io-uring))))
+
+;;; The ring doesn't survive SAVE-APPLICATION.
+(defun %forget-io-uring ()
+  (setq *io-uring* nil
+        *io-uring-available* :unknown))
+
+(pushnew '%forget-io-uring *save-exit-functions*)
+
+
+;;; A stream's connection to the ring.
+(defstruct uring-stream
+  ring
+  ;; (address length slot) of each of the stream's registered buffers
+  (fixed ())
+  ;; For read-ahead: the spare buffer and the pointer to its data, the
+  ;; outstanding request and the offset it's reading from.
+  (ahead-buffer nil)
+  (ahead-ptr nil)
+  (ahead-request nil)
+  (ahead-offset nil))
+
+(defun %uring-stream-slot (b bufptr octets)
+  (let* ((address (%ptr-to-int bufptr)))
+    (dolist (f (uring-stream-fixed b))
+      (destructuring-bind (start length slot) f
+        (when (and (>= address start)
+                   (<= (+ address octets) (+ start length)))
+          (return slot))))))
+
+(defun %uring-stream-register (b bufptr octets)
+  (let* ((slot (%io-uring-add-fixed-buffer (uring-stream-ring b) bufptr octets)))
+    (when slot
+      (push (list (%ptr-to-int bufptr) octets slot) (uring-stream-fixed b)))))
+
+;;; The octet offset of the next read, if the stream reads with
+;;; explicit offsets (and can read ahead).
+(defun %uring-stream-offset (b ioblock)
+  (and (uring-stream-ahead-buffer b)
+       (file-ioblock-octet-pos ioblock)))
+
+;;; Submit requests; each of REQUESTS is a list of the arguments to
+;;; %IO-URING-PREPARE after the ring.  Returns a list of request objects.
+(defun %uring-stream-submit (b &rest requests)
+  (let* ((ring (uring-stream-ring b)))
+    (with-lock-grabbed ((io-uring-lock ring))
+      ;; Requests are submitted as soon as they're queued, so the
+      ;; queue only holds the ones in this batch.
+      (let* ((prepared (mapcar #'(lambda (args)
+                                   (or (apply #'%io-uring-prepare ring args)
+                                       (error "~s is full." ring)))
+                               requests)))
+        (%io-uring-submit ring (length prepared))
+        prepared))))
+
+(defun %uring-stream-start-read-ahead (b fd offset octets)
+  (let* ((ptr (uring-stream-ahead-ptr b)))
+    (setf (uring-stream-ahead-request b)
+          (car (%uring-stream-submit b (list ioring-op-read fd ptr octets offset
+                                             (%uring-stream-slot b ptr octets))))
+          (uring-stream-ahead-offset b) offset)))
+
+;;; Wait for the read-ahead request, if any; return its result if it
+;;; read from OFFSET, else NIL.
+(defun %uring-stream-finish-read-ahead (b offset)
+  (let* ((request (uring-stream-ahead-request b)))
+    (when request
+      (setf (uring-stream-ahead-request b) nil)
+      (let* ((result (%io-uring-wait request)))
+        (when (and (eql offset (uring-stream-ahead-offset b))
+                   (>= result 0))
+          result)))))
+
+(defmethod io-backend-read ((b uring-stream) ioblock fd bufptr octets)
+  (let* ((offset (%uring-stream-offset b ioblock)))
+    (if (null offset)
+      (%io-uring-wait
+       (car (%uring-stream-submit b (list ioring-op-read fd bufptr octets -1
+                                          (%uring-stream-slot b bufptr octets)))))
+      (let* ((n (%uring-stream-finish-read-ahead b offset)))
+        (if n
+          ;; The data's in the spare buffer: swap it with the stream's.
+          (let* ((inbuf (ioblock-inbuf ioblock)))
+            (rotatef (io-buffer-buffer inbuf) (uring-stream-ahead-buffer b))
+            (rotatef (io-buffer-bufptr inbuf) (uring-stream-ahead-ptr b))
+            (when (eql n octets)
+              (%uring-stream-start-read-ahead b fd (+ offset n) octets)))
+          (let* ((ptr (uring-stream-ahead-ptr b))
+                 (requests (%uring-stream-submit
+                            b
+                            (list ioring-op-read fd bufptr octets offset
+                                  (%uring-stream-slot b bufptr octets))
+                            (list ioring-op-read fd ptr octets (+ offset octets)
+                                  (%uring-stream-slot b ptr octets)))))
+            (setf (uring-stream-ahead-request b) (cadr requests)
+                  (uring-stream-ahead-offset b) (+ offset octets)
+                  n (%io-uring-wait (car requests)))))
+        (when (> n 0)
+          (fd-lseek fd (+ offset n) #$SEEK_SET))
+        n))))
+
+(defmethod io-backend-write ((b uring-stream) ioblock fd bufptr octets)
+  (declare (ignore ioblock))
+  (%io-uring-wait
+   (car (%uring-stream-submit b (list ioring-op-write fd bufptr octets -1
+                                      (%uring-stream-slot b bufptr octets))))))
+
+(defmethod io-backend-close ((b uring-stream) ioblock)
+  (declare (ignore ioblock))
+  (%uring-stream-finish-read-ahead b nil)
+  (let* ((ring (uring-stream-ring b)))
+    (dolist (f (uring-stream-fixed b))
+      (%io-uring-remove-fixed-buffer ring (third f))))
+  (setf (uring-stream-fixed b) ())
+  (let* ((buffer (uring-stream-ahead-buffer b)))
+    (when buffer
+      (setf (uring-stream-ahead-buffer b) nil
+            (uring-stream-ahead-ptr b) nil)
+      (dispose-heap-ivector buffer))))
+
+(defun use-io-uring (stream &key (read-ahead t))
+  "Make STREAM, an FD-stream, do its I/O through IO-URING.  If
+READ-AHEAD is true and STREAM is an input-only file stream of octets or
+of characters in an encoding with 8-bit code units, read the next
+buffer while the current one's being consumed.  Returns true if io_uring is available, else NIL, in which
+case STREAM is unchanged."
+  (let* ((ring (io-uring))
+         (ioblock (stream-ioblock stream t)))
+    (when ring
+      (let* ((b (make-uring-stream :ring ring))
+             (inbuf (ioblock-inbuf ioblock))
+             (outbuf (ioblock-outbuf ioblock)))
+        (when inbuf
+          (%uring-stream-register b (io-buffer-bufptr inbuf) (io-buffer-size inbuf)))
+        (when (and outbuf (not (eq outbuf inbuf)))
+          (%uring-stream-register b (io-buffer-bufptr outbuf) (io-buffer-size outbuf)))
+        ;; Read-ahead swaps buffers under the stream, which is only
+        ;; safe where nothing holds on to the buffer across an advance:
+        ;; the readers of 16- and 32-bit code units do.
+        (when (and read-ahead
+                   inbuf
+                   (null outbuf)
+                   (file-ioblock-p ioblock)
+                   (eql 0 (ioblock-element-shift ioblock))
+                   (let* ((encoding (ioblock-encoding ioblock)))
+                     (or (null encoding)
+                         (eql 8 (character-encoding-code-unit-size encoding)))))
+          (let* ((buffer (io-buffer-buffer inbuf)))
+            (multiple-value-bind (ahead ptr size)
+                (make-heap-ivector (length buffer) (array-element-type buffer))
+              (setf (uring-stream-ahead-buffer b) ahead
+                    (uring-stream-ahead-ptr b) ptr)
+              (%uring-stream-register b ptr size))))
+        (setf (ioblock-io-backend ioblock) b)
+        t))))
+
+(provide "IO-URING")
@@ -1140,6 +1140,7 @@
     %gf-dispatch-table-keyvect          ; keyword vector, set by E-G-F.
     %gf-dispatch-table-argnum		; argument number
     %gf-dispatch-table-gf		; back pointer to gf - NEW
+    %gf-dispatch-table-stats            ; dispatch statistics, or NIL
     %gf-dispatch-table-mask		; mask for rest of table
     %gf-dispatch-table-first-data)	; offset to first data.  Must follow mask.
   
@@ -1153,6 +1154,19 @@
   `(make-array (%i+ ,size ,(%i+ 2 %gf-dispatch-table-first-data))
                :initial-element nil))
 
+;;; Layout of a dispatch table's %gf-dispatch-table-stats vector, which
+;;; is shared by a generic function's dispatch table and those of the
+;;; combined methods that dispatch on its other arguments.
+(def-accessors () %svref
+  gf-dispatch-stats.calls               ; calls that looked in the cache
+  gf-dispatch-stats.misses              ; lookups that had to compute a method
+  gf-dispatch-stats.overflows           ; table was at its maximum size, so cleared
+  gf-dispatch-stats.invalidations       ; entries dropped because their class changed
+  gf-dispatch-stats.clears              ; whole cache flushed (CLEAR-GF-CACHE)
+  )
+
+(defconstant gf-dispatch-stats.size 5)
+
 
 ;;; method-combination info
 (def-accessors svref
@@ -1243,8 +1257,24 @@
     nhash.find-new                      ; function: find vector-index on put
     nhash.read-only                     ; boolean: true when read-only
     nhash.min-size                      ; smallest size can shrink the table to.
+    nhash.stats                         ; probe statistics, or NIL
     )
 
+;;; Layout of a hash table's nhash.stats vector.
+(def-accessors () %svref
+  nhash.stats.lookups                   ; calls to the find functions
+  nhash.stats.probes                    ; total slots examined by them
+  nhash.stats.max-probe                 ; most slots examined by one call
+  nhash.stats.gc-rehashes               ; rehashes because the GC moved keys
+  nhash.stats.grows                     ; the vector was replaced by a bigger one
+  nhash.stats.in-place-rehashes         ; rehashes to get rid of deleted entries
+  nhash.stats.lock-free-retries         ; lock-free operations that had to start over
+  nhash.stats.find                      ; the table's own nhash.find
+  nhash.stats.find-new                  ; the table's own nhash.find-new
+  )
+
+(defconstant nhash.stats.size 9)
+
 (def-accessors (lock-acquisition) %svref
   nil                                   ; 'lock-acquisition
   lock-acquisition.status
@@ -0,0 +1,179 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; lock-profiler.lisp
+; Find out which locks threads spend their time waiting for.  While lock
+; profiling is enabled, every acquisition of a lock or read-write lock
+; (by lisp or by the kernel) is counted, and so is the time spent
+; waiting for it when it was already held.  Every so often a thread
+; that has to wait asks the holder to record its backtrace when it
+; releases the lock.  When profiling is disabled, taking a lock costs
+; a test or two of global variables.
+
+(in-package :ccl)
+
+(export '(enable-lock-profiling
+          disable-lock-profiling
+          reset-lock-profiling
+          with-lock-profiling
+          lock-contention-statistics
+          lock-contention-report))
+
+;;; Layout of the vector that lisp_lock_stats_values fills in.
+(eval-when (:compile-toplevel :load-toplevel :execute)
+  (defconstant lock-stats-values-count 6))
+
+(defun enable-lock-profiling (&key (backtrace-interval 16) (backtrace-depth 8))
+  "Start counting lock acquisitions and timing the waits for contended
+locks.  On about one in BACKTRACE-INTERVAL contended acquisitions of
+a lock, the thread holding it records up to BACKTRACE-DEPTH frames of
+its backtrace when it releases the lock; a BACKTRACE-INTERVAL of NIL
+disables that."
+  (unless *profiled-locks*
+    (setq *profiled-locks* (make-population)))
+  (setq *lock-holder-backtrace-depth* backtrace-depth)
+  (ff-call (%kernel-import target::kernel-import-lisp-lock-profiling-control)
+           :signed-fullword 1
+           #+64-bit-target :unsigned-doubleword
+           #+32-bit-target :unsigned-fullword (or backtrace-interval 0)
+           :signed-fullword)
+  (setq *lock-profiling* t))
+
+(defun disable-lock-profiling ()
+  "Stop counting lock acquisitions.  The statistics gathered so far are
+kept until RESET-LOCK-PROFILING is called."
+  (setq *lock-profiling* nil)
+  (ff-call (%kernel-import target::kernel-import-lisp-lock-profiling-control)
+           :signed-fullword 0
+           #+64-bit-target :unsigned-doubleword
+           #+32-bit-target :unsigned-fullword 0
+           :signed-fullword)
+  nil)
+
+(defun reset-lock-profiling ()
+  "Discard the lock statistics gathered so far."
+  (ff-call (%kernel-import target::kernel-import-lisp-lock-stats-reset)
+           :void)
+  (setf (car *lock-holder-backtraces*) nil)
+  nil)
+
+(defmacro with-lock-profiling ((&rest args) &body body)
+  "Run BODY with lock profiling enabled (with ARGS); disable it
+afterwards."
+  `(unwind-protect
+        (progn
+          (enable-lock-profiling ,@args)
+          ,@body)
+     (disable-lock-profiling)))
+
+(defun %lock-stats-pointers ()
+  (flet ((get-stats (v n)
+           (ff-call (%kernel-import target::kernel-import-lisp-lock-stats)
+                    :address v
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword n
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword)))
+    (let* ((n (get-stats (%null-ptr) 0)))
+      (unless (zerop n)
+        (%stack-block ((v (* n target::node-size)))
+          (setq n (min n (get-stats v n)))
+          (collect ((stats))
+            (dotimes (i n (stats))
+              (stats (%get-ptr v (* i target::node-size))))))))))
+
+;;; Map the address of each lock_stats that lisp knows about to the
+;;; lock that owns it.
+(defun %profiled-locks-by-stats ()
+  (let* ((table (make-hash-table)))
+    (when *profiled-locks*
+      (dolist (lock (population-data *profiled-locks*))
+        (let* ((ptr (%svref lock target::lock._value-cell)))
+          (unless (%null-ptr-p ptr)
+            (let* ((stats (%get-natural ptr
+                                        (if (eq (%svref lock target::lock.kind-cell)
+                                                'read-write-lock)
+                                          target::rwlock.stats
+                                          target::lockptr.stats))))
+              (unless (eql stats 0)
+                (setf (gethash stats table) lock)))))))
+    table))
+
+(defun %lock-holder-backtraces ()
+  (let* ((table (make-hash-table)))
+    (dolist (entry (car *lock-holder-backtraces*) table)
+      (push (cdr entry) (gethash (car entry) table)))))
+
+(defun lock-contention-statistics ()
+  "Return a list of plists describing each lock that's been acquired
+while lock profiling was enabled, sorted so that the locks that
+threads have waited longest for come first.  Times are in seconds."
+  (let* ((locks (%profiled-locks-by-stats))
+         (backtraces (%lock-holder-backtraces))
+         (result ()))
+    (%stack-block ((v (* lock-stats-values-count 8)))
+      (dolist (stats (%lock-stats-pointers))
+        (ff-call (%kernel-import target::kernel-import-lisp-lock-stats-values)
+                 :address stats
+                 :address v
+                 :void)
+        (flet ((value (i) (%%get-unsigned-longlong v (* i 8))))
+          (let* ((address (%ptr-to-int stats))
+                 (acquisitions (value 2)))
+            (unless (zerop acquisitions)
+              (push (list :lock (or (gethash address locks)
+                                    (if (zerop (value 0))
+                                      :destroyed
+                                      :kernel))
+                          :kind (if (eql (value 1) 1) :read-write-lock :recursive-lock)
+                          :acquisitions acquisitions
+                          :contended (value 3)
+                          :total-wait (/ (value 4) 1d9)
+                          :max-wait (/ (value 5) 1d9)
+                          :holder-backtraces (gethash address backtraces))
+                    result))))))
+    (sort result #'> :key #'(lambda (entry) (getf entry :total-wait)))))
+
+(defun %lock-profile-description (lock kind)
+  (if (typep lock 'symbol)
+    (format nil "<~(~a ~a~)>" lock kind)
+    (let* ((name (lock-name lock)))
+      (if name
+        (format nil "~a" name)
+        (format nil "~s" lock)))))
+
+(defun lock-contention-report (&key (stream t) (count 20) (backtraces 3))
+  "Describe the COUNT locks that threads have spent the most time
+waiting for, with up to BACKTRACES of the backtraces that their
+holders recorded."
+  (when (eq stream t) (setq stream *standard-output*))
+  (format stream "~&~12@a ~12@a ~7@a ~12@a ~12@a  Lock~%"
+          "Acquired" "Contended" "%" "Wait (s)" "Max (ms)")
+  (loop for entry in (lock-contention-statistics)
+        repeat count
+        do (destructuring-bind (&key lock kind acquisitions contended
+                                     total-wait max-wait holder-backtraces)
+               entry
+             (format stream "~&~12d ~12d ~6,1f% ~12,6f ~12,3f  ~a~%"
+                     acquisitions contended
+                     (/ (* 100.0 contended) acquisitions)
+                     total-wait (* max-wait 1000)
+                     (%lock-profile-description lock kind))
+             (loop for functions in holder-backtraces
+                   repeat backtraces
+                   do (format stream "~&~14theld by:~{ ~a~^ <-~}~%"
+                              (mapcar #'%lfun-name-string functions)))))
+  (values))
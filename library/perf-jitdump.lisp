@@ -0,0 +1,54 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; perf-jitdump.lisp
+; Make compiled lisp functions visible to Linux "perf".  Once
+; START-PERF-JITDUMP has been called, the GC describes every function
+; in the heap, and every function that it creates or moves afterwards,
+; in a "jitdump" file.  To use it:
+;
+;   (start-perf-jitdump)
+;   $ perf record -k mono -p <pid> ...
+;   $ perf inject --jit -i perf.data -o perf.jit.data
+;   $ perf report -i perf.jit.data
+;
+; Functions created since the last GC show up as unknown addresses;
+; calling (GC) after loading code reports them right away.
+
+(in-package :ccl)
+
+(export '(start-perf-jitdump stop-perf-jitdump))
+
+(defun start-perf-jitdump (&optional (pathname (format nil "/tmp/jit-~d.dump" (getpid))))
+  "Start describing compiled functions in the perf jitdump file
+PATHNAME.  perf expects the file's name to be jit-<pid>.dump."
+  (let* ((err (with-cstrs ((path (native-translated-namestring pathname)))
+                (without-gcing
+                  (ff-call (%kernel-import target::kernel-import-lisp-jitdump-start)
+                           :address path
+                           :signed-fullword)))))
+    (unless (zerop err)
+      (error "Can't start writing ~s: ~a" pathname (%strerror err)))
+    ;; Describe everything that's already in the heap now.
+    (gc)
+    pathname))
+
+(defun stop-perf-jitdump ()
+  "Stop describing compiled functions."
+  (without-gcing
+    (ff-call (%kernel-import target::kernel-import-lisp-jitdump-stop)
+             :signed-fullword))
+  nil)
@@ -0,0 +1,384 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; reactor.lisp
+; An I/O reactor built on Linux epoll.  A reactor watches any number of
+; file descriptors; when one becomes ready for input or output, it
+; calls the function that was registered for that fd and direction.
+; Registrations are one-shot: a function that wants to hear about the
+; fd again re-registers it, typically after reading or writing until it
+; gets EAGAIN.  One or more event-loop threads (START-REACTOR's
+; :THREADS) share the reactor's epoll instance, and the kernel hands
+; each ready fd to exactly one of them, so a small pool of threads can
+; serve a large number of mostly idle connections.
+;
+; REACTOR-WAIT-FD parks the calling thread until an fd is ready, and
+; USE-REACTOR-FOR-FD-STREAMS makes FD-streams (including sockets) wait
+; that way instead of blocking in poll(2) or read(2).
+
+(in-package :ccl)
+
+(export '(make-reactor
+          reactor-add-fd
+          reactor-remove-fd
+          reactor-wait-fd
+          run-reactor
+          start-reactor
+          stop-reactor
+          close-reactor
+          use-reactor-for-fd-streams
+          with-reactor-for-fd-streams))
+
+(eval-when (:compile-toplevel :load-toplevel :execute)
+  (defconstant epollin #x001)
+  (defconstant epollout #x004)
+  (defconstant epollerr #x008)
+  (defconstant epollhup #x010)
+  (defconstant epolloneshot (ash 1 30))
+  (defconstant epoll-ctl-add 1)
+  (defconstant epoll-ctl-del 2)
+  (defconstant epoll-ctl-mod 3)
+  (defconstant epoll-cloexec #o2000000)
+  (defconstant efd-cloexec #o2000000)
+  (defconstant efd-nonblock #o4000)
+  ;; struct epoll_event is packed on x86-64.
+  (defconstant epoll-event.data #+x8664-target 4 #-x8664-target 8)
+  (defconstant epoll-event-size #+x8664-target 12 #-x8664-target 16))
+
+(defparameter *reactor-events-per-wait* 128)
+
+;;; Reactors that haven't been closed, so that closing an FD-stream
+;;; can take its fd out of them.  The list is never modified
+;;; destructively, so it can be read without the lock.
+(defvar *reactors* ())
+(defvar *reactors-lock* (make-lock))
+
+(defstruct (reactor (:constructor %make-reactor))
+  (epfd -1)
+  ;; An eventfd, always readable once STOP-REACTOR has written to it,
+  ;; which wakes up the event-loop threads.
+  (wakeup-fd -1)
+  (lock (make-lock))
+  ;; fd -> fd-registration
+  (registrations (make-hash-table :test 'eql))
+  (threads ())
+  (stopping nil))
+
+(defmethod print-object ((r reactor) stream)
+  (print-unreadable-object (r stream :type t :identity t)
+    (format stream "epoll fd ~d, ~d fds, ~d threads"
+            (reactor-epfd r)
+            (hash-table-count (reactor-registrations r))
+            (length (reactor-threads r)))))
+
+(defstruct fd-registration
+  fd
+  (input-function nil)
+  (output-function nil)
+  ;; True if the fd has been added to the epoll set.
+  (added nil))
+
+(defun %reactor-error (errno situation)
+  (error "~a failed: ~a" situation (%strerror errno)))
+
+(defun %epoll-ctl (epfd op fd events)
+  (%stack-block ((event epoll-event-size))
+    (setf (%get-unsigned-long event 0) events
+          (%%get-unsigned-longlong event epoll-event.data) fd)
+    (int-errno-call (external-call "epoll_ctl"
+                                   :int epfd :int op :int fd
+                                   :address event
+                                   :int))))
+
+(defun make-reactor ()
+  "Return a new reactor.  It doesn't watch any fds or have any
+event-loop threads yet."
+  (let* ((epfd (int-errno-call (external-call "epoll_create1"
+                                              :int epoll-cloexec
+                                              :int))))
+    (when (< epfd 0)
+      (%reactor-error (- epfd) "epoll_create1"))
+    (let* ((wakeup-fd (int-errno-call (external-call "eventfd"
+                                                     :unsigned-fullword 0
+                                                     :int (logior efd-cloexec efd-nonblock)
+                                                     :int))))
+      (when (< wakeup-fd 0)
+        (fd-close epfd)
+        (%reactor-error (- wakeup-fd) "eventfd"))
+      (let* ((result (%epoll-ctl epfd epoll-ctl-add wakeup-fd epollin)))
+        (when (< result 0)
+          (fd-close epfd)
+          (fd-close wakeup-fd)
+          (%reactor-error (- result) "epoll_ctl")))
+      (let* ((reactor (%make-reactor :epfd epfd :wakeup-fd wakeup-fd)))
+        (with-lock-grabbed (*reactors-lock*)
+          (push reactor *reactors*))
+        reactor))))
+
+;;; Make the epoll set's interest in the registration's fd match its
+;;; functions; a registration with no functions left is dropped.
+;;; Called with the reactor's lock held.  Returns 0 or a negated errno.
+(defun %reactor-arm (reactor reg)
+  (let* ((fd (fd-registration-fd reg))
+         (events (logior (if (fd-registration-input-function reg) epollin 0)
+                         (if (fd-registration-output-function reg) epollout 0))))
+    (declare (fixnum events))
+    (if (zerop events)
+      (progn
+        (when (fd-registration-added reg)
+          ;; The fd may already have been closed.
+          (%epoll-ctl (reactor-epfd reactor) epoll-ctl-del fd 0))
+        (remhash fd (reactor-registrations reactor))
+        0)
+      (let* ((result (%epoll-ctl (reactor-epfd reactor)
+                                 (if (fd-registration-added reg)
+                                   epoll-ctl-mod
+                                   epoll-ctl-add)
+                                 fd
+                                 (logior events epolloneshot))))
+        (if (< result 0)
+          result
+          (progn
+            (setf (fd-registration-added reg) t)
+            0))))))
+
+;;; Like REACTOR-ADD-FD, but returns 0 or a negated errno: EPERM if FD
+;;; is something (like a regular file) that epoll can't watch.
+(defun %reactor-add-fd (reactor fd direction function)
+  (with-lock-grabbed ((reactor-lock reactor))
+    (let* ((registrations (reactor-registrations reactor))
+           (reg (or (gethash fd registrations)
+                    (setf (gethash fd registrations)
+                          (make-fd-registration :fd fd))))
+           (result 0))
+      (ecase direction
+        (:input (setf (fd-registration-input-function reg) function))
+        (:output (setf (fd-registration-output-function reg) function)))
+      (setq result (%reactor-arm reactor reg))
+      (when (< result 0)
+        (ecase direction
+          (:input (setf (fd-registration-input-function reg) nil))
+          (:output (setf (fd-registration-output-function reg) nil)))
+        (unless (or (fd-registration-input-function reg)
+                    (fd-registration-output-function reg))
+          (remhash fd registrations)))
+      result)))
+
+(defun reactor-add-fd (reactor fd direction function)
+  "Arrange for FUNCTION to be called, once, when FD is ready for
+DIRECTION (:INPUT or :OUTPUT); an fd that has reached end-of-file or has
+an error pending is ready for both.  FUNCTION is called with one
+argument: true if the fd became ready, NIL if the registration was
+cancelled by REACTOR-REMOVE-FD or CLOSE-REACTOR.  It's called in one of
+the reactor's event-loop threads and shouldn't block.  Replaces any
+function already registered for FD and DIRECTION."
+  (let* ((result (%reactor-add-fd reactor fd direction function)))
+    (when (< result 0)
+      (%reactor-error (- result) "epoll_ctl")))
+  fd)
+
+;;; If DIRECTION is NIL, cancel both directions and forget about the fd.
+;;; Returns the functions that were cancelled, without calling them.
+(defun %reactor-cancel (reactor fd direction)
+  (with-lock-grabbed ((reactor-lock reactor))
+    (let* ((registrations (reactor-registrations reactor))
+           (reg (gethash fd registrations))
+           (cancelled ()))
+      (when reg
+        (when (and (member direction '(nil :input))
+                   (fd-registration-input-function reg))
+          (push (fd-registration-input-function reg) cancelled)
+          (setf (fd-registration-input-function reg) nil))
+        (when (and (member direction '(nil :output))
+                   (fd-registration-output-function reg))
+          (push (fd-registration-output-function reg) cancelled)
+          (setf (fd-registration-output-function reg) nil))
+        (let* ((result (%reactor-arm reactor reg)))
+          (when (< result 0)
+            (%reactor-error (- result) "epoll_ctl"))))
+      cancelled)))
+
+(defun reactor-remove-fd (reactor fd &optional direction)
+  "Stop watching FD for DIRECTION (:INPUT, :OUTPUT, or by default both),
+calling the functions that were registered for it with NIL.  FD should
+be removed before it's closed."
+  (dolist (f (%reactor-cancel reactor fd direction))
+    (funcall f nil)))
+
+;;; Called in an event-loop thread when EVENTS are reported for FD.
+(defun %reactor-dispatch (reactor fd events)
+  (declare (fixnum events))
+  (let* ((input-ready (logtest events (logior epollin epollerr epollhup)))
+         (output-ready (logtest events (logior epollout epollerr epollhup)))
+         (ready ()))
+    (with-lock-grabbed ((reactor-lock reactor))
+      (let* ((reg (gethash fd (reactor-registrations reactor))))
+        (when reg
+          (when (and input-ready (fd-registration-input-function reg))
+            (push (fd-registration-input-function reg) ready)
+            (setf (fd-registration-input-function reg) nil))
+          (when (and output-ready (fd-registration-output-function reg))
+            (push (fd-registration-output-function reg) ready)
+            (setf (fd-registration-output-function reg) nil))
+          ;; The fd was disarmed when the event was reported; keep
+          ;; watching it for the other direction, if anyone is, or
+          ;; take it out of the epoll set, so that the fd's number
+          ;; can be reused.
+          (let* ((result (%reactor-arm reactor reg)))
+            (when (< result 0)
+              (%reactor-error (- result) "epoll_ctl"))))))
+    (dolist (f ready)
+      (funcall f t))))
+
+(defun run-reactor (reactor)
+  "Wait for and dispatch events on REACTOR in the current thread, until
+STOP-REACTOR is called."
+  (let* ((epfd (reactor-epfd reactor))
+         (wakeup-fd (reactor-wakeup-fd reactor))
+         (max *reactor-events-per-wait*))
+    (declare (fixnum epfd wakeup-fd max))
+    (%stack-block ((events (* max epoll-event-size)))
+      (loop
+        (when (reactor-stopping reactor)
+          (return))
+        (let* ((n (int-errno-call (external-call "epoll_wait"
+                                                 :int epfd
+                                                 :address events
+                                                 :int max
+                                                 :int -1
+                                                 :int))))
+          (declare (fixnum n))
+          (if (< n 0)
+            (unless (eql n (- #$EINTR))
+              (%reactor-error (- n) "epoll_wait"))
+            (dotimes (i n)
+              (let* ((offset (* i epoll-event-size))
+                     (fd (%%get-unsigned-longlong events (+ offset epoll-event.data))))
+                (unless (eql fd wakeup-fd)
+                  (%reactor-dispatch reactor
+                                     fd
+                                     (%get-unsigned-long events offset)))))))))))
+
+(defun start-reactor (reactor &key (threads 1))
+  "Start THREADS event-loop threads running RUN-REACTOR on REACTOR."
+  (setf (reactor-stopping reactor) nil)
+  (dotimes (i threads reactor)
+    (let* ((p (process-run-function (format nil "reactor ~d" i)
+                                    #'run-reactor reactor)))
+      (with-lock-grabbed ((reactor-lock reactor))
+        (push p (reactor-threads reactor))))))
+
+(defun stop-reactor (reactor)
+  "Make REACTOR's event-loop threads return, and wait for the ones that
+START-REACTOR started to exit."
+  (setf (reactor-stopping reactor) t)
+  (%stack-block ((one 8))
+    (setf (%%get-unsigned-longlong one 0) 1)
+    (fd-write (reactor-wakeup-fd reactor) one 8))
+  (let* ((threads (with-lock-grabbed ((reactor-lock reactor))
+                    (prog1 (reactor-threads reactor)
+                      (setf (reactor-threads reactor) ())))))
+    (dolist (p threads)
+      (unless (eq p *current-process*)
+        (process-wait "reactor stop" #'process-exhausted-p p))))
+  ;; Drain the eventfd, so that the reactor can be restarted.
+  (%stack-block ((count 8))
+    (fd-read (reactor-wakeup-fd reactor) count 8))
+  reactor)
+
+(defun close-reactor (reactor)
+  "Stop REACTOR, cancel all of its registrations and close its epoll
+instance."
+  (stop-reactor reactor)
+  (let* ((fds ()))
+    (with-lock-grabbed ((reactor-lock reactor))
+      (maphash #'(lambda (fd reg)
+                   (declare (ignore reg))
+                   (push fd fds))
+               (reactor-registrations reactor)))
+    (dolist (fd fds)
+      (reactor-remove-fd reactor fd)))
+  (with-lock-grabbed (*reactors-lock*)
+    (setq *reactors* (remove reactor *reactors*)))
+  (fd-close (reactor-wakeup-fd reactor))
+  (fd-close (reactor-epfd reactor))
+  (setf (reactor-epfd reactor) -1
+        (reactor-wakeup-fd reactor) -1)
+  reactor)
+
+(defun reactor-wait-fd (reactor fd direction &optional timeout)
+  "Park the current thread until FD is ready for DIRECTION or until
+TIMEOUT milliseconds have elapsed.  Returns the same values as
+PROCESS-INPUT-WAIT: T, NIL, NIL if the fd is ready and NIL, T, NIL on
+timeout.  REACTOR must have event-loop threads running."
+  (let* ((semaphore (make-semaphore))
+         (ready nil)
+         (result (%reactor-add-fd reactor fd direction
+                                  #'(lambda (win)
+                                      (setq ready win)
+                                      (signal-semaphore semaphore)))))
+    (declare (fixnum result))
+    (when (< result 0)
+      (if (eql result (- #$EPERM))
+        ;; Regular files and such are always ready, as far as poll(2)
+        ;; is concerned.
+        (return-from reactor-wait-fd
+          (if (eq direction :input)
+            (process-input-wait fd timeout)
+            (process-output-wait fd timeout)))
+        (%reactor-error (- result) "epoll_ctl")))
+    (if (and timeout (>= timeout 0))
+      (unless (timed-wait-on-semaphore semaphore (/ timeout 1000))
+        ;; If the registration is still there, no one will signal the
+        ;; semaphore; otherwise, it's being signaled now.
+        (if (%reactor-cancel reactor fd direction)
+          (return-from reactor-wait-fd (values nil t nil))
+          (wait-on-semaphore semaphore)))
+      (wait-on-semaphore semaphore))
+    (if ready
+      (values t nil nil)
+      (values nil nil (- #$EBADF)))))
+
+;;; Called by FD-STREAM-CLOSE before it closes FD.  A thread that's
+;;; waiting on FD is woken up and told that it's been closed.
+(defun %reactors-forget-fd (fd)
+  (dolist (reactor *reactors*)
+    (when (with-lock-grabbed ((reactor-lock reactor))
+            (gethash fd (reactor-registrations reactor)))
+      (reactor-remove-fd reactor fd))))
+
+(setq *fd-stream-close-function* '%reactors-forget-fd)
+
+(defun use-reactor-for-fd-streams (reactor)
+  "Make FD-streams wait on REACTOR (or, if REACTOR is NIL, poll(2)) when
+they'd otherwise block, in all threads that don't bind
+*FD-STREAM-WAIT-FUNCTION*."
+  (setq *fd-stream-wait-function*
+        (when reactor
+          #'(lambda (fd direction timeout)
+              (reactor-wait-fd reactor fd direction timeout)))))
+
+(defmacro with-reactor-for-fd-streams ((reactor) &body body)
+  "Execute BODY with FD-streams waiting on REACTOR when they'd
+otherwise block."
+  (let* ((r (gensym)))
+    `(let* ((,r ,reactor)
+            (*fd-stream-wait-function*
+             #'(lambda (fd direction timeout)
+                 (reactor-wait-fd ,r fd direction timeout))))
+       ,@body)))
+
+(provide "REACTOR")
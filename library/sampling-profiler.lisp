@@ -0,0 +1,522 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;; Copyright 2026 Clozure Associates
+;;;
+;;; Licensed under the Apache License, Version 2.0 (the "License");
+;;; you may not use this file except in compliance with the License.
+;;; You may obtain a copy of the License at
+;;;
+;;;     http://www.apache.org/licenses/LICENSE-2.0
+;;;
+;;; Unless required by applicable law or agreed to in writing, software
+;;; distributed under the License is distributed on an "AS IS" BASIS,
+;;; WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+;;; See the License for the specific language governing permissions and
+;;; limitations under the License.
+
+; sampling-profiler.lisp
+; A statistical CPU profiler.  The kernel samples whichever thread is
+; running every so often (SIGPROF, driven by process CPU time) and
+; records its lisp backtrace in that thread's ring buffer; the GC keeps
+; the functions in unread samples alive and up to date.  A lisp thread
+; drains the buffers into a table of stacks, which can be reported or
+; written in "folded stack" form (for flame graph tools) or as a pprof
+; profile.  The allocation profiler works the same way, but samples
+; allocations and records their types and sizes.
+
+(in-package :ccl)
+
+(export '(start-sampling-profiler
+          stop-sampling-profiler
+          reset-sampling-profiler
+          with-sampling-profiler
+          sampling-profiler-report
+          write-folded-stacks
+          write-pprof-profile
+          start-allocation-profiler
+          stop-allocation-profiler
+          reset-allocation-profiler
+          with-allocation-profiler
+          allocation-profiler-sites
+          allocation-profiler-report))
+
+;;; Layout of the kernel's profile_buffer struct (see threads.h), as
+;;; byte offsets.
+(eval-when (:compile-toplevel :load-toplevel :execute)
+  (defconstant profile-buffer.nrecords (* 2 target::node-size))
+  (defconstant profile-buffer.record-words (* 3 target::node-size))
+  (defconstant profile-buffer.head (* 4 target::node-size))
+  (defconstant profile-buffer.tail (* 5 target::node-size))
+  (defconstant profile-buffer.dropped (* 6 target::node-size))
+  (defconstant profile-buffer.records (* 7 target::node-size)))
+
+;;; Sample states (PROFILE_SAMPLE_xxx)
+(defparameter *profile-sample-states* #("<lisp>" "<foreign>" "<kernel>"))
+
+(defvar *profile-lock* (make-lock "sampling profiler"))
+(defvar *profile-stacks* (make-hash-table :test #'equal)
+  "Maps a list of functions (outermost first) to a sample count.")
+(defvar *profile-interval* 1000 "Sampling interval, in microseconds.")
+(defvar *profile-start-time* nil)
+(defvar *profile-dropped* 0)
+(defvar *profile-drainer* nil)
+(defvar *profiling-cpu* nil)
+(defvar *profiling-allocation* nil)
+
+;;; Words at the start of each record before the (function, offset)
+;;; pairs: a frame count and two words of sample-specific data.
+(defconstant profile-record-header-words 3)
+
+(defun %profile-buffers (import)
+  (flet ((get-buffers (v n)
+           (ff-call (%kernel-import import)
+                    :address v
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword n
+                    #+64-bit-target :unsigned-doubleword
+                    #+32-bit-target :unsigned-fullword)))
+    (let* ((n (get-buffers (%null-ptr) 0)))
+      (unless (zerop n)
+        (%stack-block ((v (* n target::node-size)))
+          ;; More buffers may have been created in the meantime; they're
+          ;; at the front of the list.
+          (setq n (min n (get-buffers v n)))
+          (collect ((buffers))
+            (dotimes (i n (buffers))
+              (buffers (%get-ptr v (* i target::node-size))))))))))
+
+;;; Call FN on the stack (a list of functions, outermost first) and the
+;;; two data words of each unread sample in BUF, then mark them read.
+;;; Records between the buffer's tail and head aren't touched by the
+;;; sampler, and the GC updates the functions in them until the tail is
+;;; advanced past them.  A frame that isn't in a lisp function is
+;;; represented by a string, which NAMER returns for the innermost one.
+(defun %drain-profile-buffer (buf fn namer)
+  (let* ((nrecords (%get-natural buf profile-buffer.nrecords))
+         (record-bytes (* (%get-natural buf profile-buffer.record-words)
+                          target::node-size))
+         (records (%get-ptr buf profile-buffer.records))
+         (head (%get-natural buf profile-buffer.head))
+         (tail (%get-natural buf profile-buffer.tail)))
+    (do* ((i tail (1+ i)))
+         ((= i head))
+      (let* ((base (* (mod i nrecords) record-bytes))
+             (nframes (%get-object records base))
+             (data1 (%get-object records (+ base target::node-size)))
+             (data2 (%get-object records (+ base (* 2 target::node-size))))
+             (frames ()))
+        (declare (fixnum nframes))
+        (dotimes (j nframes)
+          (let* ((f (%get-object records
+                                 (+ base (* (+ profile-record-header-words (* 2 j))
+                                            target::node-size)))))
+            (push (cond ((functionp f) f)
+                        ((zerop j) (funcall namer data1))
+                        (t "<unknown>"))
+                  frames)))
+        (funcall fn frames data1 data2)))
+    (setf (%get-natural buf profile-buffer.tail) head)
+    (%get-natural buf profile-buffer.dropped)))
+
+(defun %drain-profile-buffers ()
+  (with-lock-grabbed (*profile-lock*)
+    (let* ((dropped 0)
+           (stacks *profile-stacks*))
+      (dolist (buf (%profile-buffers target::kernel-import-lisp-profiler-buffers))
+        (incf dropped (%drain-profile-buffer
+                       buf
+                       #'(lambda (frames state size)
+                           (declare (ignore state size))
+                           (incf (gethash frames stacks 0)))
+                       #'(lambda (state) (svref *profile-sample-states* state)))))
+      (setq *profile-dropped* dropped))))
+
+(defun start-sampling-profiler (&key (frequency 1000) (max-depth 64) (buffer-size 4096))
+  "Start sampling every thread that's running lisp code FREQUENCY
+times per second of CPU time, recording up to MAX-DEPTH frames per
+sample.  Each thread buffers up to BUFFER-SIZE samples until they're
+collected (which happens about ten times a second.)"
+  (let* ((usec (max 1 (round 1000000 frequency)))
+         (err (ff-call (%kernel-import target::kernel-import-lisp-profiler-start)
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword usec
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword buffer-size
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword max-depth
+                       :signed-fullword)))
+    (unless (zerop err)
+      (error "Can't start the sampling profiler: ~a" (%strerror err)))
+    (setq *profile-interval* usec
+          *profiling-cpu* t)
+    (unless *profile-start-time*
+      (setq *profile-start-time* (get-universal-time)))
+    (%start-profile-drainer)
+    t))
+
+;;; Samples are moved out of the kernel's buffers every so often while
+;;; either profiler is running, so that the buffers don't fill up.
+(defun %start-profile-drainer ()
+  (unless *profile-drainer*
+    (setq *profile-drainer*
+          (process-run-function "sampling profiler"
+                                #'(lambda ()
+                                    (loop
+                                      (sleep 0.1)
+                                      (%drain-profile-buffers)
+                                      (%drain-allocation-profile-buffers)))))))
+
+(defun %stop-profile-drainer ()
+  (let* ((p *profile-drainer*))
+    (when (and p (not *profiling-cpu*) (not *profiling-allocation*))
+      (setq *profile-drainer* nil)
+      (process-kill p))))
+
+(defun stop-sampling-profiler ()
+  "Stop sampling, and collect any samples that haven't been."
+  (ff-call (%kernel-import target::kernel-import-lisp-profiler-stop) :signed-fullword)
+  (setq *profiling-cpu* nil)
+  (%stop-profile-drainer)
+  (%drain-profile-buffers)
+  nil)
+
+(defun reset-sampling-profiler ()
+  "Discard all samples collected so far."
+  (%drain-profile-buffers)
+  (with-lock-grabbed (*profile-lock*)
+    (clrhash *profile-stacks*)
+    (setq *profile-start-time* (if *profiling-cpu* (get-universal-time)))))
+
+(defmacro with-sampling-profiler ((&rest args) &body body)
+  "Run BODY with the sampling profiler started (with ARGS); stop it
+afterwards."
+  `(unwind-protect
+        (progn
+          (start-sampling-profiler ,@args)
+          ,@body)
+     (stop-sampling-profiler)))
+
+(defun %profile-frame-name (frame)
+  (if (stringp frame)
+    frame
+    (let* ((name (function-name frame)))
+      (if name
+        (with-standard-io-syntax
+          (let* ((*package* (find-package "CL-USER"))
+                 (*print-readably* nil))
+            (prin1-to-string name)))
+        "<anonymous>"))))
+
+;;; Stacks with frames replaced by names; frames that name the same
+;;; function are merged.
+(defun %profile-named-stacks ()
+  (%drain-profile-buffers)
+  (let* ((names (make-hash-table :test #'eq))
+         (result (make-hash-table :test #'equal)))
+    (with-lock-grabbed (*profile-lock*)
+      (maphash #'(lambda (frames count)
+                   (let* ((key (mapcar #'(lambda (f)
+                                           (or (gethash f names)
+                                               (setf (gethash f names)
+                                                     (%profile-frame-name f))))
+                                       frames)))
+                     (incf (gethash key result 0) count)))
+               *profile-stacks*))
+    result))
+
+(defun %call-with-profile-output (destination element-type fn)
+  (if (or (streamp destination) (eq destination t))
+    (funcall fn (if (eq destination t) *standard-output* destination))
+    (with-open-file (s destination :direction :output
+                       :if-exists :supersede
+                       :element-type element-type)
+      (funcall fn s))))
+
+(defun write-folded-stacks (destination)
+  "Write the samples collected so far to DESTINATION (a stream, T or a
+pathname) in the \"folded stack\" format read by flame graph tools: a
+line per distinct stack, with frames (outermost first) separated by
+semicolons and followed by a space and a sample count."
+  (let* ((stacks (%profile-named-stacks)))
+    (%call-with-profile-output
+     destination 'character
+     #'(lambda (s)
+         (maphash #'(lambda (names count)
+                      (let* ((first t))
+                        (dolist (name names)
+                          (unless first (write-char #\; s))
+                          (setq first nil)
+                          (write-string (substitute #\: #\; name) s)))
+                      (format s " ~d~%" count))
+                  stacks)))
+    destination))
+
+;;; Just enough of a protocol buffer encoder to write a pprof profile
+;;; (see profile.proto in the pprof sources.)
+
+(defun %pb-varint (buf n)
+  (loop
+    (let* ((b (logand n #x7f)))
+      (setq n (ash n -7))
+      (if (zerop n)
+        (return (vector-push-extend b buf))
+        (vector-push-extend (logior b #x80) buf)))))
+
+(defun %pb-int-field (buf field n)
+  (%pb-varint buf (ash field 3))
+  (%pb-varint buf n))
+
+(defun %pb-bytes-field (buf field bytes)
+  (%pb-varint buf (logior (ash field 3) 2))
+  (%pb-varint buf (length bytes))
+  (dotimes (i (length bytes))
+    (vector-push-extend (aref bytes i) buf)))
+
+(defun %pb-buffer ()
+  (make-array 256 :element-type '(unsigned-byte 8) :fill-pointer 0 :adjustable t))
+
+(defun %pb-message-field (buf field fn)
+  (let* ((sub (%pb-buffer)))
+    (funcall fn sub)
+    (%pb-bytes-field buf field sub)))
+
+(defun %pb-packed-field (buf field values)
+  (let* ((sub (%pb-buffer)))
+    (dolist (v values) (%pb-varint sub v))
+    (%pb-bytes-field buf field sub)))
+
+(defun write-pprof-profile (pathname)
+  "Write the samples collected so far to PATHNAME as an uncompressed
+pprof profile, with sample counts and CPU time."
+  (let* ((stacks (%profile-named-stacks))
+         (strings (make-hash-table :test #'equal))
+         (string-list ())
+         (nstrings 0)
+         (functions (make-hash-table :test #'equal))
+         (buf (%pb-buffer))
+         (nanos (* *profile-interval* 1000)))
+    (flet ((string-index (s)
+             (or (gethash s strings)
+                 (progn
+                   (push s string-list)
+                   (prog1 (setf (gethash s strings) nstrings)
+                     (incf nstrings)))))
+           (function-id (name)
+             (or (gethash name functions)
+                 (setf (gethash name functions)
+                       (1+ (hash-table-count functions))))))
+      (string-index "")
+      (flet ((value-type (type unit)
+               (let* ((ti (string-index type))
+                      (ui (string-index unit)))
+                 #'(lambda (m)
+                     (%pb-int-field m 1 ti)
+                     (%pb-int-field m 2 ui)))))
+        (%pb-message-field buf 1 (value-type "samples" "count"))
+        (%pb-message-field buf 1 (value-type "cpu" "nanoseconds"))
+        ;; Samples, with location ids (= function ids) leaf first.
+        (maphash #'(lambda (names count)
+                     (let* ((ids (mapcar #'function-id names)))
+                       (%pb-message-field buf 2
+                                          #'(lambda (m)
+                                              (%pb-packed-field m 1 (reverse ids))
+                                              (%pb-packed-field m 2 (list count (* count nanos)))))))
+                 stacks)
+        ;; One location per function.
+        (maphash #'(lambda (name id)
+                     (declare (ignore name))
+                     (%pb-message-field buf 4
+                                        #'(lambda (m)
+                                            (%pb-int-field m 1 id)
+                                            (%pb-message-field m 4
+                                                               #'(lambda (line)
+                                                                   (%pb-int-field line 1 id))))))
+                 functions)
+        (maphash #'(lambda (name id)
+                     (let* ((ni (string-index name)))
+                       (%pb-message-field buf 5
+                                          #'(lambda (m)
+                                              (%pb-int-field m 1 id)
+                                              (%pb-int-field m 2 ni)
+                                              (%pb-int-field m 3 ni)))))
+                 functions)
+        (dolist (s (reverse string-list))
+          (%pb-bytes-field buf 6 (encode-string-to-octets s :external-format :utf-8)))
+        (when *profile-start-time*
+          (%pb-int-field buf 9 (* (- *profile-start-time* unix-to-universal-time)
+                                  1000000000)))
+        (%pb-message-field buf 11 (value-type "cpu" "nanoseconds"))
+        (%pb-int-field buf 12 nanos)))
+    (with-open-file (s pathname :direction :output
+                       :if-exists :supersede
+                       :element-type '(unsigned-byte 8))
+      (write-sequence buf s))
+    pathname))
+
+(defun sampling-profiler-report (&key (stream t) (count 20))
+  "Summarize the samples collected so far: the COUNT functions in which
+the most samples were taken, and the COUNT functions that were most
+often on the stack."
+  (let* ((stacks (%profile-named-stacks))
+         (self (make-hash-table :test #'equal))
+         (total (make-hash-table :test #'equal))
+         (nsamples 0))
+    (maphash #'(lambda (names n)
+                 (incf nsamples n)
+                 (incf (gethash (car (last names)) self 0) n)
+                 (dolist (name (remove-duplicates names :test #'string=))
+                   (incf (gethash name total 0) n)))
+             stacks)
+    (when (eq stream t) (setq stream *standard-output*))
+    (format stream "~&~d samples (~,1f seconds of CPU time), ~d dropped~%"
+            nsamples (/ (* nsamples *profile-interval*) 1000000.0) *profile-dropped*)
+    (flet ((show (title table)
+             (let* ((entries ()))
+               (maphash #'(lambda (name n) (push (cons name n) entries)) table)
+               (setq entries (sort entries #'> :key #'cdr))
+               (format stream "~&~%~a~%" title)
+               (loop for (name . n) in entries
+                     repeat count
+                     do (format stream "~&~8d ~5,1f% ~a~%" n
+                                (if (zerop nsamples) 0 (/ (* 100.0 n) nsamples))
+                                name)))))
+      (show "Self:" self)
+      (show "Total:" total))
+    (values)))
+
+
+;;; Allocation profiling.  The kernel samples an allocation about every
+;;; *ALLOCATION-SAMPLE-INTERVAL* bytes that each thread allocates; the
+;;; intervals vary randomly so that loops don't always sample the same
+;;; allocation.  A sampled object stands for about that many bytes, or
+;;; for itself if it's bigger.
+
+(defvar *allocation-sample-interval* (* 512 1024))
+(defvar *allocation-sites* (make-hash-table :test #'equal)
+  "Maps (subtag . stack) to (samples . estimated bytes).")
+(defvar *allocation-profile-dropped* 0)
+
+(defun %drain-allocation-profile-buffers ()
+  (with-lock-grabbed (*profile-lock*)
+    (let* ((dropped 0)
+           (sites *allocation-sites*)
+           (interval *allocation-sample-interval*))
+      (dolist (buf (%profile-buffers target::kernel-import-lisp-allocation-profiler-buffers))
+        (incf dropped (%drain-profile-buffer
+                       buf
+                       #'(lambda (frames subtag size)
+                           (let* ((key (cons subtag frames))
+                                  (entry (or (gethash key sites)
+                                             (setf (gethash key sites) (cons 0 0)))))
+                             (incf (car entry))
+                             (incf (cdr entry) (max size interval))))
+                       #'(lambda (subtag)
+                           (declare (ignore subtag))
+                           "<subprimitive>"))))
+      (setq *allocation-profile-dropped* dropped))))
+
+(defun start-allocation-profiler (&key (interval (* 512 1024)) (max-depth 32) (buffer-size 4096))
+  "Start sampling an allocation about every INTERVAL bytes that each
+thread allocates, recording the object's type and size and up to
+MAX-DEPTH frames of the allocating thread's stack.  Each thread buffers
+up to BUFFER-SIZE samples until they're collected."
+  (let* ((err (ff-call (%kernel-import target::kernel-import-lisp-allocation-profiler-start)
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword interval
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword buffer-size
+                       #+64-bit-target :unsigned-doubleword
+                       #+32-bit-target :unsigned-fullword max-depth
+                       :signed-fullword)))
+    (unless (zerop err)
+      (error "Can't start the allocation profiler: ~a" (%strerror err)))
+    (setq *allocation-sample-interval* interval
+          *profiling-allocation* t)
+    (%start-profile-drainer)
+    t))
+
+(defun stop-allocation-profiler ()
+  "Stop sampling allocation, and collect any samples that haven't been."
+  (ff-call (%kernel-import target::kernel-import-lisp-allocation-profiler-stop) :signed-fullword)
+  (setq *profiling-allocation* nil)
+  (%stop-profile-drainer)
+  (%drain-allocation-profile-buffers)
+  nil)
+
+(defun reset-allocation-profiler ()
+  "Discard all allocation samples collected so far."
+  (%drain-allocation-profile-buffers)
+  (with-lock-grabbed (*profile-lock*)
+    (clrhash *allocation-sites*)))
+
+(defmacro with-allocation-profiler ((&rest args) &body body)
+  "Run BODY with the allocation profiler started (with ARGS); stop it
+afterwards."
+  `(unwind-protect
+        (progn
+          (start-allocation-profiler ,@args)
+          ,@body)
+     (stop-allocation-profiler)))
+
+(defun %allocation-type-name (subtag)
+  (if (eql subtag target::fulltag-cons)
+    'cons
+    (or (aref *heap-utilization-vector-type-names* subtag)
+        subtag)))
+
+(defun allocation-profiler-sites (&key (depth 1))
+  "Return a list of (site type samples bytes) for the allocations
+sampled so far, where SITE is a list of the names of the DEPTH
+innermost lisp functions on the stack (innermost first) and BYTES is
+an estimate of how much was allocated there.  The list is sorted by
+BYTES, largest first."
+  (%drain-allocation-profile-buffers)
+  (let* ((names (make-hash-table :test #'eq))
+         (result (make-hash-table :test #'equal)))
+    (with-lock-grabbed (*profile-lock*)
+      (maphash #'(lambda (key entry)
+                   (let* ((site ()))
+                     (dolist (f (reverse (cdr key)))
+                       (unless (stringp f)
+                         (push (or (gethash f names)
+                                   (setf (gethash f names)
+                                         (%profile-frame-name f)))
+                               site)
+                         (when (= (length site) depth)
+                           (return))))
+                     (let* ((k (cons (nreverse site) (car key)))
+                            (e (or (gethash k result)
+                                   (setf (gethash k result) (cons 0 0)))))
+                       (incf (car e) (car entry))
+                       (incf (cdr e) (cdr entry)))))
+               *allocation-sites*))
+    (let* ((sites ()))
+      (maphash #'(lambda (k e)
+                   (push (list (car k) (%allocation-type-name (cdr k)) (car e) (cdr e))
+                         sites))
+               result)
+      (sort sites #'> :key #'fourth))))
+
+(defun allocation-profiler-report (&key (stream t) (count 20) (depth 1))
+  "Show the COUNT allocation sites (see ALLOCATION-PROFILER-SITES)
+responsible for the most bytes and for the most samples."
+  (let* ((sites (allocation-profiler-sites :depth depth))
+         (total-bytes (reduce #'+ sites :key #'fourth))
+         (total-samples (reduce #'+ sites :key #'third)))
+    (when (eq stream t) (setq stream *standard-output*))
+    (format stream "~&~d samples, about ~:d bytes allocated, ~d dropped~%"
+            total-samples total-bytes *allocation-profile-dropped*)
+    (flet ((show (title sites key total)
+             (format stream "~&~%~a~%" title)
+             (loop for entry in sites
+                   repeat count
+                   do (destructuring-bind (site type samples bytes) entry
+                        (format stream "~&~14:d ~8d ~5,1f% ~a ~{~a~^ < ~}~%"
+                                bytes samples
+                                (if (zerop total)
+                                  0
+                                  (/ (* 100.0 (funcall key entry)) total))
+                                type site)))))
+      (show "By bytes:" sites #'fourth total-bytes)
+      (show "By samples:" (sort (copy-list sites) #'> :key #'third) #'third total-samples))
+    (values)))
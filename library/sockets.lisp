@@ -30,6 +30,19 @@
 	    ;;with-pending-connect
 	    RECEIVE-FROM
 	    SEND-TO
+            RECEIVE-MANY
+            SEND-MANY
+            MAKE-DATAGRAM-BATCH
+            DISPOSE-DATAGRAM-BATCH
+            DATAGRAM-BATCH-BUFFER
+            DATAGRAM-BATCH-COUNT
+            DATAGRAM-BATCH-SIZE
+            DATAGRAM-LENGTH
+            DATAGRAM-ADDRESS
+            MAKE-LISTENER-GROUP
+            LISTENER-GROUP-LISTENERS
+            LISTENER-GROUP-ACCEPT
+            LISTENER-GROUP-ACCEPT-RATES
 	    SHUTDOWN
 	    ;;socket-control
 	    SOCKET-OS-FD
@@ -514,6 +527,8 @@ the socket is not connected."))
                            &key 
                              keepalive
                              reuse-address
+                             reuse-port
+                             defer-accept
                              nodelay
                              broadcast
                              linger
@@ -532,6 +547,11 @@ the socket is not connected."))
       (int-setsockopt fd #$SOL_SOCKET #$SO_KEEPALIVE 1))
     (when reuse-address
       (int-setsockopt fd #$SOL_SOCKET #$SO_REUSEADDR 1))
+    ;; Lets several sockets (in several threads, say) bind the same
+    ;; address; the kernel spreads datagrams and connections among them.
+    #-windows-target
+    (when reuse-port
+      (int-setsockopt fd #$SOL_SOCKET #$SO_REUSEPORT 1))
     (when broadcast
       (int-setsockopt fd #$SOL_SOCKET #$SO_BROADCAST 1))
     (when out-of-band-inline
@@ -549,6 +569,11 @@ the socket is not connected."))
 			#+linux-target #$SOL_TCP
 			#-linux-target #$IPPROTO_TCP
 			#$TCP_NODELAY 1))
+      ;; Don't wake an acceptor until the client has sent some data
+      ;; (or DEFER-ACCEPT seconds have passed.)
+      #+linux-target
+      (when (and defer-accept (eq connect :passive))
+        (int-setsockopt fd #$SOL_TCP 9 #|TCP_DEFER_ACCEPT|# defer-accept))
       (when (or local-port local-host local-address)
         (socket-bind-local socket (or local-address
                                       (resolve-address :host local-host
@@ -587,8 +612,8 @@ the socket is not connected."))
                       (connect :active)
                       remote-host remote-port remote-address
                       eol format
-                      keepalive reuse-address nodelay broadcast linger
-                      local-port local-host local-address
+                      keepalive reuse-address reuse-port defer-accept nodelay
+                      broadcast linger local-port local-host local-address
                       backlog class out-of-band-inline
                       local-filename remote-filename sharing basic
                       external-format (auto-close t)
@@ -597,8 +622,8 @@ the socket is not connected."))
   "Create and return a new socket."
   (declare (dynamic-extent keys))
   (declare (ignore type connect remote-host remote-port remote-address
-		   eol format keepalive reuse-address nodelay
-		   broadcast linger local-port local-host
+		   eol format keepalive reuse-address reuse-port defer-accept
+		   nodelay broadcast linger local-port local-host
 		   local-address backlog class out-of-band-inline
 		   local-filename remote-filename sharing basic
 		   external-format auto-close connect-timeout
@@ -824,9 +849,15 @@ the socket is not connected."))
 		 :device fd
 		 :keys keys))
 
-(defun socket-accept (fd wait)
+(defun socket-accept (fd wait &optional (flags 0))
+  #-linux-target (declare (ignore flags))
   (flet ((_accept (fd async)
-	   (let ((res (c_accept fd (%null-ptr) (%null-ptr))))
+	   (let ((res #+linux-target
+                      (if (eql flags 0)
+                        (c_accept fd (%null-ptr) (%null-ptr))
+                        (c_accept4 fd (%null-ptr) (%null-ptr) flags))
+                      #-linux-target
+                      (c_accept fd (%null-ptr) (%null-ptr))))
 	     (declare (fixnum res))
 	     ;; See the inscrutable note under ERROR HANDLING in
 	     ;; man accept(2). This is my best guess at what they mean...
@@ -854,18 +885,20 @@ the socket is not connected."))
 	  (t ; if nowait was specified, temporarily force the socket to not block
              ;  (sockets are generally 'born blocking' in CCL)
 	    (let ((was-blocking (get-socket-fd-blocking fd)))
-	      (unwind-protect
-		  (progn
-                    (set-socket-fd-blocking fd nil)
-		    (_accept fd t))
-		(set-socket-fd-blocking fd was-blocking)))))))
-
-(defun accept-socket-connection (socket wait stream-create-function &optional stream-args)
+              (if (not was-blocking)
+                (_accept fd t)
+                (unwind-protect
+                     (progn
+                       (set-socket-fd-blocking fd nil)
+                       (_accept fd t))
+                  (set-socket-fd-blocking fd was-blocking))))))))
+
+(defun accept-socket-connection (socket wait stream-create-function &optional stream-args (flags 0))
   (let ((listen-fd (socket-device socket))
 	(fd -1))
     (unwind-protect
       (let ((keys (append stream-args (socket-keys socket))))
-	(setq fd (socket-accept listen-fd wait))
+	(setq fd (socket-accept listen-fd wait flags))
 	(cond ((>= fd 0)
 	       (prog1 (apply stream-create-function fd keys)
 		 (setq fd -1)))
@@ -892,6 +925,81 @@ accept-connection on it again."))
 (defmethod accept-connection ((socket file-listener-socket) &key (wait t) stream-args)
   (accept-socket-connection socket wait #'make-file-socket-stream stream-args))
 
+;;; A LISTENER-GROUP is a set of passive TCP sockets bound to the same
+;;; address with SO_REUSEPORT, meant to be served by one acceptor
+;;; thread apiece: the kernel spreads incoming connections among the
+;;; listeners, so acceptors don't contend for a single accept queue.
+
+(defstruct (listener-group (:constructor %make-listener-group))
+  (listeners #() :type simple-vector)
+  (accepts #() :type simple-vector)     ; connections accepted per listener
+  (since 0))                            ; internal real time counts started
+
+(defmethod print-object ((group listener-group) stream)
+  (print-unreadable-object (group stream :type t :identity t)
+    (format stream "~d listener~:p" (length (listener-group-listeners group)))))
+
+(defun make-listener-group (count &rest keys)
+  "Return a LISTENER-GROUP of COUNT passive TCP sockets which all listen
+on the same address.  KEYS are as for MAKE-SOCKET (:CONNECT :PASSIVE and
+:REUSE-PORT T are implied); :DEFER-ACCEPT seconds is useful here on Linux.
+Each listener should be served by its own thread, using LISTENER-GROUP-ACCEPT."
+  (declare (dynamic-extent keys))
+  (let* ((listeners (make-array count :initial-element nil))
+         (ok nil))
+    (unwind-protect
+         (progn
+           (dotimes (i count)
+             (let* ((socket (apply #'make-socket :connect :passive :reuse-port t keys)))
+               (setf (svref listeners i) socket)
+               ;; Waiting for a connection is done by WITH-EAGAIN, so
+               ;; a listener that doesn't block never needs its flags
+               ;; toggled around a non-waiting accept.
+               (set-socket-fd-blocking (socket-device socket) nil)))
+           (setq ok t)
+           (%make-listener-group :listeners listeners
+                                 :accepts (make-array count :initial-element 0)
+                                 :since (get-internal-real-time)))
+      (unless ok
+        (dotimes (i count)
+          (let* ((socket (svref listeners i)))
+            (when socket (close socket :abort t))))))))
+
+(defmethod close ((group listener-group) &key abort)
+  (let* ((listeners (listener-group-listeners group)))
+    (dotimes (i (length listeners) t)
+      (close (svref listeners i) :abort abort))))
+
+(defun listener-group-accept (group index &key (wait t) stream-args)
+  "Accept a connection on the INDEXth listener of GROUP, as ACCEPT-CONNECTION
+would.  On Linux the connection's fd is made non-blocking and close-on-exec
+by accept4(2) itself."
+  (let* ((socket (svref (listener-group-listeners group) index))
+         (stream (accept-socket-connection socket wait #'make-tcp-stream stream-args
+                                           #+linux-target
+                                           (logior #o4000 ; SOCK_NONBLOCK
+                                                   #o2000000) ; SOCK_CLOEXEC
+                                           #-linux-target 0)))
+    (when stream
+      ;; Only INDEX's acceptor thread touches this element.
+      (incf (svref (listener-group-accepts group) index)))
+    stream))
+
+(defun listener-group-accept-rates (group &optional reset)
+  "Return a list of the number of connections per second each listener
+in GROUP has accepted since it was made or since the rates were last
+reset.  If RESET is true, start counting again."
+  (let* ((now (get-internal-real-time))
+         (seconds (max (/ (- now (listener-group-since group))
+                          internal-time-units-per-second)
+                       1/1000))
+         (accepts (listener-group-accepts group))
+         (rates (map 'list #'(lambda (n) (float (/ n seconds))) accepts)))
+    (when reset
+      (fill accepts 0)
+      (setf (listener-group-since group) now))
+    rates))
+
 (defun verify-socket-buffer (buf offset size)
   (unless offset (setq offset 0))
   (unless (<= (+ offset size) (length buf))
@@ -917,16 +1025,7 @@ accept-connection on it again."))
 (defmethod send-to ((socket udp-socket) msg size
 		    &key remote-host remote-port remote-address offset)
   "Send a UDP packet over a socket."
-  (let ((socket-address (and (not (socket-connected socket))
-                             (or remote-address
-                                 (remote-socket-address socket)
-                                 (resolve-address :host (or remote-host
-                                                            (getf (socket-keys socket) :remote-host))
-                                                  :port (or remote-port
-                                                            (getf (socket-keys socket) :remote-port))
-                                                  :connect :active
-                                                  :address-family (socket-address-family socket)
-                                                  :socket-type :datagram)))))
+  (let ((socket-address (udp-socket-destination socket remote-host remote-port remote-address)))
     (multiple-value-setq (msg offset) (verify-socket-buffer msg offset size))
     (%stack-block ((bufptr size))
       (%copy-ivector-to-ptr msg offset bufptr 0 size)
@@ -993,6 +1092,258 @@ If want-socket-address-p is true:
             (values buffer ret-size socket-address)
             (values buffer ret-size (host socket-address) (port socket-address)))))))
 
+;;; Batched datagram I/O.  A DATAGRAM-BATCH holds COUNT buffers of up
+;;; to SIZE octets each, along with the message headers and address
+;;; storage that recvmmsg(2) and sendmmsg(2) use, so that RECEIVE-MANY
+;;; and SEND-MANY can move many datagrams with one system call and
+;;; without consing.  The buffers are all in one heap-allocated octet
+;;; vector, DATAGRAM-BATCH-BUFFER; datagram I starts at (* I SIZE).
+;;; Neither that vector nor the headers are managed by the GC: use
+;;; DISPOSE-DATAGRAM-BATCH to free them.
+
+#-windows-target
+(defstruct (datagram-batch (:constructor %make-datagram-batch))
+  (count 0 :type fixnum)
+  (size 0 :type fixnum)
+  buffer                                ; COUNT * SIZE octets
+  bufptr                                ; address of BUFFER's data
+  (lengths #() :type simple-vector)     ; octets in each datagram
+  (addresses #() :type simple-vector)   ; socket-address of each, or NIL
+  headers)                              ; mmsghdrs, iovecs, sockaddrs
+
+;;; A struct mmsghdr is a struct msghdr followed by an unsigned int.
+#-windows-target
+(defmacro mmsghdr-size ()
+  (logandc2 (+ (record-length :msghdr) 4 (1- target::node-size))
+            (1- target::node-size)))
+
+#-windows-target
+(defun make-datagram-batch (count size)
+  "Return a DATAGRAM-BATCH for RECEIVE-MANY and SEND-MANY, which holds
+up to COUNT datagrams of up to SIZE octets each."
+  (setq count (require-type count '(integer 1 #.(ash 1 20)))
+        size (require-type size '(integer 1 65536)))
+  (let* ((nheaders (* count (+ (mmsghdr-size)
+                               (record-length :iovec)
+                               (record-length :sockaddr_storage))))
+         (headers (malloc nheaders)))
+    (#_memset headers 0 nheaders)
+    (multiple-value-bind (buffer bufptr)
+        (make-heap-ivector (* count size) '(unsigned-byte 8))
+      (%make-datagram-batch :count count
+                            :size size
+                            :buffer buffer
+                            :bufptr bufptr
+                            :lengths (make-array count :initial-element 0)
+                            :addresses (make-array count :initial-element nil)
+                            :headers headers))))
+
+#-windows-target
+(defun dispose-datagram-batch (batch)
+  "Free the memory that BATCH uses.  It can't be used afterwards."
+  (let* ((buffer (datagram-batch-buffer batch))
+         (headers (datagram-batch-headers batch)))
+    (setf (datagram-batch-buffer batch) nil
+          (datagram-batch-bufptr batch) nil
+          (datagram-batch-headers batch) nil
+          (datagram-batch-count batch) 0)
+    (when buffer
+      (dispose-heap-ivector buffer))
+    (when headers
+      (free headers))
+    nil))
+
+#-windows-target
+(defun datagram-length (batch i)
+  "The number of octets in datagram I of BATCH."
+  (svref (datagram-batch-lengths batch) i))
+
+#-windows-target
+(defun (setf datagram-length) (new batch i)
+  (setf (svref (datagram-batch-lengths batch) i)
+        (require-type new `(integer 0 ,(datagram-batch-size batch)))))
+
+#-windows-target
+(defun %datagram-batch-header (batch i ptr)
+  (%setf-macptr ptr (%inc-ptr (datagram-batch-headers batch) (* i (mmsghdr-size)))))
+
+#-windows-target
+(defun %datagram-batch-name (batch i ptr)
+  (%setf-macptr ptr (%inc-ptr (datagram-batch-headers batch)
+                              (+ (* (datagram-batch-count batch)
+                                    (+ (mmsghdr-size) (record-length :iovec)))
+                                 (* i (record-length :sockaddr_storage))))))
+
+#-windows-target
+(defun datagram-address (batch i)
+  "The socket address of datagram I of BATCH: after RECEIVE-MANY, the
+address it came from; for SEND-MANY, where it's to be sent (or NIL, to
+send it to the socket's default address.)  SEND-MANY sends a received
+datagram back where it came from unless this is changed."
+  (let* ((addresses (datagram-batch-addresses batch)))
+    (or (svref addresses i)
+        (with-macptrs ((name))
+          (%datagram-batch-name batch i name)
+          (let* ((family (pref name :sockaddr_storage.ss_family)))
+            (unless (eql family 0)
+              (let* ((socket-address (make-instance 'socket-address)))
+                (#_memcpy (sockaddr socket-address) name (record-length :sockaddr_storage))
+                (upgrade-socket-address-from-sockaddr family socket-address)
+                (setf (svref addresses i) socket-address))))))))
+
+#-windows-target
+(defun (setf datagram-address) (new batch i)
+  (setq new (require-type new '(or null socket-address)))
+  (unless new
+    ;; Forget where a received datagram came from, too.
+    (with-macptrs ((name))
+      (%datagram-batch-name batch i name)
+      (setf (pref name :sockaddr_storage.ss_family) 0)))
+  (setf (svref (datagram-batch-addresses batch) i) new))
+
+;;; The length of the address that RECEIVE-MANY stored for datagram I,
+;;; which NAME points to, or NIL if there isn't one.
+#-windows-target
+(defun %datagram-batch-name-length (name)
+  (let* ((family (pref name :sockaddr_storage.ss_family)))
+    (cond ((eql family #$AF_INET) (record-length :sockaddr_in))
+          ((eql family #$AF_INET6) (record-length #:sockaddr_in6)))))
+
+;;; Make the header for datagram I describe LEN octets of its buffer
+;;; and the socket address at NAME.
+#-windows-target
+(defun %datagram-batch-prepare (batch i len name namelen)
+  (with-macptrs ((hdr)
+                 (iov (%inc-ptr (datagram-batch-headers batch)
+                                (+ (* (datagram-batch-count batch) (mmsghdr-size))
+                                   (* i (record-length :iovec)))))
+                 (buf (%inc-ptr (datagram-batch-bufptr batch)
+                                (* i (datagram-batch-size batch)))))
+    (%datagram-batch-header batch i hdr)
+    (setf (pref iov :iovec.iov_base) buf
+          (pref iov :iovec.iov_len) len
+          (pref hdr :msghdr.msg_name) name
+          (pref hdr :msghdr.msg_namelen) namelen
+          (pref hdr :msghdr.msg_iov) iov
+          (pref hdr :msghdr.msg_iovlen) 1
+          (pref hdr :msghdr.msg_control) (%null-ptr)
+          (pref hdr :msghdr.msg_controllen) 0
+          (pref hdr :msghdr.msg_flags) 0)))
+
+;;; Receive into (or send from) up to N consecutive headers starting
+;;; with the one for datagram I.  Returns the number of datagrams
+;;; transferred or a negative errno.  Without recvmmsg/sendmmsg, do
+;;; one recvmsg/sendmsg per datagram, not waiting after the first.
+#-windows-target
+(defun %datagram-batch-transfer (fd batch i n direction flags)
+  (with-macptrs ((hdr))
+    (%datagram-batch-header batch i hdr)
+    #+linux-target
+    (if (eq direction :input)
+      (c_recvmmsg fd hdr n flags)
+      (c_sendmmsg fd hdr n flags))
+    #-linux-target
+    (do* ((j 0 (1+ j)))
+         ((= j n) j)
+      (let* ((res (if (eq direction :input)
+                    (c_recvmsg fd hdr (if (zerop j) flags (logior flags #$MSG_DONTWAIT)))
+                    (c_sendmsg fd hdr (if (zerop j) flags (logior flags #$MSG_DONTWAIT))))))
+        (when (< res 0)
+          (return (if (zerop j) res j)))
+        ;; Leave the length where recvmmsg would.
+        (setf (%get-unsigned-long hdr (record-length :msghdr)) res)
+        (%incf-ptr hdr (mmsghdr-size))))))
+
+#-windows-target
+(defmethod receive-many ((socket udp-socket) batch &key (wait t))
+  "Receive up to (DATAGRAM-BATCH-COUNT BATCH) datagrams into BATCH,
+using a single recvmmsg(2) where possible, and return the number
+received.  The octets of datagram I are at (* I (DATAGRAM-BATCH-SIZE
+BATCH)) in (DATAGRAM-BATCH-BUFFER BATCH); (DATAGRAM-LENGTH BATCH I) is
+their number and (DATAGRAM-ADDRESS BATCH I) their sender.  If WAIT is
+true, wait for at least one datagram; otherwise, return 0 if none are
+available."
+  (let* ((fd (socket-device socket))
+         (count (datagram-batch-count batch))
+         (size (datagram-batch-size batch))
+         (lengths (datagram-batch-lengths batch)))
+    (fill (datagram-batch-addresses batch) nil)
+    (with-macptrs ((name))
+      (dotimes (i count)
+        (%datagram-batch-name batch i name)
+        (setf (pref name :sockaddr_storage.ss_family) 0)
+        (%datagram-batch-prepare batch i size name (record-length :sockaddr_storage))))
+    (let* ((n (socket-call socket "recvmmsg"
+                (if wait
+                  (with-eagain fd :input
+                    (%datagram-batch-transfer fd batch 0 count :input
+                                              #+linux-target #x10000 ; MSG_WAITFORONE
+                                              #-linux-target 0))
+                  (let* ((res (%datagram-batch-transfer fd batch 0 count :input #$MSG_DONTWAIT)))
+                    (if (eql res (- #$EAGAIN)) 0 res))))))
+      (declare (fixnum n))
+      (with-macptrs ((hdr))
+        (dotimes (i n)
+          (%datagram-batch-header batch i hdr)
+          (setf (svref lengths i) (%get-unsigned-long hdr (record-length :msghdr)))))
+      n)))
+
+;;; Where SEND-TO sends a datagram that doesn't say where to go.
+(defun udp-socket-destination (socket remote-host remote-port remote-address)
+  (and (not (socket-connected socket))
+       (or remote-address
+           (remote-socket-address socket)
+           (resolve-address :host (or remote-host
+                                      (getf (socket-keys socket) :remote-host))
+                            :port (or remote-port
+                                      (getf (socket-keys socket) :remote-port))
+                            :connect :active
+                            :address-family (socket-address-family socket)
+                            :socket-type :datagram))))
+
+#-windows-target
+(defmethod send-many ((socket udp-socket) batch
+                      &key (start 0) end remote-host remote-port remote-address)
+  "Send datagrams START (inclusive) through END (exclusive) of BATCH,
+using sendmmsg(2) where possible, and return the number sent.  Datagram
+I is the first (DATAGRAM-LENGTH BATCH I) octets at (* I
+(DATAGRAM-BATCH-SIZE BATCH)) in (DATAGRAM-BATCH-BUFFER BATCH).  It goes
+to the address that (SETF DATAGRAM-ADDRESS) gave it, if any; otherwise
+to the address it was received from by RECEIVE-MANY, if any (so a
+received batch can be echoed as is); otherwise where SEND-TO would send
+it given REMOTE-HOST, REMOTE-PORT and REMOTE-ADDRESS.  Setting
+DATAGRAM-ADDRESS to NIL forgets the received address."
+  (let* ((fd (socket-device socket))
+         (count (datagram-batch-count batch))
+         (end (or end count))
+         (lengths (datagram-batch-lengths batch))
+         (addresses (datagram-batch-addresses batch))
+         (default nil)
+         (default-p nil))
+    (unless (<= 0 start end count)
+      (error "Invalid START ~s and END ~s for ~s." start end batch))
+    (with-macptrs ((name))
+      (do* ((i start (1+ i)))
+           ((= i end))
+        (%datagram-batch-name batch i name)
+        (let* ((address (svref addresses i))
+               (namelen (unless address (%datagram-batch-name-length name))))
+          (unless (or address namelen)
+            (setq address (if default-p
+                            default
+                            (setq default-p t
+                                  default (udp-socket-destination socket remote-host remote-port remote-address)))))
+          (if address
+            (%datagram-batch-prepare batch i (svref lengths i)
+                                     (sockaddr address) (sockaddr-length address))
+            (%datagram-batch-prepare batch i (svref lengths i)
+                                     (if namelen name (%null-ptr)) (or namelen 0))))))
+    (do* ((sent start))
+         ((= sent end) (- end start))
+      (incf sent (socket-call socket "sendmmsg"
+                   (with-eagain fd :output
+                     (%datagram-batch-transfer fd batch sent (- end sent) :output 0)))))))
+
 (defgeneric shutdown (socket &key direction)
   (:documentation
    "Shut down part of a bidirectional connection. This is useful if e.g.
@@ -1172,6 +1523,14 @@ unsigned IP address."
   (ignoring-eintr
    (check-socket-error (#_accept sockfd addrp addrlenp))))
 
+#+linux-target
+(defun c_accept4 (sockfd addrp addrlenp flags)
+  (ignoring-eintr
+   (check-socket-error (external-call "accept4"
+                                      :int sockfd :address addrp
+                                      :address addrlenp :int flags
+                                      :int))))
+
 (defun c_getsockname (sockfd addrp addrlenp)
   (check-socket-error (#_getsockname sockfd addrp addrlenp)))
 
@@ -1205,6 +1564,23 @@ unsigned IP address."
 #-windows-target
 (defun c_recvmsg (sockfd msghdrp flags)
   (check-socket-error   (#_recvmsg sockfd msghdrp flags)))
+
+#+linux-target
+(defun c_sendmmsg (sockfd msgvec vlen flags)
+  (ignoring-eintr
+   (check-socket-error (external-call "sendmmsg"
+                                      :int sockfd :address msgvec
+                                      :unsigned-fullword vlen :int flags
+                                      :int))))
+
+#+linux-target
+(defun c_recvmmsg (sockfd msgvec vlen flags)
+  (ignoring-eintr
+   (check-socket-error (external-call "recvmmsg"
+                                      :int sockfd :address msgvec
+                                      :unsigned-fullword vlen :int flags
+                                      :address (%null-ptr)
+                                      :int))))
 
 ;;; Return a list of currently configured interfaces, a la ifconfig.
 (defstruct ip-interface
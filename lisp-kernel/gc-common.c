@@ -23,10 +23,17 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #ifndef WINDOWS
 #include <sys/time.h>
 #endif
+#ifdef HAVE_PERF_JITDUMP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+#endif
 
 #ifndef timeradd
 # define timeradd(a, b, result)						      \
@@ -671,6 +678,31 @@ mark_tcr_tlb(TCR *tcr)
   }
 }
 
+/* Unread profiler samples refer to functions; keep them alive. */
+static void
+mark_profile_buffer_list(profile_buffer *b)
+{
+  natural i, j, n;
+  LispObj *rec;
+
+  for (; b; b = b->next) {
+    for (i = b->tail; i != b->head; i++) {
+      rec = b->records + ((i % b->nrecords) * b->record_words);
+      n = unbox_fixnum(rec[0]);
+      for (j = 0; j < n; j++) {
+        mark_root(rec[PROFILE_RECORD_HEADER_WORDS+(2*j)]);
+      }
+    }
+  }
+}
+
+void
+mark_profile_buffers()
+{
+  mark_profile_buffer_list(profile_buffers);
+  mark_profile_buffer_list(alloc_profile_buffers);
+}
+
 /*
   Mark things that're only reachable through some (suspended) TCR.
   (This basically means the tcr's gc_context and the exception
@@ -1179,7 +1211,9 @@ forward_memoized_area(area *a, natural num_memo_dnodes, bitvector refbits, bitve
 
   if (num_memo_dnodes) {
     init_bitidx_state(&state, refidx, refbits, num_memo_dnodes);
-    if (GCDebug) {
+    /* In fork-friendly mode, the managed static area's memoized range
+       has a hole between it and the frozen dnodes. */
+    if (GCDebug && !((a == managed_static_area) && fork_frozen_dnodes)) {
       check_refmap_consistency(p, p+(num_memo_dnodes << 1), refbits, refidx);
     }
 
@@ -1274,6 +1308,45 @@ forward_tcr_tlb(TCR *tcr)
   }
 }
 
+/* Purify and impurify move functions without leaving anything that
+   the GC can forward; just drop samples that refer to them. */
+void
+discard_profile_samples()
+{
+  profile_buffer *b;
+
+  for (b = profile_buffers; b; b = b->next) {
+    b->tail = b->head;
+  }
+  for (b = alloc_profile_buffers; b; b = b->next) {
+    b->tail = b->head;
+  }
+}
+
+static void
+forward_profile_buffer_list(profile_buffer *b)
+{
+  natural i, j, n;
+  LispObj *rec;
+
+  for (; b; b = b->next) {
+    for (i = b->tail; i != b->head; i++) {
+      rec = b->records + ((i % b->nrecords) * b->record_words);
+      n = unbox_fixnum(rec[0]);
+      for (j = 0; j < n; j++) {
+        update_noderef(&rec[PROFILE_RECORD_HEADER_WORDS+(2*j)]);
+      }
+    }
+  }
+}
+
+void
+forward_profile_buffers()
+{
+  forward_profile_buffer_list(profile_buffers);
+  forward_profile_buffer_list(alloc_profile_buffers);
+}
+
 void
 reclaim_static_dnodes()
 {
@@ -1298,6 +1371,797 @@ reclaim_static_dnodes()
   lisp_global(FREE_STATIC_CONSES)+=(nfree<<fixnumshift);
 }
 
+/*
+  Fork-friendly mode.  The frozen part of the tenured area (everything
+  that was live when fork_freeze() was called) is excluded from full
+  GC: it's not marked, compacted or scanned, so the pages that a forked
+  child shares with its parent stay shared.  Anything stored into a
+  frozen object afterwards is noted by the write barrier, which records
+  stores into [REF_BASE, REF_BASE+MANAGED_STATIC_DNODES) in
+  managed_static_refbits; making that range cover the frozen dnodes
+  lets full GC treat them exactly like the managed static area and
+  only visit (and perhaps update) the dnodes that the barrier noted.
+*/
+
+natural fork_frozen_dnodes = 0;
+
+#ifdef X86
+static bitvector saved_managed_static_refbits = NULL, saved_managed_static_refidx = NULL;
+#endif
+
+/* Called after the tenured area's static_dnodes has been set to cover
+   everything that's live. */
+Boolean
+fork_freeze()
+{
+#ifdef X86
+  natural
+    frozen = tenured_area->static_dnodes,
+    ms_dnodes = managed_static_area->ndnodes,
+    limit = area_dnode(tenured_area->low+(frozen<<dnode_shift),
+                       lisp_global(REF_BASE));
+  bitvector refbits, refidx;
+
+  if ((frozen & bitmap_shift_count_mask) ||
+      (limit <= ms_dnodes)) {
+    return false;
+  }
+  refbits = (bitvector) calloc(((limit+nbits_in_word-1)>>bitmap_shift),sizeof(natural));
+  refidx = (bitvector) calloc(((((limit+255)>>8)+nbits_in_word-1)>>bitmap_shift),sizeof(natural));
+  if ((refbits == NULL) || (refidx == NULL)) {
+    free(refbits);
+    free(refidx);
+    return false;
+  }
+  memcpy(refbits, managed_static_refbits, (ms_dnodes+7)>>3);
+  memcpy(refidx, managed_static_refidx, (((ms_dnodes+255)>>8)+7)>>3);
+  if (fork_frozen_dnodes) {
+    free(managed_static_refbits);
+    free(managed_static_refidx);
+  } else {
+    saved_managed_static_refbits = managed_static_refbits;
+    saved_managed_static_refidx = managed_static_refidx;
+  }
+  managed_static_refbits = refbits;
+  managed_static_refidx = refidx;
+  lisp_global(MANAGED_STATIC_REFBITS) = (LispObj)refbits;
+  lisp_global(MANAGED_STATIC_REFIDX) = (LispObj)refidx;
+  lisp_global(MANAGED_STATIC_DNODES) = limit;
+  fork_frozen_dnodes = frozen;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Go back to treating the frozen dnodes like other static dnodes.
+   Their refbits aren't needed then, since full GC scans them. */
+void
+fork_thaw()
+{
+#ifdef X86
+  if (fork_frozen_dnodes) {
+    natural ms_dnodes = managed_static_area->ndnodes;
+
+    memcpy(saved_managed_static_refbits, managed_static_refbits, (ms_dnodes+7)>>3);
+    memcpy(saved_managed_static_refidx, managed_static_refidx, (((ms_dnodes+255)>>8)+7)>>3);
+    free(managed_static_refbits);
+    free(managed_static_refidx);
+    managed_static_refbits = saved_managed_static_refbits;
+    managed_static_refidx = saved_managed_static_refidx;
+    lisp_global(MANAGED_STATIC_REFBITS) = (LispObj)managed_static_refbits;
+    lisp_global(MANAGED_STATIC_REFIDX) = (LispObj)managed_static_refidx;
+    lisp_global(MANAGED_STATIC_DNODES) = ms_dnodes;
+    fork_frozen_dnodes = 0;
+  }
+#endif
+}
+
+/*
+  Parts of the readonly area that hold objects which have been
+  declared deep-immutable (see purify_object_graph().)  Each range is
+  page-aligned and holds only such objects, so a write fault on one of
+  its pages is an error rather than something that just unprotects the
+  page.  Ranges are recorded as offsets from the start of the readonly
+  area when lisp asks for them, so that they can be saved in the image
+  and re-established when it's loaded.
+*/
+
+typedef struct {
+  BytePtr low;
+  BytePtr high;
+} immutable_range;
+
+static immutable_range *immutable_ranges = NULL;
+static natural n_immutable_ranges = 0, max_immutable_ranges = 0;
+
+Boolean
+note_immutable_range(BytePtr low, BytePtr high)
+{
+  if (n_immutable_ranges == max_immutable_ranges) {
+    natural new_max = max_immutable_ranges ? (max_immutable_ranges*2) : 16;
+    immutable_range *new = realloc(immutable_ranges, new_max*sizeof(immutable_range));
+
+    if (new == NULL) {
+      return false;
+    }
+    immutable_ranges = new;
+    max_immutable_ranges = new_max;
+  }
+  immutable_ranges[n_immutable_ranges].low = low;
+  immutable_ranges[n_immutable_ranges].high = high;
+  n_immutable_ranges++;
+  return true;
+}
+
+void
+forget_immutable_ranges()
+{
+  n_immutable_ranges = 0;
+}
+
+/* If addr is in an immutable range, return the (tagged) object that
+   contains it, else 0. */
+LispObj
+immutable_object_containing(BytePtr addr)
+{
+  natural i;
+  LispObj *p, *next, header;
+  int tag;
+
+  for (i = 0; i < n_immutable_ranges; i++) {
+    if ((addr >= immutable_ranges[i].low) &&
+        (addr < immutable_ranges[i].high)) {
+      p = (LispObj *)immutable_ranges[i].low;
+      while (p < (LispObj *)immutable_ranges[i].high) {
+        header = *p;
+        tag = fulltag_of(header);
+        if (immheader_tag_p(tag)) {
+          next = (LispObj *)skip_over_ivector((natural)p, header);
+        } else if (nodeheader_tag_p(tag)) {
+          next = p + ((header_element_count(header)+2)&~1);
+        } else {
+          next = p + 2;
+        }
+        if (addr < (BytePtr)next) {
+          if (immheader_tag_p(tag) || nodeheader_tag_p(tag)) {
+#ifdef X8664
+            if (header_subtag(header) == subtag_function) {
+              return ((LispObj)p)+fulltag_function;
+            }
+#endif
+            return ((LispObj)p)+fulltag_misc;
+          }
+          return ((LispObj)p)+fulltag_cons;
+        }
+        p = next;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Store up to n (low, high) pairs of readonly area offsets in buf,
+   return the number of ranges. */
+natural
+lisp_immutable_ranges(natural *buf, natural n)
+{
+  natural i;
+  BytePtr base = readonly_area->low;
+
+  for (i = 0; (i < n) && (i < n_immutable_ranges); i++) {
+    *buf++ = immutable_ranges[i].low - base;
+    *buf++ = immutable_ranges[i].high - base;
+  }
+  return n_immutable_ranges;
+}
+
+/* Called on startup to re-establish a range noted in a saved image. */
+int
+add_immutable_range(natural low_offset, natural high_offset)
+{
+  BytePtr
+    low = readonly_area->low + low_offset,
+    high = readonly_area->low + high_offset;
+
+  if ((low >= high) ||
+      (high > readonly_area->active) ||
+      (((natural)low) & (page_size-1)) ||
+      (((natural)high) & (page_size-1))) {
+    return EINVAL;
+  }
+  if (!note_immutable_range(low, high)) {
+    return ENOMEM;
+  }
+  ProtectMemory(low, high-low);
+  return 0;
+}
+
+/*
+  Heap census.  When it's enabled, each full GC counts the live objects
+  in the dynamic heap by subtag (conses are counted under fulltag_cons)
+  and standard instances by class wrapper, after marking and before
+  anything moves.  Marking sets the bit of every dnode of a live
+  object, so a marked dnode that follows an unmarked one (or the end
+  of a live object) starts a live object; unmarked dnodes can be
+  skipped a bitmap word at a time.  The wrappers aren't roots: each
+  later GC (full or ephemeral) forgets the ones that it finds dead and
+  forwards the rest.
+*/
+
+typedef struct {
+  LispObj wrapper;
+  natural count;
+  natural bytes;
+} census_wrapper_entry;
+
+Boolean heap_census_enabled = false;
+static natural census_counts[256], census_bytes[256], census_gc_num = 0;
+static census_wrapper_entry *census_wrappers = NULL;
+static natural census_wrapper_capacity = 0, census_nwrappers = 0;
+
+static Boolean
+census_grow_wrappers()
+{
+  natural i, j, old_capacity = census_wrapper_capacity,
+    new_capacity = old_capacity ? (old_capacity*2) : 1024;
+  census_wrapper_entry *old = census_wrappers,
+    *new = calloc(new_capacity, sizeof(census_wrapper_entry));
+
+  if (new == NULL) {
+    return false;
+  }
+  for (i = 0; i < old_capacity; i++) {
+    if (old[i].wrapper) {
+      for (j = (old[i].wrapper >> dnode_shift) & (new_capacity-1);
+           new[j].wrapper;
+           j = (j+1) & (new_capacity-1));
+      new[j] = old[i];
+    }
+  }
+  free(old);
+  census_wrappers = new;
+  census_wrapper_capacity = new_capacity;
+  return true;
+}
+
+static void
+census_note_instance(LispObj wrapper, natural bytes)
+{
+  natural i;
+
+  if ((census_nwrappers*2) >= census_wrapper_capacity) {
+    if (!census_grow_wrappers()) {
+      return;
+    }
+  }
+  for (i = (wrapper >> dnode_shift) & (census_wrapper_capacity-1);
+       census_wrappers[i].wrapper && (census_wrappers[i].wrapper != wrapper);
+       i = (i+1) & (census_wrapper_capacity-1));
+  if (census_wrappers[i].wrapper == 0) {
+    census_wrappers[i].wrapper = wrapper;
+    census_nwrappers++;
+  }
+  census_wrappers[i].count++;
+  census_wrappers[i].bytes += bytes;
+}
+
+void
+take_heap_census(BytePtr high)
+{
+  natural dnode = 0, ndnodes = gc_area_dnode(high), w, bytes;
+  LispObj *p, header;
+  int tag, subtag;
+
+  memset(census_counts, 0, sizeof(census_counts));
+  memset(census_bytes, 0, sizeof(census_bytes));
+  if (census_wrappers) {
+    memset(census_wrappers, 0, census_wrapper_capacity*sizeof(census_wrapper_entry));
+  }
+  census_nwrappers = 0;
+
+  while (dnode < ndnodes) {
+    w = GCmarkbits[dnode>>bitmap_shift] << (dnode & bitmap_shift_count_mask);
+    if (w == 0) {
+      dnode = (dnode | bitmap_shift_count_mask) + 1;
+      continue;
+    }
+    dnode += count_leading_zeros(w);
+    if (dnode >= ndnodes) {
+      break;
+    }
+    p = (LispObj *)(GCarealow + (dnode << dnode_shift));
+    header = *p;
+    tag = fulltag_of(header);
+    if (immheader_tag_p(tag)) {
+      bytes = ((natural)skip_over_ivector((natural)p, header)) - (natural)p;
+      subtag = header_subtag(header);
+    } else if (nodeheader_tag_p(tag)) {
+      bytes = ((header_element_count(header)+2)&~1) << node_shift;
+      subtag = header_subtag(header);
+      if ((subtag == subtag_instance) && (header_element_count(header) >= 2)) {
+        census_note_instance(p[2], bytes);
+      }
+    } else {
+      bytes = dnode_size;
+      subtag = fulltag_cons;
+    }
+    census_counts[subtag]++;
+    census_bytes[subtag] += bytes;
+    dnode += bytes >> dnode_shift;
+  }
+  census_gc_num = (lisp_global(GC_NUM) >> fixnumshift) + 1;
+}
+
+/* Called with the current GC's mark bits still valid.  The table's
+   only probed while a census is being taken, which starts by clearing
+   it, so entries can be dropped without rehashing. */
+void
+forward_heap_census()
+{
+  natural i, dnode;
+  LispObj wrapper;
+
+  for (i = 0; i < census_wrapper_capacity; i++) {
+    wrapper = census_wrappers[i].wrapper;
+    if (wrapper) {
+      dnode = gc_area_dnode(wrapper);
+      if ((dnode < GCndnodes_in_area) &&
+          (!ref_bit(GCmarkbits, dnode))) {
+        census_wrappers[i].wrapper = 0;
+        census_wrappers[i].count = 0;
+        census_wrappers[i].bytes = 0;
+        census_nwrappers--;
+      } else {
+        update_noderef(&census_wrappers[i].wrapper);
+      }
+    }
+  }
+}
+
+/* purify and impurify move wrappers without forwarding them. */
+void
+discard_heap_census()
+{
+  if (census_wrappers) {
+    memset(census_wrappers, 0, census_wrapper_capacity*sizeof(census_wrapper_entry));
+  }
+  census_nwrappers = 0;
+}
+
+/* Enable or disable the census; return true if it was enabled. */
+Boolean
+lisp_heap_census_control(natural enable)
+{
+  Boolean was = heap_census_enabled;
+
+  heap_census_enabled = (enable != 0);
+  return was;
+}
+
+/* Copy the counts and sizes from the last census (if bufs are
+   non-null), return the number of the GC that took it (or 0.) */
+natural
+lisp_heap_census(natural *counts, natural *bytes)
+{
+  if (counts) {
+    memcpy(counts, census_counts, sizeof(census_counts));
+  }
+  if (bytes) {
+    memcpy(bytes, census_bytes, sizeof(census_bytes));
+  }
+  return census_gc_num;
+}
+
+/* Store up to n (wrapper, count, bytes) triples in buf, return the
+   number of wrappers.  Lisp calls this with the GC inhibited, since
+   the wrappers are lisp objects. */
+natural
+lisp_heap_census_wrappers(natural *buf, natural n)
+{
+  natural i, j = 0;
+
+  for (i = 0; i < census_wrapper_capacity; i++) {
+    if (census_wrappers[i].wrapper) {
+      if (j < n) {
+        *buf++ = census_wrappers[i].wrapper;
+        *buf++ = census_wrappers[i].count;
+        *buf++ = census_wrappers[i].bytes;
+      }
+      j++;
+    }
+  }
+  return j;
+}
+
+#ifdef HAVE_PERF_JITDUMP
+/*
+  Tell Linux "perf" where compiled functions are, in the "jitdump"
+  format that "perf inject --jit" reads (see jitdump-specification.txt
+  in the perf sources.)  perf finds the file because we map part of it
+  executable; its timestamps are CLOCK_MONOTONIC, so "perf record"
+  needs "-k mono".
+
+  The GC does all the work.  The first GC after the file's opened
+  reports every function in the heap; after that, each GC reports the
+  functions that have been created since the last one and the ones
+  that it moves.  jitdump_functions is sorted by address; compaction
+  preserves address order, so it stays sorted.
+*/
+
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD 0
+#define JIT_CODE_MOVE 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+} jitdump_header;
+
+typedef struct {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+} jitdump_code_load;            /* followed by name and code bytes */
+
+typedef struct {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t old_code_addr;
+  uint64_t new_code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+} jitdump_code_move;
+
+typedef struct {
+  LispObj fn;
+  natural index;
+} jitdump_function;
+
+#ifdef X8664
+#define JITDUMP_ELF_MACH 62     /* EM_X86_64 */
+#define JITDUMP_FUNCTION_TAG fulltag_function
+#else
+#define JITDUMP_ELF_MACH 3      /* EM_386 */
+#define JITDUMP_FUNCTION_TAG fulltag_misc
+#endif
+
+#define JITDUMP_BUFSIZE (64<<10)
+
+static int jitdump_fd = -1;
+static void *jitdump_marker = NULL;
+static Boolean jitdump_scan_all = false;
+static natural jitdump_next_index = 0;
+static jitdump_function *jitdump_functions = NULL, *jitdump_new_functions = NULL;
+static natural jitdump_nfunctions = 0, jitdump_max_functions = 0, jitdump_max_new_functions = 0;
+static char jitdump_buf[JITDUMP_BUFSIZE];
+static natural jitdump_bufpos = 0;
+
+static uint64_t
+jitdump_timestamp()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void
+jitdump_flush()
+{
+  char *p = jitdump_buf;
+  ssize_t n;
+
+  while (jitdump_bufpos) {
+    n = write(jitdump_fd, p, jitdump_bufpos);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    p += n;
+    jitdump_bufpos -= n;
+  }
+  jitdump_bufpos = 0;
+}
+
+static void
+jitdump_write(void *data, natural n)
+{
+  char *p = data;
+  natural chunk;
+
+  while (n) {
+    if (jitdump_bufpos == JITDUMP_BUFSIZE) {
+      jitdump_flush();
+    }
+    chunk = JITDUMP_BUFSIZE - jitdump_bufpos;
+    if (chunk > n) {
+      chunk = n;
+    }
+    memcpy(jitdump_buf+jitdump_bufpos, p, chunk);
+    jitdump_bufpos += chunk;
+    p += chunk;
+    n -= chunk;
+  }
+}
+
+static natural
+jitdump_function_size(LispObj fn)
+{
+  return ((header_element_count(header_of(fn))+2)&~1) << node_shift;
+}
+
+/* fn is about to be at address new; its contents are still at fn. */
+static void
+jitdump_load(LispObj fn, LispObj new, natural index)
+{
+  jitdump_code_load rec;
+  char *name = print_function_name(fn);
+  natural namelen = strlen(name)+1, size = jitdump_function_size(fn);
+
+  rec.id = JIT_CODE_LOAD;
+  rec.total_size = sizeof(rec) + namelen + size;
+  rec.timestamp = jitdump_timestamp();
+  rec.pid = getpid();
+  rec.tid = rec.pid;
+  rec.vma = rec.code_addr = untag(new);
+  rec.code_size = size;
+  rec.code_index = index;
+  jitdump_write(&rec, sizeof(rec));
+  jitdump_write(name, namelen);
+  jitdump_write((void *)untag(fn), size);
+}
+
+static void
+jitdump_move(LispObj fn, LispObj new, natural index)
+{
+  jitdump_code_move rec;
+
+  rec.id = JIT_CODE_MOVE;
+  rec.total_size = sizeof(rec);
+  rec.timestamp = jitdump_timestamp();
+  rec.pid = getpid();
+  rec.tid = rec.pid;
+  rec.vma = untag(new);
+  rec.old_code_addr = untag(fn);
+  rec.new_code_addr = untag(new);
+  rec.code_size = jitdump_function_size(fn);
+  rec.code_index = index;
+  jitdump_write(&rec, sizeof(rec));
+}
+
+static Boolean
+jitdump_note_new_function(natural i, LispObj fn, natural index)
+{
+  if (i == jitdump_max_new_functions) {
+    natural new_max = i ? (i*2) : 1024;
+    jitdump_function *new = realloc(jitdump_new_functions, new_max*sizeof(jitdump_function));
+
+    if (new == NULL) {
+      return false;
+    }
+    jitdump_new_functions = new;
+    jitdump_max_new_functions = new_max;
+  }
+  jitdump_new_functions[i].fn = fn;
+  jitdump_new_functions[i].index = index;
+  return true;
+}
+
+static natural
+jitdump_first_function_above(LispObj addr)
+{
+  natural low = 0, high = jitdump_nfunctions, mid;
+
+  while (low < high) {
+    mid = (low+high) >> 1;
+    if (jitdump_functions[mid].fn < addr) {
+      low = mid+1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/*
+  Replace the entries for [low,high) with the functions that are in
+  that range now (at the addresses that they'll have after this GC),
+  reporting those that are new or that move.  If marked is true, only
+  objects that the GC marked are live; otherwise all are.
+*/
+static void
+jitdump_scan_range(LispObj *low, LispObj *high, Boolean marked)
+{
+  natural
+    start = jitdump_first_function_above((LispObj)low),
+    end = jitdump_first_function_above((LispObj)high),
+    i = start, n = 0, tail;
+  LispObj *p = low, *next, header, fn, new;
+  int tag;
+
+  while (p < high) {
+    header = *p;
+    tag = fulltag_of(header);
+    if (immheader_tag_p(tag)) {
+      next = (LispObj *)skip_over_ivector((natural)p, header);
+    } else if (nodeheader_tag_p(tag)) {
+      next = p + ((header_element_count(header)+2)&~1);
+      if ((header_subtag(header) == subtag_function) &&
+          ((!marked) ||
+           ref_bit(GCdynamic_markbits, gc_dynamic_area_dnode(p)))) {
+        fn = ((LispObj)p)+JITDUMP_FUNCTION_TAG;
+        new = marked ? node_forwarding_address(fn) : fn;
+        while ((i < end) && (jitdump_functions[i].fn < fn)) {
+          i++;                  /* function's dead */
+        }
+        if ((i < end) && (jitdump_functions[i].fn == fn)) {
+          if (new != fn) {
+            jitdump_move(fn, new, jitdump_functions[i].index);
+          }
+          if (!jitdump_note_new_function(n, new, jitdump_functions[i].index)) {
+            break;
+          }
+          i++;
+        } else {
+          jitdump_load(fn, new, jitdump_next_index);
+          if (!jitdump_note_new_function(n, new, jitdump_next_index++)) {
+            break;
+          }
+        }
+        n++;
+      }
+    } else {
+      next = p + 2;
+    }
+    p = next;
+  }
+
+  /* Splice the new entries in place of [start, end). */
+  tail = jitdump_nfunctions - end;
+  if ((start + n + tail) > jitdump_max_functions) {
+    natural new_max = (start + n + tail) * 2;
+    jitdump_function *new_functions = realloc(jitdump_functions, new_max*sizeof(jitdump_function));
+
+    if (new_functions == NULL) {
+      return;
+    }
+    jitdump_functions = new_functions;
+    jitdump_max_functions = new_max;
+  }
+  memmove(jitdump_functions+start+n, jitdump_functions+end, tail*sizeof(jitdump_function));
+  memcpy(jitdump_functions+start, jitdump_new_functions, n*sizeof(jitdump_function));
+  jitdump_nfunctions = start + n + tail;
+}
+
+/* Called by the GC after relocation has been calculated, before
+   anything's been moved. */
+void
+jitdump_note_gc(BytePtr dynamic_low, BytePtr dynamic_high)
+{
+  if (jitdump_fd < 0) {
+    return;
+  }
+  if (jitdump_scan_all) {
+    area *a = active_dynamic_area;
+
+    while (a->older) {
+      a = a->older;
+    }
+    jitdump_scan_range((LispObj *)readonly_area->low, (LispObj *)readonly_area->active, false);
+    jitdump_scan_range((LispObj *)managed_static_area->low, (LispObj *)managed_static_area->active, false);
+    jitdump_scan_range((LispObj *)a->low, (LispObj *)dynamic_low, false);
+    jitdump_scan_all = false;
+  }
+  jitdump_scan_range((LispObj *)dynamic_low, (LispObj *)dynamic_high, true);
+  jitdump_flush();
+}
+
+/* purify and friends move functions out of the dynamic heap without
+   telling us where; have the next GC report everything again. */
+void
+jitdump_rescan()
+{
+  jitdump_nfunctions = 0;
+  jitdump_scan_all = true;
+}
+
+/* Lisp calls these with the GC inhibited. */
+int
+lisp_jitdump_start(char *path)
+{
+  jitdump_header h;
+  int fd;
+  void *marker;
+
+  if (jitdump_fd >= 0) {
+    return EBUSY;
+  }
+  fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+  if (fd < 0) {
+    return errno;
+  }
+  /* This is how perf finds the file. */
+  marker = mmap(NULL, page_size, PROT_READ|PROT_EXEC, MAP_PRIVATE, fd, 0);
+  if (marker == MAP_FAILED) {
+    int e = errno;
+
+    close(fd);
+    return e;
+  }
+  jitdump_fd = fd;
+  jitdump_marker = marker;
+  h.magic = JITDUMP_MAGIC;
+  h.version = JITDUMP_VERSION;
+  h.total_size = sizeof(h);
+  h.elf_mach = JITDUMP_ELF_MACH;
+  h.pad1 = 0;
+  h.pid = getpid();
+  h.timestamp = jitdump_timestamp();
+  h.flags = 0;
+  jitdump_write(&h, sizeof(h));
+  jitdump_flush();
+  jitdump_rescan();
+  return 0;
+}
+
+int
+lisp_jitdump_stop()
+{
+  if (jitdump_fd < 0) {
+    return 0;
+  }
+  jitdump_flush();
+  munmap(jitdump_marker, page_size);
+  close(jitdump_fd);
+  jitdump_fd = -1;
+  jitdump_marker = NULL;
+  jitdump_nfunctions = 0;
+  return 0;
+}
+#else
+void
+jitdump_note_gc(BytePtr dynamic_low, BytePtr dynamic_high)
+{
+}
+
+void
+jitdump_rescan()
+{
+}
+
+int
+lisp_jitdump_start(char *path)
+{
+  return ENOSYS;
+}
+
+int
+lisp_jitdump_stop()
+{
+  return 0;
+}
+#endif
+
 Boolean
 youngest_non_null_area_p (area *a)
 {
@@ -1359,14 +2223,15 @@ mark_managed_static_refs(area *a, BytePtr low_dynamic_address, natural ndynamic_
   dnode *dnodes = (dnode *)a->low, *d;
   LispObj *p = (LispObj *) a->low, x1, x2;
   natural inbits, outbits, bits, *bitsp, nextbit, memo_dnode = 0,
-    num_memo_dnodes = a->ndnodes, ref_dnode;
+    num_memo_dnodes = (fork_frozen_dnodes ? lisp_global(MANAGED_STATIC_DNODES) : a->ndnodes),
+    ref_dnode;
   Boolean keep_x1, keep_x2;
   bitidx_state state;
 
   if (num_memo_dnodes) {
     init_bitidx_state(&state, refidx, refbits, num_memo_dnodes);
 
-    if (GCDebug) {
+    if (GCDebug && !fork_frozen_dnodes) {
       check_refmap_consistency(p, p+(num_memo_dnodes << 1), refbits, refidx);
     }
 
@@ -1399,7 +2264,7 @@ mark_managed_static_refs(area *a, BytePtr low_dynamic_address, natural ndynamic_
         outbits &= ~(BIT0_MASK >> nextbit);
       }
     }
-    if (GCDebug) {
+    if (GCDebug && !fork_frozen_dnodes) {
       p = (LispObj *) a->low;
       check_refmap_consistency(p, p+(num_memo_dnodes << 1), refbits, NULL);
     }
@@ -1656,6 +2521,12 @@ gc(TCR *tcr, signed_natural param)
   static_dnodes = static_dnodes_for_area(a);
   GCmarkbits = a->markbits;
   GCarealow = ptr_to_lispobj(a->low);
+  if (fork_frozen_dnodes && (GCephemeral_low == 0) && (a->low == tenured_area->low)) {
+    /* Leave the frozen dnodes out of the GC area entirely. */
+    GCmarkbits += (fork_frozen_dnodes >> bitmap_shift);
+    GCarealow += (fork_frozen_dnodes << dnode_shift);
+    static_dnodes -= fork_frozen_dnodes;
+  }
   GCareadynamiclow = GCarealow+(static_dnodes << dnode_shift);
   GCndnodes_in_area = gc_area_dnode(oldfree);
 
@@ -1740,7 +2611,9 @@ gc(TCR *tcr, signed_natural param)
       mark_memoized_area(tenured_area, area_dnode(a->low,tenured_area->low), tenured_area->refidx);
       mark_memoized_area(managed_static_area,managed_static_area->ndnodes, managed_static_area->refidx);
     } else {
-      mark_managed_static_refs(managed_static_area,low_markable_address,area_dnode(a->active,low_markable_address), managed_static_refidx);
+      BytePtr markable_low = (fork_frozen_dnodes ? (BytePtr)GCarealow : low_markable_address);
+
+      mark_managed_static_refs(managed_static_area,markable_low,area_dnode(a->active,markable_low), managed_static_refidx);
     }
     other_tcr = tcr;
     do {
@@ -1748,6 +2621,7 @@ gc(TCR *tcr, signed_natural param)
       mark_tcr_tlb(other_tcr);
       other_tcr = TCR_AUX(other_tcr)->next;
     } while (other_tcr != tcr);
+    mark_profile_buffers();
 
 
 
@@ -1813,16 +2687,21 @@ gc(TCR *tcr, signed_natural param)
       }
     }
   
+    if (heap_census_enabled && (GCephemeral_low == 0)) {
+      take_heap_census(oldfree);
+    }
+
     reap_gcable_ptrs();
 
     preforward_weakvll();
 
     GCrelocptr = global_reloctab;
     GCfirstunmarked = calculate_relocation();
+    jitdump_note_gc((BytePtr)GCareadynamiclow, oldfree);
 
 
 
-    if (!GCephemeral_low) {
+    if ((!GCephemeral_low) && (!fork_frozen_dnodes)) {
       reclaim_static_dnodes();
     }
 
@@ -1835,6 +2714,8 @@ gc(TCR *tcr, signed_natural param)
       forward_tcr_tlb(other_tcr);
       other_tcr = TCR_AUX(other_tcr)->next;
     } while (other_tcr != tcr);
+    forward_profile_buffers();
+    forward_heap_census();
 
   
     forward_gcable_ptrs();
@@ -1879,7 +2760,11 @@ gc(TCR *tcr, signed_natural param)
       forward_memoized_area(tenured_area, area_dnode(a->low, tenured_area->low), tenured_area->refbits, tenured_area->refidx);
       forward_memoized_area(managed_static_area,managed_static_area->ndnodes, managed_static_area->refbits, managed_static_area->refidx);
     } else {
-      forward_memoized_area(managed_static_area,area_dnode(managed_static_area->active,managed_static_area->low),managed_static_refbits, NULL);
+      forward_memoized_area(managed_static_area,
+                            (fork_frozen_dnodes ?
+                             lisp_global(MANAGED_STATIC_DNODES) :
+                             area_dnode(managed_static_area->active,managed_static_area->low)),
+                            managed_static_refbits, NULL);
     }
     a->active = (BytePtr) ptr_from_lispobj(compact_dynamic_heap());
 
@@ -152,6 +152,20 @@ void report_paging_info_delta(FILE*, paging_info *, paging_info *);
 #define GC_TRAP_FUNCTION_CONFIGURE_EGC 64
 #define GC_TRAP_FUNCTION_FREEZE 129
 #define GC_TRAP_FUNCTION_THAW 130
+#define GC_TRAP_FUNCTION_FORK_FREEZE 144
+#define GC_TRAP_FUNCTION_PURIFY_OBJECT 160
+#define GC_TRAP_FUNCTION_HEAP_DUMP 176
+
+/* Results of GC_TRAP_FUNCTION_PURIFY_OBJECT */
+#define PURIFY_OBJECT_DEFERRED 0 /* GC was inhibited; nothing done */
+#define PURIFY_OBJECT_COPIED 1
+#define PURIFY_OBJECT_NOT_IN_HEAP 2 /* nothing in the dynamic heap to copy */
+#define PURIFY_OBJECT_NOT_SHAREABLE 3 /* offending object in arg_z */
+#define PURIFY_OBJECT_NO_ROOM 4
+
+/* Results of GC_TRAP_FUNCTION_HEAP_DUMP (or -errno) */
+#define HEAP_DUMP_DEFERRED 0 /* GC was inhibited; nothing done */
+#define HEAP_DUMP_OK 1
 
 Boolean GCDebug, GCverbose, just_purified_p;
 bitvector GCmarkbits, GCdynamic_markbits;
@@ -189,6 +203,26 @@ void forward_memoized_area(area *, natural, bitvector, bitvector);
 
 void forward_tcr_tlb(TCR *);
 void reclaim_static_dnodes(void);
+void mark_profile_buffers(void);
+void forward_profile_buffers(void);
+void discard_profile_samples(void);
+extern Boolean heap_census_enabled;
+void take_heap_census(BytePtr);
+void forward_heap_census(void);
+void discard_heap_census(void);
+natural fork_frozen_dnodes;
+Boolean fork_freeze(void);
+void fork_thaw(void);
+Boolean note_immutable_range(BytePtr, BytePtr);
+void forget_immutable_ranges(void);
+LispObj immutable_object_containing(BytePtr);
+
+#if defined(X86) && defined(LINUX)
+#define HAVE_PERF_JITDUMP 1
+#endif
+void jitdump_note_gc(BytePtr, BytePtr);
+void jitdump_rescan(void);
+char *print_function_name(LispObj);
 Boolean youngest_non_null_area_p(area *);
 void gc(TCR *, signed_natural);
 
@@ -228,6 +262,8 @@ void forward_cstack_area(area *);
 LispObj compact_dynamic_heap(void);
 signed_natural purify(TCR *, signed_natural);
 signed_natural impurify(TCR *, signed_natural);
+signed_natural purify_object_graph(TCR *, signed_natural);
+signed_natural write_heap_dump(TCR *, signed_natural);
 signed_natural gc_like_from_xp(ExceptionInformation *, signed_natural(*fun)(TCR *, signed_natural), signed_natural);
 Boolean mark_ephemeral_root(LispObj);
 
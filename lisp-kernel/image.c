@@ -23,8 +23,14 @@
 #include <unistd.h>
 #ifndef WINDOWS
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #endif
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <time.h>
 
@@ -204,8 +210,47 @@ find_openmcl_image_file_header(int fd, openmcl_image_file_header *header)
   return true;
 }
 
+/*
+  Where each section of the image that we loaded was mapped, and
+  where its data lives in the image file.  Used to turn the runs
+  in an IMAGE_SECTION_PAGE_ORDER section into addresses (and to
+  record them in the first place.)
+*/
+typedef struct {
+  BytePtr low;
+  off_t pos;
+  natural nbytes;
+} mapped_image_section;
+
+mapped_image_section mapped_image_sections[NUM_IMAGE_SECTIONS];
+int n_mapped_image_sections = 0;
+
+image_page_run *image_page_order = NULL;
+natural image_page_order_nruns = 0;
+
+image_prefetch_policy image_prefetch = image_prefetch_willneed;
+Boolean record_page_order = false;
+extern struct timeval kernel_start_time;
+extern int lisp_gettimeofday(struct timeval *, void *);
+
+void
+load_image_page_order(int fd, off_t pos, natural nbytes)
+{
+  image_page_run *runs = malloc(nbytes);
+
+  if (runs) {
+    LSEEK(fd, pos, SEEK_SET);
+    if (read(fd, runs, nbytes) == nbytes) {
+      image_page_order = runs;
+      image_page_order_nruns = nbytes/sizeof(image_page_run);
+    } else {
+      free(runs);
+    }
+  }
+}
+
 void
-load_image_section(int fd, openmcl_image_section_header *sect)
+load_image_section(int fd, openmcl_image_section_header *sect, int index)
 {
   extern area* allocate_dynamic_area(natural);
   off_t
@@ -335,10 +380,26 @@ load_image_section(int fd, openmcl_image_section_header *sect)
     */
     break;
 
+  case IMAGE_SECTION_PAGE_ORDER:
+    if (mem_size) {
+      load_image_page_order(fd, pos, mem_size);
+    }
+    break;
+
   default:
     return;
     
   }
+  if ((index < NUM_IMAGE_SECTIONS) && (sect->area != NULL)) {
+    mapped_image_section *m = &mapped_image_sections[index];
+
+    m->low = sect->area->low;
+    m->pos = pos;
+    m->nbytes = mem_size;
+    if (index >= n_mapped_image_sections) {
+      n_mapped_image_sections = index+1;
+    }
+  }
   LSEEK(fd, pos+advance, SEEK_SET);
 }
 
@@ -364,9 +425,9 @@ load_openmcl_image(int fd, openmcl_image_file_header *h)
     LSEEK(fd, section_data_delta, SEEK_CUR);
 #endif
     for (i = 0; i < nsections; i++, sect++) {
-      load_image_section(fd, sect);
+      load_image_section(fd, sect, i);
       a = sect->area;
-      if (a == NULL) {
+      if ((a == NULL) && (sect->code != IMAGE_SECTION_PAGE_ORDER)) {
 	return 0;
       }
     }
@@ -565,6 +626,254 @@ prepare_to_write_static_space(Boolean egc_was_enabled)
 }
 
 
+/*
+  Writing the image.  The layout of the file (the page-aligned
+  position of each section's data, the headers and the trailer) is
+  computed up front, relative to the (page-aligned) position of fd
+  when we're called.  If fd is seekable, section data is then written
+  in chunks with pwrite() by several threads (optionally with
+  O_DIRECT, in which case partial pages are copied to aligned bounce
+  buffers); if fd is a pipe or socket, everything's written
+  sequentially and the gaps between sections are filled with zeros.
+*/
+
+#define SAVE_APPLICATION_DIRECT_IO 1
+#define SAVE_APPLICATION_NO_FSYNC 2
+#define SAVE_APPLICATION_REPORT_PROGRESS 4
+
+#define DEFAULT_SAVE_APPLICATION_CHUNK_SIZE (64<<20)
+#define MAX_SAVE_APPLICATION_THREADS 8
+
+typedef void (*save_application_progress_function)(natural, natural);
+
+int save_application_nthreads = 0; /* 0: pick a default */
+natural save_application_chunk_size = DEFAULT_SAVE_APPLICATION_CHUNK_SIZE;
+int save_application_flags = 0;
+save_application_progress_function save_application_progress_hook = NULL;
+
+/* Called from lisp (via SAVE-APPLICATION) before the save trap. */
+void
+configure_save_application(int nthreads, natural chunk_size, int flags, void *progress_hook)
+{
+  save_application_nthreads = nthreads;
+  if (chunk_size) {
+    save_application_chunk_size = align_to_power_of_2(chunk_size, log2_page_size);
+  } else {
+    save_application_chunk_size = DEFAULT_SAVE_APPLICATION_CHUNK_SIZE;
+  }
+  save_application_flags = flags;
+  save_application_progress_hook = (save_application_progress_function)progress_hook;
+}
+
+void
+report_save_application_progress(natural done, natural total)
+{
+  fprintf(dbgout, ";;; Saved " DECIMAL " of " DECIMAL " MB\n", done>>20, total>>20);
+}
+
+typedef struct {
+  char *bytes;
+  natural nbytes;
+  off_t pos;
+  char *bounce;                 /* bytes, if we allocated them, else NULL */
+} save_write_job;
+
+typedef struct {
+  int fd;
+  save_write_job *jobs;
+  natural njobs;
+  signed_natural next_job;      /* claimed with atomic_incf */
+  natural bytes_written;
+  natural total_bytes;
+  natural last_report;
+  int err;
+#ifndef WINDOWS
+  pthread_mutex_t lock;
+#endif
+} save_writer_state;
+
+natural
+pwritebuf(int fd, char *bytes, natural n, off_t pos)
+{
+  natural remain = n, this_size;
+  signed_natural result;
+
+  while (remain) {
+    this_size = remain;
+    if (this_size > INT_MAX) {
+      this_size = INT_MAX;
+    }
+#ifdef WINDOWS
+    if (LSEEK(fd, pos, SEEK_SET) < 0) {
+      return errno;
+    }
+    result = write(fd, bytes, this_size);
+#else
+    result = pwrite(fd, bytes, this_size, pos);
+#endif
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    bytes += result;
+    pos += result;
+    remain -= result;
+  }
+  return 0;
+}
+
+void
+note_save_application_progress(save_writer_state *state, natural n)
+{
+  save_application_progress_function hook = save_application_progress_hook;
+  natural done, step;
+
+  if ((hook == NULL) && (save_application_flags & SAVE_APPLICATION_REPORT_PROGRESS)) {
+    hook = report_save_application_progress;
+  }
+#ifndef WINDOWS
+  pthread_mutex_lock(&state->lock);
+#endif
+  done = (state->bytes_written += n);
+  step = state->total_bytes/20;
+  if (hook && ((done == state->total_bytes) || ((done - state->last_report) >= step))) {
+    state->last_report = done;
+    hook(done, state->total_bytes);
+  }
+#ifndef WINDOWS
+  pthread_mutex_unlock(&state->lock);
+#endif
+}
+
+void *
+save_writer_thread(void *arg)
+{
+  extern signed_natural atomic_incf(signed_natural *);
+  save_writer_state *state = arg;
+  save_write_job *job;
+  natural i, err;
+
+  while (state->err == 0) {
+    i = atomic_incf(&state->next_job) - 1;
+    if (i >= state->njobs) {
+      break;
+    }
+    job = &state->jobs[i];
+    err = pwritebuf(state->fd, job->bytes, job->nbytes, job->pos);
+#if defined(LINUX) && defined(O_DIRECT)
+    if (err == EINVAL) {
+      /* O_DIRECT wasn't acceptable after all */
+      fcntl(state->fd, F_SETFL, fcntl(state->fd, F_GETFL) & ~O_DIRECT);
+      err = pwritebuf(state->fd, job->bytes, job->nbytes, job->pos);
+    }
+#endif
+    if (err) {
+      state->err = err;
+      break;
+    }
+    note_save_application_progress(state, job->nbytes);
+  }
+  return NULL;
+}
+
+/*
+  Write jobs (which are sorted by file position) to a non-seekable fd,
+  writing zeros between them.
+*/
+natural
+write_zeros(int fd, natural n)
+{
+  static char zeros[4096];
+  natural this_size, err;
+
+  while (n) {
+    this_size = (n > sizeof(zeros)) ? sizeof(zeros) : n;
+    if ((err = writebuf(fd, zeros, this_size)) != 0) {
+      return err;
+    }
+    n -= this_size;
+  }
+  return 0;
+}
+
+natural
+stream_save_jobs(save_writer_state *state, off_t *ppos)
+{
+  save_write_job *job;
+  natural i, err;
+  off_t pos = *ppos;
+
+  for (i = 0, job = state->jobs; i < state->njobs; i++, job++) {
+    if (pos < job->pos) {
+      if ((err = write_zeros(state->fd, job->pos - pos)) != 0) {
+        return err;
+      }
+      *ppos = pos = job->pos;
+    }
+    if ((err = writebuf(state->fd, job->bytes, job->nbytes)) != 0) {
+      return err;
+    }
+    *ppos = (pos += job->nbytes);
+    note_save_application_progress(state, job->nbytes);
+  }
+  return 0;
+}
+
+natural
+add_save_jobs(save_write_job *jobs, natural njobs, char *bytes, natural nbytes, off_t pos, Boolean direct_io)
+{
+  natural chunk = save_application_chunk_size, n, tail;
+  char *bounce;
+
+  while (nbytes) {
+    n = (nbytes > chunk) ? chunk : nbytes;
+    if (direct_io && (n & (page_size-1))) {
+      tail = n & ~(page_size-1);
+      if (tail) {
+        jobs[njobs].bytes = bytes;
+        jobs[njobs].nbytes = tail;
+        jobs[njobs].pos = pos;
+        njobs++;
+        bytes += tail;
+        pos += tail;
+        nbytes -= tail;
+        n -= tail;
+      }
+      bounce = NULL;
+#ifndef WINDOWS
+      if (posix_memalign((void **)&bounce, page_size, page_size) == 0) {
+        memset(bounce, 0, page_size);
+        memcpy(bounce, bytes, n);
+        bytes = bounce;
+        n = page_size;
+      }
+#endif
+      jobs[njobs].bytes = bytes;
+      jobs[njobs].nbytes = n;
+      jobs[njobs].pos = pos;
+      jobs[njobs].bounce = bounce;
+      njobs++;
+      break;
+    }
+    jobs[njobs].bytes = bytes;
+    jobs[njobs].nbytes = n;
+    jobs[njobs].pos = pos;
+    njobs++;
+    bytes += n;
+    pos += n;
+    nbytes -= n;
+  }
+  return njobs;
+}
+
+natural
+count_save_jobs(natural nbytes)
+{
+  return (nbytes / save_application_chunk_size) + 2;
+}
+
 OSErr
 save_application_internal(unsigned fd, Boolean egc_was_enabled)
 {
@@ -572,8 +881,12 @@ save_application_internal(unsigned fd, Boolean egc_was_enabled)
   openmcl_image_section_header sections[NUM_IMAGE_SECTIONS];
   openmcl_image_file_trailer trailer;
   area *areas[NUM_IMAGE_SECTIONS], *a;
-  int i, err;
-  off_t header_pos, eof_pos;
+  int i, err, nthreads = save_application_nthreads;
+  off_t start_pos, pos, header_pos, eof_pos, section_pos[NUM_IMAGE_SECTIONS], refbits_pos = 0;
+  natural nrefbytes = 0, njobs = 0, maxjobs = 0;
+  Boolean streaming = false, direct_io = false;
+  save_write_job *jobs;
+  save_writer_state state;
 #if WORD_SIZE == 64
   off_t image_data_pos;
   signed_natural section_data_delta;
@@ -629,65 +942,173 @@ save_application_internal(unsigned fd, Boolean egc_was_enabled)
 #endif
   fh.flags = PLATFORM;
 
+  /* Lay out the file. */
+  start_pos = LSEEK(fd, 0, SEEK_CUR);
+  if (start_pos < 0) {
+    /* A pipe or socket: positions are relative to what we write. */
+    streaming = true;
+    start_pos = 0;
+  }
+  pos = align_to_power_of_2(start_pos, log2_page_size);
 #if WORD_SIZE == 64
-  image_data_pos = seek_to_next_page(fd);
+  image_data_pos = pos;
 #else
-  err = write_file_and_section_headers(fd, &fh, sections, NUM_IMAGE_SECTIONS, &header_pos);
-  if (err) {
-    return err;
+  header_pos = pos;
+  pos += sizeof(fh) + sizeof(sections);
+#endif
+  for (i = 0; i < NUM_IMAGE_SECTIONS; i++) {
+    a = areas[i];
+    pos = align_to_power_of_2(pos, log2_page_size);
+    section_pos[i] = pos;
+    pos += sections[i].memory_size;
+    maxjobs += count_save_jobs(sections[i].memory_size);
+    if (sections[i].memory_size && ((sections[i].code) == AREA_MANAGED_STATIC)) {
+      natural ndnodes = area_dnode(a->active, a->low);
+
+      nrefbytes = align_to_power_of_2((ndnodes+7)>>3,log2_page_size);
+      pos = align_to_power_of_2(pos, log2_page_size);
+      refbits_pos = pos;
+      pos += nrefbytes;
+      maxjobs += count_save_jobs(nrefbytes);
+    }
   }
+#if WORD_SIZE == 64
+  pos = align_to_power_of_2(pos, log2_page_size);
+  header_pos = pos;
+  section_data_delta = -((header_pos+sizeof(fh)+sizeof(sections)) - image_data_pos);
+  fh.section_data_offset_high = (int)(section_data_delta>>32L);
+  fh.section_data_offset_low = (unsigned)section_data_delta;
+  pos += sizeof(fh) + sizeof(sections);
 #endif
+  trailer.sig0 = IMAGE_SIG0;
+  trailer.sig1 = IMAGE_SIG1;
+  trailer.sig2 = IMAGE_SIG2;
+  eof_pos = pos + sizeof(trailer);
+  trailer.delta = (int) (header_pos-eof_pos);
 
   prepare_to_write_static_space(egc_was_enabled);
 
+#if defined(LINUX) && defined(O_DIRECT)
+  if ((save_application_flags & SAVE_APPLICATION_DIRECT_IO) && !streaming) {
+    direct_io = (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0);
+  }
+#endif
 
-
+  maxjobs += 2;
+  jobs = calloc(maxjobs, sizeof(save_write_job));
+  if (jobs == NULL) {
+    return ENOMEM;
+  }
+#if WORD_SIZE == 32
+  if (streaming) {
+    jobs[njobs].bytes = (char *)&fh;
+    jobs[njobs].nbytes = sizeof(fh);
+    jobs[njobs++].pos = header_pos;
+    jobs[njobs].bytes = (char *)sections;
+    jobs[njobs].nbytes = sizeof(sections);
+    jobs[njobs++].pos = header_pos+sizeof(fh);
+  }
+#endif
   for (i = 0; i < NUM_IMAGE_SECTIONS; i++) {
-    natural n;
     a = areas[i];
-    seek_to_next_page(fd);
-    n = sections[i].memory_size;
-    if (writebuf(fd, a->low, n)) {
-	return errno;
+    njobs = add_save_jobs(jobs, njobs, (char *)a->low, sections[i].memory_size,
+                          section_pos[i], direct_io);
+    if (sections[i].memory_size && ((sections[i].code) == AREA_MANAGED_STATIC)) {
+      njobs = add_save_jobs(jobs, njobs, (char *)managed_static_refbits, nrefbytes,
+                            refbits_pos, direct_io);
     }
-    if (n &&  ((sections[i].code) == AREA_MANAGED_STATIC)) {
-      natural ndnodes = area_dnode(a->active, a->low);
-      natural nrefbytes = align_to_power_of_2((ndnodes+7)>>3,log2_page_size);
+  }
+
+  state.fd = fd;
+  state.jobs = jobs;
+  state.njobs = njobs;
+  state.next_job = 0;
+  state.bytes_written = 0;
+  state.last_report = 0;
+  state.err = 0;
+  state.total_bytes = 0;
+  for (i = 0; i < njobs; i++) {
+    state.total_bytes += jobs[i].nbytes;
+  }
+#ifndef WINDOWS
+  pthread_mutex_init(&state.lock, NULL);
+#endif
+
+  if (streaming) {
+    pos = start_pos;
+    state.err = stream_save_jobs(&state, &pos);
+  } else {
+#ifdef WINDOWS
+    save_writer_thread(&state);
+#else
+    pthread_t threads[MAX_SAVE_APPLICATION_THREADS];
+    int nstarted = 0;
 
-      seek_to_next_page(fd);
-      if (writebuf(fd,(char*)managed_static_refbits,nrefbytes)) {
-        return errno;
+    if (nthreads <= 0) {
+      nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (nthreads > MAX_SAVE_APPLICATION_THREADS) {
+      nthreads = MAX_SAVE_APPLICATION_THREADS;
+    }
+    while (nstarted < (nthreads-1)) {
+      if (pthread_create(&threads[nstarted], NULL, save_writer_thread, &state) != 0) {
+        break;
       }
+      nstarted++;
+    }
+    save_writer_thread(&state);
+    for (i = 0; i < nstarted; i++) {
+      pthread_join(threads[i], NULL);
     }
+#endif
   }
-
-#if WORD_SIZE == 64
-  seek_to_next_page(fd);
-  section_data_delta = -((LSEEK(fd,0,SEEK_CUR)+sizeof(fh)+sizeof(sections)) -
-                         image_data_pos);
-  fh.section_data_offset_high = (int)(section_data_delta>>32L);
-  fh.section_data_offset_low = (unsigned)section_data_delta;
-  err =  write_file_and_section_headers(fd, &fh, sections, NUM_IMAGE_SECTIONS, &header_pos);
+  err = state.err;
+  for (i = 0; i < njobs; i++) {
+    if (jobs[i].bounce) {
+      free(jobs[i].bounce);
+    }
+  }
+  free(jobs);
   if (err) {
+    close(fd);
     return err;
-  }  
+  }
+
+#if defined(LINUX) && defined(O_DIRECT)
+  if (direct_io) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+  }
 #endif
 
-  trailer.sig0 = IMAGE_SIG0;
-  trailer.sig1 = IMAGE_SIG1;
-  trailer.sig2 = IMAGE_SIG2;
-  eof_pos = LSEEK(fd, 0, SEEK_CUR) + sizeof(trailer);
-  trailer.delta = (int) (header_pos-eof_pos);
-  if (write(fd, &trailer, sizeof(trailer)) == sizeof(trailer)) {
+  /* The headers (at least in the 64-bit case) and the trailer. */
+  if (streaming) {
+#if WORD_SIZE == 64
+    {
+      /* pos is where the last section's data ended. */
+      if (write_zeros(fd, header_pos - pos) ||
+          writebuf(fd, (char *)&fh, sizeof(fh)) ||
+          writebuf(fd, (char *)sections, sizeof(sections))) {
+        err = errno;
+      }
+    }
+#endif
+    if ((err == 0) && writebuf(fd, (char *)&trailer, sizeof(trailer))) {
+      err = errno;
+    }
+  } else {
+    if (pwritebuf(fd, (char *)&fh, sizeof(fh), header_pos) ||
+        pwritebuf(fd, (char *)sections, sizeof(sections), header_pos+sizeof(fh)) ||
+        pwritebuf(fd, (char *)&trailer, sizeof(trailer), eof_pos-sizeof(trailer))) {
+      err = errno;
+    }
 #ifndef WINDOWS
-    fsync(fd);
+    if ((err == 0) && !(save_application_flags & SAVE_APPLICATION_NO_FSYNC)) {
+      fsync(fd);
+    }
 #endif
-    close(fd);
-    return 0;
-  } 
-  i = errno;
+  }
   close(fd);
-  return i;
+  return err;
 }
 
 OSErr
@@ -710,3 +1131,327 @@ save_application(int fd, Boolean egc_was_enabled)
 
 
 
+
+/*
+  Startup prefetching.  If the image that we loaded contains an
+  IMAGE_SECTION_PAGE_ORDER section, a helper thread asks the OS to
+  bring those pages in (in the recorded order) while the initial
+  thread starts running lisp code, so that the latter takes minor
+  rather than major faults.  Each policy falls back to the next if
+  the OS refuses it.
+*/
+#ifndef WINDOWS
+int image_prefetch_fd = -1;
+
+void *
+image_prefetch_thread(void *arg)
+{
+  natural i, offset, len;
+  image_page_run *r;
+  mapped_image_section *m;
+  image_prefetch_policy policy = image_prefetch;
+  int fd = image_prefetch_fd;
+  sigset_t mask;
+
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  for (i = 0, r = image_page_order; i < image_page_order_nruns; i++, r++) {
+    if (r->section >= n_mapped_image_sections) {
+      continue;
+    }
+    m = &mapped_image_sections[r->section];
+    offset = ((natural)r->page) << log2_page_size;
+    if (offset >= m->nbytes) {
+      continue;
+    }
+    len = ((natural)r->npages) << log2_page_size;
+    if (len > (m->nbytes - offset)) {
+      len = align_to_power_of_2(m->nbytes - offset, log2_page_size);
+    }
+    switch (policy) {
+    case image_prefetch_willneed:
+      if (madvise(m->low+offset, len, MADV_WILLNEED) == 0) {
+        break;
+      }
+      policy = image_prefetch_populate;
+      /* Fall through */
+    case image_prefetch_populate:
+#ifdef MAP_POPULATE
+      {
+        void *p = mmap(NULL, len, PROT_READ, MAP_SHARED|MAP_POPULATE, fd, m->pos+offset);
+
+        if (p != MAP_FAILED) {
+          munmap(p, len);
+          break;
+        }
+      }
+#endif
+      policy = image_prefetch_readahead;
+      /* Fall through */
+    case image_prefetch_readahead:
+#ifdef LINUX
+      if (readahead(fd, m->pos+offset, len) == 0) {
+        break;
+      }
+#endif
+      return NULL;
+
+    default:
+      return NULL;
+    }
+  }
+  return NULL;
+}
+#endif
+
+#ifdef LINUX
+#if WORD_SIZE == 64
+/*
+  Recording.  With --record-page-order, a helper thread samples
+  /proc/self/pagemap every few milliseconds and notes the pages of
+  each image section as they first become present (or swapped), until
+  lisp says that it's ready (normally when the first REPL prompt is
+  printed.)  Pages that first show up in the same sample are recorded
+  in address order.
+*/
+#define PAGE_ORDER_SAMPLE_USECS 2000
+#define PAGEMAP_CHUNK 4096
+#define PAGEMAP_PRESENT (1ULL<<63)
+#define PAGEMAP_SWAPPED (1ULL<<62)
+
+pthread_t page_order_recorder;
+volatile Boolean page_order_recorder_done = false;
+image_page_run *recorded_page_order = NULL;
+natural recorded_page_order_nruns = 0, recorded_page_order_size = 0;
+
+void
+note_recorded_page(unsigned section, unsigned page)
+{
+  image_page_run *r;
+
+  if (recorded_page_order_nruns) {
+    r = &recorded_page_order[recorded_page_order_nruns-1];
+    if ((r->section == section) && ((r->page+r->npages) == page)) {
+      r->npages++;
+      return;
+    }
+  }
+  if (recorded_page_order_nruns == recorded_page_order_size) {
+    natural new_size = recorded_page_order_size ? (recorded_page_order_size*2) : 1024;
+    image_page_run *new = realloc(recorded_page_order, new_size*sizeof(image_page_run));
+
+    if (new == NULL) {
+      return;
+    }
+    recorded_page_order = new;
+    recorded_page_order_size = new_size;
+  }
+  r = &recorded_page_order[recorded_page_order_nruns++];
+  r->section = section;
+  r->page = page;
+  r->npages = 1;
+  r->pad = 0;
+}
+
+void *
+page_order_recorder_thread(void *arg)
+{
+  int fd = open("/proc/self/pagemap", O_RDONLY), i;
+  bitvector seen[NUM_IMAGE_SECTIONS];
+  natural npages[NUM_IMAGE_SECTIONS], first, p, j, n;
+  unsigned long long entries[PAGEMAP_CHUNK];
+  ssize_t got;
+  sigset_t mask;
+
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  if (fd < 0) {
+    return NULL;
+  }
+  for (i = 0; i < n_mapped_image_sections; i++) {
+    npages[i] = align_to_power_of_2(mapped_image_sections[i].nbytes, log2_page_size) >> log2_page_size;
+    seen[i] = calloc((npages[i]+(1<<bitmap_shift))>>bitmap_shift, sizeof(natural));
+    if (seen[i] == NULL) {
+      npages[i] = 0;
+    }
+  }
+
+  while (!page_order_recorder_done) {
+    for (i = 0; i < n_mapped_image_sections; i++) {
+      first = ((natural)(mapped_image_sections[i].low)) >> log2_page_size;
+      for (p = 0; p < npages[i]; p += n) {
+        n = npages[i] - p;
+        if (n > PAGEMAP_CHUNK) {
+          n = PAGEMAP_CHUNK;
+        }
+        got = pread(fd, entries, n*sizeof(entries[0]), (first+p)*sizeof(entries[0]));
+        if (got <= 0) {
+          break;
+        }
+        n = got/sizeof(entries[0]);
+        for (j = 0; j < n; j++) {
+          if ((entries[j] & (PAGEMAP_PRESENT|PAGEMAP_SWAPPED)) &&
+              !set_bit(seen[i], p+j)) {
+            note_recorded_page(i, p+j);
+          }
+        }
+      }
+    }
+    usleep(PAGE_ORDER_SAMPLE_USECS);
+  }
+  for (i = 0; i < n_mapped_image_sections; i++) {
+    free(seen[i]);
+  }
+  close(fd);
+  return NULL;
+}
+
+/*
+  Add (or replace) the IMAGE_SECTION_PAGE_ORDER section of the image
+  file at path.  The new section's data goes where the image header
+  was (or where the old page-order section's data was); the header,
+  section headers and trailer are rewritten after it.  None of this
+  overlaps the section data that the running lisp has mapped.
+*/
+int
+write_image_page_order(char *path, image_page_run *runs, natural nruns)
+{
+  openmcl_image_file_header h;
+  openmcl_image_file_trailer trailer;
+  off_t header_pos, data_start, data_pos, eof_pos;
+  signed_natural section_data_delta;
+  natural nbytes = nruns*sizeof(image_page_run);
+  int fd = open(path, O_RDWR), nsections, err = 0;
+
+  if (fd < 0) {
+    return errno;
+  }
+  if (!find_openmcl_image_file_header(fd, &h)) {
+    close(fd);
+    return EINVAL;
+  }
+  header_pos = LSEEK(fd, 0, SEEK_CUR) - sizeof(h);
+  nsections = h.nsections;
+  {
+    openmcl_image_section_header sections[nsections+1], *sect;
+
+    if (read(fd, sections, nsections*sizeof(sections[0])) !=
+        (nsections*sizeof(sections[0]))) {
+      close(fd);
+      return EINVAL;
+    }
+    section_data_delta = 
+      ((signed_natural)(h.section_data_offset_high) << 32L) | h.section_data_offset_low;
+    data_start = header_pos + sizeof(h) + (nsections*sizeof(sections[0])) + section_data_delta;
+
+    sect = &sections[nsections-1];
+    if (sect->code == IMAGE_SECTION_PAGE_ORDER) {
+      data_pos = header_pos - sect->static_dnodes;
+    } else {
+      data_pos = header_pos;
+      sect = &sections[nsections++];
+      sect->code = IMAGE_SECTION_PAGE_ORDER;
+      sect->area = NULL;
+    }
+    sect->memory_size = nbytes;
+
+    if ((LSEEK(fd, data_pos, SEEK_SET) < 0) ||
+        (writebuf(fd, (char *)runs, nbytes) != 0)) {
+      err = errno;
+      close(fd);
+      return err;
+    }
+    sect->static_dnodes = seek_to_next_page(fd) - data_pos;
+    h.nsections = nsections;
+    section_data_delta = -((sect->static_dnodes + data_pos + sizeof(h) +
+                            (nsections*sizeof(sections[0]))) - data_start);
+    h.section_data_offset_high = (int)(section_data_delta>>32L);
+    h.section_data_offset_low = (unsigned)section_data_delta;
+    err = write_file_and_section_headers(fd, &h, sections, nsections, &header_pos);
+    if (err) {
+      close(fd);
+      return err;
+    }
+  }
+  trailer.sig0 = IMAGE_SIG0;
+  trailer.sig1 = IMAGE_SIG1;
+  trailer.sig2 = IMAGE_SIG2;
+  eof_pos = LSEEK(fd, 0, SEEK_CUR) + sizeof(trailer);
+  trailer.delta = (int) (header_pos-eof_pos);
+  if ((write(fd, &trailer, sizeof(trailer)) != sizeof(trailer)) ||
+      (ftruncate(fd, eof_pos) != 0)) {
+    err = errno;
+  }
+  close(fd);
+  return err;
+}
+#endif
+#endif
+
+void
+start_image_prefetch(int fd)
+{
+#ifndef WINDOWS
+  pthread_attr_t attr;
+  pthread_t thread;
+
+#ifdef LINUX
+#if WORD_SIZE == 64
+  if (record_page_order) {
+    pthread_create(&page_order_recorder, NULL, page_order_recorder_thread, NULL);
+    return;
+  }
+#endif
+#endif
+  if (image_page_order && (image_prefetch != image_prefetch_none)) {
+    image_prefetch_fd = fd;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, image_prefetch_thread, NULL);
+    pthread_attr_destroy(&attr);
+  }
+#endif
+}
+
+/*
+  Called from lisp when the application is "ready" (by default, when
+  the first listener prompt is printed.)  Stores the number of
+  microseconds since the kernel started in *elapsed_usecs; if we were
+  recording the image's page order, stops recording and writes it to
+  the image file.  Returns 0 or an errno value.
+*/
+int
+image_ready(natural *elapsed_usecs)
+{
+  int err = 0;
+
+  if (elapsed_usecs) {
+    struct timeval now;
+
+    lisp_gettimeofday(&now, NULL);
+    *elapsed_usecs = ((now.tv_sec - kernel_start_time.tv_sec) * 1000000) +
+      (now.tv_usec - kernel_start_time.tv_usec);
+  }
+#ifdef LINUX
+#if WORD_SIZE == 64
+  if (record_page_order && !page_order_recorder_done) {
+    extern char *image_name;
+
+    page_order_recorder_done = true;
+    pthread_join(page_order_recorder, NULL);
+    if (recorded_page_order_nruns == 0) {
+      /* Don't make the image unloadable by older kernels for nothing. */
+      return 0;
+    }
+    err = write_image_page_order(image_name, recorded_page_order, recorded_page_order_nruns);
+    if (err == 0) {
+      fprintf(dbgout, ";;; Recorded page order for %s (" DECIMAL " runs)\n",
+              image_name, recorded_page_order_nruns);
+    }
+  }
+#endif
+#endif
+  return err;
+}
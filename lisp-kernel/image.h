@@ -88,6 +88,11 @@ load_openmcl_image(int, openmcl_image_file_header*);
 
 extern Boolean find_openmcl_image_file_header(int fd, openmcl_image_file_header *h);
 
+/* Write all n bytes, at the current position or at pos; return 0 or an
+   errno value. */
+extern natural writebuf(int, char *, natural);
+extern natural pwritebuf(int, char *, natural, off_t);
+
 extern void
 prepare_to_write_dynamic_space(area *);
 
@@ -97,7 +102,48 @@ prepare_to_write_static_space(Boolean);
 extern area *
 set_nil(LispObj);
 
+extern int
+image_ready(natural *);
+
+extern void
+start_image_prefetch(int);
+
 
 
 
 #define NUM_IMAGE_SECTIONS 5    /* used to be 3 */
+
+/*
+   An image may contain an optional section (after all of the
+   sections that describe areas) which records the order in which a
+   training run first touched the pages of the other sections.  Its
+   memory_size is the size in bytes of a vector of image_page_run
+   records; its static_dnodes field holds the distance in bytes from
+   the start of its data to the start of the image header, so that it
+   can be found and replaced in place.  Kernels which know about the
+   section use it to prefetch those pages on a helper thread.  Older
+   kernels don't: load_image_section() leaves an unknown section's
+   area NULL, and load_openmcl_image() then rejects the image.  So
+   the section is only ever added to an image file by
+   --record-page-order, and SAVE-APPLICATION doesn't carry it over.
+*/
+
+#define IMAGE_SECTION_PAGE_ORDER (16<<fixnumshift)
+
+typedef struct {
+  unsigned section;             /* index of the section */
+  unsigned page;                /* first page, relative to section start */
+  unsigned npages;
+  unsigned pad;
+} image_page_run;
+
+typedef enum {
+  image_prefetch_none = 0,
+  image_prefetch_willneed,      /* madvise(MADV_WILLNEED) */
+  image_prefetch_populate,      /* transient MAP_POPULATE mapping */
+  image_prefetch_readahead      /* readahead(2) on the image fd */
+} image_prefetch_policy;
+
+extern image_prefetch_policy image_prefetch;
+extern Boolean record_page_order;
+
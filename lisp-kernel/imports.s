@@ -102,6 +102,32 @@ import_ptrs_start:
         defimport(lisp_sigexit)
         defimport(jvm_init)
         defimport(lisp_lstat)
+        defimport(image_ready)
+        defimport(configure_save_application)
+        defimport(lisp_fork)
+        defimport(lisp_immutable_ranges)
+        defimport(add_immutable_range)
+        defimport(lisp_profiler_start)
+        defimport(lisp_profiler_stop)
+        defimport(lisp_profiler_buffers)
+        defimport(lisp_jitdump_start)
+        defimport(lisp_jitdump_stop)
+        defimport(lisp_allocation_profiler_start)
+        defimport(lisp_allocation_profiler_stop)
+        defimport(lisp_allocation_profiler_buffers)
+        defimport(lisp_heap_census_control)
+        defimport(lisp_heap_census)
+        defimport(lisp_heap_census_wrappers)
+        defimport(lisp_lock_wait_begin)
+        defimport(lisp_lock_acquired)
+        defimport(lisp_lock_profiling_control)
+        defimport(lisp_lock_stats)
+        defimport(lisp_lock_stats_values)
+        defimport(lisp_lock_stats_reset)
+        defimport(lisp_trace_start)
+        defimport(lisp_trace_stop)
+        defimport(lisp_trace_event)
+        defimport(lisp_trace_buffers)
    
         .globl C(import_ptrs_base)
 C(import_ptrs_base):
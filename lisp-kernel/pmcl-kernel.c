@@ -18,6 +18,7 @@
 #include "lisp_globals.h"
 #include "gc.h"
 #include "area.h"
+#include "image.h"
 #include <stdlib.h>
 #include <string.h>
 #include "lisp-exceptions.h"
@@ -1173,6 +1174,16 @@ usage_exit(char *herald, int exit_status, char* other_args)
  fprintf(dbgout,  "\t--no-avx :signal handler don't preserve AVX(YMM) registers on x8664 Linux, This the default on Linux <3.0\n");
 #endif
 #endif
+#endif
+#ifndef WINDOWS
+  fprintf(dbgout, "\t--image-prefetch <policy>: how to prefetch recorded image pages at startup:\n");
+  fprintf(dbgout, "\t\t willneed (the default), populate, readahead or none\n");
+#ifdef LINUX
+#if WORD_SIZE==64
+  fprintf(dbgout, "\t--record-page-order : record the order in which image pages are touched\n");
+  fprintf(dbgout, "\t\t until the first prompt and store it in the image\n");
+#endif
+#endif
 #endif
   fprintf(dbgout, "\t-I, --image-name <image-name>\n");
 #ifndef WINDOWS
@@ -1239,6 +1250,7 @@ parse_numeric_option(char *arg, char *argname, natural default_val)
    remaining args will be processed by lisp code.
 */
 Boolean copy_exception_avx_state = false;
+struct timeval kernel_start_time;
 
 void
 process_options(int argc, char *argv[], wchar_t *shadow[])
@@ -1388,6 +1400,33 @@ process_options(int argc, char *argv[], wchar_t *shadow[])
       } else if (strcmp (arg,"--no-avx") == 0) {
         copy_exception_avx_state =0;
         num_elide = 1;
+#ifndef WINDOWS
+      } else if (strcmp(arg, "--image-prefetch") == 0) {
+        if ((i+1) < argc) {
+          val = argv[i+1];
+          num_elide = 2;
+          if (strcmp(val, "none") == 0) {
+            image_prefetch = image_prefetch_none;
+          } else if (strcmp(val, "willneed") == 0) {
+            image_prefetch = image_prefetch_willneed;
+          } else if (strcmp(val, "populate") == 0) {
+            image_prefetch = image_prefetch_populate;
+          } else if (strcmp(val, "readahead") == 0) {
+            image_prefetch = image_prefetch_readahead;
+          } else {
+            arg_error = 1;
+          }
+        } else {
+          arg_error = 1;
+        }
+#ifdef LINUX
+#if WORD_SIZE==64
+      } else if (strcmp(arg, "--record-page-order") == 0) {
+        record_page_order = true;
+        num_elide = 1;
+#endif
+#endif
+#endif
 
     
       } else if (strcmp(arg,"--") == 0) {
@@ -1883,10 +1922,12 @@ main
 #else
   extern LispObj load_image(char *);
 #endif
+  extern int lisp_gettimeofday(struct timeval *, void *);
   area *a;
   BytePtr stack_base, current_sp = (BytePtr) current_stack_pointer();
   TCR *tcr;
 
+  lisp_gettimeofday(&kernel_start_time, NULL);
   dbgout = stderr;
 
 #ifdef WINDOWS
@@ -2292,7 +2333,6 @@ do_fd_zero(fd_set *fdsetp)
   FD_ZERO(fdsetp);
 }
 
-#include "image.h"
 
 
 
@@ -2353,6 +2393,11 @@ load_image(
     if (!image_nil) {
       close(fd);
     }
+#ifndef WINDOWS
+    if (image_nil) {
+      start_image_prefetch(fd);
+    }
+#endif
 #ifdef WINDOWS
     /* We currently don't actually map the image, and leaving the file
        open seems to make it difficult to write to reliably. */
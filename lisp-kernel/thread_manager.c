@@ -16,6 +16,9 @@
 
 
 #include "threads.h"
+#ifndef WINDOWS
+#include <sys/time.h>
+#endif
 
 
 typedef struct {
@@ -254,6 +257,7 @@ get_spin_lock(signed_natural *p, TCR *tcr)
 int
 lock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
 {
+  unsigned long long wait_start = 0;
 
   if (tcr == NULL) {
     tcr = get_tcr(true);
@@ -272,8 +276,14 @@ lock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
       break;
     }
     RELEASE_SPINLOCK(m->spinlock);
+    if ((lock_profiling_enabled || trace_enabled) && (wait_start == 0)) {
+      wait_start = lock_wait_begin(NULL, m, LOCK_STATS_RECURSIVE);
+    }
     SEM_WAIT_FOREVER(m->signal);
   }
+  if (lock_profiling_enabled || wait_start) {
+    note_lock_acquired(&m->stats, m, LOCK_STATS_RECURSIVE, wait_start);
+  }
   return 0;
 }
 
@@ -315,6 +325,18 @@ lock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
     m->count++;
     return 0;
   }
+  if (lock_profiling_enabled || trace_enabled) {
+    unsigned long long wait_start = 0;
+
+    if (store_conditional((natural *)&m->avail,FUTEX_AVAIL,FUTEX_LOCKED) != FUTEX_AVAIL) {
+      wait_start = lock_wait_begin(NULL, m, LOCK_STATS_RECURSIVE);
+      lock_futex(&m->avail);
+    }
+    m->owner = tcr;
+    m->count = 1;
+    note_lock_acquired(&m->stats, m, LOCK_STATS_RECURSIVE, wait_start);
+    return 0;
+  }
   lock_futex(&m->avail);
   m->owner = tcr;
   m->count = 1;
@@ -383,6 +405,9 @@ destroy_recursive_lock(RECURSIVE_LOCK m)
 #ifndef USE_FUTEX
   destroy_semaphore((void **)&m->signal);
 #endif
+  if (m->stats) {
+    m->stats->lock = NULL;
+  }
   free((void *)(m->malloced_ptr));
 }
 
@@ -601,10 +626,16 @@ suspend_resume_handler(int signo, siginfo_t *info, ExceptionInformation *context
   if (TCR_INTERRUPT_LEVEL(tcr) <= (-2<<fixnumshift)) {
     SET_TCR_FLAG(tcr,TCR_FLAG_BIT_PENDING_SUSPEND);
   } else {
+    if (trace_enabled) {
+      trace_event_now(tcr, TRACE_EVENT_SUSPENDED, TRACE_PHASE_BEGIN, 0);
+    }
     TCR_AUX(tcr)->suspend_context = context;
     SEM_RAISE(TCR_AUX(tcr)->suspend);
     SEM_WAIT_FOREVER(TCR_AUX(tcr)->resume);
     TCR_AUX(tcr)->suspend_context = NULL;
+    if (trace_enabled) {
+      trace_event_now(tcr, TRACE_EVENT_SUSPENDED, TRACE_PHASE_END, 0);
+    }
   }
   SIGRETURN(context);
 }
@@ -1293,6 +1324,7 @@ new_tcr(natural vstack_size, natural tstack_size)
 #ifndef ARM
   a = allocate_tstack_holding_area_lock(tstack_size);
 #endif
+  profile_new_tcr(tcr);
   UNLOCK(lisp_global(TCR_AREA_LOCK),tcr);
 #ifndef ARM
   tcr->ts_area = a;
@@ -1409,6 +1441,7 @@ shutdown_thread_tcr(void *arg)
     tcr->tlb_limit = 0;
     free(tcr->tlb_pointer);
     tcr->tlb_pointer = NULL;
+    profile_dead_tcr(tcr);
 #ifdef WINDOWS
     if (TCR_AUX(tcr)->osid != 0) {
       CloseHandle((HANDLE)(TCR_AUX(tcr)->osid));
@@ -2435,6 +2468,645 @@ lisp_resume_other_threads()
   resume_other_threads(false);
 }
 
+/*
+  Fork a child process that continues to run lisp on the calling
+  thread.  Other threads are suspended across the fork, so none of
+  them is in the middle of something that holds a kernel lock; they
+  don't exist in the child, so they're marked as dead there and the
+  next GC reclaims their TCRs.  Returns the child's pid (0 in the
+  child) or a negated errno value.
+*/
+signed_natural
+lisp_fork()
+{
+#ifdef WINDOWS
+  return -ENOSYS;
+#else
+  TCR *current = get_tcr(true), *other;
+  pid_t pid;
+  int err;
+
+  suspend_other_threads(false);
+  pid = fork();
+  err = errno;
+  if (pid == 0) {
+    for (other = TCR_AUX(current)->next; other != current; other = TCR_AUX(other)->next) {
+      TCR_AUX(other)->osid = 0;
+    }
+    TCR_AUX(current)->native_thread_id = current_native_thread_id();
+    UNLOCK(lisp_global(TCR_AREA_LOCK), current);
+  } else {
+    resume_other_threads(false);
+  }
+  if (pid < 0) {
+    return -err;
+  }
+  return pid;
+#endif
+}
+
+profile_buffer *profile_buffers = NULL, *alloc_profile_buffers = NULL;
+Boolean profiler_enabled = false;
+natural alloc_sample_interval = 0;
+static natural profile_nrecords = 0, profile_record_words = 0;
+static natural alloc_profile_nrecords = 0, alloc_profile_record_words = 0;
+static void ensure_trace_buffer(TCR *);
+
+/* Give tcr a buffer of the given shape in *slot, from (or added to)
+   *list.  Caller owns TCR_AREA_LOCK, which also protects the lists of
+   buffers. */
+static void
+ensure_profile_buffer(TCR *tcr, void **slot, profile_buffer **list,
+                      natural nrecords, natural record_words)
+{
+#ifdef HAVE_LISP_PROFILER
+  profile_buffer *b = *slot;
+
+  if (b && (b->nrecords == nrecords) &&
+      (b->record_words == record_words)) {
+    b->tcr = tcr;
+    return;
+  }
+  for (b = *list; b; b = b->next) {
+    /* Reuse the buffer of a thread that's gone. */
+    if ((b->tcr == NULL) &&
+        (b->nrecords == nrecords) &&
+        (b->record_words == record_words)) {
+      break;
+    }
+  }
+  if (b == NULL) {
+    b = calloc(1, sizeof(profile_buffer));
+    if (b == NULL) {
+      return;
+    }
+    b->records = calloc(nrecords*record_words, sizeof(LispObj));
+    if (b->records == NULL) {
+      free(b);
+      return;
+    }
+    b->nrecords = nrecords;
+    b->record_words = record_words;
+    b->next = *list;
+    *list = b;
+  }
+  if (*slot) {
+    ((profile_buffer *)(*slot))->tcr = NULL;
+  }
+  b->tcr = tcr;
+  *slot = b;
+#endif
+}
+
+void
+profile_new_tcr(TCR *tcr)
+{
+#ifdef HAVE_LISP_PROFILER
+  tcr->profile_buffer = NULL;
+  tcr->alloc_profile_buffer = NULL;
+  tcr->alloc_sample_base = NULL;
+  tcr->alloc_sample_at = 0;
+  tcr->alloc_sample_seed = (natural)tcr;
+  if (profiler_enabled) {
+    ensure_profile_buffer(tcr, &tcr->profile_buffer, &profile_buffers,
+                          profile_nrecords, profile_record_words);
+  }
+  if (alloc_sample_interval) {
+    ensure_profile_buffer(tcr, &tcr->alloc_profile_buffer, &alloc_profile_buffers,
+                          alloc_profile_nrecords, alloc_profile_record_words);
+  }
+  tcr->trace_buffer = NULL;
+  if (trace_enabled) {
+    ensure_trace_buffer(tcr);
+  }
+#endif
+}
+
+void
+profile_dead_tcr(TCR *tcr)
+{
+#ifdef HAVE_LISP_PROFILER
+  profile_buffer *b = tcr->profile_buffer;
+
+  /* Unread samples stay where lisp can find them. */
+  if (b) {
+    b->tcr = NULL;
+    tcr->profile_buffer = NULL;
+  }
+  b = tcr->alloc_profile_buffer;
+  if (b) {
+    b->tcr = NULL;
+    tcr->alloc_profile_buffer = NULL;
+  }
+  if (tcr->trace_buffer) {
+    ((trace_buffer *)(tcr->trace_buffer))->tcr = NULL;
+    tcr->trace_buffer = NULL;
+  }
+#endif
+}
+
+/*
+  Start sampling every usec microseconds of process CPU time, keeping
+  up to nrecords unread samples of at most depth frames per thread.
+  Returns 0 or an errno value.
+*/
+int
+lisp_profiler_start(natural usec, natural nrecords, natural depth)
+{
+#ifdef HAVE_LISP_PROFILER
+  TCR *current = get_tcr(true), *other;
+  struct itimerval it;
+  static Boolean handler_installed = false;
+
+  if ((usec == 0) || (nrecords == 0) || (depth == 0)) {
+    return EINVAL;
+  }
+  LOCK(lisp_global(TCR_AREA_LOCK), current);
+  profile_nrecords = nrecords;
+  profile_record_words = PROFILE_RECORD_HEADER_WORDS+(2*depth);
+  other = current;
+  do {
+    ensure_profile_buffer(other, &other->profile_buffer, &profile_buffers,
+                          profile_nrecords, profile_record_words);
+    other = TCR_AUX(other)->next;
+  } while (other != current);
+  profiler_enabled = true;
+  UNLOCK(lisp_global(TCR_AREA_LOCK), current);
+  if (!handler_installed) {
+    install_profile_signal_handler();
+    handler_installed = true;
+  }
+  it.it_interval.tv_sec = usec / 1000000;
+  it.it_interval.tv_usec = usec % 1000000;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    profiler_enabled = false;
+    return errno;
+  }
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+int
+lisp_profiler_stop()
+{
+#ifdef HAVE_LISP_PROFILER
+  struct itimerval it;
+
+  memset(&it, 0, sizeof(it));
+  profiler_enabled = false;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    return errno;
+  }
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+static natural
+list_profile_buffers(profile_buffer *b, profile_buffer **v, natural n)
+{
+  natural count = 0;
+
+  for (; b; b = b->next, count++) {
+    if (count < n) {
+      v[count] = b;
+    }
+  }
+  return count;
+}
+
+/* Store up to n buffers in v, return the total number of buffers. */
+natural
+lisp_profiler_buffers(profile_buffer **v, natural n)
+{
+  return list_profile_buffers(profile_buffers, v, n);
+}
+
+/*
+  Sample an allocation about every interval bytes that each thread
+  allocates, keeping up to nrecords unread samples of at most depth
+  frames per thread.  Threads start sampling when they next get a new
+  allocation segment.
+*/
+int
+lisp_allocation_profiler_start(natural interval, natural nrecords, natural depth)
+{
+#ifdef HAVE_LISP_PROFILER
+  TCR *current = get_tcr(true), *other;
+
+  if ((interval == 0) || (nrecords == 0) || (depth == 0)) {
+    return EINVAL;
+  }
+  LOCK(lisp_global(TCR_AREA_LOCK), current);
+  alloc_profile_nrecords = nrecords;
+  alloc_profile_record_words = PROFILE_RECORD_HEADER_WORDS+(2*depth);
+  other = current;
+  do {
+    ensure_profile_buffer(other, &other->alloc_profile_buffer, &alloc_profile_buffers,
+                          alloc_profile_nrecords, alloc_profile_record_words);
+    other->alloc_sample_at = 0;
+    other = TCR_AUX(other)->next;
+  } while (other != current);
+  alloc_sample_interval = interval;
+  UNLOCK(lisp_global(TCR_AREA_LOCK), current);
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+/*
+  Stop sampling allocations.  Threads whose allocbase sampling has
+  lowered restore it at their next alloc trap, which records nothing
+  once the interval is 0.
+*/
+int
+lisp_allocation_profiler_stop()
+{
+#ifdef HAVE_LISP_PROFILER
+  TCR *current = get_tcr(true), *other;
+
+  LOCK(lisp_global(TCR_AREA_LOCK), current);
+  alloc_sample_interval = 0;
+  other = current;
+  do {
+    other->alloc_sample_at = 0;
+    other = TCR_AUX(other)->next;
+  } while (other != current);
+  UNLOCK(lisp_global(TCR_AREA_LOCK), current);
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+natural
+lisp_allocation_profiler_buffers(profile_buffer **v, natural n)
+{
+  return list_profile_buffers(alloc_profile_buffers, v, n);
+}
+
+/*
+  Lock contention profiling.  When it's enabled, every acquisition of
+  a recursive lock or rwlock (from lisp or from the kernel) is counted
+  in the lock's lock_stats, as is the time spent waiting for it when
+  it had to wait.  Callers note acquisitions while they still hold the
+  lock (or the rwlock's spinlock), so the counters don't need to be
+  updated atomically.
+*/
+
+Boolean lock_profiling_enabled = false;
+natural lock_backtrace_interval = 0;
+lock_stats *all_lock_stats = NULL;
+
+unsigned long long
+monotonic_nanoseconds()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+#else
+  extern int lisp_gettimeofday(struct timeval *, void *);
+  struct timeval tv;
+
+  lisp_gettimeofday(&tv, NULL);
+  return (tv.tv_sec * 1000000000ULL) + (tv.tv_usec * 1000ULL);
+#endif
+}
+
+static lock_stats *
+ensure_lock_stats(lock_stats **slot, void *lock, natural kind)
+{
+  lock_stats *s = *slot, *head;
+
+  if (s == NULL) {
+    s = calloc(1, sizeof(lock_stats));
+    if (s == NULL) {
+      return NULL;
+    }
+    s->lock = lock;
+    s->kind = kind;
+    s->sample_countdown = lock_backtrace_interval;
+    /* A waiter and the holder can race to do this. */
+    if (store_conditional((natural *)slot, 0, (natural)s) != 0) {
+      free(s);
+      return *slot;
+    }
+    do {
+      head = all_lock_stats;
+      s->next = head;
+    } while (store_conditional((natural *)&all_lock_stats, (natural)head, (natural)s) != (natural)head);
+  }
+  return s;
+}
+
+/*
+  Called by a thread that's about to wait for a lock while lock
+  profiling or event tracing is enabled; returns the time at which the
+  wait started.  Every lock_backtrace_interval'th
+  wait asks the current holder to note its backtrace when it releases
+  the lock; only lisp does that, so the kernel passes a NULL slot
+  here and the stats pointer separately via note_lock_acquired.
+*/
+unsigned long long
+lock_wait_begin(lock_stats **slot, void *lock, natural kind)
+{
+  lock_stats *s;
+
+  if (slot && lock_profiling_enabled && lock_backtrace_interval) {
+    s = ensure_lock_stats(slot, lock, kind);
+    /* The race here just makes sampling a little less regular. */
+    if (s && (--s->sample_countdown == 0)) {
+      s->sample_countdown = lock_backtrace_interval;
+      s->want_backtrace = 1;
+    }
+  }
+  return monotonic_nanoseconds();
+}
+
+void
+note_lock_acquired(lock_stats **slot, void *lock, natural kind, unsigned long long wait_start)
+{
+  lock_stats *s;
+  unsigned long long wait = 0;
+
+  if (wait_start) {
+    wait = monotonic_nanoseconds() - wait_start;
+    if (trace_enabled) {
+      trace_event(get_tcr(false), TRACE_EVENT_LOCK_WAIT, TRACE_PHASE_COMPLETE,
+                  (natural)lock, wait_start, wait);
+    }
+  }
+  if (lock_profiling_enabled) {
+    s = ensure_lock_stats(slot, lock, kind);
+    if (s) {
+      s->acquisitions++;
+      if (wait_start) {
+        s->contended++;
+        s->total_wait_ns += wait;
+        if (wait > s->max_wait_ns) {
+          s->max_wait_ns = wait;
+        }
+      }
+    }
+  }
+}
+
+static lock_stats **
+lock_stats_slot(void *lock, natural kind)
+{
+  if (kind == LOCK_STATS_RWLOCK) {
+    return &(((rwlock *)lock)->stats);
+  }
+  return &(((RECURSIVE_LOCK)lock)->stats);
+}
+
+/* Lisp's versions of lock_wait_begin and note_lock_acquired. */
+unsigned long long
+lisp_lock_wait_begin(void *lock, natural kind)
+{
+  return lock_wait_begin(lock_stats_slot(lock, kind), lock, kind);
+}
+
+void
+lisp_lock_acquired(void *lock, natural kind, unsigned long long wait_start)
+{
+  note_lock_acquired(lock_stats_slot(lock, kind), lock, kind, wait_start);
+}
+
+/*
+  Enable or disable lock profiling.  If backtrace_interval is
+  non-zero, lisp lock holders note their backtraces on about one in
+  that many contended acquisitions of each lock.  Return the previous
+  state.
+*/
+int
+lisp_lock_profiling_control(int enable, natural backtrace_interval)
+{
+  Boolean was = lock_profiling_enabled;
+  lock_stats *s;
+
+  if (enable) {
+    lock_backtrace_interval = backtrace_interval;
+    for (s = all_lock_stats; s; s = s->next) {
+      s->sample_countdown = backtrace_interval;
+      s->want_backtrace = 0;
+    }
+  }
+  lock_profiling_enabled = (enable != 0);
+  return was;
+}
+
+/* Store up to n lock_stats in v, return the total number of them. */
+natural
+lisp_lock_stats(lock_stats **v, natural n)
+{
+  lock_stats *s;
+  natural count = 0;
+
+  for (s = all_lock_stats; s; s = s->next, count++) {
+    if (count < n) {
+      v[count] = s;
+    }
+  }
+  return count;
+}
+
+/*
+  Copy s's lock address, kind, acquisitions, contended acquisitions,
+  total wait and maximum wait (in nanoseconds) to v.  This doesn't
+  stop the counters from changing while it's reading them.
+*/
+void
+lisp_lock_stats_values(lock_stats *s, unsigned long long *v)
+{
+  v[0] = (natural)(s->lock);
+  v[1] = s->kind;
+  v[2] = s->acquisitions;
+  v[3] = s->contended;
+  v[4] = s->total_wait_ns;
+  v[5] = s->max_wait_ns;
+}
+
+void
+lisp_lock_stats_reset()
+{
+  lock_stats *s;
+
+  for (s = all_lock_stats; s; s = s->next) {
+    s->acquisitions = 0;
+    s->contended = 0;
+    s->total_wait_ns = 0;
+    s->max_wait_ns = 0;
+    s->want_backtrace = 0;
+  }
+}
+
+/* Event tracing; see threads.h. */
+
+Boolean trace_enabled = false;
+int trace_ffcalls = 0;          /* tested by .SPffcall */
+trace_buffer *trace_buffers = NULL;
+static natural trace_nrecords = 0;
+
+/* Give tcr a trace buffer.  Caller owns TCR_AREA_LOCK, which also
+   protects trace_buffers. */
+static void
+ensure_trace_buffer(TCR *tcr)
+{
+#ifdef HAVE_LISP_PROFILER
+  trace_buffer *b = tcr->trace_buffer;
+
+  if (b && (b->nrecords == trace_nrecords)) {
+    b->tcr = tcr;
+    return;
+  }
+  for (b = trace_buffers; b; b = b->next) {
+    /* Reuse the buffer of a thread that's gone. */
+    if ((b->tcr == NULL) && (b->nrecords == trace_nrecords)) {
+      b->head = 0;
+      break;
+    }
+  }
+  if (b == NULL) {
+    b = calloc(1, sizeof(trace_buffer));
+    if (b == NULL) {
+      return;
+    }
+    b->records = calloc(trace_nrecords, sizeof(trace_record));
+    if (b->records == NULL) {
+      free(b);
+      return;
+    }
+    b->nrecords = trace_nrecords;
+    b->next = trace_buffers;
+    trace_buffers = b;
+  }
+  if (tcr->trace_buffer) {
+    ((trace_buffer *)(tcr->trace_buffer))->tcr = NULL;
+  }
+  b->tcr = tcr;
+  tcr->trace_buffer = b;
+#endif
+}
+
+void
+trace_event(TCR *tcr, natural event, natural phase, natural arg,
+            unsigned long long time, unsigned long long duration)
+{
+#ifdef HAVE_LISP_PROFILER
+  trace_buffer *b;
+  trace_record *r;
+  natural i;
+
+  if (tcr && ((b = tcr->trace_buffer) != NULL)) {
+    /* A signal handler may write a record while we're writing this one. */
+    i = atomic_incf((signed_natural *)&b->head) - 1;
+    r = &(b->records[i & (b->nrecords - 1)]);
+    r->time = time;
+    r->duration = duration;
+    r->event = event;
+    r->phase = phase;
+    r->arg = arg;
+  }
+#endif
+}
+
+void
+trace_event_now(TCR *tcr, natural event, natural phase, natural arg)
+{
+  trace_event(tcr, event, phase, arg, monotonic_nanoseconds(), 0);
+}
+
+/* Called from .SPffcall when trace_ffcalls is set. */
+void
+trace_ffcall_enter(TCR *tcr, natural entry)
+{
+  trace_event_now(tcr, TRACE_EVENT_FFCALL, TRACE_PHASE_BEGIN, entry);
+}
+
+void
+trace_ffcall_exit(TCR *tcr)
+{
+  trace_event_now(tcr, TRACE_EVENT_FFCALL, TRACE_PHASE_END, 0);
+}
+
+/*
+  Start tracing, with room for nrecords (rounded up to a power of 2)
+  events per thread.  If TRACE_FFCALLS is set in flags, also trace
+  foreign function calls where the kernel can.
+*/
+int
+lisp_trace_start(natural nrecords, natural flags)
+{
+#ifdef HAVE_LISP_PROFILER
+  TCR *current = get_tcr(true), *other;
+  natural n = 1;
+
+  if (nrecords == 0) {
+    return EINVAL;
+  }
+  while (n < nrecords) {
+    n <<= 1;
+  }
+  LOCK(lisp_global(TCR_AREA_LOCK), current);
+  trace_nrecords = n;
+  other = current;
+  do {
+    ensure_trace_buffer(other);
+    other = TCR_AUX(other)->next;
+  } while (other != current);
+  trace_enabled = true;
+  trace_ffcalls = (flags & TRACE_FFCALLS) != 0;
+  UNLOCK(lisp_global(TCR_AREA_LOCK), current);
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+int
+lisp_trace_stop()
+{
+#ifdef HAVE_LISP_PROFILER
+  trace_ffcalls = 0;
+  trace_enabled = false;
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+/* Record an event for lisp (a span, usually) in the current thread. */
+void
+lisp_trace_event(natural event, natural phase, natural arg)
+{
+  if (trace_enabled) {
+    trace_event_now(get_tcr(false), event, phase, arg);
+  }
+}
+
+/* Store up to n trace buffers in v, return the total number of them. */
+natural
+lisp_trace_buffers(trace_buffer **v, natural n)
+{
+  trace_buffer *b;
+  natural count = 0;
+
+  for (b = trace_buffers; b; b = b->next, count++) {
+    if (count < n) {
+      v[count] = b;
+    }
+  }
+  return count;
+}
+
 
 
 rwlock *
@@ -2479,6 +3151,7 @@ int
 rwlock_rlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
 {
   int err = 0;
+  unsigned long long wait_start = 0;
   
   LOCK_SPINLOCK(rw->spin, tcr);
 
@@ -2490,6 +3163,9 @@ rwlock_rlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
   while (rw->blocked_writers || (rw->state > 0)) {
     rw->blocked_readers++;
     RELEASE_SPINLOCK(rw->spin);
+    if ((lock_profiling_enabled || trace_enabled) && (wait_start == 0)) {
+      wait_start = lock_wait_begin(NULL, rw, LOCK_STATS_RWLOCK);
+    }
     err = semaphore_maybe_timedwait(rw->reader_signal,waitfor);
     LOCK_SPINLOCK(rw->spin,tcr);
     rw->blocked_readers--;
@@ -2502,6 +3178,9 @@ rwlock_rlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
     }
   }
   rw->state--;
+  if (lock_profiling_enabled || wait_start) {
+    note_lock_acquired(&rw->stats, rw, LOCK_STATS_RWLOCK, wait_start);
+  }
   RELEASE_SPINLOCK(rw->spin);
   return err;
 }
@@ -2510,6 +3189,7 @@ int
 rwlock_rlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
 {
   natural waitval;
+  unsigned long long wait_start = 0;
 
   lock_futex(&rw->spin);
 
@@ -2520,12 +3200,18 @@ rwlock_rlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
   while (1) {
     if (rw->writer == NULL) {
       --rw->state;
+      if (lock_profiling_enabled || wait_start) {
+        note_lock_acquired(&rw->stats, rw, LOCK_STATS_RWLOCK, wait_start);
+      }
       unlock_futex(&rw->spin);
       return 0;
     }
     rw->blocked_readers++;
     waitval = rw->reader_signal;
     unlock_futex(&rw->spin);
+    if ((lock_profiling_enabled || trace_enabled) && (wait_start == 0)) {
+      wait_start = lock_wait_begin(NULL, rw, LOCK_STATS_RWLOCK);
+    }
     futex_wait(&rw->reader_signal,waitval);
     lock_futex(&rw->spin);
     rw->blocked_readers--;
@@ -2550,6 +3236,7 @@ int
 rwlock_wlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
 {
   int err = 0;
+  unsigned long long wait_start = 0;
 
   LOCK_SPINLOCK(rw->spin,tcr);
   if (rw->writer == tcr) {
@@ -2561,6 +3248,9 @@ rwlock_wlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
   while (rw->state != 0) {
     rw->blocked_writers++;
     RELEASE_SPINLOCK(rw->spin);
+    if ((lock_profiling_enabled || trace_enabled) && (wait_start == 0)) {
+      wait_start = lock_wait_begin(NULL, rw, LOCK_STATS_RWLOCK);
+    }
     err = semaphore_maybe_timedwait(rw->writer_signal, waitfor);
     LOCK_SPINLOCK(rw->spin,tcr);
     rw->blocked_writers--;
@@ -2574,6 +3264,9 @@ rwlock_wlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
   }
   rw->state = 1;
   rw->writer = tcr;
+  if (lock_profiling_enabled || wait_start) {
+    note_lock_acquired(&rw->stats, rw, LOCK_STATS_RWLOCK, wait_start);
+  }
   RELEASE_SPINLOCK(rw->spin);
   return err;
 }
@@ -2584,6 +3277,7 @@ rwlock_wlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
 {
   int err = 0;
   natural waitval;
+  unsigned long long wait_start = 0;
 
   lock_futex(&rw->spin);
   if (rw->writer == tcr) {
@@ -2596,12 +3290,18 @@ rwlock_wlock(rwlock *rw, TCR *tcr, struct timespec *waitfor)
     rw->blocked_writers++;
     waitval = rw->writer_signal;
     unlock_futex(&rw->spin);
+    if ((lock_profiling_enabled || trace_enabled) && (wait_start == 0)) {
+      wait_start = lock_wait_begin(NULL, rw, LOCK_STATS_RWLOCK);
+    }
     futex_wait(&rw->writer_signal,waitval);
     lock_futex(&rw->spin);
     rw->blocked_writers--;
   }
   rw->state = 1;
   rw->writer = tcr;
+  if (lock_profiling_enabled || wait_start) {
+    note_lock_acquired(&rw->stats, rw, LOCK_STATS_RWLOCK, wait_start);
+  }
   unlock_futex(&rw->spin);
   return err;
 }
@@ -2783,6 +3483,9 @@ rwlock_destroy(rwlock *rw)
   destroy_semaphore((void **)&rw->reader_signal);
   destroy_semaphore((void **)&rw->writer_signal);
 #endif
+  if (rw->stats) {
+    rw->stats->lock = NULL;
+  }
   free((void *)(rw->malloced_ptr));
 }
 
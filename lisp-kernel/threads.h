@@ -157,6 +157,33 @@ void sem_wait_forever(SEMAPHORE s);
 #define SEM_WAIT_FOREVER(s) sem_wait_forever((SEMAPHORE)s)
 #endif
 
+/*
+  Contention statistics for a recursive lock or rwlock.  One of these
+  is allocated the first time that a lock is acquired while lock
+  profiling is enabled, and it's never freed.  want_backtrace comes
+  first so that lisp can test it cheaply when it releases a lock.
+*/
+typedef struct lock_stats
+{
+  natural want_backtrace;       /* a waiter wants the holder's backtrace */
+  struct lock_stats *next;
+  void *lock;                   /* NULL once the lock's been destroyed */
+  natural kind;                 /* LOCK_STATS_RECURSIVE or LOCK_STATS_RWLOCK */
+  natural acquisitions;
+  natural contended;
+  natural sample_countdown;
+  unsigned long long total_wait_ns;
+  unsigned long long max_wait_ns;
+} lock_stats;
+
+#define LOCK_STATS_RECURSIVE 0
+#define LOCK_STATS_RWLOCK 1
+
+extern Boolean lock_profiling_enabled;
+unsigned long long monotonic_nanoseconds(void);
+unsigned long long lock_wait_begin(lock_stats **, void *, natural);
+void note_lock_acquired(lock_stats **, void *, natural, unsigned long long);
+
 typedef struct
 {
   signed_natural avail;
@@ -166,6 +193,7 @@ typedef struct
   signed_natural waiting;
   void *malloced_ptr;
   signed_natural spinlock;
+  lock_stats *stats;
 } _recursive_lock, *RECURSIVE_LOCK;
 
 
@@ -216,6 +244,112 @@ Boolean lisp_suspend_tcr(TCR *);
 Boolean lisp_resume_tcr(TCR *);
 void lisp_suspend_other_threads(void);
 void lisp_resume_other_threads(void);
+signed_natural lisp_fork(void);
+
+/*
+  Statistical profiler.  A timer signal samples whichever thread is
+  running into that thread's profile_buffer: each record is a fixnum
+  frame count, two fixnums of sample data and that many (function,
+  fixnum offset) pairs, innermost first.  A function of 0 means that
+  the offset is a foreign or subprimitive PC.  The GC treats unread
+  records as roots, so lisp can map them to names after the functions
+  have moved.  Buffers are never freed.
+
+  CPU samples' data is a state (PROFILE_SAMPLE_xxx) and 0.  The
+  allocation profiler samples an allocation every alloc_sample_interval
+  bytes or so (per thread) into the thread's alloc_profile_buffer; its
+  data is the object's subtag (fulltag_cons for a cons) and size in
+  bytes.  It works by lowering a thread's allocbase, so that the
+  allocation that crosses the sampling point traps.
+*/
+#if defined(X86) && !defined(WINDOWS)
+#define HAVE_LISP_PROFILER 1
+#endif
+
+#define PROFILE_SAMPLE_LISP 0
+#define PROFILE_SAMPLE_FOREIGN 1
+#define PROFILE_SAMPLE_KERNEL 2 /* GC or exception handling */
+
+#define PROFILE_RECORD_HEADER_WORDS 3
+
+typedef struct profile_buffer {
+  struct profile_buffer *next;  /* all buffers */
+  TCR *tcr;                     /* thread that last owned it */
+  natural nrecords;
+  natural record_words;
+  natural head;                 /* records written (not reduced mod nrecords) */
+  natural tail;                 /* records consumed by lisp */
+  natural dropped;              /* samples lost because the buffer was full */
+  LispObj *records;
+} profile_buffer;
+
+extern profile_buffer *profile_buffers, *alloc_profile_buffers;
+extern Boolean profiler_enabled;
+extern natural alloc_sample_interval;
+int lisp_profiler_start(natural, natural, natural);
+int lisp_profiler_stop(void);
+natural lisp_profiler_buffers(profile_buffer **, natural);
+int lisp_allocation_profiler_start(natural, natural, natural);
+int lisp_allocation_profiler_stop(void);
+natural lisp_allocation_profiler_buffers(profile_buffer **, natural);
+unsigned long long lisp_lock_wait_begin(void *, natural);
+void lisp_lock_acquired(void *, natural, unsigned long long);
+int lisp_lock_profiling_control(int, natural);
+natural lisp_lock_stats(lock_stats **, natural);
+void lisp_lock_stats_values(lock_stats *, unsigned long long *);
+void lisp_lock_stats_reset(void);
+
+/*
+  Event tracing.  While tracing is enabled, each thread records timed
+  events in its own trace_buffer, a ring of nrecords (a power of 2)
+  trace_records whose oldest records are overwritten when it's full.
+  Only the thread itself (perhaps in a signal handler) writes to its
+  buffer, so claiming a record just increments head.  Readers take
+  whatever's there, and may see a record that's being written.
+  Buffers are never freed.
+*/
+typedef struct trace_record {
+  unsigned long long time;      /* nanoseconds, same clock as lock waits */
+  unsigned long long duration;  /* for TRACE_PHASE_COMPLETE */
+  unsigned long long event;     /* TRACE_EVENT_xxx */
+  unsigned long long phase;     /* TRACE_PHASE_xxx */
+  unsigned long long arg;
+} trace_record;
+
+typedef struct trace_buffer {
+  struct trace_buffer *next;
+  TCR *tcr;                     /* NULL once the thread's gone */
+  natural nrecords;
+  volatile natural head;        /* number of records ever written */
+  trace_record *records;
+} trace_buffer;
+
+#define TRACE_EVENT_GC 1                /* GC, purify, etc. */
+#define TRACE_EVENT_SUSPEND_THREADS 2   /* in the GCing thread */
+#define TRACE_EVENT_SUSPENDED 3         /* in each suspended thread */
+#define TRACE_EVENT_EXCEPTION 4         /* arg: signal number */
+#define TRACE_EVENT_LOCK_WAIT 5         /* arg: kernel lock address */
+#define TRACE_EVENT_FFCALL 6            /* arg: entry point */
+#define TRACE_EVENT_SPAN 7              /* lisp; arg: span name index */
+
+#define TRACE_PHASE_BEGIN 0
+#define TRACE_PHASE_END 1
+#define TRACE_PHASE_COMPLETE 2
+#define TRACE_PHASE_INSTANT 3
+
+#define TRACE_FFCALLS 1                 /* lisp_trace_start flag */
+
+extern Boolean trace_enabled;
+void trace_event(TCR *, natural, natural, natural, unsigned long long, unsigned long long);
+void trace_event_now(TCR *, natural, natural, natural);
+int lisp_trace_start(natural, natural);
+int lisp_trace_stop(void);
+void lisp_trace_event(natural, natural, natural);
+natural lisp_trace_buffers(trace_buffer **, natural);
+void profile_new_tcr(TCR *);
+void profile_dead_tcr(TCR *);
+void install_profile_signal_handler(void);
+void profile_sample_context(TCR *, ExceptionInformation *, profile_buffer *);
 
 typedef struct
 {
@@ -232,6 +366,7 @@ typedef struct
   void * writer_signal;
 #endif
   void *malloced_ptr;
+  lock_stats *stats;
 } rwlock;
 
 
@@ -251,6 +386,7 @@ natural
 atomic_ior(natural*, natural);
 
 signed_natural atomic_incf(signed_natural *);
+signed_natural atomic_incf_by(signed_natural *, signed_natural);
 signed_natural atomic_decf(signed_natural *);
 
 #define SET_TCR_FLAG(t,bit) atomic_ior(&(t->flags),(1L<<bit))
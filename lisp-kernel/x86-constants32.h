@@ -397,6 +397,12 @@ typedef struct tcr {
   void *pending_io_info;
   void *io_datum;
   void *nfp;
+  void *profile_buffer;         /* statistical profiler samples */
+  void *alloc_profile_buffer;   /* allocation profiler samples */
+  void *alloc_sample_base;      /* real allocbase when sampling lowers it */
+  unsigned long long alloc_sample_at; /* bytes_allocated at next sample, or 0 */
+  natural alloc_sample_seed;
+  void *trace_buffer;           /* event tracing */
 } TCR;
 #endif
 
@@ -331,6 +331,12 @@ typedef struct tcr {
   void *pending_io_info;
   void *io_datum;
   void *nfp;
+  void *profile_buffer;         /* statistical profiler samples */
+  void *alloc_profile_buffer;   /* allocation profiler samples */
+  void *alloc_sample_base;      /* real allocbase when sampling lowers it */
+  natural alloc_sample_at;      /* bytes_allocated at next sample, or 0 */
+  natural alloc_sample_seed;
+  void *trace_buffer;           /* event tracing */
 } TCR;
 
 #define t_offset (t_value-nil_value)
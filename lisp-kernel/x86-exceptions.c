@@ -147,13 +147,24 @@ update_bytes_allocated(TCR* tcr, void *cur_allocptr)
 
 
 
+#ifdef HAVE_LISP_PROFILER
+static void set_alloc_sample_limit(TCR *, BytePtr, BytePtr);
+static void profile_allocation(TCR *, ExceptionInformation *, natural, natural);
+static natural alloc_trap_subtag(ExceptionInformation *, natural);
+static Boolean handle_alloc_sample_trap(ExceptionInformation *, TCR *, natural, natural, natural);
+#endif
+
 void
 platform_new_heap_segment(ExceptionInformation *xp, TCR *tcr, BytePtr low, BytePtr high)
 {
   tcr->last_allocptr = (void *)high;
   tcr->save_allocptr = (void *)high;
   xpGPR(xp,Iallocptr) = (LispObj) high;
+#ifdef HAVE_LISP_PROFILER
+  set_alloc_sample_limit(tcr, high, low);
+#else
   tcr->save_allocbase = (void *) low;
+#endif
 }
 
 Boolean
@@ -281,6 +292,27 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
     ensure_static_conses(xp, tcr, 32768);
     break;
 
+  case GC_TRAP_FUNCTION_HEAP_DUMP:
+    /* Describe the heap to the file descriptor in arg, using the
+       number of writer threads in arg_z.  write_heap_dump() does its
+       own full GC, while the other threads are still suspended. */
+    update_bytes_allocated(tcr, (void *) tcr->save_allocptr);
+    if (egc_was_enabled) {
+      egc_control(false, (BytePtr) a->active);
+    }
+    {
+      int params[2];
+
+      params[0] = (int)arg;
+      params[1] = (int)unbox_fixnum(xpGPR(xp, Iarg_z));
+      xpGPR(xp, Iimm0) = gc_like_from_xp(xp, write_heap_dump, (signed_natural)params);
+    }
+    freeGCptrs();
+    if (egc_was_enabled) {
+      egc_control(true, NULL);
+    }
+    break;
+
   case GC_TRAP_FUNCTION_FLASH_FREEZE: /* Like freeze below, but no GC */
     untenure_from_area(tenured_area);
     gc_like_from_xp(xp,flash_freeze,0);
@@ -356,6 +388,12 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
       full_gc_deferred = 0;
     }
     if (selector > GC_TRAP_FUNCTION_GC) {
+      if (selector & (GC_TRAP_FUNCTION_IMPURIFY |
+                      GC_TRAP_FUNCTION_PURIFY |
+                      GC_TRAP_FUNCTION_SAVE_APPLICATION)) {
+        /* These move or save things in the frozen part of the heap */
+        fork_thaw();
+      }
       if (selector & GC_TRAP_FUNCTION_IMPURIFY) {
         impurify_from_xp(xp, 0L);
         /*        nrs_GC_EVENT_STATUS_BITS.vcell |= gc_integrity_check_bit; */
@@ -388,6 +426,31 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
         tenured_area->static_dnodes = area_dnode(a->active, a->low);
         xpGPR(xp, Iimm0) = tenured_area->static_dnodes << dnode_shift;
         break;
+      case GC_TRAP_FUNCTION_FORK_FREEZE:
+        /* Like FREEZE (without purifying), but subsequent full GCs
+           don't touch the frozen pages. */
+        a->active = (BytePtr) align_to_power_of_2(a->active, log2_page_size);
+        tenured_area->static_dnodes = area_dnode(a->active, a->low);
+        if (fork_freeze()) {
+          xpGPR(xp, Iimm0) = tenured_area->static_dnodes << dnode_shift;
+        } else {
+          xpGPR(xp, Iimm0) = 0;
+        }
+        break;
+      case GC_TRAP_FUNCTION_PURIFY_OBJECT:
+        /* Copy the graph rooted at arg_z into the readonly area,
+           then reclaim the dynamic-heap originals. */
+        fork_thaw();
+        {
+          signed_natural status = gc_like_from_xp(xp, purify_object_graph, (signed_natural)&(xpGPR(xp, Iarg_z)));
+
+          if (status == PURIFY_OBJECT_COPIED) {
+            lisp_global(OLDSPACE_DNODE_COUNT) = 0;
+            gc_from_xp(xp, 0L);
+          }
+          xpGPR(xp, Iimm0) = status;
+        }
+        break;
       default:
         break;
       }
@@ -659,7 +722,17 @@ handle_alloc_trap(ExceptionInformation *xp, TCR *tcr, Boolean *notify)
   }
   bytes_needed = disp+allocptr_tag;
 
+#ifdef HAVE_LISP_PROFILER
+  if (handle_alloc_sample_trap(xp, tcr, cur_allocptr, allocptr_tag, bytes_needed)) {
+    return true;
+  }
+#endif
   update_bytes_allocated(tcr,((BytePtr)(cur_allocptr+disp)));
+#ifdef HAVE_LISP_PROFILER
+  if (alloc_sample_interval) {
+    profile_allocation(tcr, xp, alloc_trap_subtag(xp, allocptr_tag), bytes_needed);
+  }
+#endif
   if (allocate_object(xp, bytes_needed, disp, tcr, notify)) {
     if (notify && *notify) {
       xpPC(xp)+=2;
@@ -949,6 +1022,35 @@ handle_fault(TCR *tcr, ExceptionInformation *xp, siginfo_t *info, int old_valenc
 
     if ((addr >= readonly_area->low) &&
 	(addr < readonly_area->active)) {
+      LispObj obj = immutable_object_containing(addr),
+        cmain = nrs_CMAIN.vcell;
+
+      if (obj &&
+          (old_valence == TCR_STATE_LISP) &&
+          (fulltag_of(cmain) == fulltag_misc) &&
+	  (header_subtag(header_of(cmain)) == subtag_macptr)) {
+        /* A write to an object that was declared immutable. */
+        LispObj save_vsp = xpGPR(xp, Isp);
+        LispObj save_fp = xpGPR(xp, Ifp);
+        LispObj xcf;
+        natural offset = (LispObj)addr - obj;
+        int skip;
+
+        push_on_lisp_stack(xp, obj);
+        xcf = create_exception_callback_frame(xp, tcr);
+        skip = callback_to_lisp(tcr, cmain, xp, xcf, SIGSEGV, 3,
+                                (natural)addr, offset);
+        xpPC(xp) += skip;
+        xpGPR(xp, Ifp) = save_fp;
+        xpGPR(xp, Isp) = save_vsp;
+        return true;
+      }
+      if (obj) {
+        /* Foreign code (or the kernel) wrote to an immutable object,
+           or lisp can't be told about it.  Leave the page protected
+           and treat this like any other unhandled fault. */
+        return false;
+      }
       UnProtectMemory((LogicalAddress)(truncate_to_power_of_2(addr,log2_page_size)),
 		      page_size);
       return true;
@@ -1488,7 +1590,9 @@ signal_handler(int signum, siginfo_t *info, ExceptionInformation  *context
   }
   wait_for_exception_lock_in_handler(tcr,context, &xframe_link);
 
-
+  if (trace_enabled) {
+    trace_event_now(tcr, TRACE_EVENT_EXCEPTION, TRACE_PHASE_BEGIN, signum);
+  }
   if (! handle_exception(signum, info, context, tcr, old_valence)) {
     char msg[512];
     Boolean foreign = (old_valence != TCR_STATE_LISP);
@@ -1499,6 +1603,9 @@ signal_handler(int signum, siginfo_t *info, ExceptionInformation  *context
       SET_TCR_FLAG(tcr,TCR_FLAG_BIT_PROPAGATE_EXCEPTION);
     }
   }
+  if (trace_enabled) {
+    trace_event_now(tcr, TRACE_EVENT_EXCEPTION, TRACE_PHASE_END, signum);
+  }
   unlock_exception_lock_in_handler(tcr);
 #ifndef DARWIN_USE_PSEUDO_SIGRETURN
   exit_signal_handler(tcr, old_valence);
@@ -2006,6 +2113,275 @@ install_signal_handler(int signo, void *handler, unsigned flags)
 }
 #endif
 
+#ifdef HAVE_LISP_PROFILER
+/* True if code at p can be safely examined: it's in the heap or in
+   the readonly area, where purified functions live. */
+static Boolean
+profile_code_address_p(LispObj p)
+{
+  return (((p >= lisp_global(HEAP_START)) &&
+           (p < lisp_global(HEAP_END))) ||
+          (readonly_area &&
+           (p >= (LispObj)readonly_area->low) &&
+           (p < (LispObj)readonly_area->active)));
+}
+
+/* Store a function and offset (or 0 and a PC) for pc in rec. */
+static void
+profile_note_pc(LispObj *rec, LispObj fn, LispObj pc)
+{
+  if (fn && (pc >= fn) &&
+      ((pc - fn) < (header_element_count(header_of(fn)) << node_shift))) {
+    rec[0] = fn;
+    rec[1] = box_fixnum(pc - fn);
+  } else {
+    rec[0] = 0;
+    rec[1] = box_fixnum(pc);
+  }
+}
+
+/* The function in xp's fn register, if it looks like one. */
+static LispObj
+profile_current_function(ExceptionInformation *xp)
+{
+  LispObj fn = xpGPR(xp, Ifn);
+
+#ifdef X8664
+  if ((fulltag_of(fn) != fulltag_function) ||
+      !profile_code_address_p(fn)) {
+    fn = 0;
+  }
+#else
+  if ((fulltag_of(fn) != fulltag_misc) ||
+      !profile_code_address_p(fn) ||
+      (header_subtag(header_of(fn)) != subtag_function)) {
+    fn = 0;
+  }
+#endif
+  return fn;
+}
+
+/*
+  Note the return addresses of the lisp frames on tcr's vstack, starting
+  with frame, in the (function, offset) pairs at rec; return the new
+  count of pairs.  Walks the frames in the same way that the kernel
+  debugger's backtrace does.
+*/
+static natural
+profile_note_frames(TCR *tcr, lisp_frame *frame, LispObj *rec,
+                    natural nframes, natural maxframes)
+{
+  area *vs = tcr->vs_area;
+  LispObj ra, fn;
+  lisp_frame *next;
+
+  while (frame &&
+         (nframes < maxframes) &&
+         ((BytePtr)frame >= vs->low) &&
+         ((BytePtr)(frame+1) <= vs->high)) {
+    ra = frame->tra;
+    if (ra == lisp_global(RET1VALN)) {
+      ra = frame->xtra;
+    }
+    if (profile_code_address_p(ra)) {
+      fn = tra_function(ra);
+      if (fn && !profile_code_address_p(fn)) {
+        fn = 0;
+      }
+      profile_note_pc(rec+(2*nframes), fn, ra);
+      nframes++;
+    }
+    next = frame->backlink;
+    if (next <= frame) {
+      break;
+    }
+    frame = next;
+  }
+  return nframes;
+}
+
+/*
+  Called from the profiling signal handler, so this can't lock
+  anything, allocate or follow anything that it can't validate first.
+*/
+void
+profile_sample_context(TCR *tcr, ExceptionInformation *xp, profile_buffer *b)
+{
+  LispObj *rec;
+  lisp_frame *frame;
+  natural nframes = 0, maxframes, state;
+
+  if ((b->head - b->tail) >= b->nrecords) {
+    b->dropped++;
+    return;
+  }
+  rec = b->records + ((b->head % b->nrecords) * b->record_words);
+  maxframes = (b->record_words - PROFILE_RECORD_HEADER_WORDS) >> 1;
+  if ((lisp_global(IN_GC) != 0) || (tcr->valence != TCR_STATE_LISP)) {
+    profile_note_pc(rec+PROFILE_RECORD_HEADER_WORDS, 0, (LispObj)xpPC(xp));
+    nframes = 1;
+    if ((tcr->valence == TCR_STATE_FOREIGN) && (lisp_global(IN_GC) == 0)) {
+      /* In an ff-call; the lisp frames start where it was made. */
+      state = PROFILE_SAMPLE_FOREIGN;
+      frame = (lisp_frame *)(tcr->save_fp);
+    } else {
+      /* GCing or handling an exception. */
+      state = PROFILE_SAMPLE_KERNEL;
+      frame = NULL;
+    }
+  } else {
+    state = PROFILE_SAMPLE_LISP;
+    profile_note_pc(rec+PROFILE_RECORD_HEADER_WORDS,
+                    profile_current_function(xp), (LispObj)xpPC(xp));
+    nframes = 1;
+    frame = (lisp_frame *)xpGPR(xp, Ifp);
+  }
+  nframes = profile_note_frames(tcr, frame, rec+PROFILE_RECORD_HEADER_WORDS,
+                                nframes, maxframes);
+  rec[0] = box_fixnum(nframes);
+  rec[1] = box_fixnum(state);
+  rec[2] = box_fixnum(0);
+  b->head++;
+}
+
+/* A pseudo-random interval averaging interval bytes, so that periodic
+   allocation patterns don't bias the samples.  interval is a copy of
+   alloc_sample_interval that's been checked to be non-zero; another
+   thread may zero the global at any time. */
+static natural
+next_alloc_sample_interval(TCR *tcr, natural interval)
+{
+  natural x = tcr->alloc_sample_seed;
+
+  /* xorshift */
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  if (x == 0) {
+    x = 1;
+  }
+  tcr->alloc_sample_seed = x;
+  return 1 + (x % (2 * interval));
+}
+
+/* Set tcr's allocbase so that the allocation which crosses the next
+   sampling point traps, given that it's allocating down from allocptr
+   in a segment that ends at low. */
+static void
+set_alloc_sample_limit(TCR *tcr, BytePtr allocptr, BytePtr low)
+{
+  uint64_t allocated = (uint64_t)TCR_AUX(tcr)->bytes_allocated;
+  natural due, interval = alloc_sample_interval;
+
+  tcr->alloc_sample_base = low;
+  if (interval == 0) {
+    tcr->save_allocbase = low;
+    tcr->alloc_sample_at = 0;
+    return;
+  }
+  if (tcr->alloc_sample_at == 0) {
+    tcr->alloc_sample_at = allocated + next_alloc_sample_interval(tcr, interval);
+  }
+  due = (tcr->alloc_sample_at > allocated) ? (tcr->alloc_sample_at - allocated) : 0;
+  if ((natural)(allocptr - low) > due) {
+    tcr->save_allocbase = allocptr - due;
+  } else {
+    tcr->save_allocbase = low;
+  }
+}
+
+/* The subtag of the object that an alloc trap's trying to allocate;
+   a uvector's header is in imm0. */
+static natural
+alloc_trap_subtag(ExceptionInformation *xp, natural allocptr_tag)
+{
+  if (allocptr_tag == fulltag_cons) {
+    return fulltag_cons;
+  }
+#ifdef X8664
+  return header_subtag(xpGPR(xp,Iimm0));
+#else
+  return header_subtag(xpMMXreg(xp,Imm0));
+#endif
+}
+
+/* Record an allocation of bytes of the given subtag by the lisp code
+   in xp, if it's time to. */
+static void
+profile_allocation(TCR *tcr, ExceptionInformation *xp, natural subtag, natural bytes)
+{
+  profile_buffer *b = tcr->alloc_profile_buffer;
+  uint64_t allocated = (uint64_t)TCR_AUX(tcr)->bytes_allocated;
+  LispObj *rec;
+  natural nframes, interval = alloc_sample_interval;
+
+  if ((interval == 0) || (b == NULL) || (tcr->alloc_sample_at == 0) ||
+      ((allocated + bytes) < tcr->alloc_sample_at)) {
+    return;
+  }
+  tcr->alloc_sample_at = allocated + bytes + next_alloc_sample_interval(tcr, interval);
+  if ((b->head - b->tail) >= b->nrecords) {
+    b->dropped++;
+    return;
+  }
+  rec = b->records + ((b->head % b->nrecords) * b->record_words);
+  profile_note_pc(rec+PROFILE_RECORD_HEADER_WORDS,
+                  profile_current_function(xp), (LispObj)xpPC(xp));
+  nframes = profile_note_frames(tcr, (lisp_frame *)xpGPR(xp, Ifp),
+                                rec+PROFILE_RECORD_HEADER_WORDS, 1,
+                                (b->record_words - PROFILE_RECORD_HEADER_WORDS) >> 1);
+  rec[0] = box_fixnum(nframes);
+  rec[1] = box_fixnum(subtag);
+  rec[2] = box_fixnum(bytes);
+  b->head++;
+}
+
+/*
+  If sampling lowered tcr's allocbase and the allocation that trapped
+  fits in what's really left of its segment, note it and let it
+  proceed; return true if so.
+*/
+static Boolean
+handle_alloc_sample_trap(ExceptionInformation *xp, TCR *tcr,
+                         natural cur_allocptr, natural allocptr_tag,
+                         natural bytes_needed)
+{
+  BytePtr low = tcr->alloc_sample_base, before = (BytePtr)(cur_allocptr+bytes_needed-allocptr_tag);
+
+  if ((tcr->save_allocbase == (void *)VOID_ALLOCPTR) ||
+      (low == NULL) ||
+      (tcr->save_allocbase == low) ||
+      ((BytePtr)(cur_allocptr-allocptr_tag) < low)) {
+    return false;
+  }
+  update_bytes_allocated(tcr, before);
+  profile_allocation(tcr, xp, alloc_trap_subtag(xp, allocptr_tag), bytes_needed);
+  tcr->last_allocptr = before;
+  set_alloc_sample_limit(tcr, before, low);
+  tcr->save_allocptr = (void *)cur_allocptr;
+  return true;
+}
+
+static void
+profile_signal_handler(int signum, siginfo_t *info, ExceptionInformation *context)
+{
+  TCR *tcr = get_interrupt_tcr(false);
+  int old_errno = errno;
+
+  if (tcr && profiler_enabled && tcr->profile_buffer && tcr->vs_area) {
+    profile_sample_context(tcr, context, (profile_buffer *)(tcr->profile_buffer));
+  }
+  errno = old_errno;
+}
+
+void
+install_profile_signal_handler()
+{
+  install_signal_handler(SIGPROF, (void *)profile_signal_handler,
+                         RESERVE_FOR_LISP|ON_ALTSTACK|RESTART_SYSCALLS);
+}
+#endif
+
 #ifdef WINDOWS
 BOOL 
 CALLBACK ControlEventHandler(DWORD event)
@@ -2879,7 +3255,13 @@ gc_like_from_xp(ExceptionInformation *xp,
   signed_natural inhibit, barrier = 0;
 
   atomic_incf(&barrier);
+  if (trace_enabled) {
+    trace_event_now(tcr, TRACE_EVENT_SUSPEND_THREADS, TRACE_PHASE_BEGIN, 0);
+  }
   suspend_other_threads(true);
+  if (trace_enabled) {
+    trace_event_now(tcr, TRACE_EVENT_SUSPEND_THREADS, TRACE_PHASE_END, 0);
+  }
   inhibit = (signed_natural)(lisp_global(GC_INHIBIT_COUNT));
   if (inhibit != 0) {
     if (inhibit > 0) {
@@ -2922,7 +3304,13 @@ gc_like_from_xp(ExceptionInformation *xp,
     
 
 
+  if (trace_enabled) {
+    trace_event_now(tcr, TRACE_EVENT_GC, TRACE_PHASE_BEGIN, 0);
+  }
   result = fun(tcr, param);
+  if (trace_enabled) {
+    trace_event_now(tcr, TRACE_EVENT_GC, TRACE_PHASE_END, 0);
+  }
 
   other_tcr = tcr;
   do {
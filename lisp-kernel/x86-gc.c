@@ -20,7 +20,11 @@
 #include "gc.h"
 #include "area.h"
 #include "threads.h"
+#include "image.h"
+#include "x86-utils.h"
 #include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
@@ -2795,6 +2799,9 @@ purify(TCR *tcr, signed_natural param)
   if (pure_area) {
     new_pure_start = pure_area->active;
     lisp_global(IN_GC) = (1<<fixnumshift);
+    discard_profile_samples();
+    jitdump_rescan();
+    discard_heap_census();
 
     /* 
       Caller will typically GC again (and that should recover quite a bit of
@@ -2878,6 +2885,1045 @@ purify(TCR *tcr, signed_natural param)
   return -1;
 }
 
+/*
+  Copy everything reachable from *(LispObj *)param that's in the
+  dynamic heap into a new page-aligned immutable range of the readonly
+  area.  The graph may only contain conses, simple vectors, array
+  headers, ratios, complex numbers, immutable functions and ivectors
+  other than macptrs; anything else that's in the dynamic heap (and
+  anything in its static dnodes, which can be reclaimed) makes the whole
+  thing fail and is returned in *param.  Since nothing in the result
+  points into the dynamic heap, the GC never needs to look at it.
+*/
+
+static Boolean
+shareable_object_p(LispObj obj)
+{
+  LispObj header;
+  int header_tag, subtag;
+
+  if (fulltag_of(obj) == fulltag_cons) {
+    return true;
+  }
+  header = header_of(obj);
+  header_tag = fulltag_of(header);
+  subtag = header_subtag(header);
+  if (immheader_tag_p(header_tag)) {
+    return ((subtag != subtag_macptr) && (subtag != subtag_dead_macptr));
+  }
+  if (nodeheader_tag_p(header_tag)) {
+    switch (subtag) {
+    case subtag_simple_vector:
+    case subtag_arrayH:
+    case subtag_vectorH:
+    case subtag_ratio:
+    case subtag_complex:
+      return true;
+    case subtag_function:
+      return immutable_function_p(obj);
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
+static natural
+object_physical_size(LispObj obj)
+{
+  LispObj header;
+  int header_tag;
+
+  if (fulltag_of(obj) == fulltag_cons) {
+    return dnode_size;
+  }
+  header = header_of(obj);
+  header_tag = fulltag_of(header);
+  if (immheader_tag_p(header_tag)) {
+    natural start = untag(obj);
+    return ((natural)(skip_over_ivector(start,header))) - start;
+  }
+  return ((header_element_count(header)+2)&~1) << node_shift;
+}
+
+/* Call fun on each node slot of the (untagged) object at p, return
+   the address of the next object. */
+static LispObj *
+map_object_slots(LispObj *p, Boolean (*fun)(LispObj *, void *), void *arg)
+{
+  LispObj header = *p;
+  int tag = fulltag_of(header);
+  natural nwords;
+
+  if (immheader_tag_p(tag)) {
+    return (LispObj *)skip_over_ivector((natural)p, header);
+  }
+  if (nodeheader_tag_p(tag)) {
+    nwords = header_element_count(header);
+    nwords += (1 - (nwords&1));
+    if (header_subtag(header) == subtag_function) {
+#ifdef X8632
+      int skip = (unsigned short)(p[1]);
+
+      if (skip & 0x8000)
+        skip = header_element_count(header) - (skip & 0x7fff);
+#else
+      int skip = (int)(p[1]);
+#endif
+      p += skip;
+      nwords -= skip;
+    }
+    p++;
+    while(nwords--) {
+      fun(p++, arg);
+    }
+    return p;
+  }
+  fun(p++, arg);
+  fun(p++, arg);
+  return p;
+}
+
+typedef struct {
+  BytePtr low;                  /* of objects to copy */
+  BytePtr high;
+  BytePtr static_low;           /* static dnodes in [static_low,low) */
+  bitvector visited;
+  LispObj *stack;
+  natural sp, stack_size;
+  natural bytes;
+  LispObj culprit;
+} purify_graph_state;
+
+static Boolean
+note_graph_reference(LispObj *ref, void *arg)
+{
+  purify_graph_state *s = (purify_graph_state *)arg;
+  LispObj obj = *ref;
+  BytePtr p = (BytePtr)ptr_from_lispobj(obj);
+  natural tag = fulltag_of(obj), dnode;
+
+  if ((s->culprit != 0) ||
+      (!is_node_fulltag(tag)) ||
+#ifdef X8664
+      (tag == fulltag_tra_0) || (tag == fulltag_tra_1) ||
+#endif
+#ifdef X8632
+      (tag == fulltag_tra) ||
+#endif
+      (p < s->static_low) || (p >= s->high)) {
+    return false;
+  }
+  if ((p < s->low) || !shareable_object_p(obj)) {
+    s->culprit = obj;
+    return false;
+  }
+  dnode = area_dnode(p, s->low);
+  if (ref_bit(s->visited, dnode)) {
+    return false;
+  }
+  set_bit(s->visited, dnode);
+  s->bytes += object_physical_size(obj);
+  if (s->sp == s->stack_size) {
+    natural new_size = s->stack_size ? (s->stack_size * 2) : 1024;
+    LispObj *new = realloc(s->stack, new_size*sizeof(LispObj));
+
+    if (new == NULL) {
+      s->culprit = obj;
+      return false;
+    }
+    s->stack = new;
+    s->stack_size = new_size;
+  }
+  s->stack[s->sp++] = obj;
+  return true;
+}
+
+static Boolean
+purify_graph_reference(LispObj *ref, void *arg)
+{
+  purify_graph_state *s = (purify_graph_state *)arg;
+  natural tag = fulltag_of(*ref);
+
+#ifdef X8664
+  if ((tag == fulltag_tra_0) || (tag == fulltag_tra_1)) {
+    return false;
+  }
+#endif
+#ifdef X8632
+  if (tag == fulltag_tra) {
+    return false;
+  }
+#endif
+  return purify_noderef(ref, s->low, s->high, readonly_area, PURIFY_ALL);
+}
+
+signed_natural
+purify_object_graph(TCR *tcr, signed_natural param)
+{
+  extern area *extend_readonly_area(natural);
+  LispObj *rootp = (LispObj *)param, obj;
+  area *a = active_dynamic_area, *pure_area;
+  BytePtr new_pure_start, *scan;
+  TCR *other_tcr;
+  purify_graph_state s;
+  natural ndnodes;
+
+  memset(&s, 0, sizeof(s));
+  s.static_low = a->low;
+  s.low = a->low + (static_dnodes_for_area(a) << dnode_shift);
+  s.high = a->active;
+  ndnodes = area_dnode(s.high, s.low);
+  s.visited = (bitvector) calloc((ndnodes+nbits_in_word-1)>>bitmap_shift, sizeof(natural));
+  if (s.visited == NULL) {
+    return PURIFY_OBJECT_NO_ROOM;
+  }
+  obj = *rootp;
+  if (note_graph_reference(&obj, &s)) {
+    while ((s.sp != 0) && (s.culprit == 0)) {
+      obj = s.stack[--s.sp];
+      map_object_slots((LispObj *)untag(obj), note_graph_reference, &s);
+    }
+  }
+  free(s.visited);
+  free(s.stack);
+  if (s.culprit) {
+    *rootp = s.culprit;
+    return PURIFY_OBJECT_NOT_SHAREABLE;
+  }
+  if (s.bytes == 0) {
+    return PURIFY_OBJECT_NOT_IN_HEAP;
+  }
+
+  pure_area = extend_readonly_area(s.bytes + (2 * page_size));
+  if (pure_area == NULL) {
+    return PURIFY_OBJECT_NO_ROOM;
+  }
+  lisp_global(IN_GC) = (1<<fixnumshift);
+  discard_profile_samples();
+  jitdump_rescan();
+  discard_heap_census();
+  /* Start and end on a page boundary; the zeroed dnodes in between
+     look like (0 . 0) to anything that walks the area. */
+  pure_area->active = (BytePtr)align_to_power_of_2(pure_area->active, log2_page_size);
+  new_pure_start = pure_area->active;
+  purify_graph_reference(rootp, &s);
+  for (scan = (BytePtr *)new_pure_start;
+       scan < (BytePtr *)pure_area->active;
+       scan = (BytePtr *)map_object_slots((LispObj *)scan, purify_graph_reference, &s));
+  pure_area->active = (BytePtr)align_to_power_of_2(pure_area->active, log2_page_size);
+  note_immutable_range(new_pure_start, pure_area->active);
+
+  /* Resolve forwarding pointers everywhere else. */
+  purify_areas(s.low, s.high, NULL, PURIFY_NOTHING);
+  other_tcr = tcr;
+  do {
+    purify_tcr_xframes(other_tcr, s.low, s.high, NULL, PURIFY_NOTHING);
+    purify_tcr_tlb(other_tcr, s.low, s.high, NULL, PURIFY_NOTHING);
+    other_tcr = TCR_AUX(other_tcr)->next;
+  } while (other_tcr != tcr);
+  purify_gcable_ptrs(s.low, s.high, NULL, PURIFY_NOTHING);
+
+  ProtectMemory(new_pure_start, pure_area->active-new_pure_start);
+  lisp_global(IN_GC) = 0;
+  return PURIFY_OBJECT_COPIED;
+}
+
+/*
+  Heap dumps.  write_heap_dump() describes every object in the heap
+  (the dynamic area and the managed static, static and readonly areas)
+  -- its address, subtag, size and the references it contains to other
+  objects in the heap -- and every root, in a compact binary format
+  that's read by library/heap-dump.lisp.  It starts with a full GC,
+  so that nothing but live objects remains in the dynamic area, and
+  runs with other threads suspended.  A sequential pass over object headers divides the heap
+  into chunks of about HEAP_DUMP_CHUNK_SIZE bytes; writer threads
+  describe the chunks as they become available, and each writer
+  writes a block whenever one of its buffers fills up.
+
+  Integers are in native byte order.  A "varint" is an unsigned LEB128
+  number; an "svarint" is a zigzag-encoded signed one.  The file is a
+  header followed by blocks:
+
+  header:
+    char magic[8]            "CCLHDUMP"
+    u32 version              HEAP_DUMP_VERSION
+    u32 word_size            in bytes
+    u64 nil                  the value of NIL
+    u64 nthreads             threads whose roots were dumped
+    u64 nareas
+    nareas * {u64 code, low, high}   the areas whose objects were
+                             dumped; code is AREA_xxx >> fixnumshift
+
+  block:
+    u32 kind                 HEAP_DUMP_BLOCK_xxx
+    u32 count                of the records that follow
+    u64 nbytes               of the records that follow
+    u64 base
+
+  Blocks are written in no particular order, except that the end
+  block is last.  The objects blocks cover disjoint ranges of
+  addresses, and the records in each are sorted by address.
+
+  HEAP_DUMP_BLOCK_OBJECTS records:
+    varint  (address - previous address) >> dnode_shift, where the
+            first record's previous address is the block's base
+    u8      subtag (fulltag_cons for a cons)
+    varint  element count (not present for conses)
+    varint  nrefs
+    nrefs * {varint slot delta, svarint target delta}
+  A reference's slot is the index of the word that contains it (0 is
+  the header, or a cons's first word), as a delta from the previous
+  reference's slot (or from 0.)  Its target is the address of the
+  referenced object, as a delta in dnodes from the referencing one.
+  Tagged return addresses refer to the function that contains them.
+  Immediates, references to objects that aren't dumped and the
+  contents of weak vectors and weak hash vectors aren't recorded.
+
+  HEAP_DUMP_BLOCK_ROOTS records:
+    u8      kind (HEAP_DUMP_ROOT_xxx)
+    varint  thread (0 for static roots; threads are numbered from 1,
+            starting with the one that took the dump)
+    varint  source: the address of the word on a stack or in a static
+            object that holds the reference, the register number, the
+            byte offset in the TLB, or (for objects outside the
+            dynamic area, which are all roots) the object's address
+    varint  target address >> dnode_shift
+
+  HEAP_DUMP_BLOCK_NAMES records, one for each symbol:
+    varint  address >> dnode_shift
+    varint  nbytes
+    nbytes  the symbol's name, in UTF-8
+
+  HEAP_DUMP_BLOCK_END has a single record:
+    u64 nobjects, nrefs, nroots, nnames
+*/
+
+#ifndef WINDOWS
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#define HEAP_DUMP_MAGIC "CCLHDUMP"
+#define HEAP_DUMP_VERSION 1
+
+#define HEAP_DUMP_BLOCK_END 0
+#define HEAP_DUMP_BLOCK_OBJECTS 1
+#define HEAP_DUMP_BLOCK_ROOTS 2
+#define HEAP_DUMP_BLOCK_NAMES 3
+
+#define HEAP_DUMP_ROOT_VSTACK 1
+#define HEAP_DUMP_ROOT_TSTACK 2
+#define HEAP_DUMP_ROOT_REGISTER 3
+#define HEAP_DUMP_ROOT_TLB 4
+#define HEAP_DUMP_ROOT_STATIC 5
+
+#define HEAP_DUMP_BLOCK_SIZE (1<<20)
+#define HEAP_DUMP_CHUNK_SIZE (16<<20)
+#define MAX_HEAP_DUMP_THREADS 16
+#define MAX_HEAP_DUMP_AREAS 16
+#define MAX_VARINT_BYTES 10
+
+typedef struct {
+  uint32_t kind;
+  uint32_t count;
+  uint64_t nbytes;
+  uint64_t base;
+} heap_dump_block_header;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t word_size;
+  uint64_t nil;
+  uint64_t nthreads;
+  uint64_t nareas;
+} heap_dump_file_header;
+
+typedef struct {
+  LispObj *start, *end;
+  Boolean roots_p;              /* each object is a static root */
+} heap_dump_chunk;
+
+typedef struct {
+  int fd;
+  Boolean seekable;
+  signed_natural pos;           /* of the next block; claimed with atomic_incf_by */
+  BytePtr low, high;            /* dynamic heap */
+  int nareas;                   /* the others */
+  area *areas[MAX_HEAP_DUMP_AREAS];
+  heap_dump_chunk *chunks;
+  signed_natural nchunks;       /* published by the heap walker */
+  signed_natural next_chunk;    /* claimed with atomic_incf */
+  Boolean chunks_done;
+  natural nobjects, nrefs, nroots, nnames;
+  int err;
+  pthread_mutex_t lock;
+} heap_dump_state;
+
+typedef struct {
+  uint32_t kind;
+  unsigned char *bytes;         /* a block header, then records */
+  natural fill, capacity, count;
+  natural base;                 /* of an objects block: its first object */
+  natural prev;                 /* address of the last object record */
+} heap_dump_buffer;
+
+typedef struct {
+  heap_dump_state *state;
+  heap_dump_buffer objects, roots, names;
+  LispObj *object;              /* whose references are being collected */
+  natural nrefs, refs_capacity;
+  natural *ref_slots;
+  LispObj *ref_targets;
+  int root_kind;                /* of the references being collected by */
+  natural root_thread;          /* heap_dump_slot_root() */
+  natural nobjects, nrefs_total, nroots, nnames;
+} heap_dump_writer;
+
+static void
+heap_dump_write(heap_dump_state *state, unsigned char *bytes, natural n)
+{
+  natural err;
+
+  if (state->seekable) {
+    signed_natural pos = atomic_incf_by(&state->pos, n) - n;
+
+    err = pwritebuf(state->fd, (char *)bytes, n, pos);
+  } else {
+    pthread_mutex_lock(&state->lock);
+    err = writebuf(state->fd, (char *)bytes, n);
+    state->pos += n;
+    pthread_mutex_unlock(&state->lock);
+  }
+  if (err) {
+    state->err = err;
+  }
+}
+
+static Boolean
+heap_dump_init_buffer(heap_dump_buffer *b, uint32_t kind)
+{
+  b->kind = kind;
+  b->capacity = HEAP_DUMP_BLOCK_SIZE;
+  b->bytes = malloc(b->capacity);
+  b->fill = sizeof(heap_dump_block_header);
+  b->count = 0;
+  b->base = 0;
+  b->prev = 0;
+  return (b->bytes != NULL);
+}
+
+static void
+heap_dump_flush(heap_dump_writer *w, heap_dump_buffer *b)
+{
+  heap_dump_block_header *h = (heap_dump_block_header *)b->bytes;
+
+  if (b->count) {
+    h->kind = b->kind;
+    h->count = b->count;
+    h->nbytes = b->fill - sizeof(heap_dump_block_header);
+    h->base = b->base;
+    heap_dump_write(w->state, b->bytes, b->fill);
+    b->fill = sizeof(heap_dump_block_header);
+    b->count = 0;
+  }
+}
+
+/* Make room for a record of up to n bytes in b, writing what's
+   already there if necessary. */
+static Boolean
+heap_dump_reserve(heap_dump_writer *w, heap_dump_buffer *b, natural n)
+{
+  if ((b->fill + n) > b->capacity) {
+    heap_dump_flush(w, b);
+    if ((b->fill + n) > b->capacity) {
+      unsigned char *bigger = realloc(b->bytes, b->fill + n);
+
+      if (bigger == NULL) {
+        w->state->err = ENOMEM;
+        return false;
+      }
+      b->bytes = bigger;
+      b->capacity = b->fill + n;
+    }
+  }
+  return true;
+}
+
+static inline void
+heap_dump_put_byte(heap_dump_buffer *b, natural v)
+{
+  b->bytes[b->fill++] = (unsigned char)v;
+}
+
+static inline void
+heap_dump_put_varint(heap_dump_buffer *b, natural v)
+{
+  while (v >= 0x80) {
+    b->bytes[b->fill++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  b->bytes[b->fill++] = (unsigned char)v;
+}
+
+static inline void
+heap_dump_put_svarint(heap_dump_buffer *b, signed_natural v)
+{
+  heap_dump_put_varint(b, (((natural)v) << 1) ^ ((natural)(v >> (nbits_in_word-1))));
+}
+
+/* Return the address of the dumped object that obj references, or 0. */
+static LispObj
+heap_dump_target(heap_dump_state *state, LispObj obj)
+{
+  int tag = fulltag_of(obj), i;
+  BytePtr p;
+
+  if (!is_node_fulltag(tag)) {
+    return 0;
+  }
+#ifdef X8664
+  if ((tag == fulltag_tra_0) || (tag == fulltag_tra_1)) {
+    obj = tra_function(obj);
+  }
+#else
+  if (tag == fulltag_tra) {
+    obj = tra_function(obj);
+  }
+#endif
+  p = (BytePtr)untag(obj);
+  if ((p >= state->low) && (p < state->high)) {
+    return (LispObj)p;
+  }
+  for (i = 0; i < state->nareas; i++) {
+    if ((p >= state->areas[i]->low) && (p < state->areas[i]->active)) {
+      return (LispObj)p;
+    }
+  }
+  return 0;
+}
+
+static void
+heap_dump_root(heap_dump_writer *w, int kind, natural thread, natural source, LispObj obj)
+{
+  heap_dump_buffer *b = &w->roots;
+  LispObj target = heap_dump_target(w->state, obj);
+
+  if (target && heap_dump_reserve(w, b, 1+(3*MAX_VARINT_BYTES))) {
+    heap_dump_put_byte(b, kind);
+    heap_dump_put_varint(b, thread);
+    heap_dump_put_varint(b, source);
+    heap_dump_put_varint(b, target >> dnode_shift);
+    b->count++;
+    w->nroots++;
+  }
+}
+
+static Boolean
+heap_dump_slot_root(LispObj *ref, void *arg)
+{
+  heap_dump_writer *w = (heap_dump_writer *)arg;
+
+  heap_dump_root(w, w->root_kind, w->root_thread, (natural)ref, *ref);
+  return false;
+}
+
+static void
+heap_dump_symbol_name(heap_dump_writer *w, LispObj *p)
+{
+  heap_dump_buffer *b = &w->names;
+  LispObj pname = ((lispsymbol *)p)->pname;
+  natural i, n, c, nbytes = 0;
+  unsigned *chars;
+
+  if ((fulltag_of(pname) != fulltag_misc) ||
+      (header_subtag(header_of(pname)) != subtag_simple_base_string)) {
+    return;
+  }
+  n = header_element_count(header_of(pname));
+  chars = (unsigned *)ptr_from_lispobj(pname + misc_data_offset);
+  for (i = 0; i < n; i++) {
+    c = chars[i];
+    nbytes += (c < 0x80) ? 1 : (c < 0x800) ? 2 : (c < 0x10000) ? 3 : 4;
+  }
+  if (!heap_dump_reserve(w, b, (2*MAX_VARINT_BYTES)+nbytes)) {
+    return;
+  }
+  heap_dump_put_varint(b, ((natural)p) >> dnode_shift);
+  heap_dump_put_varint(b, nbytes);
+  for (i = 0; i < n; i++) {
+    c = chars[i];
+    if (c < 0x80) {
+      heap_dump_put_byte(b, c);
+    } else if (c < 0x800) {
+      heap_dump_put_byte(b, 0xc0 | (c >> 6));
+      heap_dump_put_byte(b, 0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+      heap_dump_put_byte(b, 0xe0 | (c >> 12));
+      heap_dump_put_byte(b, 0x80 | ((c >> 6) & 0x3f));
+      heap_dump_put_byte(b, 0x80 | (c & 0x3f));
+    } else {
+      heap_dump_put_byte(b, 0xf0 | ((c >> 18) & 0x07));
+      heap_dump_put_byte(b, 0x80 | ((c >> 12) & 0x3f));
+      heap_dump_put_byte(b, 0x80 | ((c >> 6) & 0x3f));
+      heap_dump_put_byte(b, 0x80 | (c & 0x3f));
+    }
+  }
+  b->count++;
+  w->nnames++;
+}
+
+static Boolean
+heap_dump_reference(LispObj *ref, void *arg)
+{
+  heap_dump_writer *w = (heap_dump_writer *)arg;
+  LispObj target = heap_dump_target(w->state, *ref);
+
+  if (target) {
+    if (w->nrefs == w->refs_capacity) {
+      natural new_capacity = w->refs_capacity ? (w->refs_capacity * 2) : 1024;
+      natural *slots = realloc(w->ref_slots, new_capacity * sizeof(natural));
+      LispObj *targets;
+
+      if (slots == NULL) {
+        w->state->err = ENOMEM;
+        return false;
+      }
+      w->ref_slots = slots;
+      targets = realloc(w->ref_targets, new_capacity * sizeof(LispObj));
+      if (targets == NULL) {
+        w->state->err = ENOMEM;
+        return false;
+      }
+      w->ref_targets = targets;
+      w->refs_capacity = new_capacity;
+    }
+    w->ref_slots[w->nrefs] = ref - w->object;
+    w->ref_targets[w->nrefs] = target;
+    w->nrefs++;
+  }
+  return false;
+}
+
+static LispObj *
+heap_dump_skip_object(LispObj *p)
+{
+  LispObj header = *p;
+  int tag = fulltag_of(header);
+
+  if (immheader_tag_p(tag)) {
+    return (LispObj *)skip_over_ivector((natural)p, header);
+  }
+  if (nodeheader_tag_p(tag)) {
+    return p + ((header_element_count(header)+2)&~1);
+  }
+  return p + 2;
+}
+
+/* Describe the object at p, return the address of the next one. */
+static LispObj *
+heap_dump_object(heap_dump_writer *w, LispObj *p, Boolean root_p)
+{
+  heap_dump_buffer *b = &w->objects;
+  LispObj header = *p, *next;
+  int tag = fulltag_of(header), subtag;
+  natural i, slot, count = 0;
+
+  w->object = p;
+  w->nrefs = 0;
+  if (immheader_tag_p(tag)) {
+    subtag = header_subtag(header);
+    count = header_element_count(header);
+    next = (LispObj *)skip_over_ivector((natural)p, header);
+  } else if (nodeheader_tag_p(tag)) {
+    subtag = header_subtag(header);
+    count = header_element_count(header);
+    if ((subtag == subtag_weak) ||
+        ((subtag == subtag_hash_vector) &&
+         (((hash_table_vector_header *)p)->flags & nhash_weak_mask))) {
+      next = heap_dump_skip_object(p);
+    } else {
+      next = map_object_slots(p, heap_dump_reference, w);
+    }
+    if (subtag == subtag_symbol) {
+      heap_dump_symbol_name(w, p);
+    }
+  } else {
+    subtag = fulltag_cons;
+    next = map_object_slots(p, heap_dump_reference, w);
+  }
+  if (root_p) {
+    heap_dump_root(w, HEAP_DUMP_ROOT_STATIC, 0, (natural)p,
+                   (LispObj)p + ((subtag == fulltag_cons) ? fulltag_cons : fulltag_misc));
+  }
+  if (!heap_dump_reserve(w, b, 1+(3*MAX_VARINT_BYTES)+(w->nrefs*(2*MAX_VARINT_BYTES)))) {
+    return next;
+  }
+  if (b->count == 0) {
+    b->base = b->prev = (natural)p;
+  }
+  heap_dump_put_varint(b, (((natural)p) - b->prev) >> dnode_shift);
+  heap_dump_put_byte(b, subtag);
+  if (subtag != fulltag_cons) {
+    heap_dump_put_varint(b, count);
+  }
+  heap_dump_put_varint(b, w->nrefs);
+  for (i = 0, slot = 0; i < w->nrefs; i++) {
+    heap_dump_put_varint(b, w->ref_slots[i] - slot);
+    slot = w->ref_slots[i];
+    heap_dump_put_svarint(b, (signed_natural)(w->ref_targets[i] - (natural)p) >> dnode_shift);
+  }
+  b->prev = (natural)p;
+  b->count++;
+  w->nobjects++;
+  w->nrefs_total += w->nrefs;
+  return next;
+}
+
+
+static void
+heap_dump_xp_roots(heap_dump_writer *w, natural thread, ExceptionInformation *xp
+#ifdef X8632
+                   , natural node_regs_mask
+#endif
+                   )
+{
+  natural *regs = (natural *) xpGPRvector(xp);
+#ifdef X8664
+  static int node_regs[] = {Iarg_z, Iarg_y, Iarg_x, Itemp0, Itemp1, Itemp2,
+                            Itemp3, Itemp4, Itemp5, Itemp6, Ifn};
+  int i;
+
+  for (i = 0; i < (int)(sizeof(node_regs)/sizeof(node_regs[0])); i++) {
+    heap_dump_root(w, HEAP_DUMP_ROOT_REGISTER, thread, node_regs[i], regs[node_regs[i]]);
+  }
+#else
+  static int node_regs[] = {REG_EAX, REG_ECX, REG_EDX, REG_EBX,
+                            REG_ESP, REG_EBP, REG_ESI, REG_EDI};
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    if ((node_regs_mask & (1<<i)) &&
+        !((i == 2) && (regs[REG_EFL] & EFL_DF))) {
+      heap_dump_root(w, HEAP_DUMP_ROOT_REGISTER, thread, node_regs[i], regs[node_regs[i]]);
+    }
+  }
+#endif
+  if (tra_p(regs[Iip])) {
+    heap_dump_root(w, HEAP_DUMP_ROOT_REGISTER, thread, Iip, regs[Iip]);
+  }
+}
+
+static void
+heap_dump_tcr_roots(heap_dump_writer *w, TCR *tcr, natural thread)
+{
+  area *a;
+  LispObj *p, *q, *end, *limit, *next;
+  xframe_list *xframes;
+  ExceptionInformation *xp;
+  natural i, n;
+
+  a = tcr->vs_area;
+  if (a) {
+    for (p = (LispObj *)a->active, end = (LispObj *)a->high; p < end; p++) {
+      heap_dump_root(w, HEAP_DUMP_ROOT_VSTACK, thread, (natural)p, *p);
+    }
+  }
+
+  /* Like mark_tstack_area() */
+  a = tcr->ts_area;
+  if (a) {
+    w->root_kind = HEAP_DUMP_ROOT_TSTACK;
+    w->root_thread = thread;
+    p = (LispObj *)a->active;
+    limit = (LispObj *)a->high;
+    for (end = p; end != limit; p = next) {
+      next = (LispObj *)ptr_from_lispobj(*p);
+      end = ((next >= (LispObj *)a->active) && (next < limit)) ? next : limit;
+      for (q = p+2; q < end; q = map_object_slots(q, heap_dump_slot_root, w));
+    }
+  }
+
+  xp = TCR_AUX(tcr)->gc_context;
+  if (xp) {
+#ifdef X8664
+    heap_dump_xp_roots(w, thread, xp);
+#else
+    heap_dump_xp_roots(w, thread, xp, tcr->node_regs_mask);
+#endif
+  }
+  for (xframes = (xframe_list *)tcr->xframe; xframes; xframes = xframes->prev) {
+#ifdef X8664
+    heap_dump_xp_roots(w, thread, xframes->curr);
+#else
+    heap_dump_xp_roots(w, thread, xframes->curr, xframes->node_regs_mask);
+#endif
+  }
+
+  n = tcr->tlb_limit / sizeof(LispObj);
+  for (i = 0; i < n; i++) {
+    if (tcr->tlb_pointer[i] != no_thread_local_binding_marker) {
+      heap_dump_root(w, HEAP_DUMP_ROOT_TLB, thread, i*sizeof(LispObj), tcr->tlb_pointer[i]);
+    }
+  }
+}
+
+static void
+heap_dump_publish_chunk(heap_dump_state *state, LispObj *start, LispObj *end, Boolean roots_p)
+{
+  heap_dump_chunk *chunk = &state->chunks[state->nchunks];
+
+  chunk->start = start;
+  chunk->end = end;
+  chunk->roots_p = roots_p;
+  atomic_incf(&state->nchunks);
+}
+
+static void
+heap_dump_find_chunks(heap_dump_state *state, BytePtr low, BytePtr high, Boolean roots_p)
+{
+  LispObj *p = (LispObj *)low, *start = p, *end = (LispObj *)high;
+
+  while (p < end) {
+    if (((BytePtr)p - (BytePtr)start) >= HEAP_DUMP_CHUNK_SIZE) {
+      heap_dump_publish_chunk(state, start, p, roots_p);
+      start = p;
+    }
+    p = heap_dump_skip_object(p);
+  }
+  if (start < end) {
+    heap_dump_publish_chunk(state, start, end, roots_p);
+  }
+}
+
+static void
+heap_dump_chunks(heap_dump_writer *w)
+{
+  heap_dump_state *state = w->state;
+  volatile heap_dump_state *vstate = state;
+  heap_dump_chunk *chunk;
+  signed_natural i;
+  Boolean done;
+  LispObj *p;
+
+  while (state->err == 0) {
+    i = atomic_incf(&state->next_chunk) - 1;
+    for (;;) {
+      done = vstate->chunks_done;
+      if (i < vstate->nchunks) {
+        break;
+      }
+      if (done) {
+        return;
+      }
+      sched_yield();
+    }
+    chunk = &state->chunks[i];
+    for (p = chunk->start; (p < chunk->end) && (state->err == 0); ) {
+      p = heap_dump_object(w, p, chunk->roots_p);
+    }
+    /* Each chunk's objects go in their own blocks */
+    heap_dump_flush(w, &w->objects);
+  }
+}
+
+static Boolean
+heap_dump_init_writer(heap_dump_writer *w, heap_dump_state *state)
+{
+  memset(w, 0, sizeof(*w));
+  w->state = state;
+  return heap_dump_init_buffer(&w->objects, HEAP_DUMP_BLOCK_OBJECTS) &&
+    heap_dump_init_buffer(&w->roots, HEAP_DUMP_BLOCK_ROOTS) &&
+    heap_dump_init_buffer(&w->names, HEAP_DUMP_BLOCK_NAMES);
+}
+
+static void
+heap_dump_finish_writer(heap_dump_writer *w)
+{
+  heap_dump_state *state = w->state;
+
+  if (state->err == 0) {
+    heap_dump_flush(w, &w->objects);
+    heap_dump_flush(w, &w->roots);
+    heap_dump_flush(w, &w->names);
+  }
+  pthread_mutex_lock(&state->lock);
+  state->nobjects += w->nobjects;
+  state->nrefs += w->nrefs_total;
+  state->nroots += w->nroots;
+  state->nnames += w->nnames;
+  pthread_mutex_unlock(&state->lock);
+  free(w->objects.bytes);
+  free(w->roots.bytes);
+  free(w->names.bytes);
+  free(w->ref_slots);
+  free(w->ref_targets);
+}
+
+static void *
+heap_dump_writer_thread(void *arg)
+{
+  heap_dump_writer *w = arg;
+
+  heap_dump_chunks(w);
+  heap_dump_finish_writer(w);
+  return NULL;
+}
+
+/* Called via gc_like_from_xp(), with the EGC disabled; param points
+   to {fd, nthreads}.  Returns HEAP_DUMP_OK or -errno. */
+signed_natural
+write_heap_dump(TCR *tcr, signed_natural param)
+{
+  int fd = ((int *)param)[0], nthreads = ((int *)param)[1], nstarted = 0, i;
+  area *a = active_dynamic_area;
+  heap_dump_state state;
+  heap_dump_writer writers[MAX_HEAP_DUMP_THREADS];
+  pthread_t threads[MAX_HEAP_DUMP_THREADS];
+  heap_dump_file_header fh;
+  TCR *other_tcr;
+  natural nthreads_dumped = 0, nchunks_max, nbytes;
+  uint64_t area_info[3];
+  off_t start_pos;
+  struct {
+    heap_dump_block_header h;
+    uint64_t totals[4];
+  } end_block;
+
+  /* Collect the garbage and the unused tails of threads' allocation
+     segments, which would otherwise read as conses. */
+  gc(tcr, 0);
+
+  memset(&state, 0, sizeof(state));
+  state.fd = fd;
+  state.low = a->low;
+  state.high = a->active;
+  nbytes = state.high - state.low;
+  nchunks_max = 1;
+  for (a = a->succ; a->code != AREA_VOID; a = a->succ) {
+    if (((a->code == AREA_STATIC) ||
+         (a->code == AREA_WATCHED) ||
+         (a->code == AREA_READONLY) ||
+         (a->code == AREA_MANAGED_STATIC)) &&
+        (a->active > a->low) &&
+        (state.nareas < MAX_HEAP_DUMP_AREAS)) {
+      state.areas[state.nareas++] = a;
+      nbytes += a->active - a->low;
+      nchunks_max++;
+    }
+  }
+  a = active_dynamic_area;
+  nchunks_max += nbytes / HEAP_DUMP_CHUNK_SIZE;
+  state.chunks = malloc(nchunks_max * sizeof(heap_dump_chunk));
+  if (state.chunks == NULL) {
+    return -ENOMEM;
+  }
+  pthread_mutex_init(&state.lock, NULL);
+
+  start_pos = lseek(fd, 0, SEEK_CUR);
+  state.seekable = (start_pos >= 0);
+  if (!state.seekable) {
+    start_pos = 0;
+  }
+
+  other_tcr = tcr;
+  do {
+    nthreads_dumped++;
+    other_tcr = TCR_AUX(other_tcr)->next;
+  } while (other_tcr != tcr);
+
+  memset(&fh, 0, sizeof(fh));
+  memcpy(fh.magic, HEAP_DUMP_MAGIC, sizeof(fh.magic));
+  fh.version = HEAP_DUMP_VERSION;
+  fh.word_size = sizeof(LispObj);
+  fh.nil = lisp_nil;
+  fh.nthreads = nthreads_dumped;
+  fh.nareas = state.nareas + 1;
+  state.pos = start_pos;
+  heap_dump_write(&state, (unsigned char *)&fh, sizeof(fh));
+  for (i = 0; i <= state.nareas; i++) {
+    area *this = (i == state.nareas) ? a : state.areas[i];
+
+    area_info[0] = this->code >> fixnumshift;
+    area_info[1] = (natural)this->low;
+    area_info[2] = (natural)((i == state.nareas) ? state.high : this->active);
+    heap_dump_write(&state, (unsigned char *)area_info, sizeof(area_info));
+  }
+
+  if (nthreads <= 0) {
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (nthreads > MAX_HEAP_DUMP_THREADS) {
+    nthreads = MAX_HEAP_DUMP_THREADS;
+  }
+  if (nthreads < 1) {
+    nthreads = 1;
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (!heap_dump_init_writer(&writers[i], &state)) {
+      state.err = ENOMEM;
+    }
+  }
+
+  if (state.err == 0) {
+    while (nstarted < (nthreads-1)) {
+      if (pthread_create(&threads[nstarted], NULL, heap_dump_writer_thread, &writers[nstarted+1]) != 0) {
+        break;
+      }
+      nstarted++;
+    }
+    /* The other writers describe chunks as they're found. */
+    for (i = 0; i < state.nareas; i++) {
+      heap_dump_find_chunks(&state, state.areas[i]->low, state.areas[i]->active, true);
+    }
+    heap_dump_find_chunks(&state, state.low, state.high, false);
+    state.chunks_done = true;
+
+    other_tcr = tcr;
+    i = 1;
+    do {
+      heap_dump_tcr_roots(&writers[0], other_tcr, i++);
+      other_tcr = TCR_AUX(other_tcr)->next;
+    } while (other_tcr != tcr);
+    heap_dump_chunks(&writers[0]);
+  } else {
+    state.chunks_done = true;
+  }
+  heap_dump_finish_writer(&writers[0]);
+  for (i = 0; i < nstarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  for (i = nstarted+1; i < nthreads; i++) {
+    heap_dump_finish_writer(&writers[i]);
+  }
+
+  if (state.err == 0) {
+    memset(&end_block, 0, sizeof(end_block));
+    end_block.h.kind = HEAP_DUMP_BLOCK_END;
+    end_block.h.count = 1;
+    end_block.h.nbytes = sizeof(end_block.totals);
+    end_block.totals[0] = state.nobjects;
+    end_block.totals[1] = state.nrefs;
+    end_block.totals[2] = state.nroots;
+    end_block.totals[3] = state.nnames;
+    heap_dump_write(&state, (unsigned char *)&end_block, sizeof(end_block));
+    if (state.seekable) {
+      lseek(fd, state.pos, SEEK_SET);
+    }
+  }
+  free(state.chunks);
+  pthread_mutex_destroy(&state.lock);
+  return state.err ? -((signed_natural)state.err) : HEAP_DUMP_OK;
+}
+#else
+signed_natural
+write_heap_dump(TCR *tcr, signed_natural param)
+{
+  return -ENOSYS;
+}
+#endif
+
 Boolean
 impurify_locref(LispObj *p, LispObj low, LispObj high, signed_natural delta)
 {
@@ -3208,7 +4254,11 @@ signed_natural
 impurify(TCR *tcr, signed_natural param)
 {
   lisp_global(IN_GC)=1;
+  discard_profile_samples();
+  jitdump_rescan();
+  discard_heap_census();
   impurify_from_area(tcr, readonly_area);
+  forget_immutable_ranges();
   impurify_from_area(tcr, managed_static_area);
   lisp_global(MANAGED_STATIC_DNODES)=0;
   lisp_global(IN_GC)=0;
@@ -4254,6 +4254,39 @@ LocalLabelPrefix`'ffcall:
 	/* Preserve TCR pointer */
 	__(movq %rcontext_reg, %csave0)
 	__endif
+	__ifndef(`WINDOWS')
+	/* Note the call if we're tracing ff-calls.  Preserve %imm1, and
+	   the FP args and FP arg count that the caller's already loaded
+	   into %xmm0-%xmm7 and %rax. */
+	__(cmpl $0,C(trace_ffcalls)(%rip))
+	__(je 2f)
+	__(subq $80,%rsp)
+	__(movq %imm1,(%rsp))
+	__(movq %rax,8(%rsp))
+	__(movsd %xmm0,16(%rsp))
+	__(movsd %xmm1,24(%rsp))
+	__(movsd %xmm2,32(%rsp))
+	__(movsd %xmm3,40(%rsp))
+	__(movsd %xmm4,48(%rsp))
+	__(movsd %xmm5,56(%rsp))
+	__(movsd %xmm6,64(%rsp))
+	__(movsd %xmm7,72(%rsp))
+	__(movq rcontext(tcr.linear),%carg0)
+	__(movq %imm1,%carg1)
+	__(call C(trace_ffcall_enter))
+	__(movq (%rsp),%imm1)
+	__(movq 8(%rsp),%rax)
+	__(movsd 16(%rsp),%xmm0)
+	__(movsd 24(%rsp),%xmm1)
+	__(movsd 32(%rsp),%xmm2)
+	__(movsd 40(%rsp),%xmm3)
+	__(movsd 48(%rsp),%xmm4)
+	__(movsd 56(%rsp),%xmm5)
+	__(movsd 64(%rsp),%xmm6)
+	__(movsd 72(%rsp),%xmm7)
+	__(addq $80,%rsp)
+2:
+	__endif
 LocalLabelPrefix`'ffcall_setup: 
 	__(addq $2*node_size,%rsp)
         __(movq %imm1,%r11)
@@ -4282,6 +4315,27 @@ LocalLabelPrefix`'ffcall_call_end:
 	__(movq %rbp,%rsp)
 	__ifdef(`TCR_IN_GPR')
 	__(movq %csave0, %rcontext_reg)
+	__endif
+	__ifndef(`WINDOWS')
+	/* Note the return if tracing; preserve the result registers. */
+	__(cmpl $0,C(trace_ffcalls)(%rip))
+	__(je 2f)
+	__(subq $32,%rsp)
+	__(movq %rax,(%rsp))
+	__(movq %rdx,8(%rsp))
+	__(movsd %xmm0,16(%rsp))
+	__(movsd %xmm1,24(%rsp))
+	__(movq rcontext(tcr.linear),%carg0)
+	__(call C(trace_ffcall_exit))
+	__(movq (%rsp),%rax)
+	__(movq 8(%rsp),%rdx)
+	__(movsd 16(%rsp),%xmm0)
+	__(movsd 24(%rsp),%xmm1)
+	__(addq $32,%rsp)
+	__ifdef(`TCR_IN_GPR')
+	__(movq %csave0, %rcontext_reg)
+	__endif
+2:
 	__endif
 	__(movq %rsp,rcontext(tcr.foreign_sp))
 	__ifndef(`TCR_IN_GPR')
@@ -4458,6 +4512,39 @@ LocalLabelPrefix`'ffcall_return_registers:
 	__ifdef(`TCR_IN_GPR')
 	/* Preserve TCR pointer */
 	__(movq %rcontext_reg, %csave1)
+	__endif
+	__ifndef(`WINDOWS')
+	/* Note the call if we're tracing ff-calls.  Preserve %imm1, and
+	   the FP args and FP arg count that the caller's already loaded
+	   into %xmm0-%xmm7 and %rax. */
+	__(cmpl $0,C(trace_ffcalls)(%rip))
+	__(je 2f)
+	__(subq $80,%rsp)
+	__(movq %imm1,(%rsp))
+	__(movq %rax,8(%rsp))
+	__(movsd %xmm0,16(%rsp))
+	__(movsd %xmm1,24(%rsp))
+	__(movsd %xmm2,32(%rsp))
+	__(movsd %xmm3,40(%rsp))
+	__(movsd %xmm4,48(%rsp))
+	__(movsd %xmm5,56(%rsp))
+	__(movsd %xmm6,64(%rsp))
+	__(movsd %xmm7,72(%rsp))
+	__(movq rcontext(tcr.linear),%carg0)
+	__(movq %imm1,%carg1)
+	__(call C(trace_ffcall_enter))
+	__(movq (%rsp),%imm1)
+	__(movq 8(%rsp),%rax)
+	__(movsd 16(%rsp),%xmm0)
+	__(movsd 24(%rsp),%xmm1)
+	__(movsd 32(%rsp),%xmm2)
+	__(movsd 40(%rsp),%xmm3)
+	__(movsd 48(%rsp),%xmm4)
+	__(movsd 56(%rsp),%xmm5)
+	__(movsd 64(%rsp),%xmm6)
+	__(movsd 72(%rsp),%xmm7)
+	__(addq $80,%rsp)
+2:
 	__endif
         __(movq %imm1,%r11)
 LocalLabelPrefix`'ffcall_return_registers_setup: 
@@ -4486,6 +4573,17 @@ LocalLabelPrefix`'ffcall_return_registers_call_end:
 	__(movq %rbp,%rsp)
 	__ifdef(`TCR_IN_GPR')
 	__(movq %csave1, %rcontext_reg)
+	__endif
+	__ifndef(`WINDOWS')
+	/* The results are already in the buffer. */
+	__(cmpl $0,C(trace_ffcalls)(%rip))
+	__(je 2f)
+	__(movq rcontext(tcr.linear),%carg0)
+	__(call C(trace_ffcall_exit))
+	__ifdef(`TCR_IN_GPR')
+	__(movq %csave1, %rcontext_reg)
+	__endif
+2:
 	__endif
 	__(movq %rsp,rcontext(tcr.foreign_sp))        
 	__ifndef(`TCR_IN_GPR')
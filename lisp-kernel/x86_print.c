@@ -330,8 +330,10 @@ nth_immediate(LispObj o, unsigned n)
 }
 #endif
 
+/* Describe function O, without the #< ... > and address that
+   sprint_function adds.  Output ends with a space. */
 void
-sprint_function(LispObj o, int depth)
+sprint_function_name(LispObj o, int depth)
 {
   LispObj lfbits, header, name = lisp_nil;
   natural elements;
@@ -344,7 +346,6 @@ sprint_function(LispObj o, int depth)
     name = deref(o, elements-1);
   }
   
-  add_c_string("#<");
   if (name == lisp_nil) {
     add_c_string("Anonymous Function ");
   } else {
@@ -390,6 +391,13 @@ sprint_function(LispObj o, int depth)
       add_char(' ');
     }
   }
+}
+
+void
+sprint_function(LispObj o, int depth)
+{
+  add_c_string("#<");
+  sprint_function_name(o, depth);
   sprint_unsigned_hex(o);
   add_char('>');
 }
@@ -649,6 +657,26 @@ sprint_lisp_object(LispObj o, int depth)
   }
 }
 
+/* A short description of function O, for symbol tables and the like. */
+char *
+print_function_name(LispObj o)
+{
+  bufpos = 0;
+  if (setjmp(escape) == 0) {
+    sprint_function_name(o, 3);
+    if (bufpos && (printbuf[bufpos-1] == ' ')) {
+      --bufpos;
+    }
+    printbuf[bufpos] = 0;
+  } else {
+    printbuf[PBUFLEN+0] = '.';
+    printbuf[PBUFLEN+1] = '.';
+    printbuf[PBUFLEN+2] = '.';
+    printbuf[PBUFLEN+3] = 0;
+  }
+  return printbuf;
+}
+
 char *
 print_lisp_object(LispObj o)
 {